@@ -0,0 +1,27 @@
+#ifndef CARNIVAL_HASH_H
+#define CARNIVAL_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// 64 bit FNV-1a, good enough for cache keys and lookup tables, not for anything adversarial
+const uint64_t fnvOffsetBasis = 14695981039346656037ull;
+const uint64_t fnvPrime = 1099511628211ull;
+
+inline uint64_t hashBytes(const void *data, size_t size, uint64_t hash = fnvOffsetBasis)
+{
+    auto bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= fnvPrime;
+    }
+    return hash;
+}
+
+inline uint64_t hashString(std::string_view text, uint64_t hash = fnvOffsetBasis)
+{
+    return hashBytes(text.data(), text.size(), hash);
+}
+
+#endif //CARNIVAL_HASH_H
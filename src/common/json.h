@@ -0,0 +1,35 @@
+#ifndef CARNIVAL_JSON_H
+#define CARNIVAL_JSON_H
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+// text as a JSON string, quotes included, for the tools that print their results as JSON
+inline std::string jsonString(std::string_view text)
+{
+    std::string out;
+    out.reserve(text.size() + 2);
+    out += '"';
+    for (char c: text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned) c);
+                    out += escaped;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+    return out;
+}
+
+#endif //CARNIVAL_JSON_H
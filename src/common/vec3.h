@@ -0,0 +1,43 @@
+#ifndef CARNIVAL_VEC3_H
+#define CARNIVAL_VEC3_H
+
+#include <algorithm>
+#include <cmath>
+
+// small float vector for the CPU renderers, nothing fancy
+struct Vec3 {
+    float x = 0.0f;
+    float y = 0.0f;
+    float z = 0.0f;
+
+    Vec3() = default;
+    Vec3(float x, float y, float z) : x(x), y(y), z(z) {}
+
+    float operator[](int axis) const { return axis == 0 ? x : (axis == 1 ? y : z); }
+};
+
+inline Vec3 operator+(const Vec3 &a, const Vec3 &b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+inline Vec3 operator-(const Vec3 &a, const Vec3 &b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+inline Vec3 operator-(const Vec3 &a) { return {-a.x, -a.y, -a.z}; }
+inline Vec3 operator*(const Vec3 &a, const Vec3 &b) { return {a.x * b.x, a.y * b.y, a.z * b.z}; }
+inline Vec3 operator*(const Vec3 &a, float s) { return {a.x * s, a.y * s, a.z * s}; }
+inline Vec3 operator*(float s, const Vec3 &a) { return a * s; }
+inline Vec3 operator/(const Vec3 &a, float s) { return a * (1.0f / s); }
+inline Vec3 &operator+=(Vec3 &a, const Vec3 &b) { a = a + b; return a; }
+inline Vec3 &operator*=(Vec3 &a, const Vec3 &b) { a = a * b; return a; }
+inline Vec3 &operator*=(Vec3 &a, float s) { a = a * s; return a; }
+inline bool operator==(const Vec3 &a, const Vec3 &b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+inline bool operator!=(const Vec3 &a, const Vec3 &b) { return !(a == b); }
+
+inline float dot(const Vec3 &a, const Vec3 &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3 cross(const Vec3 &a, const Vec3 &b)
+{
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+inline float length(const Vec3 &a) { return std::sqrt(dot(a, a)); }
+inline Vec3 normalize(const Vec3 &a) { return a / length(a); }
+inline Vec3 min(const Vec3 &a, const Vec3 &b) { return {std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)}; }
+inline Vec3 max(const Vec3 &a, const Vec3 &b) { return {std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)}; }
+inline float maxComponent(const Vec3 &a) { return std::max(a.x, std::max(a.y, a.z)); }
+
+#endif //CARNIVAL_VEC3_H
@@ -1,12 +1,18 @@
+#include <algorithm>
+#include <cstring>
+#include <ctime>
 #include <filesystem>
 #include "../common/imgui-style.h"
 #include "imgui_impl_opengl3.h"
 #include "imgui_impl_sdl2.h"
-#include "../common/functions.h"
 #include "Application.h"
-#include "../common/shader.h"
 #include "imgui_internal.h"
-#include "../common/img.h"
+#include "../common/hash.h"
+#include "../render/GLExtensions.h"
+#include "../render/GLState.h"
+#include "Log.h"
+#include "Profiler.h"
+#include "StartupTimer.h"
 
 using namespace carnival;
 
@@ -18,24 +24,189 @@ namespace carnival::core {
             //1.0f, -1.0f, 0.0f,
     };
 
-    Application::Application() {
-        InitSDL();
-        InitWindow();
-        InitOpenGl();
-        InitImGui();
-
-        std::cout << "Current path is " << std::filesystem::current_path() << std::endl << std::flush;
+    // The uniforms of the post effect and upscale shaders, declared in them as FULLSCREEN_PASS_BLOCK; and
+    // written by bindPassUniforms(). ShaderManager binds it at the same point in every program.
+    static const char *fullscreenPassBlock = "FULLSCREEN_PASS_BLOCK layout(std140) uniform FullscreenPass {"
+                                             " vec2 size; vec2 source_size; vec2 direction; float sharpness; }";
+
+    // directory / prefix_YYYYmmdd_HHMMSS extension, for files started from the UI
+    static std::filesystem::path timestampedPath(const char *directory, const char *prefix, const char *extension) {
+        auto now = std::time(nullptr);
+        std::tm local{};
+#ifdef _WIN32
+        localtime_s(&local, &now);
+#else
+        localtime_r(&now, &local);
+#endif
+        char stamp[32];
+        std::strftime(stamp, sizeof(stamp), "_%Y%m%d_%H%M%S", &local);
+        return std::filesystem::current_path() / directory / (std::string(prefix) + stamp + extension);
+    }
 
+    Application::Application(const ApplicationConfig &config) : config(config) {
         auto currentPath = std::filesystem::current_path();
+        CARNIVAL_LOG_INFO("Current path is {}", currentPath);
+
+        if (config.check_allocations)
+            AllocationTracker::instance().setChecking(true);
+        render::glstate.enabled = config.gl_state_cache;
+        render::glstate.validating = config.validate_gl_state;
+
+        // background work finishing while the loop sleeps has to wake it up
+        shader_manager.on_change = [this]() { frame_scheduler.wake(); };
+        texture_loader.on_decoded = [this]() { frame_scheduler.wake(); };
+
+        for (int i = 0; i < maxViewports; i++) {
+            auto &viewport = viewports[i];
+            viewport.title = "Viewport " + std::to_string(i + 1);
+            viewport.scene_pass = viewport.title + " scene";
+            viewport.resolve_pass = viewport.title + " resolve";
+            viewport.blur_horizontal_pass = viewport.title + " blur horizontal";
+            viewport.blur_vertical_pass = viewport.title + " blur vertical";
+            viewport.vignette_pass = viewport.title + " vignette";
+            viewport.upscale_pass = viewport.title + " upscale";
+            viewport.depth_view_pass = viewport.title + " depth view";
+            viewport.open = i < std::clamp(config.viewports, 1, maxViewports);
+        }
 
-        auto vertPath = currentPath / "src" / "shader" / "test.vert";
-        auto fragPath = currentPath / "src" / "shader" / "test.frag";
+        // the loose asset tree, and what carnival_pack built from it
+        auto assets = currentPath / "src";
+        if (!config.pack_path.empty()) {
+            StartupPhase phase("open asset pack");
+            if (asset_pack.open(config.pack_path, assets)) {
+                auto stats = asset_pack.stats();
+                CARNIVAL_LOG_INFO("Using asset pack {}: {} assets, {:.1f} MB, opened in {:.2f} ms", config.pack_path,
+                                  stats.entries, (double) stats.file_bytes / (1024.0 * 1024.0), stats.open_ms);
+                shader_manager.setAssetPack(&asset_pack);
+                texture_loader.setAssetPack(&asset_pack);
+            }
+        }
+
+        // reading and decoding need no context, the pool does it while the window and context are created
+        {
+            StartupPhase phase("queue asset loads");
+            shader_manager.setCommonDefines({fullscreenPassBlock});
+            scene_program = shader_manager.add(assets / "shader" / "test.vert", assets / "shader" / "test.frag");
+            auto fullscreen = assets / "shader" / "fullscreen.vert";
+            blur_program = shader_manager.add(fullscreen, assets / "shader" / "blur.frag");
+            vignette_program = shader_manager.add(fullscreen, assets / "shader" / "vignette.frag");
+            depth_view_program = shader_manager.add(fullscreen, assets / "shader" / "depth_view.frag");
+            upscale_variants = shader_manager.addVariants(fullscreen, assets / "shader" / "upscale.frag", {"SHARPEN"});
+            if (!config.headless)
+                preview_image = texture_loader.acquire((assets / "MyImage01.jpg").string());
+        }
+
+        if (config.headless) {
+            StartupPhase phase("headless context");
+            InitHeadless();
+        } else {
+            {
+                StartupPhase phase("SDL");
+                InitSDL();
+            }
+            {
+                StartupPhase phase("window");
+                InitWindow();
+            }
+            {
+                StartupPhase phase("GL context");
+                InitOpenGl();
+            }
+            {
+                StartupPhase phase("ImGui");
+                InitImGui();
+            }
+            frame_scheduler.init();
+            input.init();
+            input.setMeasuring(config.measure_input_latency);
+        }
 
-        rendering_context.shader_program = LoadShaders(vertPath.string().c_str(), fragPath.string().c_str());
-        glClearColor(0.0f, 0.0f, 0.4f, 0.0f);
+        StartupPhase phase("GL resources");
+        shader_manager.init();
+        stream_buffer.init(streamRegionBytes);
+        if (!config.headless && !imgui_renderer.init())
+            CARNIVAL_LOG_ERROR("Couldn't build the ImGui program, using the backend's renderer");
+        if (render_queue.init(stream_buffer)) {
+            objects_program = shader_manager.add(assets / "shader" / "objects.vert", assets / "shader" / "objects.frag");
+            render_queue.use_multi_draw = config.multi_draw;
+            demo_scene.init(render_queue);
+            demo_scene.resize(config.objects);
+        }
+        // opaque, recordings and exports keep the alpha channel
+        glClearColor(0.0f, 0.0f, 0.4f, 1.0f);
+        // core profiles draw nothing without a VAO bound, even with no attributes
+        glGenVertexArrays(1, &fullscreen_vao);
+        app_state.post_effects = config.post_effects;
+        app_state.msaa_samples = config.msaa_samples;
+        app_state.dynamic_resolution = config.dynamic_resolution;
+        app_state.resolution_budget_ms = (float) config.resolution_budget_ms;
+
+        texture_loader.init();
+        if (!config.record_path.empty())
+            frame_recorder.start(config.record_path, render::FrameRecorder::formatFor(config.record_path));
+        // headless runs export in finishExport()
+        if (!config.headless && !config.export_path.empty())
+            exporter.start(config.export_path, config.export_width, config.export_height);
+        if (!config.headless && config.path_tracer)
+            setRenderer(ViewportRenderer::PathTracer);
     }
 
     Application::~Application() {
+        stopRenderThread();
+        exporter.cancel();
+        frame_recorder.stop();
+        path_tracer.stop();
+        render_graph.shutdown();
+        render::glstate.deleteVertexArrays(1, &fullscreen_vao);
+        for (auto &viewport: viewports)
+            viewport.target.release();
+        render_queue.shutdown();
+        imgui_renderer.shutdown();
+        stream_buffer.shutdown();
+        texture_loader.shutdown();
+        shader_manager.shutdown();
+
+        if (asset_pack.isOpen()) {
+            auto pack = asset_pack.stats();
+            CARNIVAL_LOG_INFO("Asset pack: {} lookups, {} not in the pack, {} inflated ({:.1f} KB in {:.2f} ms)",
+                              pack.lookups, pack.misses, pack.inflated, (double) pack.inflated_bytes / 1024.0,
+                              pack.inflate_ms);
+        }
+
+        if (config.headless) {
+            headless_context.destroy();
+            return;
+        }
+
+        if (input.isMeasuring()) {
+            auto latency = input.latency();
+            CARNIVAL_LOG_INFO("Input to present over {} events: median {:.2f} ms, p90 {:.2f} ms, p99 {:.2f} ms, max {:.2f} ms",
+                              latency.event_to_present.count, latency.event_to_present.median, latency.present_p90,
+                              latency.event_to_present.p99, latency.event_to_present.max);
+        }
+        input.shutdown();
+
+        auto heap = AllocationTracker::instance().stats();
+        if (heap.frames > 0) {
+            CARNIVAL_LOG_INFO("Heap allocations per frame: peak {} ({:.1f} KB), {} of {} settled frames without any",
+                              heap.peak_frame_allocations, (double) heap.peak_frame_bytes / 1024.0, heap.steady_frames,
+                              heap.settled_frames);
+        }
+
+        auto &gl_state = render::glstate.stats();
+        if (gl_state.frames > 0) {
+            auto total = (double) std::max<uint64_t>(gl_state.total_issued + gl_state.total_elided, 1);
+            CARNIVAL_LOG_INFO("GL state changes: {} issued, {} elided ({:.1f}%), {} mismatches", gl_state.total_issued,
+                              gl_state.total_elided, 100.0 * (double) gl_state.total_elided / total, gl_state.mismatches);
+        }
+
+        auto loop = frame_loop.stats();
+        if (loop.frames > 0) {
+            CARNIVAL_LOG_INFO("{} frames, {}: {:.1f} fps, build to present median {:.2f} ms, p90 {:.2f} ms, p99 {:.2f} ms",
+                              loop.frames, loop.threaded ? "render thread" : "single thread", loop.frames_per_second,
+                              loop.latency.median, loop.latency_p90, loop.latency.p99);
+        }
+
         ImGui_ImplOpenGL3_Shutdown();
         ImGui_ImplSDL2_Shutdown();
         ImGui::DestroyContext();
@@ -44,82 +215,197 @@ namespace carnival::core {
         SDL_DestroyWindow(rendering_context.window_handle);
         SDL_Quit();
 
-        std::cout << "\n- - -\n" << "[" << currentTime(std::chrono::system_clock::now()) << "] " << "Quit\n";
+        CARNIVAL_LOG_INFO("Quit");
     }
 
     void Application::Run() {
+        if (config.render_thread)
+            startRenderThread();
+        int64_t wait_start = 0;
+
         while (app_state.running) {
+            // nothing to show, sleep until an event or a background thread wakes us
+            if (!frame_scheduler.shouldRender(hasPendingWork()))
+                frame_scheduler.waitForEvents();
+
             HandleEvents();
+            if (!frame_scheduler.shouldRender(hasPendingWork()))
+                continue;
+
+            if (threaded()) {
+                // both frames are with the render thread, keep handling events until it presented one
+                if (!render_thread.waitReady(1)) {
+                    if (wait_start == 0)
+                        wait_start = InputSystem::now();
+                    continue;
+                }
+                frame_loop.waited(wait_start != 0 ? (double) (InputSystem::now() - wait_start) / 1e6 : 0.0);
+                wait_start = 0;
+
+                frame_scheduler.beginFrame();
+                buildFrame();
+                frame_scheduler.endFrame();
+                AllocationTracker::instance().endFrame();
+                continue;
+            }
+
+            frame_scheduler.beginFrame();
+            CARNIVAL_PROFILE_BEGIN_FRAME();
             render();
+            CARNIVAL_PROFILE_END_FRAME();
+            frame_scheduler.endFrame();
+            AllocationTracker::instance().endFrame();
         }
 
+        stopRenderThread();
+    }
+
+    FrameTimings Application::RunHeadless(int frames, int warmup_frames) {
+        FrameTimings timings;
+        timings.cpu_ms.reserve(frames);
+        timings.gpu_ms.reserve(frames);
+
+        // a few queries in flight, so reading the oldest one only waits if the GPU is that far behind,
+        // which also keeps the CPU from running away without a swap to throttle it
+        const int query_count = 4;
+        GLuint queries[query_count] = {};
+        bool gpu_timing = render::glext.timer_query;
+        if (gpu_timing)
+            glGenQueries(query_count, queries);
+
+        auto readQuery = [&](int frame) {
+            if (frame < warmup_frames)
+                return;
+            GLuint64 elapsed = 0;
+            render::glext.GetQueryObjectui64v(queries[frame % query_count], GL_QUERY_RESULT, &elapsed);
+            // llvmpipe answers the very first elapsed query with an absolute timestamp
+            if (elapsed > 10'000'000'000ull)
+                return;
+            timings.gpu_ms.push_back((double) elapsed / 1e6);
+        };
+
+        // frames without their programs would time nothing
+        {
+            StartupPhase phase("finish loading");
+            shader_manager.finishLoading();
+        }
+
+        auto total = frames + warmup_frames;
+        auto wall_start = std::chrono::steady_clock::now();
+
+        for (int frame = 0; frame < total; frame++) {
+            if (gpu_timing && frame >= query_count)
+                readQuery(frame - query_count);
+
+            auto start = std::chrono::steady_clock::now();
+
+            // outside the allocation scope, as in the windowed loop
+            CARNIVAL_PROFILE_BEGIN_FRAME();
+            {
+                AllocationScope allocations;
+                if (gpu_timing)
+                    glBeginQuery(GL_TIME_ELAPSED, queries[frame % query_count]);
+                stream_buffer.beginFrame();
+                renderGL();
+                frame_recorder.capture(viewports[0].image.framebuffer, viewports[0].image.width,
+                                       viewports[0].image.height);
+                stream_buffer.endFrame();
+                render::glstate.endFrame();
+                if (gpu_timing)
+                    glEndQuery(GL_TIME_ELAPSED);
+                glFlush();
+            }
+            CARNIVAL_PROFILE_END_FRAME();
+            AllocationTracker::instance().endFrame();
+
+            auto end = std::chrono::steady_clock::now();
+            if (frame == 0)
+                trackStartup();
+            if (frame == warmup_frames - 1)
+                wall_start = end;
+            if (frame >= warmup_frames)
+                timings.cpu_ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        }
+
+        if (gpu_timing) {
+            for (int frame = std::max(total - query_count, 0); frame < total; frame++)
+                readQuery(frame);
+            glDeleteQueries(query_count, queries);
+        }
+
+        glFinish();
+        timings.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall_start).count();
+        return timings;
+    }
+
+    void Application::InitHeadless() {
+        for (auto &viewport: viewports) {
+            viewport.width = config.width;
+            viewport.height = config.height;
+        }
+
+        if (!headless_context.create(4, 3)) {
+            throw EXIT_FAILURE;
+        }
+
+        if (!gladLoadGLLoader((GLADloadproc) HeadlessContext::getProcAddress)) {
+            CARNIVAL_LOG_ERROR("Couldn't initialize glad");
+            throw EXIT_FAILURE;
+        }
+        render::loadGLExtensions((GLADloadproc) HeadlessContext::getProcAddress);
+
+        CARNIVAL_LOG_INFO("OpenGL renderer: {}", glGetString(GL_RENDERER));
+        CARNIVAL_LOG_INFO("OpenGL version: {}", glGetString(GL_VERSION));
     }
 
     void Application::InitOpenGl() {
         rendering_context.gl_context = SDL_GL_CreateContext(rendering_context.window_handle);
         if (rendering_context.gl_context == nullptr) {
-            std::cerr << "[ERROR] Failed to create a GL context: "
-                      << SDL_GetError() << std::endl;
+            CARNIVAL_LOG_ERROR("Failed to create a GL context: {}", SDL_GetError());
             throw EXIT_FAILURE;
         }
         SDL_GL_MakeCurrent(rendering_context.window_handle, rendering_context.gl_context);
 
         // enable VSync
-        SDL_GL_SetSwapInterval(1);
-        SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
-        SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 16);
+        SDL_GL_SetSwapInterval(app_state.swap_interval);
 
         if (!gladLoadGLLoader((GLADloadproc) SDL_GL_GetProcAddress)) {
-            std::cerr << "[ERROR] Couldn't initialize glad" << std::endl;
+            CARNIVAL_LOG_ERROR("Couldn't initialize glad");
             throw EXIT_FAILURE;
         } else {
-            std::cout << "[INFO] glad initialized" << std::endl;
+            CARNIVAL_LOG_INFO("glad initialized");
         }
+        render::loadGLExtensions((GLADloadproc) SDL_GL_GetProcAddress);
 
-        glEnable(GL_MULTISAMPLE);
-
-        std::cout << "[INFO] OpenGL renderer: "
-                  << glGetString(GL_RENDERER)
-                  << std::endl;
-
-        std::cout << "[INFO] OpenGL version: "
-                  << glGetString(GL_VERSION)
-                  << std::endl;
+        render::glstate.enable(GL_MULTISAMPLE);
 
-        std::cout << "[INFO] OpenGL vendor: "
-                  << glGetString(GL_VENDOR)
-                  << std::endl;
-
-        std::cout << "[INFO] OpenGL shading language version: "
-                  << glGetString(GL_SHADING_LANGUAGE_VERSION)
-                  << std::endl;
+        CARNIVAL_LOG_INFO("OpenGL renderer: {}", glGetString(GL_RENDERER));
+        CARNIVAL_LOG_INFO("OpenGL version: {}", glGetString(GL_VERSION));
+        CARNIVAL_LOG_INFO("OpenGL vendor: {}", glGetString(GL_VENDOR));
+        CARNIVAL_LOG_INFO("OpenGL shading language version: {}", glGetString(GL_SHADING_LANGUAGE_VERSION));
 
         int nNumExtensions;
         glGetIntegerv(GL_NUM_EXTENSIONS, &nNumExtensions);
-
-        for (int i = 0; i < nNumExtensions; i++) {
-            std::cout << "[INFO] OpenGL extension: "
-                      << glGetStringi(GL_EXTENSIONS, i)
-                      << std::endl;
-        }
+        // looked up by name when needed, see render::hasGLExtension
+        CARNIVAL_LOG_INFO("OpenGL extensions: {}", nNumExtensions);
 
         // apparently, that shows maximum supported version
-        std::cout << "[INFO] OpenGL from glad: "
-                  << GLVersion.major
-                  << "."
-                  << GLVersion.minor
-                  << std::endl;
+        CARNIVAL_LOG_INFO("OpenGL from glad: {}.{}", GLVersion.major, GLVersion.minor);
     }
 
-    void Application::InitImGui() const {
+    void Application::InitImGui() {
         IMGUI_CHECKVERSION();
+        // ImGui's vectors and windows come and go with the UI, the pool recycles them
+        ImGui::SetAllocatorFunctions(poolAllocate, poolFree, &ui_pool);
         ImGui::CreateContext();
 
         ImGuiIO &io = ImGui::GetIO();
         (void) io;
         io.IniFilename = nullptr;
         io.ConfigFlags |= ImGuiConfigFlags_DockingEnable;
-        io.ConfigFlags |= ImGuiConfigFlags_ViewportsEnable;
+        // platform windows are drawn with ImGui's own draw data, which only lives until the next frame
+        if (!config.render_thread)
+            io.ConfigFlags |= ImGuiConfigFlags_ViewportsEnable;
 
         setImGuiStyle();
 
@@ -129,9 +415,9 @@ namespace carnival::core {
 
     void Application::InitWindow() {
 
-        SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 1);
-        SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 16);
-
+        // only ImGui draws into the window, the viewports are multisampled on their own
+        SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 0);
+        SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 0);
 
         auto window_flags = (SDL_WindowFlags) (
                 SDL_WINDOW_OPENGL
@@ -188,16 +474,22 @@ namespace carnival::core {
 #endif
 
         if (result != 0) {
-            std::cerr << "[ERROR] Failed to initialize SDL: "
-                      << SDL_GetError() << std::endl;
+            CARNIVAL_LOG_ERROR("Failed to initialize SDL: {}", SDL_GetError());
             throw EXIT_FAILURE;
         }
     }
 
     void Application::HandleEvents() {
+        CARNIVAL_PROFILE_SCOPE("HandleEvents");
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
+            // any input may change the UI, wake events only mean a background job finished
+            frame_scheduler.markDirty();
+            if (frame_scheduler.isWakeEvent(event))
+                continue;
+
             ImGui_ImplSDL2_ProcessEvent(&event);
+            input.handle(event);
 
             switch (event.type) {
                 case SDL_QUIT:
@@ -231,48 +523,15 @@ namespace carnival::core {
                             break;
                         case SDLK_v:
                             if (event.key.keysym.mod & KMOD_CTRL) {
-                                SDL_GL_SetSwapInterval(!SDL_GL_GetSwapInterval());
+                                auto interval = app_state.swap_interval = !app_state.swap_interval;
+                                onRenderThread([interval]() { SDL_GL_SetSwapInterval(interval); });
                             }
                             break;
-                        case SDLK_k:
-                            if (input_context.controller != nullptr) {
-                                SDL_GameControllerClose(input_context.controller);
-                                input_context.controller = nullptr;
-                                std::cout << "[INFO] Controller disconnected" << std::endl;
-                            } else {
-                                std::cout << "[ERROR] No controller connected" << std::endl;
-                            }
-                            break;
-                        case SDLK_h: {
-                            if (input_context.controller == nullptr) { break; }
-                            input_context.joystick = SDL_GameControllerGetJoystick(input_context.controller);
-                            if (input_context.joystick == nullptr) { break; }
-
-                            int res = SDL_JoystickRumble(input_context.joystick, 0xFFFF, 0xFFFF, 1000);
-                            std::cout << "[INFO] Rumble result: " << res << std::endl;
-                            break;
-                        }
-                        case SDLK_j:
-                            if (input_context.controller == nullptr) {
-                                SDL_JoystickUpdate();
-                                int joyStickCount = SDL_NumJoysticks();
-                                if (joyStickCount != 0) {
-                                    input_context.controller = SDL_GameControllerOpen(0);
-                                    if (input_context.controller != nullptr) {
-                                        std::cout << "[INFO] Controller connected" << std::endl;
-                                    } else {
-                                        std::cout << "[ERROR] Controller not connected" << std::endl;
-                                        std::cout << SDL_GetError() << std::endl;
-                                    }
-                                } else {
-                                    std::cout << "[ERROR] No controller connected" << std::endl;
-                                }
-                            } else {
-                                std::cout << "[ERROR] Controller already connected" << std::endl;
-                            }
+                        case SDLK_h:
+                            input.rumble(0xFFFF, 0xFFFF, 1000);
                             break;
                         case SDLK_r:
-                            log();
+                            CARNIVAL_LOG_INFO("Application at {}", (const void *) this);
                             break;
                         case SDLK_F11:
                             if (SDL_GetWindowFlags(rendering_context.window_handle) & SDL_WINDOW_FULLSCREEN_DESKTOP) {
@@ -287,66 +546,85 @@ namespace carnival::core {
         }
     }
 
+    bool Application::hasPendingWork() const {
+        // everything it looks at belongs to the render thread, which answers after every frame
+        if (threaded())
+            return render_work_pending.load(std::memory_order_relaxed);
+        return renderWorkPending();
+    }
+
+    bool Application::renderWorkPending() const {
+        bool resizing = std::any_of(viewports.begin(), viewports.end(), [](const Viewport &viewport) {
+            return viewport.open && viewport.resize_queued;
+        });
+        return resizing || texture_loader.busy() || shader_manager.stats().in_flight > 0
+               || shader_manager.loading() || path_tracer.busy() || frame_recorder.recording() || exporter.active();
+    }
+
+    void Application::trackStartup() {
+        auto &startup = StartupTimer::instance();
+        startup.milestone("first frame");
+
+        if (shader_manager.loading())
+            return;
+        if (preview_image != render::invalidTexture) {
+            auto state = texture_loader.state(preview_image);
+            if (state == render::TextureState::Decoding || state == render::TextureState::Uploading)
+                return;
+        }
+        startup.milestone("assets ready");
+        startup.report();
+        startup_reported = true;
+    }
+
+    void Application::setRenderer(ViewportRenderer renderer)
+    {
+        app_state.renderer = renderer;
+        // the workers only exist while the path tracer is shown
+        if (renderer == ViewportRenderer::PathTracer)
+            path_tracer.start();
+        else
+            path_tracer.stop();
+    }
+
     void Application::setupTriangle()
     {
+        StartupPhase phase("setupTriangle");
         glGenVertexArrays(1, &rendering_context.VertexArrayID);
-        glBindVertexArray(rendering_context.VertexArrayID);
+        render::glstate.bindVertexArray(rendering_context.VertexArrayID);
         // This will identify our vertex buffer
         // Generate 1 buffer, put the resulting identifier in vertex-buffer
         glGenBuffers(1, &rendering_context.vertex_buffer);
         // The following commands will talk about our 'vertex-buffer' buffer
-        glBindBuffer(GL_ARRAY_BUFFER, rendering_context.vertex_buffer);
+        render::glstate.bindBuffer(GL_ARRAY_BUFFER, rendering_context.vertex_buffer);
         // Give our vertices to OpenGL.
         glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
+        // the layout lives in the VAO, drawing only has to bind it
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+        glEnableVertexAttribArray(0);
+        render::glstate.bindVertexArray(0);
     }
 
     void Application::setupImage()
     {
-        GLuint FramebufferName = 0;
-        glGenFramebuffers(1, &FramebufferName);
-        glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
-
-        GLuint renderedTexture;
-        glGenTextures(1, &renderedTexture);
-
-        // "Bind" the newly created texture : all future texture functions will modify this texture
-        glBindTexture(GL_TEXTURE_2D, renderedTexture);
-
-        image_data.width = app_state.viewport_width;
-        image_data.height = app_state.viewport_height;
-
-        // Give an empty image to OpenGL ( the last "0" )
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image_data.width, image_data.height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-
-        // Poor filtering. Needed !
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-        // The depth buffer
-        GLuint depthrenderbuffer;
-        glGenRenderbuffers(1, &depthrenderbuffer);
-        glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, image_data.width, image_data.height);
-        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
-
-        // Set "renderedTexture" as our colour attachement #0
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderedTexture, 0);
-
-        // Set the list of draw buffers.
-        GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
-        glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
-
-        image_data.texture = renderedTexture;
-        image_data.framebuffer = FramebufferName;
-        image_data.depthbuffer = depthrenderbuffer;
+        StartupPhase phase("setupImage");
+        for (auto &viewport: viewports) {
+            if (!viewport.open)
+                continue;
+            viewport.target.request(viewport.width, viewport.height);
+            viewport.target.update();
+            viewport.image = viewport.target.image();
+        }
     }
 
-    void Application::updateTexture()
+    void Application::updateTexture(Viewport &viewport)
     {
-        glDeleteTextures(1, &image_data.texture);
-        glDeleteRenderbuffers(1, &image_data.depthbuffer);
-        glDeleteFramebuffers(1, &image_data.framebuffer);
-        setupImage();
+        CARNIVAL_PROFILE_GPU_SCOPE("updateTexture");
+        // resizes are coalesced by the viewport target, keep feeding it until the size has settled
+        viewport.target.request(viewport.width, viewport.height);
+        viewport.target.update();
+        viewport.image = viewport.target.image();
+        viewport.resize_queued = viewport.target.pending();
     }
 
     void Application::setupGUI(ImGuiID dockID)
@@ -359,8 +637,8 @@ namespace carnival::core {
         ImGui::DockBuilderDockWindow("Left Panel", id1);
         ImGui::DockBuilderDockWindow("Right Panel", id2);
         ImGui::DockBuilderDockWindow("Bottom Panel", id3);
-        ImGui::DockBuilderDockWindow("Viewport-Container", dockID);
-        ImGui::DockBuilderDockWindow("Viewport-Container2", dockID);
+        for (auto &viewport: viewports)
+            ImGui::DockBuilderDockWindow(viewport.title.c_str(), dockID);
 
 
         ImGui::DockBuilderFinish(dockID);
@@ -368,9 +646,13 @@ namespace carnival::core {
 
     void Application::renderGUI()
     {
-        // Wichtig!
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        ImGui_ImplOpenGL3_NewFrame();
+        CARNIVAL_PROFILE_SCOPE("renderGUI");
+        // threaded, the backend's objects were made in startRenderThread() and this thread has no context
+        if (!threaded()) {
+            // Wichtig!
+            render::glstate.bindFramebuffer(GL_FRAMEBUFFER, 0);
+            ImGui_ImplOpenGL3_NewFrame();
+        }
         ImGui_ImplSDL2_NewFrame(rendering_context.window_handle);
 
         int sdl_width, sdl_height;
@@ -396,106 +678,1300 @@ namespace carnival::core {
             firstFrame = false;
         }
 
-        ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0, 0));
-
         ImGuiWindowClass window_class_fixed;
         window_class_fixed.DockNodeFlagsOverrideSet = ImGuiDockNodeFlags_NoUndocking | ImGuiDockNodeFlags_NoWindowMenuButton | ImGuiDockNodeFlags_NoDockingOverCentralNode;
-        ImGui::SetNextWindowClass(&window_class_fixed);
-        ImGui::Begin("Viewport-Container", nullptr, ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoCollapse);
-
-        auto size = ImGui::GetContentRegionAvail();
+        ImGuiWindowClass window_class_dockable;
+        window_class_dockable.DockNodeFlagsOverrideSet = ImGuiDockNodeFlags_NoWindowMenuButton;
 
-        if((int)size.x != app_state.viewport_width || (int)size.y != app_state.viewport_height)
-        {
-            app_state.viewport_width = (int)size.x;
-            app_state.viewport_height = (int)size.y;
-            app_state.resize_queued = true;
+        ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0, 0));
+        for (int i = 0; i < maxViewports; i++) {
+            if (viewports[i].open)
+                renderViewportWindow(viewports[i], i == 0 ? window_class_fixed : window_class_dockable, i == 0);
         }
-
-        ImGui::Image((void*)(intptr_t)image_data.texture, ImVec2((float)image_data.width, (float)image_data.height));
-        ImGui::End();
-
         ImGui::PopStyleVar();
 
-        ImGuiWindowClass window_class_dockable;
-        window_class_dockable.DockNodeFlagsOverrideSet = ImGuiDockNodeFlags_NoWindowMenuButton;
 
         ImGui::SetNextWindowClass(&window_class_dockable);
         ImGui::Begin("Left Panel", nullptr);
         ImGui::Text("Render Controls");
 
+        int renderer = (int) app_state.renderer;
+        if (ImGui::Combo("Renderer", &renderer, "Raster (GL)\0Path tracer (CPU)\0"))
+            setRenderer((ViewportRenderer) renderer);
+
+        if (app_state.renderer == ViewportRenderer::Raster) {
+            renderMsaaControls();
+            renderResolutionControls();
+        }
+
+        if (app_state.renderer == ViewportRenderer::PathTracer
+            && ImGui::CollapsingHeader("Path tracer", ImGuiTreeNodeFlags_DefaultOpen)) {
+            renderPathTracerControls();
+        }
+
+        if (app_state.renderer == ViewportRenderer::Raster
+            && ImGui::CollapsingHeader("Render queue", ImGuiTreeNodeFlags_DefaultOpen)) {
+            renderQueueControls();
+        }
+
+        if (ImGui::CollapsingHeader("Recording")) {
+            renderRecordingControls();
+        }
+
+        if (ImGui::CollapsingHeader("Export")) {
+            renderExportControls();
+        }
+
+        if (ImGui::CollapsingHeader("Render graph")) {
+            renderGraphControls();
+        }
+
+        if (ImGui::CollapsingHeader("Viewports", ImGuiTreeNodeFlags_DefaultOpen)) {
+            renderViewportStats();
+        }
+
+        if (ImGui::CollapsingHeader("Viewport target")) {
+            auto &stats = viewports[0].target.stats();
+            ImGui::Text("Drawn: %dx%d", viewports[0].image.width, viewports[0].image.height);
+            ImGui::Text("Allocated: %dx%d", viewports[0].image.capacity_width, viewports[0].image.capacity_height);
+            ImGui::Text("Reallocations: %llu", (unsigned long long) stats.reallocations);
+            ImGui::Text("Pool hits: %llu", (unsigned long long) stats.pool_hits);
+            ImGui::Text("Coalesced frames: %llu", (unsigned long long) stats.resizes_coalesced);
+            ImGui::Text("Allocated total: %.2f MB", (double) stats.bytes_allocated / (1024.0 * 1024.0));
+            ImGui::Text("Resident: %.2f MB (%zu pooled)", (double) stats.bytes_resident / (1024.0 * 1024.0),
+                        stats.pooled_targets);
+        }
+
+        if (ImGui::CollapsingHeader("Startup")) {
+            for (auto &event: StartupTimer::instance().events()) {
+                if (event.milestone)
+                    ImGui::Text("%s after %.1f ms", event.name.c_str(), event.start_ms);
+                else
+                    ImGui::BulletText("%s: %.1f ms at %.1f ms%s", event.name.c_str(), event.duration_ms,
+                                      event.start_ms, event.main_thread ? "" : " (worker)");
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Shaders")) {
+            auto &stats = shader_manager.stats();
+            auto &cache = shader_manager.cacheStats();
+            ImGui::Text("Loaded %.1f ms after add()%s", stats.startup_ms, shader_manager.loading() ? ", loading" : "");
+            ImGui::Text("Cache hits: %llu, misses: %llu, rejected: %llu", (unsigned long long) cache.hits,
+                        (unsigned long long) cache.misses, (unsigned long long) cache.rejected);
+            ImGui::Text("Reloads: %llu (%llu failed)", (unsigned long long) stats.reloads,
+                        (unsigned long long) stats.failed_reloads);
+            ImGui::Text("Last rebuild: %.1f ms", stats.last_build_ms);
+            ImGui::Text("Building: %zu", stats.in_flight);
+            ImGui::Text("Startup compile: %.1f ms for %zu programs", stats.startup_compile_ms, stats.programs.size());
+            ImGui::Text("Waited on first use: %llu times, %.1f ms", (unsigned long long) stats.blocking_acquires,
+                        stats.blocked_ms);
+            for (auto &program: stats.programs) {
+                if (!program.ready)
+                    ImGui::BulletText("%s: building", program.name.c_str());
+                else if (program.cached)
+                    ImGui::BulletText("%s: from the cache", program.name.c_str());
+                else
+                    ImGui::BulletText("%s: compiled in %.1f ms", program.name.c_str(), program.compile_ms);
+            }
+            ImGui::Text("Uniform blocks (%llu layout mismatches)", (unsigned long long) stats.layout_mismatches);
+            for (auto &block: shader_manager.uniformBlocks())
+                ImGui::BulletText("%s: %d bytes, %zu members, binding %u", block.name.c_str(), block.size,
+                                  block.members.size(), block.binding);
+        }
+
+        if (ImGui::CollapsingHeader("Stream buffer")) {
+            auto &stats = stream_buffer.stats();
+            ImGui::Checkbox("Draw ImGui from the stream buffer", &app_state.stream_imgui);
+            ImGui::Text("Mode: %s", stats.persistent ? "persistent, coherent" : "unsynchronized map per frame");
+            ImGui::Text("This frame: %.1f KB (peak %.1f KB)", (double) stats.frame_bytes / 1024.0,
+                        (double) stats.peak_frame_bytes / 1024.0);
+            ImGui::Text("Region: %.2f MB x %d, grown %llu times", (double) stats.region_bytes / (1024.0 * 1024.0),
+                        render::StreamBuffer::regionCount, (unsigned long long) stats.reallocations);
+            ImGui::Text("Stalls: %llu, waited %.2f ms (last %.2f ms)", (unsigned long long) stats.stalls,
+                        stats.wait_ms, stats.last_wait_ms);
+            if (app_state.stream_imgui && imgui_renderer.ready()) {
+                auto &imgui = imgui_renderer.stats();
+                ImGui::Text("ImGui: %zu draws, %zu vertices, %zu indices", imgui.draw_calls, imgui.vertices,
+                            imgui.indices);
+            }
+        }
+
+        if (ImGui::CollapsingHeader("Frame pacing", ImGuiTreeNodeFlags_DefaultOpen)) {
+            renderFramePacing();
+        }
+
+        if (ImGui::CollapsingHeader("Frame loop")) {
+            renderFrameLoopStats();
+        }
+
+        if (ImGui::CollapsingHeader("Memory")) {
+            renderMemoryStats();
+        }
+
+        if (ImGui::CollapsingHeader("GL state")) {
+            renderGLStateStats();
+        }
+
+        if (ImGui::CollapsingHeader("Input")) {
+            renderInputControls();
+        }
+
         ImGui::End();
 
         ImGui::SetNextWindowClass(&window_class_dockable);
         ImGui::Begin("Right Panel", nullptr);
         ImGui::Text("Right Panel Controls");
-        if(ImGui::Button("Test"))
-        {
-            app_state.secondOpen = !app_state.secondOpen;
+        auto closed = std::find_if(viewports.begin(), viewports.end(), [](const Viewport &viewport) { return !viewport.open; });
+        if (closed != viewports.end() && ImGui::Button("Add viewport")) {
+            closed->open = true;
+            closed->visible = true;
+        }
+
+        if (ImGui::CollapsingHeader("Textures", ImGuiTreeNodeFlags_DefaultOpen)) {
+            // shows the placeholder until the loader is done with it
+            int image_width = 1, image_height = 1;
+            texture_loader.size(preview_image, image_width, image_height);
+            float preview_width = ImGui::GetContentRegionAvail().x;
+            ImGui::Image((void*)(intptr_t)texture_loader.texture(preview_image),
+                         ImVec2(preview_width, preview_width * (float)image_height / (float)image_width));
+
+            auto &stats = texture_loader.stats();
+            ImGui::Text("Decode queue: %zu", stats.decode_queue);
+            ImGui::Text("Upload queue: %zu", stats.upload_queue);
+            ImGui::Text("Uploaded this frame: %.2f MB", (double) stats.bytes_uploaded_frame / (1024.0 * 1024.0));
+            ImGui::Text("Uploaded total: %.2f MB", (double) stats.bytes_uploaded_total / (1024.0 * 1024.0));
+            ImGui::Text("Loads: %llu, cache hits: %llu", (unsigned long long) stats.loads,
+                        (unsigned long long) stats.cache_hits);
+            ImGui::Text("Last decode: %.1f ms", stats.last_decode_ms);
+            ImGui::Text("Latency: %.1f ms (avg %.1f ms)", stats.last_latency_ms, stats.average_latency_ms);
+            ImGui::Text("Upload stalls: %llu", (unsigned long long) stats.upload_stalls);
+            auto resident_mb = (double) stats.bytes_resident / (1024.0 * 1024.0);
+            auto rgba8_mb = (double) stats.bytes_resident_rgba8 / (1024.0 * 1024.0);
+            ImGui::Text("Resident: %.2f MB (%.2f MB as RGBA8, %.0f%% saved)", resident_mb, rgba8_mb,
+                        rgba8_mb > 0.0 ? 100.0 * (1.0 - resident_mb / rgba8_mb) : 0.0);
+            ImGui::Text("KTX2 cache: %llu hits, %llu writes", (unsigned long long) stats.ktx_hits,
+                        (unsigned long long) stats.ktx_writes);
+            ImGui::Text("Encode: %.1f ms avg (mips %.1f ms, compress %.1f ms)", stats.average_encode_ms,
+                        stats.last_mip_ms, stats.last_compress_ms);
+            if (stats.ktx_hits > 0 && stats.encodes > 0 && stats.average_ktx_ms > 0.0) {
+                ImGui::Text("From cache: %.1f ms avg, %.1fx faster", stats.average_ktx_ms,
+                            stats.average_encode_ms / stats.average_ktx_ms);
+            } else {
+                ImGui::Text("From cache: %.1f ms avg", stats.average_ktx_ms);
+            }
         }
         ImGui::End();
 
         ImGui::SetNextWindowClass(&window_class_dockable);
         ImGui::Begin("Bottom Panel", nullptr);
         ImGui::Text("Bottom Panel Controls");
+        renderProfiler();
         ImGui::End();
 
         ImGui::ShowDemoWindow();
 
         ImGui::Render();
         ImGui::EndFrame();
+    }
 
+    void Application::drawGUI(ImDrawData *draw_data)
+    {
+        render::remapTextures(draw_data, [this](ImTextureID texture) { return resolveUiTexture(texture); });
+        if (app_state.stream_imgui && imgui_renderer.ready()) {
+            imgui_renderer.render(draw_data, stream_buffer);
+        } else {
+            CARNIVAL_PROFILE_GPU_SCOPE("ImGui draw");
+            ImGui_ImplOpenGL3_RenderDrawData(draw_data);
+            // it puts back what it changed, but past the cache
+            render::glstate.invalidate();
+        }
+    }
 
-        // rendering
+    // above any texture name a driver hands out in practice
+    static const intptr_t uiTextureTag = 0x40000000;
 
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    ImTextureID Application::uiTexture(UiTexture kind, int index)
+    {
+        return (ImTextureID) (uiTextureTag | (intptr_t) kind << 8 | (intptr_t) index);
     }
 
-    void Application::renderGL()
+    ImTextureID Application::resolveUiTexture(ImTextureID texture) const
+    {
+        auto value = (intptr_t) texture;
+        if ((value & ~(intptr_t) 0xFFFF) != uiTextureTag)
+            return texture;
+
+        auto &viewport = viewports[std::min((int) (value & 0xFF), maxViewports - 1)];
+        GLuint name = 0;
+        switch ((UiTexture) ((value >> 8) & 0xFF)) {
+            case UiTexture::Viewport:
+                name = viewport.image.texture;
+                break;
+            case UiTexture::DepthView:
+                name = render_graph.texture(viewport.depth_view);
+                break;
+        }
+        return (ImTextureID) (intptr_t) name;
+    }
+
+    void Application::renderProfiler()
+    {
+#if CARNIVAL_ENABLE_PROFILER
+        auto &profiler = Profiler::instance();
+        auto cpu_history = profiler.cpuHistory();
+        auto gpu_history = profiler.gpuHistory();
+        auto latest = (int) ((profiler.frameIndex() + Profiler::historySize - 1) % Profiler::historySize);
+
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), "CPU %.2f ms", cpu_history[latest]);
+        ImGui::PlotLines("##cpu", cpu_history, Profiler::historySize, profiler.historyOffset(), overlay,
+                         0.0f, 33.3f, ImVec2(-1, 60));
+        if (profiler.gpuTiming()) {
+            snprintf(overlay, sizeof(overlay), "GPU %.2f ms", gpu_history[(latest + Profiler::historySize - Profiler::gpuFrames) % Profiler::historySize]);
+            ImGui::PlotLines("##gpu", gpu_history, Profiler::historySize, profiler.historyOffset(), overlay,
+                             0.0f, 33.3f, ImVec2(-1, 60));
+        }
+
+        if (ImGui::BeginTable("passes", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+            ImGui::TableSetupColumn("Pass");
+            ImGui::TableSetupColumn("CPU ms");
+            ImGui::TableSetupColumn("GPU ms");
+            ImGui::TableHeadersRow();
+            for (auto &pass: profiler.passes()) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Indent((float) pass.depth * 10.0f + 1.0f);
+                ImGui::TextUnformatted(pass.name);
+                ImGui::Unindent((float) pass.depth * 10.0f + 1.0f);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", pass.cpu_ms);
+                ImGui::TableNextColumn();
+                if (pass.gpu_ms > 0.0)
+                    ImGui::Text("%.3f", pass.gpu_ms);
+            }
+            ImGui::EndTable();
+        }
+
+        static int trace_frames = 120;
+        ImGui::SliderInt("Capture frames", &trace_frames, 1, profiler.capture_frames);
+        if (ImGui::Button("Export Chrome trace")) {
+            auto path = std::filesystem::current_path() / "carnival-trace.json";
+            if (profiler.exportChromeTrace(path, trace_frames))
+                CARNIVAL_LOG_INFO("Wrote trace to {}", path);
+            else
+                CARNIVAL_LOG_ERROR("Failed to write {}", path);
+        }
+        ImGui::SameLine();
+        ImGui::Text("Dropped: %llu events, %llu GPU frames", (unsigned long long) profiler.droppedEvents(),
+                    (unsigned long long) profiler.droppedGpuFrames());
+#else
+        ImGui::TextDisabled("Profiler disabled at build time (CARNIVAL_PROFILER=OFF)");
+#endif
+    }
+
+    void Application::renderFramePacing()
+    {
+        int mode = (int) frame_scheduler.mode;
+        ImGui::RadioButton("On demand", &mode, (int) SchedulerMode::OnDemand);
+        ImGui::SameLine();
+        ImGui::RadioButton("Continuous", &mode, (int) SchedulerMode::Continuous);
+        frame_scheduler.mode = (SchedulerMode) mode;
+
+        ImGui::SliderInt("Target FPS", &frame_scheduler.target_fps, 0, 240, frame_scheduler.target_fps == 0 ? "unlimited" : "%d");
+        bool vsync = app_state.swap_interval != 0;
+        if (ImGui::Checkbox("VSync", &vsync)) {
+            auto interval = app_state.swap_interval = vsync ? 1 : 0;
+            onRenderThread([interval]() { SDL_GL_SetSwapInterval(interval); });
+        }
+
+        auto &stats = frame_scheduler.stats();
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), "%.2f ms", stats.frame_ms);
+        ImGui::PlotLines("##frames", stats.frame_history, FramePacingStats::historySize,
+                         (int) (stats.frames % FramePacingStats::historySize), overlay, 0.0f, 50.0f, ImVec2(-1, 40));
+        ImGui::Text("Render: %.2f ms, limiter: %.2f ms", stats.render_ms, stats.limiter_ms);
+        ImGui::Text("Idle before frame: %.2f ms", stats.idle_ms);
+        ImGui::Text("Frames: %llu, idle waits: %llu", (unsigned long long) stats.frames,
+                    (unsigned long long) stats.idle_waits);
+        ImGui::Text("Missed deadlines: %llu", (unsigned long long) stats.missed_deadlines);
+    }
+
+    void Application::renderFrameLoopStats()
+    {
+        auto stats = frame_loop.stats();
+        ImGui::Text("Mode: %s", stats.threaded ? "render thread" : "single thread");
+        if (!stats.threaded && !config.render_thread)
+            ImGui::TextDisabled("Start with --render-thread to present on a thread of its own");
+        ImGui::Text("Presented: %llu, %.1f fps", (unsigned long long) stats.frames, stats.frames_per_second);
+        ImGui::Text("Build: %.2f ms, submit: %.2f ms, swap: %.2f ms", stats.build_ms, stats.submit_ms,
+                    stats.present_ms);
+        if (stats.threaded)
+            ImGui::Text("Queued: %.2f ms, waiting for a frame: %.2f ms", stats.queued_ms, stats.wait_ms);
+        ImGui::Text("Build to present: median %.2f, p90 %.2f, p99 %.2f, max %.2f ms", stats.latency.median,
+                    stats.latency_p90, stats.latency.p99, stats.latency.max);
+    }
+
+    void Application::renderMemoryStats()
+    {
+        auto &tracker = AllocationTracker::instance();
+        auto heap = tracker.stats();
+        ImGui::Text("Heap this frame: %llu allocations, %.1f KB", (unsigned long long) heap.frame_allocations,
+                    (double) heap.frame_bytes / 1024.0);
+        ImGui::Text("Peak settled frame: %llu allocations, %.1f KB", (unsigned long long) heap.peak_frame_allocations,
+                    (double) heap.peak_frame_bytes / 1024.0);
+        ImGui::Text("Settled frames without any: %llu of %llu", (unsigned long long) heap.steady_frames,
+                    (unsigned long long) heap.settled_frames);
+        ImGui::Text("Process total: %llu allocations, %.2f MB", (unsigned long long) heap.total_allocations,
+                    (double) heap.total_bytes / (1024.0 * 1024.0));
+
+        bool checking = heap.checking;
+        if (ImGui::Checkbox("Flag heap allocations in the frame loop", &checking))
+            tracker.setChecking(checking);
+        if (heap.checking)
+            ImGui::Text("Flagged: %llu frames, %llu allocations", (unsigned long long) heap.flagged_frames,
+                        (unsigned long long) heap.flagged_allocations);
+
+        auto &arena = frame_arena.stats();
+        ImGui::Text("Frame arena: %.1f KB (peak %.1f KB) of %.1f KB, %llu allocations", (double) arena.used_bytes / 1024.0,
+                    (double) arena.peak_bytes / 1024.0, (double) arena.capacity / 1024.0,
+                    (unsigned long long) arena.allocations);
+
+        auto pool = ui_pool.stats();
+        ImGui::Text("ImGui pool: %.1f KB in use (peak %.1f KB), %.1f KB reserved", (double) pool.bytes_in_use / 1024.0,
+                    (double) pool.peak_bytes_in_use / 1024.0, (double) pool.reserved_bytes / 1024.0);
+        ImGui::Text("ImGui allocations: %llu, frees: %llu, larger than a class: %llu",
+                    (unsigned long long) pool.allocations, (unsigned long long) pool.frees,
+                    (unsigned long long) pool.large_allocations);
+    }
+
+    void Application::renderGLStateStats()
+    {
+        auto &state = render::glstate;
+        ImGui::Checkbox("Elide redundant changes", &state.enabled);
+        ImGui::Checkbox("Validate against glGet (slow)", &state.validating);
+
+        auto &stats = state.stats();
+        auto frame_total = stats.frame_issued + stats.frame_elided;
+        ImGui::Text("This frame: %llu issued, %llu elided (%.0f%%), %llu invalidations",
+                    (unsigned long long) stats.frame_issued, (unsigned long long) stats.frame_elided,
+                    frame_total > 0 ? 100.0 * (double) stats.frame_elided / (double) frame_total : 0.0,
+                    (unsigned long long) stats.frame_invalidations);
+        ImGui::Text("Total: %llu issued, %llu elided", (unsigned long long) stats.total_issued,
+                    (unsigned long long) stats.total_elided);
+        if (state.validating || stats.mismatches > 0)
+            ImGui::Text("Mismatches: %llu", (unsigned long long) stats.mismatches);
+
+        if (ImGui::BeginTable("gl state", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+            ImGui::TableSetupColumn("State");
+            ImGui::TableSetupColumn("Issued");
+            ImGui::TableSetupColumn("Elided");
+            ImGui::TableHeadersRow();
+            for (size_t i = 0; i < render::GLStateStats::kindCount; i++) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(render::stateKindName((render::GLStateKind) i));
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", (unsigned long long) stats.issued[i]);
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu", (unsigned long long) stats.elided[i]);
+            }
+            ImGui::EndTable();
+        }
+    }
+
+    void Application::renderPathTracerControls()
+    {
+        auto &stats = path_tracer.stats();
+
+        int max_samples = stats.max_samples;
+        if (ImGui::SliderInt("Max samples", &max_samples, 1, 4096))
+            path_tracer.setMaxSamples(max_samples);
+        int bounces = path_tracer.maxBounces();
+        if (ImGui::SliderInt("Bounces", &bounces, 1, 16))
+            path_tracer.setMaxBounces(bounces);
+        if (ImGui::Button("Restart"))
+            path_tracer.restart();
+
+        ImGui::Text("Samples: %d / %d", stats.samples, stats.max_samples);
+        ImGui::Text("Threads: %zu", stats.threads);
+        ImGui::Text("Throughput: %.2f Msamples/s", stats.samples_per_second / 1e6);
+        ImGui::Text("Per core: %.3f Msamples/s", stats.samples_per_second_core / 1e6);
+        ImGui::Text("First pass: %.1f ms, last pass: %.1f ms", stats.first_pass_ms, stats.pass_ms);
+        ImGui::Text("Tiles stolen: %llu", (unsigned long long) stats.tiles_stolen);
+        ImGui::Text("Restarts: %llu", (unsigned long long) stats.restarts);
+        ImGui::Text("Tiles uploaded this frame: %zu", stats.tiles_uploaded_frame);
+    }
+
+    void Application::renderQueueControls()
+    {
+        if (!render_queue.supported()) {
+            ImGui::TextDisabled("Needs GL 4.3, drawing the test triangle instead");
+            return;
+        }
+
+        int objects = (int) demo_scene.size();
+        if (ImGui::SliderInt("Objects", &objects, 0, (int) render::DemoScene::maxObjects, "%d",
+                             ImGuiSliderFlags_Logarithmic)) {
+            demo_scene.resize((size_t) objects);
+            scene_version++;
+        }
+        ImGui::Checkbox("Animate", &app_state.animate_objects);
+        ImGui::Checkbox("Multi-draw indirect", &render_queue.use_multi_draw);
+
+        auto &stats = render_queue.stats();
+        ImGui::Text("Draw calls: %zu, commands: %zu", stats.draw_calls, stats.commands);
+        ImGui::Text("Batches: %zu, state changes: %zu", stats.batches, stats.state_changes);
+        ImGui::Text("Sort: %.2f ms, upload: %.2f ms, submit: %.2f ms", stats.sort_ms, stats.upload_ms,
+                    stats.submit_ms);
+    }
+
+    static int msaaIndex(int samples)
+    {
+        int index = 0;
+        while (index < 3 && (1 << index) < samples)
+            index++;
+        return index;
+    }
+
+    double Application::msaaGpuMs(int samples) const
+    {
+        return msaa_gpu_ms[msaaIndex(samples)];
+    }
+
+    void Application::renderMsaaControls()
+    {
+        const char *labels[] = {"Off", "2x", "4x", "8x"};
+        int current = msaaIndex(app_state.msaa_samples);
+        if (ImGui::BeginCombo("MSAA", labels[current])) {
+            for (int i = 0; i < 4; i++) {
+                // what each setting cost the main viewport last time it was on
+                char label[64];
+                if (msaa_gpu_ms[i] > 0.0)
+                    snprintf(label, sizeof(label), "%s (%.2f ms GPU)", labels[i], msaa_gpu_ms[i]);
+                else
+                    snprintf(label, sizeof(label), "%s", labels[i]);
+                if (ImGui::Selectable(label, i == current) && i != current) {
+                    app_state.msaa_samples = 1 << i;
+                    msaa_settle_frames = 4;
+                }
+            }
+            ImGui::EndCombo();
+        }
+    }
+
+    void Application::renderResolutionControls()
+    {
+        if (ImGui::Checkbox("Dynamic resolution", &app_state.dynamic_resolution) && !app_state.dynamic_resolution) {
+            for (auto &viewport: viewports)
+                viewport.resolution.reset();
+        }
+        if (!app_state.dynamic_resolution)
+            return;
+
+        ImGui::SliderFloat("GPU budget (ms)", &app_state.resolution_budget_ms, 1.0f, 33.0f, "%.1f");
+        ImGui::SliderFloat("Sharpen", &app_state.upscale_sharpness, 0.0f, 1.0f, "%.2f");
+        if (!render::glext.timer_query)
+            ImGui::TextDisabled("Needs timer queries, the scale stays at 100%%");
+
+        // of the main viewport
+        auto &viewport = viewports[0];
+        auto &stats = viewport.resolution.stats();
+        ImGui::Text("Scale: %.0f%%, %dx%d of %dx%d", stats.scale * 100.0f, viewport.render_width,
+                    viewport.render_height, viewport.image.width, viewport.image.height);
+        ImGui::Text("GPU: %.2f ms of %.1f, %llu changes, %llu frames over", stats.gpu_ms,
+                    app_state.resolution_budget_ms, (unsigned long long) stats.scale_changes,
+                    (unsigned long long) stats.frames_over);
+    }
+
+    void Application::renderInputControls()
+    {
+        auto &snapshot = input.latest();
+        for (int slot = 0; slot < maxGamepads; slot++) {
+            if (!snapshot.gamepads[slot].connected())
+                continue;
+            auto &axes = snapshot.gamepads[slot].axes;
+            ImGui::Text("Pad %d: %s", slot + 1, input.gamepadName(slot));
+            ImGui::Text("  left %.2f %.2f, right %.2f %.2f, triggers %.2f %.2f", axes[0], axes[1], axes[2], axes[3],
+                        axes[4], axes[5]);
+        }
+        if (snapshot.gamepad_count == 0)
+            ImGui::TextDisabled("No controllers");
+        else if (ImGui::Button("Rumble"))
+            input.rumble(0xFFFF, 0xFFFF, 500);
+
+        bool measuring = input.isMeasuring();
+        if (ImGui::Checkbox("Measure latency", &measuring))
+            input.setMeasuring(measuring);
+        if (!measuring)
+            return;
+
+        // waits for the GPU after every swap, which is the point where a frame is counted as presented
+        auto latency = input.latency();
+        ImGui::Text("Events: %llu, measured: %llu", (unsigned long long) latency.events,
+                    (unsigned long long) latency.measured);
+        ImGui::Text("To sample: median %.2f, p99 %.2f ms", latency.event_to_sample.median, latency.event_to_sample.p99);
+        ImGui::Text("To present: median %.2f, p90 %.2f, p99 %.2f, max %.2f ms", latency.event_to_present.median,
+                    latency.present_p90, latency.event_to_present.p99, latency.event_to_present.max);
+    }
+
+    void Application::renderRecordingControls()
+    {
+        if (!frame_recorder.recording()) {
+            ImGui::Combo("Format", &app_state.record_format, "Y4M\0Raw RGBA\0PNG sequence\0");
+            if (ImGui::Button("Start")) {
+                auto format = (render::RecordingFormat) app_state.record_format;
+                const char *extension = format == render::RecordingFormat::Y4M ? ".y4m"
+                                        : format == render::RecordingFormat::Raw ? ".raw" : "";
+                auto path = timestampedPath("recordings", "viewport", extension);
+                onRenderThread([this, path, format]() { frame_recorder.start(path, format); });
+            }
+        } else {
+            if (ImGui::Button("Stop"))
+                onRenderThread([this]() { frame_recorder.stop(); });
+            ImGui::SameLine();
+            ImGui::Text("%s", frame_recorder.path().filename().string().c_str());
+        }
+
+        auto stats = frame_recorder.stats();
+        ImGui::Text("Captured: %llu, written: %llu (%.1f MB)", (unsigned long long) stats.captured,
+                    (unsigned long long) stats.written, (double) stats.bytes_written / (1024.0 * 1024.0));
+        ImGui::Text("Dropped: %llu in readback, %llu at the writer, %llu resized",
+                    (unsigned long long) stats.dropped_readback, (unsigned long long) stats.dropped_writer,
+                    (unsigned long long) stats.dropped_size);
+        ImGui::Text("Writer queue: %zu / %zu", stats.queued, render::FrameRecorder::maxQueuedFrames);
+        ImGui::Text("Capture: %.3f ms, write: %.2f ms", stats.capture_ms, stats.write_ms);
+    }
+
+    void Application::renderExportControls()
+    {
+        if (!render_queue.supported()) {
+            ImGui::TextDisabled("Needs GL 4.3, the render queue draws the tiles");
+            return;
+        }
+
+        if (!exporter.active()) {
+            ImGui::InputInt("Width", &app_state.export_width, 1024, 4096);
+            ImGui::InputInt("Height", &app_state.export_height, 1024, 4096);
+            ImGui::InputInt("Tile size", &app_state.export_tile_size, 128, 512);
+            app_state.export_width = std::clamp(app_state.export_width, 1, render::TiledExporter::maxSize);
+            app_state.export_height = std::clamp(app_state.export_height, 1, render::TiledExporter::maxSize);
+            app_state.export_tile_size = std::clamp(app_state.export_tile_size, 16, 8192);
+            ImGui::Combo("Format", &app_state.export_format, "PNG\0Raw RGBA\0");
+
+            auto strip_bytes = (double) app_state.export_width
+                               * std::min(app_state.export_tile_size, app_state.export_height) * 4;
+            ImGui::Text("Strip buffers: 2 x %.1f MB", strip_bytes / (1024.0 * 1024.0));
+            if (ImGui::Button("Export")) {
+                auto extension = (render::ExportFormat) app_state.export_format == render::ExportFormat::Raw ? ".raw" : ".png";
+                onRenderThread([this, path = timestampedPath("exports", "carnival", extension),
+                                width = app_state.export_width, height = app_state.export_height,
+                                tile_size = app_state.export_tile_size]() {
+                    exporter.start(path, width, height, tile_size);
+                });
+            }
+        } else {
+            auto stats = exporter.stats();
+            char overlay[32];
+            snprintf(overlay, sizeof(overlay), "%d / %d rows", stats.rows_written, stats.height);
+            ImGui::ProgressBar(stats.progress(), ImVec2(-1.0f, 0.0f), overlay);
+            if (ImGui::Button("Cancel"))
+                onRenderThread([this]() { exporter.cancel(); });
+            ImGui::SameLine();
+            ImGui::Text("%s", exporter.path().filename().string().c_str());
+        }
+
+        auto stats = exporter.stats();
+        if (stats.tiles == 0)
+            return;
+        ImGui::Text("%dx%d, tiles: %d / %d of %dx%d", stats.width, stats.height, stats.tiles_rendered, stats.tiles,
+                    stats.tile_size, stats.tile_size);
+        ImGui::Text("Written: %.1f MB in %.2f s%s", (double) stats.bytes_written / (1024.0 * 1024.0),
+                    stats.elapsed_ms / 1000.0, stats.failed ? ", failed" : "");
+        ImGui::Text("Throughput: %.1f Mpixels/s, %.1f MB/s", stats.megapixels_per_second, stats.megabytes_per_second);
+    }
+
+    void Application::renderViewportWindow(Viewport &viewport, const ImGuiWindowClass &window_class, bool main)
+    {
+        ImGui::SetNextWindowClass(&window_class);
+        // false for a collapsed window or a tab that isn't selected
+        bool shown = ImGui::Begin(viewport.title.c_str(), main ? nullptr : &viewport.open,
+                                  main ? ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoCollapse : 0);
+        auto size = ImGui::GetContentRegionAvail();
+        viewport.visible = shown && (int) size.x > 0 && (int) size.y > 0;
+        if (!viewport.visible) {
+            ImGui::End();
+            return;
+        }
+
+        if ((int) size.x != viewport.width || (int) size.y != viewport.height) {
+            viewport.width = (int) size.x;
+            viewport.height = (int) size.y;
+            viewport.resize_queued = true;
+        }
+
+        // the target may be larger than what we draw into, only show the used part
+        ImGui::Image(uiTexture(UiTexture::Viewport, (int) (&viewport - viewports.data())),
+                     ImVec2((float)viewport.width, (float)viewport.height),
+                     ImVec2(0, 0), ImVec2(viewport.image.uvMaxX(), viewport.image.uvMaxY()));
+
+        if (ImGui::IsItemHovered()) {
+            auto &io = ImGui::GetIO();
+            if (main && app_state.renderer == ViewportRenderer::PathTracer) {
+                // orbit the path tracer camera by dragging, zoom with the wheel
+                auto camera = path_tracer.camera();
+                if (ImGui::IsMouseDragging(ImGuiMouseButton_Left)) {
+                    camera.yaw -= io.MouseDelta.x * 0.01f;
+                    camera.pitch = std::clamp(camera.pitch + io.MouseDelta.y * 0.01f, -1.5f, 1.5f);
+                }
+                if (io.MouseWheel != 0.0f)
+                    camera.distance = std::clamp(camera.distance * std::pow(0.9f, io.MouseWheel), 0.5f, 50.0f);
+                path_tracer.setCamera(camera);
+            } else {
+                // pan by dragging, zoom with the wheel; the image is shown bottom row first
+                auto &camera = viewport.camera;
+                if (ImGui::IsMouseDragging(ImGuiMouseButton_Left)) {
+                    camera.x -= io.MouseDelta.x * 2.0f / ((float) viewport.width * camera.zoom);
+                    camera.y -= io.MouseDelta.y * 2.0f / ((float) viewport.height * camera.zoom);
+                }
+                if (io.MouseWheel != 0.0f)
+                    camera.zoom = std::clamp(camera.zoom * std::pow(1.1f, io.MouseWheel), 0.25f, 64.0f);
+            }
+        }
+        ImGui::End();
+    }
+
+    void Application::renderViewportStats()
+    {
+        if (ImGui::BeginTable("viewports", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+            ImGui::TableSetupColumn("Viewport");
+            ImGui::TableSetupColumn("State");
+            ImGui::TableSetupColumn("Scale");
+            ImGui::TableSetupColumn("CPU ms");
+            ImGui::TableSetupColumn("GPU ms");
+            ImGui::TableSetupColumn("Drawn / skipped");
+            ImGui::TableHeadersRow();
+            for (auto &viewport: viewports) {
+                if (!viewport.open)
+                    continue;
+                bool drawn = viewport.pass_end != viewport.first_pass;
+                auto &stats = viewport.counters;
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("%s", viewport.title.c_str());
+                ImGui::TableNextColumn();
+                ImGui::Text("%s", drawn ? "drawn" : !viewport.visible ? "hidden" : "unchanged");
+                ImGui::TableNextColumn();
+                ImGui::Text("%.0f%%", stats.scale * 100.0f);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", drawn ? stats.cpu_ms : 0.0);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", drawn ? stats.gpu_ms : 0.0);
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu / %llu", (unsigned long long) stats.rendered,
+                            (unsigned long long) (stats.skipped_hidden + stats.skipped_unchanged));
+            }
+            ImGui::EndTable();
+        }
+        if (ImGui::Button("Reset cameras")) {
+            for (auto &viewport: viewports)
+                viewport.camera = ViewportCamera();
+        }
+    }
+
+    void Application::renderGraphControls()
+    {
+        ImGui::Checkbox("Blur and vignette", &app_state.post_effects);
+        ImGui::Checkbox("Show depth", &app_state.show_depth_view);
+
+        auto &stats = render_graph.stats();
+        if (ImGui::BeginTable("graph passes", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+            ImGui::TableSetupColumn("Pass");
+            ImGui::TableSetupColumn("CPU ms");
+            ImGui::TableSetupColumn("GPU ms");
+            ImGui::TableSetupColumn("Live MB");
+            ImGui::TableHeadersRow();
+            for (auto &pass: stats.passes) {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                if (pass.culled)
+                    ImGui::TextDisabled("%s (culled)", pass.name);
+                else
+                    ImGui::Text("%s", pass.name);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", pass.cpu_ms);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", pass.gpu_ms);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", (double) pass.live_bytes / (1024.0 * 1024.0));
+            }
+            ImGui::EndTable();
+        }
+
+        ImGui::Text("Transient textures: %zu on %zu", stats.transient_resources, stats.physical_textures);
+        ImGui::Text("Transient memory: %.1f MB aliased, %.1f MB without", (double) stats.physical_bytes / (1024.0 * 1024.0),
+                    (double) stats.virtual_bytes / (1024.0 * 1024.0));
+        ImGui::Text("Peak: %.1f MB, pooled: %.1f MB", (double) stats.peak_bytes / (1024.0 * 1024.0),
+                    (double) stats.pooled_bytes / (1024.0 * 1024.0));
+        ImGui::Text("Framebuffers: %zu, barriers: %zu", stats.framebuffers, stats.barriers);
+        ImGui::Text("Compile: %.3f ms%s, %llu compiles", stats.compile_ms, stats.cached ? " (cached)" : "",
+                    (unsigned long long) stats.compiles);
+
+        // of the main viewport
+        auto &image = viewports[0].image;
+        GLuint depth_texture = render_graph.texture(viewports[0].depth_view);
+        if (app_state.show_depth_view && depth_texture != 0) {
+            int storage_width, storage_height;
+            render_graph.storageSize(viewports[0].depth_view, storage_width, storage_height);
+            float preview_width = ImGui::GetContentRegionAvail().x;
+            // drawn at the scene's size, which is smaller than the image while scaled
+            ImGui::Image(uiTexture(UiTexture::DepthView, 0),
+                         ImVec2(preview_width, preview_width * (float)image.height / (float)std::max(image.width, 1)),
+                         ImVec2(0, 0), ImVec2((float)viewports[0].render_width / (float)storage_width,
+                                              (float)viewports[0].render_height / (float)storage_height));
+        }
+    }
+
+    void Application::drawExportTile(const render::ViewRegion &region, int image_width, int image_height)
     {
-        // 1st attribute buffer : vertices
-        glViewport(0, 0, image_data.width, image_data.height);
-        glBindFramebuffer(GL_FRAMEBUFFER, image_data.framebuffer);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        GLuint objects = shader_manager.program(objects_program);
+        if (!render_queue.supported() || objects == 0)
+            return;
+        demo_scene.submit(render_queue, objects, (float) image_width / (float) image_height, region);
+        render_queue.flush();
+    }
 
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, rendering_context.vertex_buffer);
-        glVertexAttribPointer(
-                0,                // attribute 0. No particular reason for 0, but must match the layout in the shader.
-                3,                // size
-                GL_FLOAT,         // type
-                GL_FALSE,         // normalized?
-                0,                // stride
-                (void *) nullptr  // array buffer offset
-        );
+    bool Application::finishExport()
+    {
+        // tiles drawn without their program would stay empty
+        shader_manager.finishLoading();
+        if (!exporter.active() && !exporter.start(config.export_path, config.export_width, config.export_height))
+            return false;
+        auto draw = [this](const render::ViewRegion &region, int image_width, int image_height) {
+            drawExportTile(region, image_width, image_height);
+        };
+        // a strip per update, each in its own stream buffer frame
+        while (exporter.active()) {
+            stream_buffer.beginFrame();
+            exporter.update(draw, exporter.tilesPerStrip(), true);
+            stream_buffer.endFrame();
+        }
+        return !exporter.stats().failed;
+    }
 
-        // Draw the triangle !
-        glUseProgram(rendering_context.shader_program);
-        glDrawArrays(GL_LINE_STRIP, 0, 3); // Starting from vertex 0; 3 vertices total -> 1 triangle
-        glDisableVertexAttribArray(0);
+    void Application::applyGamepads(const InputSnapshot &snapshot)
+    {
+        auto seconds = last_gamepad_ns != 0 ? std::min((float) (snapshot.sampled_ns - last_gamepad_ns) / 1e9f, 0.1f)
+                                            : 0.0f;
+        last_gamepad_ns = snapshot.sampled_ns;
+
+        auto pad = std::find_if(std::begin(snapshot.gamepads), std::end(snapshot.gamepads),
+                                [](const GamepadState &gamepad) { return gamepad.connected(); });
+        if (pad == std::end(snapshot.gamepads) || app_state.renderer != ViewportRenderer::Raster)
+            return;
+
+        auto deadzone = [](float value) {
+            return std::abs(value) > InputSystem::stickDeadzone ? value : 0.0f;
+        };
+        auto x = deadzone(pad->axes[SDL_CONTROLLER_AXIS_LEFTX]);
+        auto y = deadzone(pad->axes[SDL_CONTROLLER_AXIS_LEFTY]);
+        auto zoom = pad->axes[SDL_CONTROLLER_AXIS_TRIGGERRIGHT] - pad->axes[SDL_CONTROLLER_AXIS_TRIGGERLEFT];
+        zoom = deadzone(zoom);
+        if (x == 0.0f && y == 0.0f && zoom == 0.0f)
+            return;
+
+        // the image is shown bottom row first, down on the screen is +y in the scene
+        auto &camera = viewports[0].camera;
+        camera.x += x * seconds * 1.5f / camera.zoom;
+        camera.y += y * seconds * 1.5f / camera.zoom;
+        camera.zoom = std::clamp(camera.zoom * std::pow(4.0f, zoom * seconds), 0.25f, 64.0f);
+        // a held stick needs frames, no events arrive while it doesn't move
+        frame_scheduler.requestAnimation();
     }
 
-    void Application::render() {
-        if(app_state.resize_queued)
-            updateTexture();
+    void Application::updateScene()
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto seconds = std::min(std::chrono::duration<float>(now - last_scene_update).count(), 0.1f);
+        last_scene_update = now;
+
+        // an export in progress needs every tile from the same moment
+        if (render_queue.supported() && shader_manager.program(objects_program) != 0 && app_state.animate_objects
+            && demo_scene.size() > 0 && !exporter.active()) {
+            demo_scene.update(seconds);
+            scene_version++;
+            frame_scheduler.requestAnimation();
+        }
+    }
+
+    uint64_t Application::viewportInputs(const Viewport &viewport) const
+    {
+        GLuint programs[] = {shader_manager.program(objects_program), shader_manager.program(blur_program),
+                             shader_manager.program(vignette_program), rendering_context.shader_program};
+        auto reloads = shader_manager.stats().reloads;
+        bool loading = shader_manager.loading();
+
+        auto hash = hashBytes(&scene_version, sizeof(scene_version));
+        hash = hashBytes(&viewport.camera, sizeof(viewport.camera), hash);
+        hash = hashBytes(&viewport.image.texture, sizeof(viewport.image.texture), hash);
+        hash = hashBytes(&viewport.image.width, sizeof(viewport.image.width), hash);
+        hash = hashBytes(&viewport.image.height, sizeof(viewport.image.height), hash);
+        hash = hashBytes(&app_state.post_effects, sizeof(app_state.post_effects), hash);
+        hash = hashBytes(&app_state.msaa_samples, sizeof(app_state.msaa_samples), hash);
+        auto scale = viewport.resolution.scale();
+        hash = hashBytes(&scale, sizeof(scale), hash);
+        hash = hashBytes(&app_state.upscale_sharpness, sizeof(app_state.upscale_sharpness), hash);
+        hash = hashBytes(programs, sizeof(programs), hash);
+        hash = hashBytes(&reloads, sizeof(reloads), hash);
+        hash = hashBytes(&loading, sizeof(loading), hash);
+        return hash != 0 ? hash : 1;
+    }
+
+    void Application::addViewports()
+    {
+        for (int i = 0; i < maxViewports; i++) {
+            auto &viewport = viewports[i];
+            viewport.resource = render::invalidGraphResource;
+            viewport.depth_view = render::invalidGraphResource;
+            viewport.first_pass = viewport.pass_end = render_graph.passCount();
+            if (!viewport.open) {
+                // a closed viewport gives its memory back
+                if (viewport.image.texture != 0) {
+                    viewport.target.release();
+                    viewport.image = viewport.target.image();
+                    viewport.drawn_inputs = 0;
+                }
+                continue;
+            }
+
+            if (viewport.resize_queued || viewport.image.texture == 0)
+                updateTexture(viewport);
+            viewport.resource = render_graph.importTexture(viewport.title.c_str(), viewport.image.texture,
+                                                           {std::max(viewport.image.width, 1),
+                                                            std::max(viewport.image.height, 1), GL_RGBA8});
+
+            // hidden in a tab, collapsed or empty: whatever it showed last stays in the target
+            if (!viewport.visible || viewport.image.width <= 0 || viewport.image.height <= 0) {
+                viewport.counters.skipped_hidden++;
+                continue;
+            }
+
+            if (i == 0 && app_state.renderer == ViewportRenderer::PathTracer) {
+                path_tracer.setTarget(viewport.image.texture, viewport.image.width, viewport.image.height);
+                path_tracer.update();
+                viewport.drawn_inputs = 0;
+                continue;
+            }
+
+            // the depth view is a transient, it only exists in frames the viewport is drawn
+            auto inputs = viewportInputs(viewport);
+            if (inputs == viewport.drawn_inputs && !(i == 0 && app_state.show_depth_view)) {
+                viewport.counters.skipped_unchanged++;
+                continue;
+            }
+            viewport.drawn_inputs = inputs;
+            viewport.counters.rendered++;
+            addViewportPasses(viewport);
+            viewport.pass_end = render_graph.passCount();
+        }
+    }
+
+    void Application::addViewportPasses(Viewport &viewport)
+    {
+        auto image_width = std::max(viewport.image.width, 1), image_height = std::max(viewport.image.height, 1);
+        // scaled, everything up to the upscale is drawn smaller into storage of the image's size,
+        // so a changing scale never allocates
+        GLuint upscale = shader_manager.program(upscale_variants[0]);
+        // sharpening compiles alongside, should it still be building when it's first turned on it's waited for
+        // rather than the upscale left out
+        if (upscale != 0 && app_state.upscale_sharpness > 0.0f) {
+            if (GLuint sharpened = shader_manager.acquire(upscale_variants[1]))
+                upscale = sharpened;
+        }
+        bool scaled = upscale != 0 && viewport.resolution.scale() < 1.0f;
+        auto width = scaled ? viewport.resolution.scaled(image_width) : image_width;
+        auto height = scaled ? viewport.resolution.scaled(image_height) : image_height;
+        viewport.render_width = width;
+        viewport.render_height = height;
+        viewport.counters.scale = (float) width / (float) image_width;
+        auto desc = [&](GLenum format, int samples = 1) {
+            return render::GraphTextureDesc{width, height, format, samples, image_width, image_height};
+        };
+        auto depth = render_graph.createTexture("scene depth", desc(GL_DEPTH_COMPONENT24));
+
+        // effects whose program is still loading are left out of the chain
+        struct PostEffect {
+            const char *name;
+            const char *output;
+            GLuint program;
+            float direction_x, direction_y;
+        };
+        std::array<PostEffect, 3> effects;
+        size_t effect_count = 0;
+        if (app_state.post_effects) {
+            GLuint blur = shader_manager.program(blur_program);
+            GLuint vignette = shader_manager.program(vignette_program);
+            if (blur != 0) {
+                effects[effect_count++] = {viewport.blur_horizontal_pass.c_str(), "blurred horizontally", blur, 1.0f, 0.0f};
+                effects[effect_count++] = {viewport.blur_vertical_pass.c_str(), "blurred", blur, 0.0f, 1.0f};
+            }
+            if (vignette != 0)
+                effects[effect_count++] = {viewport.vignette_pass.c_str(), "vignette", vignette, 0.0f, 0.0f};
+        }
+
+        auto output = scaled ? render_graph.createTexture("scaled color", desc(GL_RGBA8)) : viewport.resource;
+        auto color = effect_count == 0 ? output : render_graph.createTexture("scene color", desc(GL_RGBA8));
+        auto scene = [this, &viewport](const render::RenderPassContext &) {
+            drawScene(viewport);
+        };
+        if (app_state.msaa_samples > 1) {
+            auto samples = app_state.msaa_samples;
+            auto color_samples = render_graph.createTexture("scene color samples", desc(GL_RGBA8, samples));
+            auto depth_samples = render_graph.createTexture("scene depth samples", desc(GL_DEPTH_COMPONENT24, samples));
+            render_graph.addPass(viewport.scene_pass.c_str(), scene).write(color_samples).write(depth_samples);
+            // the samples are discarded by the graph once resolved, depth only when something looks at it
+            auto resolve = render_graph.addPass(viewport.resolve_pass.c_str(), nullptr);
+            resolve.resolve(color_samples, color);
+            if (&viewport == &viewports[0] && app_state.show_depth_view)
+                resolve.resolve(depth_samples, depth);
+        } else {
+            render_graph.addPass(viewport.scene_pass.c_str(), scene).write(color).write(depth);
+        }
+
+        for (size_t i = 0; i < effect_count; i++) {
+            auto &effect = effects[i];
+            auto target = i + 1 == effect_count ? output : render_graph.createTexture(effect.output, desc(GL_RGBA8));
+            addFullscreenPass(effect.name, effect.program, color, target, effect.direction_x, effect.direction_y);
+            color = target;
+        }
+
+        if (scaled) {
+            // in the arena, a pass that captures two pointers fits into std::function without allocating
+            struct Upscale {
+                GLuint program;
+                render::GraphResource source;
+                int width, height;
+            };
+            auto *pass = frame_arena.create<Upscale>(upscale, output, width, height);
+            render_graph.addPass(viewport.upscale_pass.c_str(), [this, pass](const render::RenderPassContext &context) {
+                render::glstate.useProgram(pass->program);
+                render::glstate.activeTexture(GL_TEXTURE0);
+                render::glstate.bindTexture(GL_TEXTURE_2D, context.texture(pass->source));
+                PassUniforms uniforms{(float) context.width, (float) context.height};
+                uniforms.source_width = (float) pass->width;
+                uniforms.source_height = (float) pass->height;
+                uniforms.sharpness = app_state.upscale_sharpness;
+                bindPassUniforms(uniforms);
+                render::glstate.bindVertexArray(fullscreen_vao);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+            }).read(output).write(viewport.resource);
+        }
+
+        // culled unless the UI shows it
+        GLuint depth_program = shader_manager.program(depth_view_program);
+        if (depth_program != 0) {
+            viewport.depth_view = render_graph.createTexture("depth view", desc(GL_RGBA8));
+            addFullscreenPass(viewport.depth_view_pass.c_str(), depth_program, depth, viewport.depth_view);
+        }
+    }
+
+    void Application::collectViewportStats()
+    {
+        auto &passes = render_graph.stats().passes;
+        for (auto &viewport: viewports) {
+            if (viewport.pass_end == viewport.first_pass)
+                continue;
+            viewport.counters.cpu_ms = viewport.counters.gpu_ms = 0.0;
+            for (auto pass = viewport.first_pass; pass < viewport.pass_end && pass < passes.size(); pass++) {
+                viewport.counters.cpu_ms += passes[pass].cpu_ms;
+                viewport.counters.gpu_ms += passes[pass].gpu_ms;
+            }
+        }
+
+        for (auto &viewport: viewports) {
+            if (!app_state.dynamic_resolution || viewport.pass_end == viewport.first_pass)
+                continue;
+            viewport.resolution.budget_ms = app_state.resolution_budget_ms;
+            viewport.resolution.update(viewport.counters.gpu_ms);
+        }
+
+        // timings of the previous sample count are still coming in for a few frames
+        auto &main = viewports[0];
+        if (msaa_settle_frames > 0) {
+            msaa_settle_frames--;
+        } else if (main.pass_end != main.first_pass && main.counters.gpu_ms > 0.0) {
+            auto &average = msaa_gpu_ms[msaaIndex(app_state.msaa_samples)];
+            average = average > 0.0 ? average * 0.9 + main.counters.gpu_ms * 0.1 : main.counters.gpu_ms;
+        }
+    }
+
+    void Application::addFullscreenPass(const char *name, GLuint program, render::GraphResource source,
+                                        render::GraphResource target, float direction_x, float direction_y)
+    {
+        struct Fullscreen {
+            GLuint program;
+            render::GraphResource source;
+            float direction_x, direction_y;
+        };
+        auto *pass = frame_arena.create<Fullscreen>(program, source, direction_x, direction_y);
+        render_graph.addPass(name, [this, pass](const render::RenderPassContext &context) {
+            render::glstate.useProgram(pass->program);
+            // the source sampler is never set, it stays at unit 0
+            render::glstate.activeTexture(GL_TEXTURE0);
+            render::glstate.bindTexture(GL_TEXTURE_2D, context.texture(pass->source));
+            PassUniforms uniforms{(float) context.width, (float) context.height};
+            uniforms.direction_x = pass->direction_x;
+            uniforms.direction_y = pass->direction_y;
+            bindPassUniforms(uniforms);
+            // left bound, the next pass of the chain binds the same vertex array and unit
+            render::glstate.bindVertexArray(fullscreen_vao);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }).read(source).write(target);
+    }
+
+    void Application::bindPassUniforms(const PassUniforms &uniforms)
+    {
+        // known once the first program declaring it was built, before that no pass uses it. Members are
+        // written where reflection found them, fullscreenPassBlock can change without touching this.
+        auto *block = shader_manager.uniformBlock("FullscreenPass");
+        if (block == nullptr)
+            return;
+        auto allocation = stream_buffer.allocateUniform((size_t) block->size);
+        if (!allocation.valid())
+            return;
+
+        // the memory is write only
+        auto write = [&](const char *member, float x, float y) {
+            auto offset = block->offset(member);
+            if (offset < 0)
+                return;
+            float values[] = {x, y};
+            std::memcpy((unsigned char *) allocation.data + offset, values, sizeof(values));
+        };
+        write("size", uniforms.width, uniforms.height);
+        write("source_size", uniforms.source_width, uniforms.source_height);
+        write("direction", uniforms.direction_x, uniforms.direction_y);
+        auto sharpness = block->offset("sharpness");
+        if (sharpness >= 0)
+            std::memcpy((unsigned char *) allocation.data + sharpness, &uniforms.sharpness, sizeof(float));
+        stream_buffer.flush();
+        render::glstate.bindBufferRange(GL_UNIFORM_BUFFER, block->binding, allocation.buffer, allocation.offset,
+                                        allocation.size);
+    }
+
+    void Application::drawScene(const Viewport &viewport)
+    {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        GLuint objects = shader_manager.program(objects_program);
+        if (render_queue.supported() && objects != 0) {
+            demo_scene.submit(render_queue, objects,
+                              (float) viewport.image.width / (float) std::max(viewport.image.height, 1),
+                              viewport.camera.region());
+            render_queue.flush();
+            return;
+        }
+
+        // without the queue: the test triangle, unless the queue's program is still on its way
+        if (rendering_context.shader_program == 0 || (render_queue.supported() && shader_manager.loading()))
+            return;
+        render::glstate.bindVertexArray(rendering_context.VertexArrayID);
+        render::glstate.useProgram(rendering_context.shader_program);
+        glDrawArrays(GL_LINE_STRIP, 0, 3);
+    }
 
-        renderGL();
-        renderGUI();
+    void Application::renderGL()
+    {
+        CARNIVAL_PROFILE_GPU_SCOPE("renderGL");
+        updateScene();
+        render_graph.reset();
+        frame_arena.reset();
+        addViewports();
+        render_graph.compile();
+        render_graph.execute();
+        collectViewportStats();
+    }
+
+    void Application::startRenderThread() {
+        // the backend makes its objects in its first new frame, afterwards only the render thread has the context
+        ImGui_ImplOpenGL3_NewFrame();
+        SDL_GL_MakeCurrent(rendering_context.window_handle, nullptr);
+        frame_loop.setThreaded(true);
+        render_thread.start({
+                [this]() { SDL_GL_MakeCurrent(rendering_context.window_handle, rendering_context.gl_context); },
+                [this](FrameCommands &frame) { submitFrame(frame); },
+                [this]() { SDL_GL_MakeCurrent(rendering_context.window_handle, nullptr); },
+        });
+        CARNIVAL_LOG_INFO("Rendering on its own thread");
+    }
+
+    void Application::stopRenderThread() {
+        if (!threaded())
+            return;
+        render_thread.stop();
+        // shutting down deletes GL objects from here
+        SDL_GL_MakeCurrent(rendering_context.window_handle, rendering_context.gl_context);
+    }
+
+    void Application::onRenderThread(std::function<void()> action) {
+        if (threaded())
+            deferred_actions.push_back(std::move(action));
+        else
+            action();
+    }
 
-        auto io = ImGui::GetIO();
+    void Application::render() {
+        AllocationScope allocations;
+        FrameTiming timing;
+        timing.build_start = InputSystem::now();
+        prepareFrame();
+
+        // as late as possible before the viewports are drawn with it
+        auto &snapshot = input.sample();
+        auto input_sequence = snapshot.sequence;
+        applyGamepads(snapshot);
+        updateScene();
+
+        drawFrame(nullptr);
+        timing.build_end = timing.submit_start = gui_built_ns;
+        timing.submit_end = InputSystem::now();
+
+        auto &io = ImGui::GetIO();
         if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable)
         {
+            CARNIVAL_PROFILE_GPU_SCOPE("platform windows");
             SDL_Window* backup_current_window = SDL_GL_GetCurrentWindow();
             SDL_GLContext backup_current_context = SDL_GL_GetCurrentContext();
             ImGui::UpdatePlatformWindows();
+            // viewport windows dragged out of the main window show targets by handle as well
+            auto &platform_io = ImGui::GetPlatformIO();
+            for (int i = 1; i < platform_io.Viewports.Size; i++) {
+                if (platform_io.Viewports[i]->DrawData != nullptr)
+                    render::remapTextures(platform_io.Viewports[i]->DrawData, [this](ImTextureID texture) {
+                        return resolveUiTexture(texture);
+                    });
+            }
             ImGui::RenderPlatformWindowsDefault();
             SDL_GL_MakeCurrent(backup_current_window, backup_current_context);
+            render::glstate.invalidate();
         }
 
-        SDL_GL_SwapWindow(rendering_context.window_handle);
+        present(input_sequence);
+        timing.present = InputSystem::now();
+        frame_loop.record(timing);
 
+        if (!startup_reported)
+            trackStartup();
 
     }
 
+    void Application::buildFrame() {
+        AllocationScope allocations;
+        auto frame = render_thread.acquire();
+        {
+            std::lock_guard lock(frame_mutex);
+            frame->timing = FrameTiming();
+            frame->timing.build_start = InputSystem::now();
+
+            auto &snapshot = input.sample();
+            frame->input_sequence = snapshot.sequence;
+            applyGamepads(snapshot);
+            updateScene();
+            renderGUI();
+            frame->gui.copy(ImGui::GetDrawData());
+        }
+        // the render thread hands the vector back empty, so swapping keeps both allocations
+        frame->actions.swap(deferred_actions);
+        frame->timing.build_end = InputSystem::now();
+        render_thread.submit(std::move(frame));
+    }
 
-}
\ No newline at end of file
+    void Application::submitFrame(FrameCommands &frame) {
+        auto &timing = frame.timing;
+        {
+            std::lock_guard lock(frame_mutex);
+            timing.submit_start = InputSystem::now();
+            CARNIVAL_PROFILE_BEGIN_FRAME();
+            AllocationScope allocations;
+            for (auto &action: frame.actions)
+                action();
+            prepareFrame();
+            drawFrame(&frame.gui);
+            timing.submit_end = InputSystem::now();
+        }
+
+        // the main thread builds the next frame meanwhile
+        present(frame.input_sequence);
+        timing.present = InputSystem::now();
+        frame_loop.record(timing);
+
+        std::lock_guard lock(frame_mutex);
+        CARNIVAL_PROFILE_END_FRAME();
+        if (!startup_reported)
+            trackStartup();
+        // a main loop that went to sleep without work in sight has to be woken for it
+        bool pending = renderWorkPending();
+        if (render_work_pending.exchange(pending, std::memory_order_relaxed) != pending && pending)
+            frame_scheduler.wake();
+    }
+
+    void Application::prepareFrame() {
+        stream_buffer.beginFrame();
+        texture_loader.update();
+        shader_manager.update();
+        rendering_context.shader_program = shader_manager.program(scene_program);
+    }
+
+    void Application::drawFrame(render::ImGuiDrawCopy *gui) {
+        render_graph.reset();
+        frame_arena.reset();
+        addViewports();
+
+        int drawable_width, drawable_height;
+        SDL_GL_GetDrawableSize(rendering_context.window_handle, &drawable_width, &drawable_height);
+        auto backbuffer = render_graph.importBackbuffer("backbuffer", drawable_width, drawable_height);
+        auto pass = render_graph.addPass("ImGui", [this, gui](const render::RenderPassContext &) {
+            auto *draw_data = gui != nullptr ? gui->data() : ImGui::GetDrawData();
+            if (draw_data != nullptr)
+                drawGUI(draw_data);
+        });
+        pass.write(backbuffer);
+        for (auto &viewport: viewports) {
+            if (viewport.resource != render::invalidGraphResource)
+                pass.read(viewport.resource);
+        }
+        if (app_state.show_depth_view && viewports[0].depth_view != render::invalidGraphResource)
+            pass.read(viewports[0].depth_view);
+
+        // the UI sizes the depth view by its storage, so it is built once that is known and drawn by the graph
+        render_graph.compile();
+        if (gui == nullptr) {
+            renderGUI();
+            gui_built_ns = InputSystem::now();
+        }
+        render_graph.execute();
+        collectViewportStats();
+
+        frame_recorder.capture(viewports[0].image.framebuffer, viewports[0].image.width, viewports[0].image.height);
+        if (exporter.active() && !shader_manager.loading()) {
+            // a couple of tiles per frame keeps the UI responsive
+            exporter.update([this](const render::ViewRegion &region, int image_width, int image_height) {
+                drawExportTile(region, image_width, image_height);
+            }, 2);
+        }
+        stream_buffer.endFrame();
+        render::glstate.endFrame();
+    }
+
+    void Application::present(uint64_t input_sequence) {
+        {
+            CARNIVAL_PROFILE_SCOPE("SDL_GL_SwapWindow");
+            SDL_GL_SwapWindow(rendering_context.window_handle);
+        }
+        if (input.isMeasuring()) {
+            // swap only queues the frame, it's on its way to the screen once the GPU is done with it
+            glFinish();
+            input.presented(input_sequence);
+        }
+    }
+}
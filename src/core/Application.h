@@ -1,14 +1,90 @@
 #ifndef CARNIVAL_APPLICATION_H
 #define CARNIVAL_APPLICATION_H
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <vector>
 #include <SDL2/SDL.h>
 #include "glad/glad.h"
 #include "imgui.h"
+#include "../render/DemoScene.h"
+#include "../render/FrameRecorder.h"
+#include "../render/ImGuiRenderer.h"
+#include "../render/PathTracer.h"
+#include "../render/RenderGraph.h"
+#include "../render/RenderQueue.h"
+#include "../render/RenderTarget.h"
+#include "../render/ShaderManager.h"
+#include "../render/StreamBuffer.h"
+#include "../render/TextureLoader.h"
+#include "../render/TiledExporter.h"
+#include "AssetPack.h"
+#include "DynamicResolution.h"
+#include "InputSystem.h"
+#include "Memory.h"
+#include "RenderThread.h"
+#include "ThreadPool.h"
+#include "HeadlessContext.h"
+#include "FrameScheduler.h"
 
 namespace carnival::core {
     const int defWindowWidth = 1280,
             defWindowHeight = 720;
+    // per frame in flight, grows when a frame needs more
+    const size_t streamRegionBytes = 4 * 1024 * 1024;
+    const int maxViewports = 4;
+
+    struct ApplicationConfig {
+        // no window, no ImGui: an EGL context rendering into the viewport framebuffer only
+        bool headless = false;
+        int width = defWindowWidth;
+        int height = defWindowHeight;
+        // start with the CPU path tracer in the viewport instead of the GL renderer
+        bool path_tracer = false;
+        // shapes the raster viewport draws through the render queue
+        size_t objects = 1000;
+        // false draws every indirect command on its own
+        bool multi_draw = true;
+        // records the viewport from the first frame on, the format follows the extension
+        std::filesystem::path record_path;
+        // renders a still of export_width x export_height in tiles: in the background of a windowed run,
+        // in finishExport() when headless
+        std::filesystem::path export_path;
+        int export_width = 16384;
+        int export_height = 16384;
+        // blur and vignette passes between the scene and the viewport
+        bool post_effects = false;
+        // open viewports, all of them drawn in a headless run
+        int viewports = 1;
+        // of the viewports' scene pass, 1 renders straight into the target
+        int msaa_samples = 4;
+        // lowers the viewports' render scale to keep each one's GPU time under the budget
+        bool dynamic_resolution = false;
+        double resolution_budget_ms = 8.0;
+        // follows input events to the present, logged on exit
+        bool measure_input_latency = false;
+        // windowed only: events and the UI on the main thread, GL and the swap on a render thread
+        bool render_thread = false;
+        // shaders and images come out of this pack where it has them, the loose files under src/ otherwise
+        std::filesystem::path pack_path;
+        // logs every frame of the loop that allocates from the heap once it has settled
+        bool check_allocations = false;
+        // false issues every GL state change, to compare against the state cache
+        bool gl_state_cache = true;
+        // checks every change the state cache leaves out against glGet*, slow
+        bool validate_gl_state = false;
+    };
+
+    struct FrameTimings {
+        std::vector<double> cpu_ms;
+        std::vector<double> gpu_ms; // empty without timer queries
+        double wall_ms = 0.0;
+    };
 
     struct RenderingContext {
         SDL_Window *window_handle = nullptr;
@@ -19,52 +95,240 @@ namespace carnival::core {
         GLuint VertexArrayID = 0;
     };
 
-    struct InputContext {
-        SDL_GameController *controller = nullptr;
-        SDL_Joystick *joystick = nullptr;
+    using render::ImageData;
+
+    // Render targets the UI shows, by a handle that is only swapped for the texture when the UI is drawn,
+    // so the UI can be built while the targets are resized.
+    enum class UiTexture {
+        Viewport,
+        DepthView
+    };
+
+    enum class ViewportRenderer {
+        Raster,     // renderGL()
+        PathTracer  // CPU, see render::PathTracer
     };
 
-    struct ImageData {
-        GLuint texture = 0;
-        GLuint framebuffer = 0;
-        GLuint depthbuffer = 0;
-        int width = 0;
-        int height = 0;
+    // Pan and zoom over the demo scene's clip space.
+    struct ViewportCamera {
+        float x = 0.0f;
+        float y = 0.0f;
+        float zoom = 1.0f;
+
+        render::ViewRegion region() const {
+            return {x - 1.0f / zoom, y - 1.0f / zoom, x + 1.0f / zoom, y + 1.0f / zoom};
+        }
+    };
+
+    struct ViewportStats {
+        uint64_t rendered = 0;
+        uint64_t skipped_hidden = 0;
+        uint64_t skipped_unchanged = 0;
+        double cpu_ms = 0.0;    // of its passes, the last time it was drawn
+        double gpu_ms = 0.0;
+        float scale = 1.0f;     // it was rendered at, before the upscale
+    };
+
+    // One view of the scene with its own camera and target, programs, meshes and textures are shared.
+    // A viewport is only drawn while it is visible and something it shows has changed.
+    struct Viewport {
+        std::string title;          // also the ImGui window
+        bool open = false;
+        // as of the last UI frame: in a selected tab, not collapsed, not empty
+        bool visible = true;
+        int width = 256;            // what the UI asks for
+        int height = 256;
+        bool resize_queued = false;
+        ViewportCamera camera;
+        render::ViewportTarget target;
+        ImageData image;
+        uint64_t drawn_inputs = 0;  // hash of what the image shows, 0 before it was drawn
+        render::GraphResource resource = render::invalidGraphResource;
+        render::GraphResource depth_view = render::invalidGraphResource;
+        DynamicResolution resolution;
+        int render_width = 0;       // the scene was drawn at, the image's size unless scaled
+        int render_height = 0;
+        size_t first_pass = 0;      // its passes in this frame's graph
+        size_t pass_end = 0;
+        // GPU times are matched to passes by name, every viewport needs names of its own
+        std::string scene_pass, resolve_pass, blur_horizontal_pass, blur_vertical_pass, vignette_pass, upscale_pass,
+                depth_view_pass;
+        ViewportStats counters;
     };
 
     struct ApplicationState {
-        int viewport_width = 256;
-        int viewport_height = 256;
         bool running = true;
-        bool resize_queued = false;
         int window_height = defWindowHeight;
         int window_width = defWindowWidth;
-        bool secondOpen = true;
+        ViewportRenderer renderer = ViewportRenderer::Raster;
+        bool animate_objects = true;
+        bool stream_imgui = true;   // render::ImGuiRenderer instead of imgui_impl_opengl3
+        int record_format = 0;      // render::RecordingFormat of the next recording started from the UI
+        int export_width = 16384;
+        int export_height = 16384;
+        int export_tile_size = 512;
+        int export_format = 0;      // render::ExportFormat
+        bool post_effects = false;
+        bool show_depth_view = false;
+        int msaa_samples = 4;
+        bool dynamic_resolution = false;
+        float resolution_budget_ms = 8.0f;
+        float upscale_sharpness = 0.25f;    // 0 is plain bilinear
+        int swap_interval = 1;      // the context's may only be asked on the render thread
     };
 
     class Application {
     public:
-        Application();
+        explicit Application(const ApplicationConfig &config = ApplicationConfig());
         ~Application();
         void Run();
+        FrameTimings RunHeadless(int frames, int warmup_frames = 0);
         void setupTriangle();
         void setupImage();
+        const render::RenderQueueStats &renderQueueStats() const { return render_queue.stats(); }
+        const render::StreamBufferStats &streamBufferStats() const { return stream_buffer.stats(); }
+        render::FrameRecorderStats frameRecorderStats() const { return frame_recorder.stats(); }
+        // waits for the writer, the stats are final afterwards
+        void stopRecording() { frame_recorder.stop(); }
+        // renders the export from the config to the end, blocking; false if it failed
+        bool finishExport();
+        render::ExportStats exportStats() const { return exporter.stats(); }
+        const render::RenderGraphStats &renderGraphStats() const { return render_graph.stats(); }
+        const ViewportStats &viewportStats(int index) const { return viewports[index].counters; }
+        // GPU ms of the main viewport per sample count (1, 2, 4, 8), 0 if never measured
+        double msaaGpuMs(int samples) const;
+        const DynamicResolutionStats &resolutionStats(int index) const { return viewports[index].resolution.stats(); }
     private:
+        ApplicationConfig config;
+        HeadlessContext headless_context;
         RenderingContext rendering_context;
-        InputContext input_context;
+        InputSystem input;
+        int64_t last_gamepad_ns = 0;
         ApplicationState app_state;
-        ImageData image_data;
+        // the first one is the main viewport: never closed, recorded, shows the path tracer
+        std::array<Viewport, maxViewports> viewports;
+        // ImGui's allocations, outlives the context
+        PoolAllocator ui_pool;
+        // per frame data of the render graph's passes, reset with the graph
+        FrameArena frame_arena;
+        // before the pool, its jobs read from it
+        AssetPack asset_pack;
+        // before the pool, finishing jobs may still wake it
+        FrameScheduler frame_scheduler;
+        ThreadPool thread_pool;
+        render::TextureLoader texture_loader{thread_pool};
+        render::TextureHandle preview_image = render::invalidTexture;
+        render::ShaderManager shader_manager{thread_pool, std::filesystem::current_path() / ".carnival-cache" / "programs"};
+        render::ProgramHandle scene_program = 0;
+        render::PathTracer path_tracer;
+        render::StreamBuffer stream_buffer;
+        render::ImGuiRenderer imgui_renderer;
+        render::RenderQueue render_queue;
+        render::DemoScene demo_scene;
+        render::ProgramHandle objects_program = 0;
+        render::FrameRecorder frame_recorder;
+        render::TiledExporter exporter;
+        render::RenderGraph render_graph;
+        render::ProgramHandle blur_program = 0;
+        render::ProgramHandle vignette_program = 0;
+        render::ProgramHandle depth_view_program = 0;
+        // without and with SHARPEN
+        std::vector<render::ProgramHandle> upscale_variants;
+        GLuint fullscreen_vao = 0;
+        std::chrono::steady_clock::time_point last_scene_update = std::chrono::steady_clock::now();
+        // bumped whenever the scene changes, part of every viewport's inputs
+        uint64_t scene_version = 0;
+        // index log2(samples); GPU times arrive a few frames late, so a new setting is measured once they caught up
+        std::array<double, 4> msaa_gpu_ms{};
+        int msaa_settle_frames = 0;
+        bool startup_reported = false;
+        // threaded mode: held by the main thread while it builds a frame and by the render thread while it
+        // draws one, the swap runs without it
+        std::mutex frame_mutex;
+        RenderThread render_thread;
+        FrameLoopMonitor frame_loop;
+        // GL work asked for while building a frame, see onRenderThread()
+        std::vector<std::function<void()>> deferred_actions;
+        // threaded mode: what renderWorkPending() said after the last frame
+        std::atomic<bool> render_work_pending{false};
+        int64_t gui_built_ns = 0;
 
         void InitSDL();
+        void InitHeadless();
         void InitWindow();
         void InitOpenGl();
-        void InitImGui() const;
+        void InitImGui();
         void HandleEvents();
+        bool hasPendingWork() const;
+        // on the thread that draws
+        bool renderWorkPending() const;
+        // startup milestones, after a frame was presented
+        void trackStartup();
+        bool threaded() const { return render_thread.running(); }
+        void startRenderThread();
+        void stopRenderThread();
+        // GL work the UI asks for: runs right away, or on the render thread before the frame being built
+        void onRenderThread(std::function<void()> action);
+        // single-threaded: a whole frame
         void render();
+        // threaded mode, main thread: input and UI into a frame for the render thread
+        void buildFrame();
+        // render thread: draws and presents what buildFrame() queued
+        void submitFrame(FrameCommands &frame);
+        // updates everything drawing depends on
+        void prepareFrame();
+        // the viewports and the UI, up to the swap; builds the UI itself without a copy of it
+        void drawFrame(render::ImGuiDrawCopy *gui);
+        void present(uint64_t input_sequence);
         void setupGUI(ImGuiID dockID);
         void renderGUI();
+        void renderProfiler();
+        void renderFramePacing();
+        void renderFrameLoopStats();
+        void renderMemoryStats();
+        void renderGLStateStats();
+        void renderPathTracerControls();
+        void renderQueueControls();
+        void renderInputControls();
+        void renderRecordingControls();
+        void renderExportControls();
+        void renderViewportWindow(Viewport &viewport, const ImGuiWindowClass &window_class, bool main);
+        void renderViewportStats();
+        void renderMsaaControls();
+        void renderResolutionControls();
+        void renderGraphControls();
+        void drawExportTile(const render::ViewRegion &region, int image_width, int image_height);
+        void setRenderer(ViewportRenderer renderer);
+        // animates the scene once per frame, however many viewports show it
+        void updateScene();
+        // the first pad pans and zooms the main viewport
+        void applyGamepads(const InputSnapshot &snapshot);
+        uint64_t viewportInputs(const Viewport &viewport) const;
+        // imports every open viewport and adds passes for those that have to be drawn
+        void addViewports();
+        // the scene and the post effects into the viewport
+        void addViewportPasses(Viewport &viewport);
+        // also feeds the GPU times to the resolution controllers
+        void collectViewportStats();
+        void addFullscreenPass(const char *name, GLuint program, render::GraphResource source,
+                               render::GraphResource target, float direction_x = 0.0f, float direction_y = 0.0f);
+        // the FullscreenPass uniform block of the shaders
+        struct PassUniforms {
+            float width, height;
+            float source_width = 0.0f, source_height = 0.0f;
+            float direction_x = 0.0f, direction_y = 0.0f;
+            float sharpness = 0.0f;
+        };
+        // from the stream buffer, for the next draw
+        void bindPassUniforms(const PassUniforms &uniforms);
+        void drawScene(const Viewport &viewport);
+        // the UI built by renderGUI() into the default framebuffer
+        void drawGUI(ImDrawData *draw_data);
+        static ImTextureID uiTexture(UiTexture kind, int index);
+        // the texture behind a uiTexture() handle, anything else unchanged
+        ImTextureID resolveUiTexture(ImTextureID texture) const;
         void renderGL();
-        void updateTexture();
+        void updateTexture(Viewport &viewport);
     };
 
 }
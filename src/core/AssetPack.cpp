@@ -0,0 +1,297 @@
+#include "AssetPack.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include "Log.h"
+#include "Lz4.h"
+#include "../common/hash.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace carnival::core {
+
+    static const char packMagic[4] = {'C', 'P', 'A', 'K'};
+    static const uint32_t packVersion = 1;
+
+    static_assert(sizeof(AssetPackHeader) == 32, "the header is written as it is");
+    static_assert(sizeof(AssetPackEntry) == 48, "index entries are written as they are");
+
+    static size_t alignUp(size_t value, size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    void AssetPackWriter::add(std::string name, std::vector<unsigned char> data, bool compress) {
+        Asset asset;
+        asset.hash = hashString(name);
+        asset.name = std::move(name);
+        asset.size = data.size();
+        asset.payload = std::move(data);
+        if (compress && !asset.payload.empty()) {
+            auto compressed = lz4Compress(asset.payload.data(), asset.payload.size());
+            if (compressed.size() <= asset.payload.size() - asset.payload.size() / 8) {
+                asset.payload = std::move(compressed);
+                asset.compression = PackCompression::Lz4;
+            }
+        }
+        total_bytes += asset.size;
+        stored_bytes += asset.payload.size();
+        assets.push_back(std::move(asset));
+    }
+
+    bool AssetPackWriter::write(const std::filesystem::path &path) const {
+        std::vector<const Asset *> sorted;
+        for (auto &asset: assets)
+            sorted.push_back(&asset);
+        std::sort(sorted.begin(), sorted.end(), [](const Asset *a, const Asset *b) {
+            return a->hash != b->hash ? a->hash < b->hash : a->name < b->name;
+        });
+
+        AssetPackHeader header = {};
+        std::copy(packMagic, packMagic + 4, header.magic);
+        header.version = packVersion;
+        header.entry_count = (uint32_t) sorted.size();
+        header.index_offset = sizeof(AssetPackHeader);
+        header.names_offset = header.index_offset + sizeof(AssetPackEntry) * sorted.size();
+
+        std::string names;
+        std::vector<AssetPackEntry> index(sorted.size());
+        for (size_t i = 0; i < sorted.size(); i++) {
+            auto &entry = index[i];
+            entry = {};
+            entry.hash = sorted[i]->hash;
+            entry.size = sorted[i]->size;
+            entry.stored_size = sorted[i]->payload.size();
+            entry.compression = sorted[i]->compression;
+            entry.name_offset = (uint32_t) names.size();
+            entry.name_length = (uint32_t) sorted[i]->name.size();
+            names += sorted[i]->name;
+        }
+
+        size_t offset = header.names_offset + names.size();
+        for (auto &entry: index) {
+            offset = alignUp(offset, packAlignment);
+            entry.offset = offset;
+            offset += entry.stored_size;
+        }
+
+        auto temporary = path;
+        temporary += ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+            file.write((const char *) &header, sizeof(header));
+            file.write((const char *) index.data(), (std::streamsize) (index.size() * sizeof(AssetPackEntry)));
+            file.write(names.data(), (std::streamsize) names.size());
+
+            size_t position = header.names_offset + names.size();
+            const char padding[packAlignment] = {};
+            for (size_t i = 0; i < sorted.size(); i++) {
+                file.write(padding, (std::streamsize) (index[i].offset - position));
+                file.write((const char *) sorted[i]->payload.data(), (std::streamsize) sorted[i]->payload.size());
+                position = index[i].offset + index[i].stored_size;
+            }
+            if (!file) {
+                CARNIVAL_LOG_ERROR("Failed to write {}", temporary);
+                return false;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+        if (error) {
+            CARNIVAL_LOG_ERROR("Can't replace {}: {}", path, error.message());
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+        return true;
+    }
+
+    AssetPack::~AssetPack() {
+        close();
+    }
+
+    bool AssetPack::open(const std::filesystem::path &path, std::filesystem::path loose_root) {
+        close();
+        auto start = std::chrono::steady_clock::now();
+
+#ifdef _WIN32
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            CARNIVAL_LOG_ERROR("Can't open asset pack {}", path);
+            return false;
+        }
+        LARGE_INTEGER file_size = {};
+        GetFileSizeEx(file, &file_size);
+        HANDLE file_mapping = file_size.QuadPart > 0
+                              ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        CloseHandle(file);
+        // the view keeps the mapping alive
+        void *view = file_mapping != nullptr ? MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (file_mapping != nullptr)
+            CloseHandle(file_mapping);
+        if (view == nullptr) {
+            CARNIVAL_LOG_ERROR("Can't map asset pack {}", path);
+            return false;
+        }
+        mapping = (const unsigned char *) view;
+        mapping_size = (size_t) file_size.QuadPart;
+#else
+        int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file < 0) {
+            CARNIVAL_LOG_ERROR("Can't open asset pack {}", path);
+            return false;
+        }
+        struct stat info = {};
+        void *view = MAP_FAILED;
+        if (fstat(file, &info) == 0 && info.st_size > 0)
+            view = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        // the mapping keeps the file alive
+        ::close(file);
+        if (view == MAP_FAILED) {
+            CARNIVAL_LOG_ERROR("Can't map asset pack {}", path);
+            return false;
+        }
+        mapping = (const unsigned char *) view;
+        mapping_size = (size_t) info.st_size;
+#endif
+
+        pack_path = path;
+        root = loose_root.empty() ? loose_root : std::filesystem::absolute(loose_root).lexically_normal();
+        if (!validate()) {
+            CARNIVAL_LOG_ERROR("{} is not an asset pack this version can read", path);
+            close();
+            return false;
+        }
+
+        auto &header = *(const AssetPackHeader *) mapping;
+        index = (const AssetPackEntry *) (mapping + header.index_offset);
+        entry_count = header.entry_count;
+        inflated.resize(entry_count);
+        open_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return true;
+    }
+
+    bool AssetPack::validate() const {
+        if (mapping_size < sizeof(AssetPackHeader))
+            return false;
+        auto &header = *(const AssetPackHeader *) mapping;
+        if (!std::equal(header.magic, header.magic + 4, packMagic) || header.version != packVersion
+            || header.index_offset % alignof(AssetPackEntry) != 0 || header.index_offset > mapping_size
+            || header.names_offset > mapping_size
+            || (mapping_size - header.index_offset) / sizeof(AssetPackEntry) < header.entry_count)
+            return false;
+
+        auto *entries = (const AssetPackEntry *) (mapping + header.index_offset);
+        for (size_t i = 0; i < header.entry_count; i++) {
+            auto &entry = entries[i];
+            bool valid = (i == 0 || entries[i - 1].hash <= entry.hash)
+                         && entry.name_offset + (uint64_t) entry.name_length <= mapping_size - header.names_offset
+                         && entry.offset <= mapping_size && entry.stored_size <= mapping_size - entry.offset
+                         && (entry.compression == PackCompression::Lz4
+                             || (entry.compression == PackCompression::None && entry.stored_size == entry.size));
+            if (!valid)
+                return false;
+        }
+        return true;
+    }
+
+    void AssetPack::close() {
+        if (mapping == nullptr)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(mapping);
+#else
+        munmap((void *) mapping, mapping_size);
+#endif
+        mapping = nullptr;
+        mapping_size = 0;
+        index = nullptr;
+        entry_count = 0;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        inflated.clear();
+        inflated_count = 0;
+        inflated_bytes = 0;
+        inflate_ms = 0.0;
+    }
+
+    AssetSpan AssetPack::find(std::string_view name) {
+        lookups.fetch_add(1, std::memory_order_relaxed);
+        auto hash = hashString(name);
+        auto *end = index + entry_count;
+        auto it = std::lower_bound(index, end, hash, [](const AssetPackEntry &entry, uint64_t value) {
+            return entry.hash < value;
+        });
+        for (; it != end && it->hash == hash; ++it) {
+            if (this->name((size_t) (it - index)) == name)
+                return load((size_t) (it - index));
+        }
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return {};
+    }
+
+    AssetSpan AssetPack::findFile(const std::filesystem::path &file) {
+        if (mapping == nullptr)
+            return {};
+        auto relative = std::filesystem::absolute(file).lexically_normal().lexically_relative(root);
+        if (relative.empty() || *relative.begin() == "..") {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return {};
+        }
+        return find(relative.generic_string());
+    }
+
+    std::string_view AssetPack::name(size_t entry) const {
+        auto &header = *(const AssetPackHeader *) mapping;
+        return {(const char *) mapping + header.names_offset + index[entry].name_offset, index[entry].name_length};
+    }
+
+    AssetSpan AssetPack::load(size_t entry) {
+        auto &info = index[entry];
+        if (info.compression == PackCompression::None)
+            return {mapping + info.offset, (size_t) info.size};
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (inflated[entry] == nullptr) {
+            auto start = std::chrono::steady_clock::now();
+            auto buffer = std::make_unique<std::vector<unsigned char>>((size_t) info.size);
+            if (!lz4Decompress(mapping + info.offset, (size_t) info.stored_size, buffer->data(), buffer->size())) {
+                CARNIVAL_LOG_ERROR("{} in {} is corrupt", name(entry), pack_path);
+                return {};
+            }
+            inflated[entry] = std::move(buffer);
+            inflated_count++;
+            inflated_bytes += info.size;
+            inflate_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        // an empty vector may have no data()
+        static const unsigned char empty = 0;
+        auto &buffer = *inflated[entry];
+        return {buffer.empty() ? &empty : buffer.data(), buffer.size()};
+    }
+
+    AssetPackStats AssetPack::stats() const {
+        AssetPackStats stats;
+        stats.entries = entry_count;
+        stats.file_bytes = mapping_size;
+        stats.open_ms = open_ms;
+        stats.lookups = lookups.load(std::memory_order_relaxed);
+        stats.misses = misses.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.inflated = inflated_count;
+        stats.inflated_bytes = inflated_bytes;
+        stats.inflate_ms = inflate_ms;
+        return stats;
+    }
+}
@@ -0,0 +1,143 @@
+#ifndef CARNIVAL_ASSETPACK_H
+#define CARNIVAL_ASSETPACK_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace carnival::core {
+
+    // A pack file is
+    //   header     AssetPackHeader
+    //   index      an AssetPackEntry per asset, sorted by the FNV-1a hash of the name
+    //   names      '/' separated, relative to the directory the pack was built from
+    //   payloads   each aligned to packAlignment, stored as they are or LZ4 compressed
+    // All integers little endian, like the machines that read it.
+    const size_t packAlignment = 16;
+
+    enum class PackCompression : uint32_t {
+        None,
+        Lz4
+    };
+
+    struct AssetPackHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t entry_count;
+        uint32_t reserved;
+        uint64_t index_offset;
+        uint64_t names_offset;
+    };
+
+    struct AssetPackEntry {
+        uint64_t hash;
+        uint64_t offset;
+        uint64_t stored_size;
+        uint64_t size;
+        uint32_t name_offset;
+        uint32_t name_length;
+        PackCompression compression;
+        uint32_t reserved;
+    };
+
+    // an asset's bytes, owned by the pack
+    struct AssetSpan {
+        const unsigned char *data = nullptr;
+        size_t size = 0;
+
+        explicit operator bool() const { return data != nullptr; }
+        std::string_view text() const { return {(const char *) data, size}; }
+    };
+
+    struct AssetPackStats {
+        size_t entries = 0;
+        uint64_t file_bytes = 0;
+        double open_ms = 0.0;
+        uint64_t lookups = 0;
+        uint64_t misses = 0;
+        uint64_t inflated = 0;          // compressed entries decompressed on first use
+        uint64_t inflated_bytes = 0;
+        double inflate_ms = 0.0;
+    };
+
+    // Builds a pack in memory and writes it in one go.
+    class AssetPackWriter {
+    public:
+        // with compress, kept LZ4 compressed if that saves at least an eighth
+        void add(std::string name, std::vector<unsigned char> data, bool compress);
+        // to a temporary next to path, renamed once complete
+        bool write(const std::filesystem::path &path) const;
+
+        size_t entries() const { return assets.size(); }
+        uint64_t bytes() const { return total_bytes; }
+        uint64_t storedBytes() const { return stored_bytes; }
+
+    private:
+        struct Asset {
+            std::string name;
+            uint64_t hash = 0;
+            uint64_t size = 0;
+            PackCompression compression = PackCompression::None;
+            std::vector<unsigned char> payload;
+        };
+
+        std::vector<Asset> assets;
+        uint64_t total_bytes = 0;
+        uint64_t stored_bytes = 0;
+    };
+
+    // Reads a pack through a read-only memory mapping: opening only checks the index, an asset's pages are
+    // faulted in when it is first read. Stored assets are handed out in place, compressed ones are inflated
+    // into a buffer the pack keeps on first use. find() may be called from any thread.
+    class AssetPack {
+    public:
+        AssetPack() = default;
+        ~AssetPack();
+        AssetPack(const AssetPack &) = delete;
+        AssetPack &operator=(const AssetPack &) = delete;
+
+        // root is where the loose files the pack was built from live, findFile() maps paths below it to names
+        bool open(const std::filesystem::path &path, std::filesystem::path root = {});
+        // invalidates every span handed out
+        void close();
+        bool isOpen() const { return mapping != nullptr; }
+        const std::filesystem::path &path() const { return pack_path; }
+
+        // empty if there is no such asset or it doesn't decompress
+        AssetSpan find(std::string_view name);
+        AssetSpan findFile(const std::filesystem::path &file);
+
+        size_t size() const { return entry_count; }
+        std::string_view name(size_t entry) const;
+        AssetPackStats stats() const;
+
+    private:
+        const unsigned char *mapping = nullptr;
+        size_t mapping_size = 0;
+        const AssetPackEntry *index = nullptr;
+        size_t entry_count = 0;
+        std::filesystem::path pack_path;
+        std::filesystem::path root;
+        double open_ms = 0.0;
+
+        std::atomic<uint64_t> lookups{0};
+        std::atomic<uint64_t> misses{0};
+        mutable std::mutex mutex;
+        // per entry, filled on first use of a compressed one
+        std::vector<std::unique_ptr<std::vector<unsigned char>>> inflated;
+        uint64_t inflated_count = 0;
+        uint64_t inflated_bytes = 0;
+        double inflate_ms = 0.0;
+
+        bool validate() const;
+        AssetSpan load(size_t entry);
+    };
+}
+
+#endif //CARNIVAL_ASSETPACK_H
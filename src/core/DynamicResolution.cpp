@@ -0,0 +1,70 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace carnival::core {
+
+    // weight of the newest frame in the smoothed time
+    static const double resolutionSmoothing = 0.2;
+
+    bool DynamicResolution::update(double gpu_ms) {
+        if (gpu_ms <= 0.0)
+            return false;
+        // still measuring frames drawn at the previous scale
+        if (settling > 0) {
+            settling--;
+            return false;
+        }
+
+        auto &smoothed = counters.gpu_ms;
+        smoothed = smoothed > 0.0 ? smoothed + (gpu_ms - smoothed) * resolutionSmoothing : gpu_ms;
+
+        if (gpu_ms > budget_ms) {
+            counters.frames_over++;
+            frames_over++;
+            frames_under = 0;
+        } else if (gpu_ms < budget_ms * headroom) {
+            frames_under++;
+            frames_over = 0;
+        } else {
+            frames_over = frames_under = 0;
+        }
+
+        auto scale = counters.scale;
+        if (frames_over >= frames_to_lower && scale > min_scale) {
+            // straight to where the budget should be met, at least one step
+            auto target = scale * (float) std::sqrt(budget_ms / smoothed);
+            return setScale(std::min(std::floor(target / step) * step, scale - step));
+        }
+        if (frames_under >= frames_to_raise && scale < max_scale) {
+            // aim below the budget so the next frames don't land right back over it
+            auto target = scale * (float) std::sqrt(budget_ms * headroom / smoothed);
+            return setScale(std::max(std::floor(target / step) * step, scale + step));
+        }
+        return false;
+    }
+
+    bool DynamicResolution::reset() {
+        counters.gpu_ms = 0.0;
+        frames_over = frames_under = 0;
+        return setScale(max_scale);
+    }
+
+    int DynamicResolution::scaled(int size) const {
+        return std::max((int) std::lround((float) size * counters.scale), 1);
+    }
+
+    bool DynamicResolution::setScale(float scale) {
+        scale = std::clamp(scale, min_scale, max_scale);
+        frames_over = frames_under = 0;
+        if (scale == counters.scale)
+            return false;
+
+        counters.scale = scale;
+        counters.gpu_ms = 0.0;
+        counters.scale_changes++;
+        settling = settle_frames;
+        return true;
+    }
+}
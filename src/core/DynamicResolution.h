@@ -0,0 +1,52 @@
+#ifndef CARNIVAL_DYNAMICRESOLUTION_H
+#define CARNIVAL_DYNAMICRESOLUTION_H
+
+#include <cstdint>
+
+namespace carnival::core {
+
+    struct DynamicResolutionStats {
+        float scale = 1.0f;
+        double gpu_ms = 0.0;            // smoothed, of frames drawn at the current scale
+        uint64_t frames_over = 0;       // measured above the budget
+        uint64_t scale_changes = 0;
+    };
+
+    // Picks the scale a viewport is rendered at from its measured GPU time.
+    // The cost follows the pixel count, so a frame that took gpu_ms would take about budget_ms at
+    // scale * sqrt(budget_ms / gpu_ms). The scale drops once a few frames in a row ran over the budget and
+    // only rises after many ran well under it, in steps of 1/16, so noise doesn't make it oscillate.
+    // Timings arrive a few frames late: after a change settle_frames measurements are ignored.
+    class DynamicResolution {
+    public:
+        static constexpr float step = 1.0f / 16.0f;
+
+        // with the GPU time of a frame drawn at scale(), returns true if the scale changed
+        bool update(double gpu_ms);
+        // back to max_scale, e.g. when the controller is turned off
+        bool reset();
+
+        float scale() const { return counters.scale; }
+        // size at the current scale, at least 1
+        int scaled(int size) const;
+        const DynamicResolutionStats &stats() const { return counters; }
+
+        double budget_ms = 8.0;
+        float min_scale = 0.5f;
+        float max_scale = 1.0f;
+        float headroom = 0.75f;         // rises only below budget_ms * headroom
+        int frames_to_lower = 3;
+        int frames_to_raise = 30;
+        int settle_frames = 4;
+
+    private:
+        int frames_over = 0;
+        int frames_under = 0;
+        int settling = 0;
+        DynamicResolutionStats counters;
+
+        bool setScale(float scale);
+    };
+}
+
+#endif //CARNIVAL_DYNAMICRESOLUTION_H
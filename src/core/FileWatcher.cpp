@@ -0,0 +1,126 @@
+#include "FileWatcher.h"
+
+#include "Log.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace carnival::core {
+
+    static std::filesystem::file_time_type lastWriteTime(const std::filesystem::path &file) {
+        std::error_code error;
+        auto time = std::filesystem::last_write_time(file, error);
+        return error ? std::filesystem::file_time_type::min() : time;
+    }
+
+    FileWatcher::FileWatcher(Callback callback) : callback(std::move(callback)) {
+#ifdef __linux__
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd < 0) {
+            CARNIVAL_LOG_ERROR("inotify unavailable, falling back to polling");
+        }
+#endif
+    }
+
+    FileWatcher::~FileWatcher() {
+        stop();
+#ifdef __linux__
+        if (inotify_fd >= 0)
+            close(inotify_fd);
+#endif
+    }
+
+    void FileWatcher::watch(const std::filesystem::path &file) {
+        auto path = std::filesystem::absolute(file).lexically_normal();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        files[path] = lastWriteTime(path);
+
+#ifdef __linux__
+        // watch the directory, editors often replace the file instead of writing it in place
+        if (inotify_fd < 0)
+            return;
+        auto directory = path.parent_path();
+        for (auto &[descriptor, watched]: directories) {
+            if (watched == directory)
+                return;
+        }
+        int descriptor = inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (descriptor >= 0)
+            directories[descriptor] = directory;
+#endif
+    }
+
+    void FileWatcher::start() {
+        if (running.exchange(true))
+            return;
+        thread = std::thread(&FileWatcher::run, this);
+    }
+
+    void FileWatcher::stop() {
+        if (!running.exchange(false))
+            return;
+        thread.join();
+    }
+
+    void FileWatcher::run() {
+        while (running) {
+            std::set<std::filesystem::path> changed;
+
+#ifdef __linux__
+            if (inotify_fd >= 0) {
+                pollfd descriptor = {inotify_fd, POLLIN, 0};
+                // wake up regularly to notice stop()
+                if (poll(&descriptor, 1, 100) <= 0)
+                    continue;
+
+                // keep draining until the burst is over
+                do {
+                    alignas(inotify_event) char buffer[4096];
+                    ssize_t length;
+                    while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+                        for (char *it = buffer; it < buffer + length;) {
+                            auto *event = (inotify_event *) it;
+                            it += sizeof(inotify_event) + event->len;
+                            if (event->len == 0)
+                                continue;
+
+                            std::lock_guard<std::mutex> lock(mutex);
+                            auto directory = directories.find(event->wd);
+                            if (directory == directories.end())
+                                continue;
+                            auto path = directory->second / event->name;
+                            if (files.count(path))
+                                changed.insert(path);
+                        }
+                    }
+                } while (poll(&descriptor, 1, debounce_ms) > 0);
+
+                notify(changed);
+                continue;
+            }
+#endif
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto &[path, time]: files) {
+                    auto current = lastWriteTime(path);
+                    if (current != time) {
+                        time = current;
+                        changed.insert(path);
+                    }
+                }
+            }
+            notify(changed);
+        }
+    }
+
+    void FileWatcher::notify(const std::set<std::filesystem::path> &changed) {
+        for (auto &path: changed)
+            callback(path);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef CARNIVAL_FILEWATCHER_H
+#define CARNIVAL_FILEWATCHER_H
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace carnival::core {
+
+    // Calls back (on its own thread) when one of the watched files was written.
+    // Uses inotify on Linux and polls modification times elsewhere. Bursts of events, like an
+    // editor truncating and then writing a file, are merged into one callback per file.
+    class FileWatcher {
+    public:
+        using Callback = std::function<void(const std::filesystem::path &)>;
+
+        explicit FileWatcher(Callback callback);
+        ~FileWatcher();
+
+        FileWatcher(const FileWatcher &) = delete;
+        FileWatcher &operator=(const FileWatcher &) = delete;
+
+        void watch(const std::filesystem::path &file);
+        void start();
+        void stop();
+
+        int debounce_ms = 50;
+
+    private:
+        Callback callback;
+        std::thread thread;
+        std::atomic<bool> running{false};
+
+        std::mutex mutex;
+        std::map<std::filesystem::path, std::filesystem::file_time_type> files;
+#ifdef __linux__
+        int inotify_fd = -1;
+        std::map<int, std::filesystem::path> directories;
+#endif
+
+        void run();
+        void notify(const std::set<std::filesystem::path> &changed);
+    };
+}
+
+#endif //CARNIVAL_FILEWATCHER_H
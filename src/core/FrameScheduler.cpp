@@ -0,0 +1,88 @@
+#include "FrameScheduler.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace carnival::core {
+
+    // weight of the newest frame in the smoothed numbers
+    static const double pacingSmoothing = 0.1;
+
+    static double milliseconds(std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    void FrameScheduler::init() {
+        auto event_type = SDL_RegisterEvents(1);
+        wake_event = event_type != (Uint32) -1 ? event_type : 0;
+        previous_frame_start = Clock::now();
+    }
+
+    void FrameScheduler::wake() {
+        if (wake_event == 0)
+            return;
+
+        SDL_Event event = {};
+        event.type = wake_event;
+        SDL_PushEvent(&event);
+    }
+
+    void FrameScheduler::markDirty(int frames) {
+        dirty_frames = std::max(dirty_frames, frames < 0 ? settle_frames : frames);
+    }
+
+    bool FrameScheduler::shouldRender(bool work_pending) const {
+        return mode == SchedulerMode::Continuous || dirty_frames > 0 || animating || work_pending;
+    }
+
+    void FrameScheduler::waitForEvents() {
+        auto start = Clock::now();
+        SDL_WaitEventTimeout(nullptr, idle_timeout_ms);
+        pending_idle_ms += milliseconds(Clock::now() - start);
+        counters.idle_waits++;
+    }
+
+    void FrameScheduler::beginFrame() {
+        frame_start = Clock::now();
+        dirty_frames = std::max(dirty_frames - 1, 0);
+        animating = false;
+    }
+
+    void FrameScheduler::endFrame() {
+        auto render_end = Clock::now();
+        double render_ms = milliseconds(render_end - frame_start);
+
+        if (target_fps > 0) {
+            auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / target_fps));
+            auto deadline = frame_start + period;
+            if (render_end > deadline) {
+                counters.missed_deadlines++;
+            } else {
+                waitUntil(deadline);
+            }
+        }
+
+        auto frame_end = Clock::now();
+        double frame_ms = milliseconds(frame_start - previous_frame_start);
+        previous_frame_start = frame_start;
+
+        counters.render_ms += (render_ms - counters.render_ms) * pacingSmoothing;
+        counters.limiter_ms += (milliseconds(frame_end - render_end) - counters.limiter_ms) * pacingSmoothing;
+        counters.idle_ms += (pending_idle_ms - counters.idle_ms) * pacingSmoothing;
+        counters.frame_ms += (frame_ms - counters.frame_ms) * pacingSmoothing;
+        counters.frame_history[counters.frames % FramePacingStats::historySize] = (float) frame_ms;
+        counters.frames++;
+        pending_idle_ms = 0.0;
+    }
+
+    void FrameScheduler::waitUntil(Clock::time_point deadline) {
+        // the OS scheduler easily oversleeps by a millisecond, so sleep most of the way and spin the rest
+        auto spin = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(spin_ms));
+        auto now = Clock::now();
+        if (deadline - now > spin)
+            std::this_thread::sleep_for(deadline - now - spin);
+
+        while (Clock::now() < deadline)
+            std::this_thread::yield();
+    }
+}
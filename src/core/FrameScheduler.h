@@ -0,0 +1,80 @@
+#ifndef CARNIVAL_FRAMESCHEDULER_H
+#define CARNIVAL_FRAMESCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <SDL2/SDL.h>
+
+namespace carnival::core {
+
+    enum class SchedulerMode {
+        Continuous, // render every iteration, like a game loop
+        OnDemand    // only render when input arrived or work is pending, otherwise sleep in SDL_WaitEventTimeout
+    };
+
+    struct FramePacingStats {
+        static const int historySize = 120;
+
+        double render_ms = 0.0;    // smoothed, beginFrame() to endFrame() without the limiter
+        double limiter_ms = 0.0;   // smoothed time the limiter waited
+        double idle_ms = 0.0;      // smoothed time blocked waiting for events before a frame
+        double frame_ms = 0.0;     // smoothed start to start
+        uint64_t frames = 0;
+        uint64_t idle_waits = 0;
+        uint64_t missed_deadlines = 0;
+        float frame_history[historySize] = {};
+    };
+
+    // Decides when the main loop renders and paces it.
+    // In OnDemand mode frames are rendered only while something is dirty: input arrived (plus a few frames
+    // for ImGui to settle), an animation requested frames, or the caller reports pending work.
+    // Background threads can wake() the loop. target_fps > 0 limits the frame rate with a sleep followed
+    // by a short spin, which is far more precise than sleeping alone.
+    class FrameScheduler {
+    public:
+        // after SDL_Init
+        void init();
+
+        // thread safe, makes a blocked waitForEvents() return
+        void wake();
+        // something changed that needs `frames` more frames to show
+        void markDirty(int frames = -1);
+        // an animation is running, keep rendering until the next check
+        void requestAnimation() { animating = true; }
+
+        bool shouldRender(bool work_pending) const;
+        // blocks until an event arrives (without removing it) or idle_timeout_ms passes
+        void waitForEvents();
+
+        void beginFrame();
+        // runs the frame limiter
+        void endFrame();
+
+        bool isWakeEvent(const SDL_Event &event) const { return wake_event != 0 && event.type == wake_event; }
+        const FramePacingStats &stats() const { return counters; }
+
+        SchedulerMode mode = SchedulerMode::OnDemand;
+        int target_fps = 0;        // 0 = no limiter, only vsync
+        int settle_frames = 3;
+        int idle_timeout_ms = 500;
+        double spin_ms = 1.5;      // the end of each wait is spent spinning instead of sleeping
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        // set by init(), read by wake() on whatever thread finished its work
+        std::atomic<Uint32> wake_event{0};
+        int dirty_frames = 1;
+        bool animating = false;
+
+        Clock::time_point frame_start;
+        Clock::time_point previous_frame_start;
+        double pending_idle_ms = 0.0;
+        FramePacingStats counters;
+
+        void waitUntil(Clock::time_point deadline);
+    };
+}
+
+#endif //CARNIVAL_FRAMESCHEDULER_H
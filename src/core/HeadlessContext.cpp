@@ -0,0 +1,165 @@
+#include "HeadlessContext.h"
+
+#include <cstring>
+#include "Log.h"
+
+#ifdef CARNIVAL_HAS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+namespace carnival::core {
+
+    HeadlessContext::~HeadlessContext() {
+        destroy();
+    }
+
+#ifdef CARNIVAL_HAS_EGL
+
+    static bool hasEGLExtension(EGLDisplay display, const char *name)
+    {
+        const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+        if (extensions == nullptr)
+            return false;
+
+        // the list is space separated, make sure we don't match a prefix of a longer name
+        size_t length = std::strlen(name);
+        for (const char *it = std::strstr(extensions, name); it != nullptr; it = std::strstr(it + 1, name)) {
+            bool start = it == extensions || it[-1] == ' ';
+            bool end = it[length] == ' ' || it[length] == '\0';
+            if (start && end)
+                return true;
+        }
+        return false;
+    }
+
+    bool HeadlessContext::create(int major, int minor) {
+        EGLDisplay egl_display = EGL_NO_DISPLAY;
+
+        auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay != nullptr && hasEGLExtension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless")) {
+            egl_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        }
+        if (egl_display == EGL_NO_DISPLAY) {
+            egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        }
+
+        EGLint egl_major = 0, egl_minor = 0;
+        if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, &egl_major, &egl_minor)) {
+            CARNIVAL_LOG_ERROR("Failed to initialize EGL: 0x{:x}", eglGetError());
+            return false;
+        }
+        display = egl_display;
+
+        CARNIVAL_LOG_INFO("EGL {}.{}, vendor: {}", egl_major, egl_minor, eglQueryString(egl_display, EGL_VENDOR));
+
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            CARNIVAL_LOG_ERROR("EGL has no desktop OpenGL");
+            destroy();
+            return false;
+        }
+
+        const EGLint pbuffer_attributes[] = {
+                EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                EGL_RED_SIZE, 8,
+                EGL_GREEN_SIZE, 8,
+                EGL_BLUE_SIZE, 8,
+                EGL_DEPTH_SIZE, 24,
+                EGL_NONE
+        };
+        // the surfaceless platform may not expose pbuffer configs, we don't render to the surface anyway
+        const EGLint any_attributes[] = {
+                EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                EGL_NONE
+        };
+
+        EGLConfig config = nullptr;
+        EGLint config_count = 0;
+        bool pbuffer_config = eglChooseConfig(egl_display, pbuffer_attributes, &config, 1, &config_count) && config_count > 0;
+        if (!pbuffer_config) {
+            if (!eglChooseConfig(egl_display, any_attributes, &config, 1, &config_count) || config_count == 0) {
+                CARNIVAL_LOG_ERROR("No usable EGL config");
+                destroy();
+                return false;
+            }
+        }
+
+        bool create_context = hasEGLExtension(egl_display, "EGL_KHR_create_context") || egl_major > 1 || egl_minor >= 5;
+        // try the requested core version first, then fall back to the oldest one our shaders need
+        const int versions[][2] = {{major, minor}, {3, 3}};
+        for (auto &version: versions) {
+            const EGLint context_attributes[] = {
+                    EGL_CONTEXT_MAJOR_VERSION, version[0],
+                    EGL_CONTEXT_MINOR_VERSION, version[1],
+                    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                    EGL_NONE
+            };
+            context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT,
+                                       create_context ? context_attributes : nullptr);
+            if (context != nullptr)
+                break;
+        }
+
+        if (context == nullptr) {
+            CARNIVAL_LOG_ERROR("Failed to create an EGL context: 0x{:x}", eglGetError());
+            destroy();
+            return false;
+        }
+
+        if (!hasEGLExtension(egl_display, "EGL_KHR_surfaceless_context")) {
+            if (!pbuffer_config) {
+                CARNIVAL_LOG_ERROR("EGL supports neither surfaceless contexts nor pbuffers");
+                destroy();
+                return false;
+            }
+            const EGLint surface_attributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+            surface = eglCreatePbufferSurface(egl_display, config, surface_attributes);
+        }
+
+        if (!eglMakeCurrent(egl_display, surface, surface, context)) {
+            CARNIVAL_LOG_ERROR("Failed to make the EGL context current: 0x{:x}", eglGetError());
+            destroy();
+            return false;
+        }
+
+        CARNIVAL_LOG_INFO("Headless context created ({})", surface == nullptr ? "surfaceless" : "pbuffer");
+        return true;
+    }
+
+    void HeadlessContext::destroy() {
+        if (display == nullptr)
+            return;
+
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (surface != nullptr)
+            eglDestroySurface(display, surface);
+        if (context != nullptr)
+            eglDestroyContext(display, context);
+        eglTerminate(display);
+
+        display = nullptr;
+        context = nullptr;
+        surface = nullptr;
+    }
+
+    void *HeadlessContext::getProcAddress(const char *name) {
+        return (void *) eglGetProcAddress(name);
+    }
+
+#else
+
+    bool HeadlessContext::create(int, int) {
+        CARNIVAL_LOG_ERROR("Carnival was built without EGL, headless mode is not available");
+        return false;
+    }
+
+    void HeadlessContext::destroy() {
+    }
+
+    void *HeadlessContext::getProcAddress(const char *) {
+        return nullptr;
+    }
+
+#endif
+}
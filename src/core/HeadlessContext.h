@@ -0,0 +1,29 @@
+#ifndef CARNIVAL_HEADLESSCONTEXT_H
+#define CARNIVAL_HEADLESSCONTEXT_H
+
+#include "glad/glad.h"
+
+namespace carnival::core {
+
+    // An offscreen GL context without any window, for render farms and CI.
+    // Uses EGL on the Mesa surfaceless platform where available (works on llvmpipe without a GPU),
+    // otherwise the default display with a 1x1 pbuffer.
+    class HeadlessContext {
+    public:
+        ~HeadlessContext();
+
+        bool create(int major, int minor);
+        void destroy();
+        bool valid() const { return context != nullptr; }
+
+        // suitable for gladLoadGLLoader
+        static void *getProcAddress(const char *name);
+
+    private:
+        void *display = nullptr;
+        void *context = nullptr;
+        void *surface = nullptr;
+    };
+}
+
+#endif //CARNIVAL_HEADLESSCONTEXT_H
@@ -0,0 +1,245 @@
+#include "InputSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include "Log.h"
+
+namespace carnival::core {
+
+    InputSystem::~InputSystem() {
+        shutdown();
+    }
+
+    void InputSystem::init() {
+        SDL_AddEventWatch(watch, this);
+        initialized = true;
+        // pads plugged in before SDL_Init arrive as CONTROLLERDEVICEADDED events with the first poll
+    }
+
+    void InputSystem::shutdown() {
+        if (!initialized)
+            return;
+
+        SDL_DelEventWatch(watch, this);
+        for (auto &gamepad: state.gamepads) {
+            if (gamepad.connected())
+                close(gamepad.instance);
+        }
+        initialized = false;
+    }
+
+    void InputSystem::handle(const SDL_Event &event) {
+        switch (event.type) {
+            case SDL_CONTROLLERDEVICEADDED:
+                open(event.cdevice.which);
+                break;
+            case SDL_CONTROLLERDEVICEREMOVED:
+                close(event.cdevice.which);
+                break;
+        }
+    }
+
+    const InputSnapshot &InputSystem::sample() {
+        if (initialized) {
+            // whatever arrived since the queue was drained updates SDL's state and gets stamped
+            SDL_PumpEvents();
+            state.mouse_buttons = SDL_GetMouseState(&state.mouse_x, &state.mouse_y);
+            state.modifiers = (uint16_t) SDL_GetModState();
+            state.gamepad_count = 0;
+            for (int slot = 0; slot < maxGamepads; slot++) {
+                auto &gamepad = state.gamepads[slot];
+                if (controllers[slot] == nullptr)
+                    continue;
+                state.gamepad_count++;
+                for (int axis = 0; axis < SDL_CONTROLLER_AXIS_MAX; axis++) {
+                    auto value = (float) SDL_GameControllerGetAxis(controllers[slot], (SDL_GameControllerAxis) axis);
+                    gamepad.axes[axis] = std::clamp(value / 32767.0f, -1.0f, 1.0f);
+                }
+                gamepad.buttons = 0;
+                for (int button = 0; button < SDL_CONTROLLER_BUTTON_MAX; button++) {
+                    if (SDL_GameControllerGetButton(controllers[slot], (SDL_GameControllerButton) button))
+                        gamepad.buttons |= 1u << button;
+                }
+            }
+        }
+
+        state.sequence++;
+        state.sampled_ns = now();
+        if (stamp_head != stamp_sampled)
+            state.newest_event_ns = stamps[(stamp_head - 1) % stampCapacity].event_ns;
+
+        if (isMeasuring() && stamp_head != stamp_sampled) {
+            std::lock_guard lock(latency_mutex);
+            // the oldest ones were overwritten if nothing sampled for that long
+            for (auto i = std::max(stamp_sampled, stamp_head - std::min(stamp_head, (uint64_t) stampCapacity));
+                 i < stamp_head; i++) {
+                auto stamp = stamps[i % stampCapacity];
+                stamp.sequence = state.sequence;
+                stamp.sampled_ns = state.sampled_ns;
+                in_flight.push_back(stamp);
+            }
+            // frames that are never presented mustn't let it grow forever
+            if (in_flight.size() > latencySamples)
+                in_flight.erase(in_flight.begin(), in_flight.end() - latencySamples);
+        }
+        stamp_sampled = stamp_head;
+
+        publish();
+        return state;
+    }
+
+    const InputSnapshot &InputSystem::latest() {
+        if (shared_slot.load(std::memory_order_acquire) & freshBit)
+            read_slot = shared_slot.exchange(read_slot, std::memory_order_acq_rel) & ~freshBit;
+        return buffers[read_slot];
+    }
+
+    void InputSystem::presented(uint64_t sequence) {
+        if (!isMeasuring())
+            return;
+
+        auto present_ns = now();
+        std::lock_guard lock(latency_mutex);
+        auto end = std::partition(in_flight.begin(), in_flight.end(), [sequence](const Stamp &stamp) {
+            return stamp.sequence > sequence;
+        });
+        for (auto it = end; it != in_flight.end(); ++it) {
+            auto to_sample = (double) (it->sampled_ns - it->event_ns) / 1e6;
+            auto to_present = (double) (present_ns - it->event_ns) / 1e6;
+            if (to_present_ms.size() < latencySamples) {
+                to_sample_ms.push_back(to_sample);
+                to_present_ms.push_back(to_present);
+            } else {
+                to_sample_ms[next_sample] = to_sample;
+                to_present_ms[next_sample] = to_present;
+                next_sample = (next_sample + 1) % latencySamples;
+            }
+            measured++;
+        }
+        in_flight.erase(end, in_flight.end());
+    }
+
+    void InputSystem::rumble(uint16_t low, uint16_t high, uint32_t duration_ms) {
+        for (auto *controller: controllers) {
+            if (controller != nullptr && SDL_GameControllerRumble(controller, low, high, duration_ms) != 0)
+                CARNIVAL_LOG_WARNING("Rumble failed: {}", SDL_GetError());
+        }
+    }
+
+    const char *InputSystem::gamepadName(int slot) const {
+        return controllers[slot] != nullptr ? SDL_GameControllerName(controllers[slot]) : nullptr;
+    }
+
+    void InputSystem::setMeasuring(bool enable) {
+        std::lock_guard lock(latency_mutex);
+        if (enable && !isMeasuring()) {
+            in_flight.clear();
+            to_sample_ms.clear();
+            to_present_ms.clear();
+            next_sample = 0;
+            measured = 0;
+        }
+        measuring.store(enable, std::memory_order_relaxed);
+    }
+
+    InputLatencyStats InputSystem::latency() const {
+        InputLatencyStats stats;
+        stats.events = stamp_count;
+
+        std::vector<double> to_sample, to_present;
+        {
+            std::lock_guard lock(latency_mutex);
+            to_sample = to_sample_ms;
+            to_present = to_present_ms;
+            stats.measured = measured;
+        }
+        stats.event_to_sample = summarize(std::move(to_sample));
+        stats.present_p90 = percentile(to_present, 90.0);
+        stats.event_to_present = summarize(std::move(to_present));
+        return stats;
+    }
+
+    int64_t InputSystem::now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    int InputSystem::watch(void *userdata, SDL_Event *event) {
+        if (!isInput(event->type))
+            return 0;
+
+        // SDL queues input only while pumping, on the event thread, in the order the events are taken off
+        auto *input = (InputSystem *) userdata;
+        input->stamps[input->stamp_head % stampCapacity] = {0, now(), 0};
+        input->stamp_head++;
+        input->stamp_count++;
+        return 0;
+    }
+
+    bool InputSystem::isInput(Uint32 type) {
+        switch (type) {
+            case SDL_KEYDOWN:
+            case SDL_KEYUP:
+            case SDL_MOUSEMOTION:
+            case SDL_MOUSEBUTTONDOWN:
+            case SDL_MOUSEBUTTONUP:
+            case SDL_MOUSEWHEEL:
+            case SDL_CONTROLLERAXISMOTION:
+            case SDL_CONTROLLERBUTTONDOWN:
+            case SDL_CONTROLLERBUTTONUP:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void InputSystem::open(int device_index) {
+        if (!SDL_IsGameController(device_index))
+            return;
+
+        auto *controller = SDL_GameControllerOpen(device_index);
+        if (controller == nullptr) {
+            CARNIVAL_LOG_ERROR("Couldn't open controller {}: {}", device_index, SDL_GetError());
+            return;
+        }
+        // SDL hands out the same controller again, with one more reference
+        auto instance = SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(controller));
+        auto free_slot = -1;
+        for (int slot = 0; slot < maxGamepads; slot++) {
+            if (state.gamepads[slot].instance == instance) {
+                SDL_GameControllerClose(controller);
+                return;
+            }
+            if (free_slot < 0 && !state.gamepads[slot].connected())
+                free_slot = slot;
+        }
+        if (free_slot < 0) {
+            CARNIVAL_LOG_WARNING("Ignoring controller {}, {} are connected already",
+                                 SDL_GameControllerName(controller), maxGamepads);
+            SDL_GameControllerClose(controller);
+            return;
+        }
+
+        controllers[free_slot] = controller;
+        state.gamepads[free_slot] = GamepadState();
+        state.gamepads[free_slot].instance = instance;
+        CARNIVAL_LOG_INFO("Controller {} connected: {}", free_slot + 1, SDL_GameControllerName(controller));
+    }
+
+    void InputSystem::close(SDL_JoystickID instance) {
+        for (int slot = 0; slot < maxGamepads; slot++) {
+            if (state.gamepads[slot].instance != instance)
+                continue;
+            SDL_GameControllerClose(controllers[slot]);
+            controllers[slot] = nullptr;
+            state.gamepads[slot] = GamepadState();
+            CARNIVAL_LOG_INFO("Controller {} disconnected", slot + 1);
+            return;
+        }
+    }
+
+    void InputSystem::publish() {
+        buffers[write_slot] = state;
+        write_slot = shared_slot.exchange(write_slot | freshBit, std::memory_order_acq_rel) & ~freshBit;
+    }
+}
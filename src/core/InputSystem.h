@@ -0,0 +1,126 @@
+#ifndef CARNIVAL_INPUTSYSTEM_H
+#define CARNIVAL_INPUTSYSTEM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <SDL2/SDL.h>
+#include "Stats.h"
+
+namespace carnival::core {
+
+    const int maxGamepads = 4;
+
+    struct GamepadState {
+        SDL_JoystickID instance = -1;   // -1 for a free slot
+        float axes[6] = {};             // SDL_GameControllerAxis order, sticks -1..1, triggers 0..1
+        uint32_t buttons = 0;           // a bit per SDL_GameControllerButton
+
+        bool connected() const { return instance >= 0; }
+    };
+
+    // The input state at one moment, copied around whole.
+    struct InputSnapshot {
+        uint64_t sequence = 0;
+        int64_t sampled_ns = 0;         // InputSystem::now() when it was taken
+        int64_t newest_event_ns = 0;    // of the newest input event it reflects, 0 before any
+        int mouse_x = 0;                // window coordinates
+        int mouse_y = 0;
+        uint32_t mouse_buttons = 0;     // SDL_BUTTON() mask
+        uint16_t modifiers = 0;         // SDL_Keymod
+        int gamepad_count = 0;
+        GamepadState gamepads[maxGamepads];
+    };
+
+    struct InputLatencyStats {
+        TimingSummary event_to_sample;  // waiting until a snapshot picked the event up
+        TimingSummary event_to_present; // until the frame that used it was presented
+        double present_p90 = 0.0;
+        uint64_t events = 0;            // stamped since init
+        uint64_t measured = 0;          // presented while measuring
+    };
+
+    // Owns the game controllers and the snapshots render code reads the input from.
+    // Pads are opened and closed as SDL reports them plugged in and out, up to maxGamepads.
+    // An event watch stamps every input event with the steady clock the moment SDL queues it, which is
+    // far finer than SDL's millisecond event timestamps. sample() pumps SDL once more and takes the state
+    // straight from SDL rather than from events still waiting in the queue, so it is as fresh as the point
+    // in the frame it is called from. Snapshots go through a triple buffer: publishing and reading never
+    // block and the reader always gets the newest complete one.
+    // While measuring, every stamped event is followed to the present of the first frame whose snapshot
+    // reflects it.
+    class InputSystem {
+    public:
+        static constexpr size_t stampCapacity = 1024;
+        static constexpr size_t latencySamples = 4096;
+        static constexpr float stickDeadzone = 0.15f;
+
+        ~InputSystem();
+
+        // after SDL_Init, on the thread that pumps events
+        void init();
+        void shutdown();
+
+        // every event taken off the queue, opens and closes pads
+        void handle(const SDL_Event &event);
+        // event thread: pumps, publishes a snapshot of the current state and returns it
+        const InputSnapshot &sample();
+        // the single reader thread: the newest published snapshot
+        const InputSnapshot &latest();
+        // after the frame that used snapshot sequence was presented, any thread
+        void presented(uint64_t sequence);
+
+        void rumble(uint16_t low, uint16_t high, uint32_t duration_ms);
+        const char *gamepadName(int slot) const;
+
+        void setMeasuring(bool measuring);
+        bool isMeasuring() const { return measuring.load(std::memory_order_relaxed); }
+        InputLatencyStats latency() const;
+
+        // steady clock in nanoseconds, what every timestamp here is in
+        static int64_t now();
+
+    private:
+        struct Stamp {
+            uint64_t sequence;          // of the snapshot that first reflected it, 0 until sampled
+            int64_t event_ns;
+            int64_t sampled_ns;
+        };
+
+        bool initialized = false;
+        SDL_GameController *controllers[maxGamepads] = {};
+        InputSnapshot state;            // the event thread's copy
+
+        // triple buffer: the writer fills its own slot and swaps it with the shared one,
+        // the reader swaps its slot with the shared one when that is marked fresh
+        static constexpr int freshBit = 4;
+        InputSnapshot buffers[3];
+        int write_slot = 0;
+        std::atomic<int> shared_slot{1};
+        int read_slot = 2;
+
+        // written by the event watch on the event thread
+        Stamp stamps[stampCapacity] = {};
+        uint64_t stamp_head = 0;
+        uint64_t stamp_sampled = 0;     // stamps before this one belong to a snapshot
+        uint64_t stamp_count = 0;
+
+        std::atomic<bool> measuring{false};
+        mutable std::mutex latency_mutex;
+        std::vector<Stamp> in_flight;   // sampled, waiting for their present
+        std::vector<double> to_sample_ms;
+        std::vector<double> to_present_ms;
+        size_t next_sample = 0;
+        uint64_t measured = 0;
+
+        static int watch(void *userdata, SDL_Event *event);
+        static bool isInput(Uint32 type);
+        void open(int device_index);
+        void close(SDL_JoystickID instance);
+        void publish();
+    };
+}
+
+#endif //CARNIVAL_INPUTSYSTEM_H
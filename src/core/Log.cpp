@@ -0,0 +1,280 @@
+#include "Log.h"
+
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+
+namespace carnival::core {
+
+    // how long the writer collects messages before it writes them out
+    static const auto batchInterval = std::chrono::milliseconds(10);
+    // an idle writer still checks this often, in case a wake-up raced with it falling asleep
+    static const auto idleInterval = std::chrono::milliseconds(250);
+
+    static const char *levelName(LogLevel level) {
+        switch (level) {
+            case LogLevel::Debug:
+                return "[DEBUG] ";
+            case LogLevel::Info:
+                return "[INFO] ";
+            case LogLevel::Warning:
+                return "[WARNING] ";
+            default:
+                return "[ERROR] ";
+        }
+    }
+
+    static std::terminate_handler previous_terminate = nullptr;
+    // initialized before main() runs, its messages aren't labelled
+    static const auto mainThread = std::this_thread::get_id();
+
+    Log &Log::instance() {
+        static Log log;
+        return log;
+    }
+
+    Log::Log() {
+        batch.reserve(LogRing::capacity);
+        text.reserve(64 * 1024);
+        writer = std::thread(&Log::run, this);
+
+        // init failures end in an uncaught throw, the message explaining them must not die in a ring
+        previous_terminate = std::set_terminate([]() {
+            Log::instance().flush();
+            if (previous_terminate != nullptr)
+                previous_terminate();
+            std::abort();
+        });
+    }
+
+    Log::~Log() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake_condition.notify_one();
+        writer.join();
+
+        flush();
+        if (output != stderr)
+            std::fclose(output);
+    }
+
+    LogRing &Log::threadRing() {
+        // rings are never freed, a thread that exits may still have messages waiting to be written
+        thread_local LogRing *ring = nullptr;
+        if (ring == nullptr) {
+            ring = new LogRing();
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            ring->thread = std::this_thread::get_id() == mainThread ? 0 : ++labelled_threads;
+            rings.push_back(ring);
+        }
+        return *ring;
+    }
+
+    bool Log::open(const std::filesystem::path &path) {
+        auto *file = std::fopen(path.string().c_str(), "a");
+        if (file == nullptr) {
+            CARNIVAL_LOG_ERROR("Can't open log file {}", path);
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(output_mutex);
+        if (output != stderr)
+            std::fclose(output);
+        output = file;
+        return true;
+    }
+
+    void Log::wake() {
+        idle.store(false, std::memory_order_relaxed);
+        wake_condition.notify_one();
+    }
+
+    void Log::run() {
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        while (!stopping) {
+            lock.unlock();
+            auto written = drain();
+            lock.lock();
+
+            if (written > 0) {
+                wake_condition.wait_for(lock, batchInterval, [this]() { return stopping; });
+            } else {
+                // nothing came in, sleep until someone logs
+                idle.store(true, std::memory_order_relaxed);
+                wake_condition.wait_for(lock, idleInterval,
+                                        [this]() { return stopping || !idle.load(std::memory_order_relaxed); });
+                idle.store(false, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void Log::flush() {
+        drain();
+    }
+
+    size_t Log::drain() {
+        std::lock_guard<std::mutex> lock(output_mutex);
+
+        std::vector<LogRing *> current_rings;
+        {
+            std::lock_guard<std::mutex> rings_lock(rings_mutex);
+            current_rings = rings;
+        }
+
+        batch.clear();
+        text.clear();
+        for (auto *ring: current_rings)
+            ring->drain([this](const LogRecord &record) { batch.push_back(record); });
+
+        // every ring is in order already, this interleaves the threads
+        std::stable_sort(batch.begin(), batch.end(), [](const LogRecord &a, const LogRecord &b) {
+            return a.timestamp_ns < b.timestamp_ns;
+        });
+        for (auto &record: batch)
+            format(record);
+
+        for (auto *ring: current_rings) {
+            auto dropped = ring->dropped.load(std::memory_order_relaxed);
+            if (dropped == ring->reported_dropped)
+                continue;
+
+            formatTimestamp((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count());
+            text += levelName(LogLevel::Warning);
+            text += "Thread " + std::to_string(ring->thread) + " dropped " +
+                    std::to_string(dropped - ring->reported_dropped) + " messages, its log ring was full\n";
+            ring->reported_dropped = dropped;
+        }
+        if (text.empty())
+            return 0;
+
+        std::fwrite(text.data(), 1, text.size(), output);
+        std::fflush(output);
+        return batch.size();
+    }
+
+    void Log::formatTimestamp(uint64_t timestamp_ns) {
+        // localtime and strftime only run once a second, the milliseconds are appended by hand
+        auto second = (int64_t) (timestamp_ns / 1'000'000'000);
+        if (second != cached_second) {
+            auto time = (std::time_t) second;
+            std::tm local{};
+#ifdef _WIN32
+            localtime_s(&local, &time);
+#else
+            localtime_r(&time, &local);
+#endif
+            std::strftime(cached_time, sizeof(cached_time), "%d.%m.%Y %H:%M:%S", &local);
+            std::strftime(cached_zone, sizeof(cached_zone), "%z", &local);
+            cached_second = second;
+        }
+
+        auto milliseconds = (unsigned) (timestamp_ns / 1'000'000 % 1000);
+        char fraction[5] = {'.', (char) ('0' + milliseconds / 100), (char) ('0' + milliseconds / 10 % 10),
+                            (char) ('0' + milliseconds % 10), ' '};
+        text += '[';
+        text += cached_time;
+        text.append(fraction, sizeof(fraction));
+        text += cached_zone;
+        text += "] ";
+    }
+
+    void Log::format(const LogRecord &record) {
+        formatTimestamp(record.timestamp_ns);
+        text += levelName(record.level);
+        if (record.thread != 0)
+            text += "[thread " + std::to_string(record.thread) + "] ";
+
+        size_t read = 0;
+        char number[64];
+        for (const char *c = record.format; *c != '\0'; c++) {
+            if ((c[0] == '{' && c[1] == '{') || (c[0] == '}' && c[1] == '}')) {
+                text += *c++;
+                continue;
+            }
+            if (c[0] != '{') {
+                text += *c;
+                continue;
+            }
+
+            const char *end = std::strchr(c, '}');
+            if (end == nullptr || read >= record.size) {
+                // more placeholders than arguments, print them as they are
+                text += *c;
+                continue;
+            }
+
+            // {:x} or {:.Nf}
+            bool hex = false;
+            int precision = -1;
+            for (const char *spec = c + 1; spec != end; spec++) {
+                if (*spec == 'x')
+                    hex = true;
+                else if (*spec == '.')
+                    precision = std::atoi(spec + 1);
+            }
+
+            auto tag = (LogArgument) record.payload[read++];
+            const uint8_t *value = record.payload + read;
+            switch (tag) {
+                case LogArgument::Int: {
+                    int64_t v;
+                    std::memcpy(&v, value, sizeof(v));
+                    std::snprintf(number, sizeof(number), hex ? "%llx" : "%lld", (long long) v);
+                    text += number;
+                    read += sizeof(v);
+                    break;
+                }
+                case LogArgument::Uint: {
+                    uint64_t v;
+                    std::memcpy(&v, value, sizeof(v));
+                    std::snprintf(number, sizeof(number), hex ? "%llx" : "%llu", (unsigned long long) v);
+                    text += number;
+                    read += sizeof(v);
+                    break;
+                }
+                case LogArgument::Double: {
+                    double v;
+                    std::memcpy(&v, value, sizeof(v));
+                    if (precision >= 0)
+                        std::snprintf(number, sizeof(number), "%.*f", precision, v);
+                    else
+                        std::snprintf(number, sizeof(number), "%g", v);
+                    text += number;
+                    read += sizeof(v);
+                    break;
+                }
+                case LogArgument::Bool:
+                    text += *value != 0 ? "true" : "false";
+                    read += 1;
+                    break;
+                case LogArgument::Char:
+                    text += (char) *value;
+                    read += 1;
+                    break;
+                case LogArgument::String: {
+                    uint16_t length;
+                    std::memcpy(&length, value, sizeof(length));
+                    text.append((const char *) value + sizeof(length), length);
+                    read += sizeof(length) + length;
+                    break;
+                }
+                case LogArgument::Pointer: {
+                    const void *v;
+                    std::memcpy(&v, value, sizeof(v));
+                    std::snprintf(number, sizeof(number), "%p", v);
+                    text += number;
+                    read += sizeof(v);
+                    break;
+                }
+            }
+            c = end;
+        }
+
+        if (record.truncated)
+            text += " [truncated]";
+        text += '\n';
+    }
+}
@@ -0,0 +1,244 @@
+#ifndef CARNIVAL_LOG_H
+#define CARNIVAL_LOG_H
+
+// Asynchronous leveled logging. A call copies its arguments into a per-thread ring and returns,
+// formatting and output happen in batches on a writer thread.
+//
+//   CARNIVAL_LOG_INFO("Loaded {} in {:.2f} ms", name, ms);
+//   CARNIVAL_LOG_ERROR("EGL error 0x{:x}", eglGetError());
+//
+// The format must be a string literal, only its pointer is stored. Placeholders are {} with an
+// optional :x (hex) or :.Nf (fixed precision), {{ and }} are literal braces.
+// Levels below CARNIVAL_LOG_LEVEL (0 debug, 1 info, 2 warning, 3 error, 4 off) compile out.
+
+#ifndef CARNIVAL_LOG_LEVEL
+#define CARNIVAL_LOG_LEVEL 1
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace carnival::core {
+
+    enum class LogLevel : uint8_t {
+        Debug, Info, Warning, Error, Off
+    };
+
+    constexpr bool logCompiledIn(LogLevel level) { return (int) level + 1 > CARNIVAL_LOG_LEVEL; }
+
+    enum class LogArgument : uint8_t {
+        Int, Uint, Double, Bool, Char, String, Pointer
+    };
+
+    // One message with its arguments still encoded, see LogEncoder.
+    struct LogRecord {
+        static const size_t payloadSize = 232;
+
+        uint64_t timestamp_ns = 0;      // system clock, since the epoch
+        const char *format = nullptr;
+        uint16_t size = 0;              // used bytes of payload
+        uint16_t thread = 0;
+        LogLevel level = LogLevel::Info;
+        bool truncated = false;         // arguments that didn't fit were dropped
+        uint8_t payload[payloadSize];
+    };
+
+    // Single producer / single consumer, the owning thread logs, the writer drains.
+    // When it's full new messages are dropped and counted, a thread never waits for the writer.
+    class LogRing {
+    public:
+        static const size_t capacity = 1024;
+
+        LogRecord *reserve() {
+            auto current_head = head.load(std::memory_order_relaxed);
+            if (current_head - tail.load(std::memory_order_acquire) >= capacity) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            return &records[current_head % capacity];
+        }
+        void commit() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+        template<typename F>
+        size_t drain(F &&consume) {
+            auto current_tail = tail.load(std::memory_order_relaxed);
+            auto current_head = head.load(std::memory_order_acquire);
+            for (auto i = current_tail; i != current_head; i++)
+                consume(records[i % capacity]);
+            tail.store(current_head, std::memory_order_release);
+            return current_head - current_tail;
+        }
+
+        uint16_t thread = 0;
+        std::atomic<uint64_t> dropped{0};
+        uint64_t reported_dropped = 0;     // writer only
+
+    private:
+        std::array<LogRecord, capacity> records;
+        std::atomic<size_t> head{0};
+        std::atomic<size_t> tail{0};
+    };
+
+    // Writes tagged arguments into a record's payload, strings are copied.
+    class LogEncoder {
+    public:
+        explicit LogEncoder(LogRecord &record) : record(record) {}
+
+        template<typename T>
+        void add(const T &value) {
+            using Type = std::decay_t<T>;
+            if constexpr (std::is_same_v<Type, bool>)
+                put(LogArgument::Bool, (uint8_t) value);
+            else if constexpr (std::is_same_v<Type, char>)
+                put(LogArgument::Char, value);
+            else if constexpr (std::is_enum_v<Type>)
+                put(LogArgument::Int, (int64_t) value);
+            else if constexpr (std::is_integral_v<Type> && std::is_signed_v<Type>)
+                put(LogArgument::Int, (int64_t) value);
+            else if constexpr (std::is_integral_v<Type>)
+                put(LogArgument::Uint, (uint64_t) value);
+            else if constexpr (std::is_floating_point_v<Type>)
+                put(LogArgument::Double, (double) value);
+            else if constexpr (std::is_same_v<Type, const char *> || std::is_same_v<Type, char *>)
+                putString(value != nullptr ? std::string_view(value) : std::string_view("(null)"));
+            else if constexpr (std::is_same_v<Type, const unsigned char *> || std::is_same_v<Type, unsigned char *>)
+                // GL strings
+                putString(value != nullptr ? std::string_view((const char *) value) : std::string_view("(null)"));
+            else if constexpr (std::is_convertible_v<const Type &, std::string_view>)
+                putString(std::string_view(value));
+            else if constexpr (std::is_same_v<Type, std::filesystem::path>)
+                putString(value.string());
+            else if constexpr (std::is_pointer_v<Type>)
+                put(LogArgument::Pointer, (const void *) value);
+            else
+                static_assert(std::is_pointer_v<Type>, "type can't be logged");
+        }
+
+    private:
+        LogRecord &record;
+
+        template<typename V>
+        void put(LogArgument tag, V value) {
+            if (record.size + 1 + sizeof(V) > LogRecord::payloadSize) {
+                record.truncated = true;
+                return;
+            }
+            record.payload[record.size] = (uint8_t) tag;
+            std::memcpy(record.payload + record.size + 1, &value, sizeof(V));
+            record.size += (uint16_t) (1 + sizeof(V));
+        }
+
+        void putString(std::string_view value) {
+            // a cut string is still worth printing
+            auto available = LogRecord::payloadSize - record.size;
+            if (available < 1 + sizeof(uint16_t)) {
+                record.truncated = true;
+                return;
+            }
+            auto length = std::min(value.size(), available - 1 - sizeof(uint16_t));
+            record.truncated |= length < value.size();
+
+            auto length16 = (uint16_t) length;
+            record.payload[record.size] = (uint8_t) LogArgument::String;
+            std::memcpy(record.payload + record.size + 1, &length16, sizeof(length16));
+            std::memcpy(record.payload + record.size + 1 + sizeof(length16), value.data(), length);
+            record.size += (uint16_t) (1 + sizeof(length16) + length);
+        }
+    };
+
+    class Log {
+    public:
+        static Log &instance();
+        ~Log();
+
+        template<typename... Args>
+        void write(LogLevel level, const char *format, const Args &... args) {
+            if (level < threshold.load(std::memory_order_relaxed))
+                return;
+
+            auto &ring = threadRing();
+            auto *record = ring.reserve();
+            if (record == nullptr)
+                return;
+
+            record->timestamp_ns = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+            record->format = format;
+            record->level = level;
+            record->thread = ring.thread;
+            record->size = 0;
+            record->truncated = false;
+            LogEncoder encoder(*record);
+            (encoder.add(args), ...);
+            ring.commit();
+
+            // errors show up right away, everything else waits for the next batch
+            if (level >= LogLevel::Error || idle.load(std::memory_order_relaxed))
+                wake();
+        }
+
+        // runtime filter on top of CARNIVAL_LOG_LEVEL
+        void setLevel(LogLevel level) { threshold.store(level, std::memory_order_relaxed); }
+        // appends to a file instead of stderr
+        bool open(const std::filesystem::path &path);
+        // writes everything logged so far, from any thread
+        void flush();
+
+    private:
+        Log();
+
+        std::atomic<LogLevel> threshold{LogLevel::Debug};
+        std::atomic<bool> idle{false};
+
+        std::vector<LogRing *> rings;
+        std::mutex rings_mutex;
+        uint16_t labelled_threads = 0;
+
+        // writer side, under output_mutex
+        std::mutex output_mutex;
+        FILE *output = stderr;
+        std::vector<LogRecord> batch;
+        std::string text;
+        int64_t cached_second = -1;
+        char cached_time[32] = {};      // "dd.mm.yyyy HH:MM:SS"
+        char cached_zone[8] = {};       // "+hhmm"
+
+        std::thread writer;
+        std::mutex wake_mutex;
+        std::condition_variable wake_condition;
+        bool stopping = false;
+
+        LogRing &threadRing();
+        void wake();
+        void run();
+        size_t drain();
+        void format(const LogRecord &record);
+        void formatTimestamp(uint64_t timestamp_ns);
+    };
+}
+
+#define CARNIVAL_LOG(level, ...) \
+    do { \
+        if constexpr (::carnival::core::logCompiledIn(::carnival::core::LogLevel::level)) \
+            ::carnival::core::Log::instance().write(::carnival::core::LogLevel::level, __VA_ARGS__); \
+    } while (0)
+
+#define CARNIVAL_LOG_DEBUG(...) CARNIVAL_LOG(Debug, __VA_ARGS__)
+#define CARNIVAL_LOG_INFO(...) CARNIVAL_LOG(Info, __VA_ARGS__)
+#define CARNIVAL_LOG_WARNING(...) CARNIVAL_LOG(Warning, __VA_ARGS__)
+#define CARNIVAL_LOG_ERROR(...) CARNIVAL_LOG(Error, __VA_ARGS__)
+
+#endif //CARNIVAL_LOG_H
@@ -0,0 +1,136 @@
+#include "Lz4.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace carnival::core {
+
+    static const size_t minMatch = 4;
+    // the format wants the last 5 bytes as literals and no match starting in the last 12
+    static const size_t lastLiterals = 5;
+    static const size_t matchLimit = 12;
+    static const size_t maxOffset = 65535;
+    static const int hashBits = 16;
+
+    static uint32_t read32(const unsigned char *data) {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    static void writeLength(std::vector<unsigned char> &out, size_t length) {
+        for (; length >= 255; length -= 255)
+            out.push_back(255);
+        out.push_back((unsigned char) length);
+    }
+
+    // literals, then a match unless match_length is 0
+    static void writeSequence(std::vector<unsigned char> &out, const unsigned char *literals, size_t literal_length,
+                              size_t offset, size_t match_length) {
+        auto token = out.size();
+        out.push_back((unsigned char) (std::min<size_t>(literal_length, 15) << 4));
+        if (literal_length >= 15)
+            writeLength(out, literal_length - 15);
+        out.insert(out.end(), literals, literals + literal_length);
+        if (match_length == 0)
+            return;
+
+        out.push_back((unsigned char) (offset & 0xFF));
+        out.push_back((unsigned char) (offset >> 8));
+        auto length = match_length - minMatch;
+        out[token] |= (unsigned char) std::min<size_t>(length, 15);
+        if (length >= 15)
+            writeLength(out, length - 15);
+    }
+
+    std::vector<unsigned char> lz4Compress(const unsigned char *data, size_t size) {
+        std::vector<unsigned char> out;
+        out.reserve(size + size / 255 + 16);
+
+        size_t anchor = 0;
+        if (size > matchLimit) {
+            // positions plus one, 0 is empty
+            std::vector<size_t> table((size_t) 1 << hashBits, 0);
+            size_t position = 0;
+            while (position + matchLimit <= size) {
+                auto sequence = read32(data + position);
+                auto hash = (sequence * 2654435761u) >> (32 - hashBits);
+                auto candidate = table[hash];
+                table[hash] = position + 1;
+
+                if (candidate == 0 || position - (candidate - 1) > maxOffset || read32(data + candidate - 1) != sequence) {
+                    position++;
+                    continue;
+                }
+
+                auto match = candidate - 1;
+                auto length = minMatch;
+                while (position + length < size - lastLiterals && data[match + length] == data[position + length])
+                    length++;
+
+                writeSequence(out, data + anchor, position - anchor, position - match, length);
+                position += length;
+                anchor = position;
+            }
+        }
+
+        writeSequence(out, data + anchor, size - anchor, 0, 0);
+        return out;
+    }
+
+    static bool readLength(const unsigned char *source, size_t source_size, size_t &in, size_t &length) {
+        unsigned char byte;
+        do {
+            if (in >= source_size)
+                return false;
+            byte = source[in++];
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    bool lz4Decompress(const unsigned char *source, size_t source_size, unsigned char *target, size_t target_size) {
+        size_t in = 0, out = 0;
+        while (in < source_size) {
+            auto token = source[in++];
+
+            size_t literals = token >> 4;
+            if (literals == 15 && !readLength(source, source_size, in, literals))
+                return false;
+            if (literals > source_size - in || literals > target_size - out)
+                return false;
+            std::memcpy(target + out, source + in, literals);
+            in += literals;
+            out += literals;
+
+            // the last sequence has no match
+            if (in == source_size)
+                break;
+
+            if (source_size - in < 2)
+                return false;
+            size_t offset = source[in] | (size_t) source[in + 1] << 8;
+            in += 2;
+            if (offset == 0 || offset > out)
+                return false;
+
+            size_t length = token & 15;
+            if (length == 15 && !readLength(source, source_size, in, length))
+                return false;
+            length += minMatch;
+            if (length > target_size - out)
+                return false;
+
+            if (offset >= length) {
+                std::memcpy(target + out, target + out - offset, length);
+            } else {
+                // overlapping, repeats the last offset bytes
+                for (size_t i = 0; i < length; i++)
+                    target[out + i] = target[out - offset + i];
+            }
+            out += length;
+        }
+        return out == target_size;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef CARNIVAL_LZ4_H
+#define CARNIVAL_LZ4_H
+
+#include <cstddef>
+#include <vector>
+
+namespace carnival::core {
+
+    // The LZ4 block format (no frame), enough for asset pack entries: a greedy single hash compressor,
+    // nowhere near as fast as the reference one, and a decompressor that checks every bound.
+    std::vector<unsigned char> lz4Compress(const unsigned char *data, size_t size);
+    // false unless source decodes to exactly target_size bytes
+    bool lz4Decompress(const unsigned char *source, size_t source_size, unsigned char *target, size_t target_size);
+}
+
+#endif //CARNIVAL_LZ4_H
@@ -0,0 +1,298 @@
+#include "Memory.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include "Log.h"
+
+namespace carnival::core {
+
+    namespace {
+        // frames with heap allocations logged while checking, the rest are only counted
+        const uint64_t maxLoggedFrames = 20;
+        // ImGui frees without the size, poolAllocate() keeps it in front of the block
+        const size_t poolHeaderBytes = 16;
+
+        thread_local int scope_depth = 0;
+    }
+
+    FrameArena::FrameArena(size_t initial_bytes) {
+        addBlock(std::max<size_t>(initial_bytes, 64));
+        counters.capacity = blocks[0].size;
+    }
+
+    FrameArena::~FrameArena() {
+        for (auto &block: blocks)
+            ::operator delete(block.data);
+    }
+
+    void FrameArena::addBlock(size_t bytes) {
+        blocks.push_back({(unsigned char *) ::operator new(bytes), bytes});
+    }
+
+    void *FrameArena::allocate(size_t bytes, size_t alignment) {
+        auto align = [&](const Block &block, size_t from) {
+            auto base = (uintptr_t) block.data;
+            return ((base + from + alignment - 1) & ~(uintptr_t) (alignment - 1)) - base;
+        };
+
+        auto start = align(blocks[current], offset);
+        if (start + bytes > blocks[current].size) {
+            // the rest of this block is lost for the frame, the merged block in reset() covers it
+            used_before += blocks[current].size;
+            addBlock(std::max(bytes + alignment, blocks[current].size));
+            current = blocks.size() - 1;
+            counters.blocks_added++;
+            start = align(blocks[current], 0);
+        }
+        offset = start + bytes;
+        allocations++;
+        return blocks[current].data + start;
+    }
+
+    void FrameArena::reset() {
+        counters.used_bytes = used_before + offset;
+        counters.peak_bytes = std::max(counters.peak_bytes, counters.used_bytes);
+        counters.allocations = allocations;
+
+        if (blocks.size() > 1) {
+            size_t total = 0;
+            for (auto &block: blocks) {
+                total += block.size;
+                ::operator delete(block.data);
+            }
+            blocks.clear();
+            addBlock(total);
+        }
+        current = 0;
+        offset = 0;
+        used_before = 0;
+        allocations = 0;
+        counters.capacity = blocks[0].size;
+    }
+
+    PoolAllocator::~PoolAllocator() {
+        for (auto *chunk: chunks)
+            ::operator delete(chunk);
+    }
+
+    size_t PoolAllocator::classIndex(size_t bytes) {
+        size_t index = 0;
+        for (size_t size = minClassBytes; size < bytes; size *= 2)
+            index++;
+        return index;
+    }
+
+    void PoolAllocator::refill(size_t index) {
+        auto slot_bytes = minClassBytes << index;
+        auto *chunk = (unsigned char *) ::operator new(chunkBytes);
+        chunks.push_back(chunk);
+        counters.reserved_bytes += chunkBytes;
+        // threaded back to front, so the list hands the slots out in address order
+        for (size_t offset = chunkBytes; offset >= slot_bytes; offset -= slot_bytes) {
+            auto *slot = (FreeSlot *) (chunk + offset - slot_bytes);
+            slot->next = free_lists[index];
+            free_lists[index] = slot;
+        }
+    }
+
+    void *PoolAllocator::allocate(size_t bytes) {
+        if (bytes > maxClassBytes) {
+            std::lock_guard<std::mutex> lock(mutex);
+            counters.large_allocations++;
+            counters.allocations++;
+            counters.bytes_in_use += bytes;
+            counters.peak_bytes_in_use = std::max(counters.peak_bytes_in_use, counters.bytes_in_use);
+            return ::operator new(bytes);
+        }
+
+        auto index = classIndex(bytes);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (free_lists[index] == nullptr)
+            refill(index);
+        auto *slot = free_lists[index];
+        free_lists[index] = slot->next;
+        counters.allocations++;
+        counters.bytes_in_use += minClassBytes << index;
+        counters.peak_bytes_in_use = std::max(counters.peak_bytes_in_use, counters.bytes_in_use);
+        return slot;
+    }
+
+    void PoolAllocator::deallocate(void *pointer, size_t bytes) {
+        if (pointer == nullptr)
+            return;
+        if (bytes > maxClassBytes) {
+            ::operator delete(pointer);
+            std::lock_guard<std::mutex> lock(mutex);
+            counters.frees++;
+            counters.bytes_in_use -= bytes;
+            return;
+        }
+
+        auto index = classIndex(bytes);
+        auto *slot = (FreeSlot *) pointer;
+        std::lock_guard<std::mutex> lock(mutex);
+        slot->next = free_lists[index];
+        free_lists[index] = slot;
+        counters.frees++;
+        counters.bytes_in_use -= minClassBytes << index;
+    }
+
+    PoolStats PoolAllocator::stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+
+    AllocationTracker &AllocationTracker::instance() {
+        // never destroyed, operator new keeps counting through static destruction
+        alignas(AllocationTracker) static unsigned char storage[sizeof(AllocationTracker)];
+        static auto *tracker = new(storage) AllocationTracker();
+        return *tracker;
+    }
+
+    void AllocationTracker::setChecking(bool enabled, uint64_t warmup_frames) {
+        std::lock_guard<std::mutex> lock(mutex);
+        checking.store(enabled, std::memory_order_relaxed);
+        counters.checking = enabled;
+        if (enabled) {
+            warmup_left = warmup_frames;
+            warm.store(warmup_frames == 0, std::memory_order_relaxed);
+        }
+    }
+
+    void AllocationTracker::record(size_t bytes) {
+        total_allocations.fetch_add(1, std::memory_order_relaxed);
+        total_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (scope_depth == 0)
+            return;
+        frame_allocations.fetch_add(1, std::memory_order_relaxed);
+        frame_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (warm.load(std::memory_order_relaxed) && checking.load(std::memory_order_relaxed))
+            flagAllocation(bytes);
+    }
+
+    // only counts, logging could allocate itself; endFrame() reports
+    void AllocationTracker::flagAllocation(size_t bytes) {
+        if (flagged_allocations.fetch_add(1, std::memory_order_relaxed) == 0)
+            first_flagged_bytes.store(bytes, std::memory_order_relaxed);
+    }
+
+    void AllocationTracker::endFrame() {
+        auto allocations = frame_allocations.exchange(0, std::memory_order_relaxed);
+        auto bytes = frame_bytes.exchange(0, std::memory_order_relaxed);
+        auto flagged = flagged_allocations.exchange(0, std::memory_order_relaxed);
+        auto first_bytes = first_flagged_bytes.exchange(0, std::memory_order_relaxed);
+
+        uint64_t frame, flagged_frames;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            frame = ++counters.frames;
+            counters.frame_allocations = allocations;
+            counters.frame_bytes = bytes;
+            if (warmup_left > 0) {
+                if (--warmup_left == 0)
+                    warm.store(true, std::memory_order_relaxed);
+            } else {
+                counters.settled_frames++;
+                counters.steady_frames += allocations == 0;
+                counters.peak_frame_allocations = std::max(counters.peak_frame_allocations, allocations);
+                counters.peak_frame_bytes = std::max(counters.peak_frame_bytes, bytes);
+            }
+            if (flagged > 0) {
+                counters.flagged_frames++;
+                counters.flagged_allocations += flagged;
+            }
+            flagged_frames = counters.flagged_frames;
+        }
+
+        if (flagged == 0 || flagged_frames > maxLoggedFrames)
+            return;
+        CARNIVAL_LOG_WARNING("Frame {} made {} heap allocations ({} bytes), the first of {} bytes", frame, flagged,
+                             bytes, first_bytes);
+        if (flagged_frames == maxLoggedFrames)
+            CARNIVAL_LOG_WARNING("Further frames with heap allocations are only counted");
+    }
+
+    AllocationStats AllocationTracker::stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto stats = counters;
+        stats.total_allocations = total_allocations.load(std::memory_order_relaxed);
+        stats.total_bytes = total_bytes.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    AllocationScope::AllocationScope() {
+        scope_depth++;
+    }
+
+    AllocationScope::~AllocationScope() {
+        scope_depth--;
+    }
+
+    void *poolAllocate(size_t bytes, void *user_data) {
+        auto *block = (unsigned char *) ((PoolAllocator *) user_data)->allocate(bytes + poolHeaderBytes);
+        *(size_t *) block = bytes + poolHeaderBytes;
+        return block + poolHeaderBytes;
+    }
+
+    void poolFree(void *pointer, void *user_data) {
+        if (pointer == nullptr)
+            return;
+        auto *block = (unsigned char *) pointer - poolHeaderBytes;
+        ((PoolAllocator *) user_data)->deallocate(block, *(size_t *) block);
+    }
+}
+
+// Replaces the global operator new and delete to count through AllocationTracker. Only the forms without
+// an alignment: the aligned ones keep their defaults, which pair with each other.
+
+void *operator new(std::size_t bytes) {
+    carnival::core::AllocationTracker::instance().record(bytes);
+    for (;;) {
+        if (void *pointer = std::malloc(bytes != 0 ? bytes : 1))
+            return pointer;
+        auto handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void *operator new[](std::size_t bytes) {
+    return ::operator new(bytes);
+}
+
+void *operator new(std::size_t bytes, const std::nothrow_t &) noexcept {
+    try {
+        return ::operator new(bytes);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new[](std::size_t bytes, const std::nothrow_t &) noexcept {
+    return ::operator new(bytes, std::nothrow);
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept {
+    std::free(pointer);
+}
@@ -0,0 +1,216 @@
+#ifndef CARNIVAL_MEMORY_H
+#define CARNIVAL_MEMORY_H
+
+// Allocators for the frame loop and the counters that show whether it still touches the heap.
+//
+//   FrameArena        bump allocator for data that lives one frame, reset when the next one starts
+//   PoolAllocator     free lists per size class for long-lived objects that come and go, e.g. ImGui's
+//   AllocationTracker counts every operator new; with checking on, one made inside an AllocationScope
+//                     after the warmup frames is flagged
+//
+// The steady state, a frame like the one before, should make no heap allocation at all.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace carnival::core {
+
+    struct FrameArenaStats {
+        size_t used_bytes = 0;          // by the last frame
+        size_t peak_bytes = 0;
+        size_t capacity = 0;
+        uint64_t allocations = 0;       // by the last frame
+        uint64_t blocks_added = 0;      // a frame outgrew the capacity
+    };
+
+    // Hands out memory by bumping an offset and takes it all back in reset(). A frame that needs more than
+    // the block has gets extra blocks; the next reset() merges them into one block of the combined size, so
+    // after a frame or two of the largest kind the arena doesn't allocate any more.
+    // Nothing is destructed: only trivially destructible types can be created in it.
+    class FrameArena {
+    public:
+        explicit FrameArena(size_t initial_bytes = 256 * 1024);
+        ~FrameArena();
+        FrameArena(const FrameArena &) = delete;
+        FrameArena &operator=(const FrameArena &) = delete;
+
+        void *allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+        template<typename T, typename... Args>
+        T *create(Args &&... args) {
+            static_assert(std::is_trivially_destructible_v<T>, "the arena never runs destructors");
+            return new(allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+        }
+
+        // default initialized
+        template<typename T>
+        T *allocateArray(size_t count) {
+            static_assert(std::is_trivially_destructible_v<T>, "the arena never runs destructors");
+            auto *items = (T *) allocate(sizeof(T) * count, alignof(T));
+            for (size_t i = 0; i < count; i++)
+                new(items + i) T;
+            return items;
+        }
+
+        // invalidates everything handed out since the last reset
+        void reset();
+        const FrameArenaStats &stats() const { return counters; }
+
+    private:
+        struct Block {
+            unsigned char *data = nullptr;
+            size_t size = 0;
+        };
+
+        std::vector<Block> blocks;
+        size_t current = 0;         // block allocations come from
+        size_t offset = 0;          // into it
+        size_t used_before = 0;     // in the blocks before current
+        uint64_t allocations = 0;
+        FrameArenaStats counters;
+
+        void addBlock(size_t bytes);
+    };
+
+    // std::vector<T, ArenaAllocator<T>> for frame data of unknown size; deallocate() is a no-op, so
+    // growing one leaves the old storage behind until the reset
+    template<typename T>
+    struct ArenaAllocator {
+        using value_type = T;
+
+        FrameArena *arena;
+
+        explicit ArenaAllocator(FrameArena &arena) : arena(&arena) {}
+        template<typename U>
+        ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+        T *allocate(size_t count) { return (T *) arena->allocate(sizeof(T) * count, alignof(T)); }
+        void deallocate(T *, size_t) {}
+
+        template<typename U>
+        bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+        template<typename U>
+        bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+    };
+
+    struct PoolStats {
+        uint64_t allocations = 0;
+        uint64_t frees = 0;
+        uint64_t large_allocations = 0;     // above the largest class, straight from the heap
+        size_t bytes_in_use = 0;            // rounded up to the classes
+        size_t peak_bytes_in_use = 0;
+        size_t reserved_bytes = 0;          // chunks carved into the classes
+    };
+
+    // Size classes of powers of two from 16 bytes to 4 KB, each a free list threaded through its free
+    // slots. Slots come from 64 KB chunks that are only returned when the pool goes; memory freed in one
+    // class is never handed to another. Thread safe.
+    class PoolAllocator {
+    public:
+        static constexpr size_t minClassBytes = 16;
+        static constexpr size_t maxClassBytes = 4096;
+        static constexpr size_t chunkBytes = 64 * 1024;
+        static constexpr size_t classCount = 9;
+
+        PoolAllocator() = default;
+        ~PoolAllocator();
+        PoolAllocator(const PoolAllocator &) = delete;
+        PoolAllocator &operator=(const PoolAllocator &) = delete;
+
+        // aligned to 16 bytes
+        void *allocate(size_t bytes);
+        // bytes as given to allocate()
+        void deallocate(void *pointer, size_t bytes);
+        PoolStats stats() const;
+
+    private:
+        struct FreeSlot {
+            FreeSlot *next;
+        };
+
+        mutable std::mutex mutex;
+        std::array<FreeSlot *, classCount> free_lists{};
+        std::vector<unsigned char *> chunks;
+        PoolStats counters;
+
+        static size_t classIndex(size_t bytes);
+        void refill(size_t index);
+    };
+
+    struct AllocationStats {
+        uint64_t frames = 0;
+        // operator new inside an AllocationScope, on any thread
+        uint64_t frame_allocations = 0;     // in the last frame
+        uint64_t frame_bytes = 0;
+        uint64_t settled_frames = 0;        // past the warmup
+        uint64_t steady_frames = 0;         // of those, without a single one
+        uint64_t peak_frame_allocations = 0;    // of a settled frame
+        uint64_t peak_frame_bytes = 0;
+        // every operator new of the process, loading and worker threads included
+        uint64_t total_allocations = 0;
+        uint64_t total_bytes = 0;
+        // checking
+        bool checking = false;
+        uint64_t flagged_frames = 0;
+        uint64_t flagged_allocations = 0;
+    };
+
+    // Counts what operator new hands out, see Memory.cpp for the replacement. An allocation belongs to the
+    // frame loop while its thread is inside an AllocationScope, whichever thread that is; endFrame(), on the
+    // thread that runs the loop, closes a frame.
+    class AllocationTracker {
+    public:
+        // frames before the loop is expected to have settled: loading, caches and pools filling up
+        static constexpr uint64_t defaultWarmupFrames = 120;
+
+        static AllocationTracker &instance();
+
+        // flags allocations of the frame loop once the warmup is over, each frame with some is logged up to
+        // a limit; break in flagAllocation() to see where one comes from. Enabling restarts the warmup.
+        void setChecking(bool enabled, uint64_t warmup_frames = defaultWarmupFrames);
+        void endFrame();
+        AllocationStats stats() const;
+
+        // called by operator new
+        void record(size_t bytes);
+
+    private:
+        std::atomic<uint64_t> total_allocations{0};
+        std::atomic<uint64_t> total_bytes{0};
+        std::atomic<uint64_t> frame_allocations{0};
+        std::atomic<uint64_t> frame_bytes{0};
+        std::atomic<bool> checking{false};
+        std::atomic<bool> warm{false};
+        std::atomic<uint64_t> flagged_allocations{0};
+        std::atomic<size_t> first_flagged_bytes{0};
+        uint64_t warmup_left = defaultWarmupFrames;
+
+        mutable std::mutex mutex;
+        AllocationStats counters;
+
+        AllocationTracker() = default;
+        void flagAllocation(size_t bytes);
+    };
+
+    // Marks the current thread as running the frame loop until it goes out of scope.
+    class AllocationScope {
+    public:
+        AllocationScope();
+        ~AllocationScope();
+        AllocationScope(const AllocationScope &) = delete;
+        AllocationScope &operator=(const AllocationScope &) = delete;
+    };
+
+    // ImGui::SetAllocatorFunctions() signatures, user_data is a PoolAllocator
+    void *poolAllocate(size_t bytes, void *user_data);
+    void poolFree(void *pointer, void *user_data);
+}
+
+#endif //CARNIVAL_MEMORY_H
@@ -0,0 +1,167 @@
+#include "PngWriter.h"
+
+#include <algorithm>
+#include <array>
+#include "Log.h"
+
+namespace carnival::core {
+
+    // deflate's limit for a stored block
+    static const size_t maxStoredBlock = 65535;
+    // IDAT chunks are written once they reach this size
+    static const size_t chunkBytes = 1024 * 1024;
+
+    static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0) {
+        static const auto table = []() {
+            std::array<uint32_t, 256> entries{};
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                entries[n] = c;
+            }
+            return entries;
+        }();
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    static void putBigEndian(uint8_t *out, uint32_t value) {
+        out[0] = (uint8_t) (value >> 24);
+        out[1] = (uint8_t) (value >> 16);
+        out[2] = (uint8_t) (value >> 8);
+        out[3] = (uint8_t) value;
+    }
+
+    PngWriter::~PngWriter() {
+        // an image that wasn't closed stays truncated
+        if (file != nullptr)
+            std::fclose(file);
+    }
+
+    bool PngWriter::open(const std::filesystem::path &path, int image_width, int image_height) {
+        if (file != nullptr || image_width <= 0 || image_height <= 0)
+            return false;
+
+        file = std::fopen(path.string().c_str(), "wb");
+        if (file == nullptr) {
+            CARNIVAL_LOG_ERROR("Can't open {} for writing", path);
+            return false;
+        }
+
+        width = image_width;
+        height = image_height;
+        rows_written = 0;
+        bytes_written = 0;
+        failed = false;
+        adler_a = 1;
+        adler_b = 0;
+        block.clear();
+        block.reserve(maxStoredBlock);
+        idat.clear();
+        idat.reserve(chunkBytes + maxStoredBlock + 16);
+
+        const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        put(signature, sizeof(signature));
+
+        // 8 bit, RGBA, deflate, adaptive filters, no interlace
+        uint8_t header[13] = {0, 0, 0, 0, 0, 0, 0, 0, 8, 6, 0, 0, 0};
+        putBigEndian(header, (uint32_t) width);
+        putBigEndian(header + 4, (uint32_t) height);
+        writeChunk("IHDR", header, sizeof(header));
+
+        // zlib header: deflate, 32K window, no compression
+        idat = {0x78, 0x01};
+        return !failed;
+    }
+
+    void PngWriter::writeRow(const uint8_t *rgba) {
+        if (file == nullptr || rows_written >= height)
+            return;
+
+        // filter type 0, the row as it is
+        const uint8_t filter = 0;
+        deflate(&filter, 1);
+        deflate(rgba, (size_t) width * 4);
+        rows_written++;
+    }
+
+    bool PngWriter::close() {
+        if (file == nullptr)
+            return false;
+
+        // whatever is left ends the stream, an empty final block is fine too
+        finishBlock(true);
+        uint8_t adler[4];
+        putBigEndian(adler, (adler_b << 16) | adler_a);
+        idat.insert(idat.end(), adler, adler + 4);
+        writeChunk("IDAT", idat.data(), idat.size());
+        writeChunk("IEND", nullptr, 0);
+
+        bool complete = !failed && rows_written == height;
+        if (std::fclose(file) != 0)
+            complete = false;
+        file = nullptr;
+        return complete;
+    }
+
+    void PngWriter::deflate(const uint8_t *data, size_t size) {
+        // adler32, reduced every 5552 bytes, the most that can't overflow
+        for (size_t offset = 0; offset < size;) {
+            auto end = std::min(size, offset + 5552);
+            for (; offset < end; offset++) {
+                adler_a += data[offset];
+                adler_b += adler_a;
+            }
+            adler_a %= 65521;
+            adler_b %= 65521;
+        }
+
+        while (size > 0) {
+            auto take = std::min(size, maxStoredBlock - block.size());
+            block.insert(block.end(), data, data + take);
+            data += take;
+            size -= take;
+            if (block.size() == maxStoredBlock)
+                finishBlock(false);
+        }
+    }
+
+    void PngWriter::finishBlock(bool last) {
+        auto size = (uint16_t) block.size();
+        const uint8_t header[5] = {(uint8_t) (last ? 1 : 0), (uint8_t) size, (uint8_t) (size >> 8),
+                                   (uint8_t) ~size, (uint8_t) (~size >> 8)};
+        idat.insert(idat.end(), header, header + sizeof(header));
+        idat.insert(idat.end(), block.begin(), block.end());
+        block.clear();
+
+        if (!last && idat.size() >= chunkBytes) {
+            writeChunk("IDAT", idat.data(), idat.size());
+            idat.clear();
+        }
+    }
+
+    void PngWriter::writeChunk(const char *type, const uint8_t *data, size_t size) {
+        uint8_t header[8];
+        putBigEndian(header, (uint32_t) size);
+        std::copy(type, type + 4, header + 4);
+        uint8_t crc[4];
+        putBigEndian(crc, crc32(data, size, crc32(header + 4, 4)));
+
+        put(header, sizeof(header));
+        put(data, size);
+        put(crc, sizeof(crc));
+    }
+
+    void PngWriter::put(const uint8_t *data, size_t size) {
+        if (size == 0)
+            return;
+        auto written = std::fwrite(data, 1, size, file);
+        bytes_written += written;
+        if (written != size)
+            failed = true;
+    }
+}
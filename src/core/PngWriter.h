@@ -0,0 +1,47 @@
+#ifndef CARNIVAL_PNGWRITER_H
+#define CARNIVAL_PNGWRITER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+namespace carnival::core {
+
+    // Writes an RGBA8 PNG one row at a time, so an image never has to be in memory as a whole.
+    // The image data goes into stored (uncompressed) deflate blocks: no zlib needed and the writer is
+    // limited by the disk, not the CPU, at the price of files as large as the raw pixels.
+    class PngWriter {
+    public:
+        ~PngWriter();
+
+        bool open(const std::filesystem::path &path, int width, int height);
+        // top row first, width * 4 bytes
+        void writeRow(const uint8_t *rgba);
+        // false if anything failed to write or rows are missing
+        bool close();
+
+        bool isOpen() const { return file != nullptr; }
+        uint64_t bytesWritten() const { return bytes_written; }
+
+    private:
+        FILE *file = nullptr;
+        int width = 0;
+        int height = 0;
+        int rows_written = 0;
+        uint64_t bytes_written = 0;
+        bool failed = false;
+
+        uint32_t adler_a = 1;
+        uint32_t adler_b = 0;
+        std::vector<uint8_t> block;     // payload of the stored block being filled
+        std::vector<uint8_t> idat;      // IDAT chunk data being filled
+
+        void deflate(const uint8_t *data, size_t size);
+        void finishBlock(bool last);
+        void writeChunk(const char *type, const uint8_t *data, size_t size);
+        void put(const uint8_t *data, size_t size);
+    };
+}
+
+#endif //CARNIVAL_PNGWRITER_H
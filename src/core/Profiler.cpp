@@ -0,0 +1,320 @@
+#include "Profiler.h"
+
+#if CARNIVAL_ENABLE_PROFILER
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <set>
+#include "../render/GLExtensions.h"
+
+namespace carnival::core {
+
+    static const uint16_t gpuThread = 0xFFFF;
+    // weight of the newest frame in the per-pass averages
+    static const double passSmoothing = 0.05;
+
+    // ProfileRing
+
+    bool ProfileRing::push(const ProfileEvent &event) {
+        auto current_head = head.load(std::memory_order_relaxed);
+        if (current_head - tail.load(std::memory_order_acquire) >= capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        events[current_head % capacity] = event;
+        head.store(current_head + 1, std::memory_order_release);
+        return true;
+    }
+
+    template<typename F>
+    void ProfileRing::drain(F &&consume) {
+        auto current_tail = tail.load(std::memory_order_relaxed);
+        auto current_head = head.load(std::memory_order_acquire);
+
+        for (auto i = current_tail; i != current_head; i++)
+            consume(events[i % capacity]);
+
+        tail.store(current_head, std::memory_order_release);
+    }
+
+    // Profiler
+
+    Profiler &Profiler::instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    uint64_t Profiler::now() const {
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    uint16_t &Profiler::depth() {
+        thread_local uint16_t depth = 0;
+        return depth;
+    }
+
+    ProfileRing &Profiler::threadRing() {
+        // rings are never freed, a thread that exits may still have events waiting to be drained
+        thread_local ProfileRing *ring = nullptr;
+        if (ring == nullptr) {
+            ring = new ProfileRing();
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            ring->thread = (uint16_t) rings.size();
+            rings.push_back(ring);
+        }
+        return *ring;
+    }
+
+    void Profiler::record(const ProfileEvent &event) {
+        auto &ring = threadRing();
+        ProfileEvent stamped = event;
+        stamped.thread = ring.thread;
+        stamped.frame = current_frame.load(std::memory_order_relaxed);
+        ring.push(stamped);
+    }
+
+    void Profiler::beginFrame() {
+        frame++;
+        current_frame.store(frame, std::memory_order_relaxed);
+        frame_start = now();
+        depth()++;
+
+        if (!render::glext.timer_query)
+            return;
+
+        auto &gpu_frame = gpu_frames[frame % gpuFrames];
+        resolveGpu(gpu_frame);
+
+        gpu_frame.frame = frame;
+        gpu_frame.used_queries = 0;
+        gpu_frame.scopes.clear();
+
+        // both clocks count nanoseconds, only the origin differs
+        GLint64 gpu_now = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+        gpu_frame.clock_offset = (int64_t) gpu_now - (int64_t) now();
+    }
+
+    void Profiler::endFrame() {
+        depth()--;
+
+        ProfileEvent frame_event;
+        frame_event.name = "Frame";
+        frame_event.start_ns = frame_start;
+        frame_event.end_ns = now();
+        record(frame_event);
+
+        cpu_history[frame % historySize] = (float) ((double) (frame_event.end_ns - frame_start) / 1e6);
+        gpu_history[frame % historySize] = 0.0f;
+
+        std::vector<ProfileRing *> current_rings;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            current_rings = rings;
+        }
+        for (auto *ring: current_rings) {
+            ring->drain([this](const ProfileEvent &event) {
+                captured.push_back(event);
+                accumulate(event);
+            });
+        }
+
+        while (!captured.empty() && captured.front().frame + (uint64_t) capture_frames < frame)
+            captured.pop_front();
+
+        pass_timings.clear();
+        for (auto &accumulator: accumulators) {
+            auto &pass = accumulator.second;
+            pass.cpu_ms += (pass.frame_cpu_ms - pass.cpu_ms) * passSmoothing;
+            pass.frame_cpu_ms = 0.0;
+            pass_timings.push_back({pass.name, pass.depth, pass.cpu_ms, pass.gpu_ms, pass.order});
+        }
+        std::sort(pass_timings.begin(), pass_timings.end(), [](const PassTiming &a, const PassTiming &b) {
+            return a.order < b.order;
+        });
+    }
+
+    int Profiler::beginGpu(const char *name, uint16_t scope_depth) {
+        // outside beginFrame() / endFrame() nothing would ever resolve or recycle the queries
+        if (!render::glext.timer_query || scope_depth == 0)
+            return -1;
+
+        auto &gpu_frame = gpu_frames[frame % gpuFrames];
+        GpuScope scope = {name, scope_depth, nextQuery(gpu_frame), -1};
+        render::glext.QueryCounter(gpu_frame.queries[scope.begin_query], GL_TIMESTAMP);
+        gpu_frame.scopes.push_back(scope);
+        return (int) gpu_frame.scopes.size() - 1;
+    }
+
+    void Profiler::endGpu(int scope) {
+        if (scope < 0)
+            return;
+
+        auto &gpu_frame = gpu_frames[frame % gpuFrames];
+        auto query = nextQuery(gpu_frame);
+        render::glext.QueryCounter(gpu_frame.queries[query], GL_TIMESTAMP);
+        gpu_frame.scopes[scope].end_query = query;
+    }
+
+    int Profiler::nextQuery(GpuFrame &gpu_frame) {
+        if (gpu_frame.used_queries == (int) gpu_frame.queries.size()) {
+            GLuint query = 0;
+            glGenQueries(1, &query);
+            gpu_frame.queries.push_back(query);
+        }
+        return gpu_frame.used_queries++;
+    }
+
+    void Profiler::resolveGpu(GpuFrame &gpu_frame) {
+        if (gpu_frame.used_queries == 0)
+            return;
+
+        // timestamps complete in order, if the last one is there so are all others
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(gpu_frame.queries[gpu_frame.used_queries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            gpu_dropped++;
+            return;
+        }
+
+        double frame_gpu_ms = 0.0;
+        for (auto &scope: gpu_frame.scopes) {
+            if (scope.end_query < 0)
+                continue;
+
+            GLuint64 begin = 0, end = 0;
+            render::glext.GetQueryObjectui64v(gpu_frame.queries[scope.begin_query], GL_QUERY_RESULT, &begin);
+            render::glext.GetQueryObjectui64v(gpu_frame.queries[scope.end_query], GL_QUERY_RESULT, &end);
+
+            ProfileEvent event;
+            event.name = scope.name;
+            event.start_ns = (uint64_t) ((int64_t) begin - gpu_frame.clock_offset);
+            event.end_ns = (uint64_t) ((int64_t) end - gpu_frame.clock_offset);
+            event.frame = gpu_frame.frame;
+            event.depth = scope.depth;
+            event.thread = gpuThread;
+            event.gpu = true;
+
+            captured.push_back(event);
+            accumulate(event);
+            if (scope.depth <= 1)
+                frame_gpu_ms += (double) (end - begin) / 1e6;
+        }
+
+        for (auto &accumulator: accumulators) {
+            auto &pass = accumulator.second;
+            pass.gpu_ms += (pass.frame_gpu_ms - pass.gpu_ms) * passSmoothing;
+            pass.frame_gpu_ms = 0.0;
+        }
+
+        if (gpu_frame.frame + historySize > frame)
+            gpu_history[gpu_frame.frame % historySize] = (float) frame_gpu_ms;
+    }
+
+    void Profiler::accumulate(const ProfileEvent &event) {
+        auto it = accumulators.find(event.name);
+        if (it == accumulators.end()) {
+            PassAccumulator pass;
+            pass.name = event.name;
+            pass.depth = event.depth;
+            pass.order = next_order++;
+            it = accumulators.emplace(event.name, pass).first;
+        }
+
+        double ms = (double) (event.end_ns - event.start_ns) / 1e6;
+        if (event.gpu)
+            it->second.frame_gpu_ms += ms;
+        else
+            it->second.frame_cpu_ms += ms;
+    }
+
+    uint64_t Profiler::droppedEvents() const {
+        uint64_t dropped = 0;
+        for (auto *ring: rings)
+            dropped += ring->dropped.load(std::memory_order_relaxed);
+        return dropped;
+    }
+
+    bool Profiler::gpuTiming() const {
+        return render::glext.timer_query;
+    }
+
+    bool Profiler::exportChromeTrace(const std::filesystem::path &path, int frames) const {
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        if (!file.is_open())
+            return false;
+
+        uint64_t first_frame = frame > (uint64_t) frames ? frame - (uint64_t) frames : 0;
+        uint64_t origin = UINT64_MAX;
+        std::set<uint16_t> threads;
+        for (auto &event: captured) {
+            if (event.frame > first_frame) {
+                origin = std::min(origin, event.start_ns);
+                threads.insert(event.thread);
+            }
+        }
+
+        file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        for (auto thread: threads) {
+            const char *separator = first ? "" : ",\n";
+            first = false;
+            file << separator << R"({"name": "thread_name", "ph": "M", "pid": 1, "tid": )" << thread
+                 << R"(, "args": {"name": ")";
+            if (thread == gpuThread)
+                file << "GPU";
+            else if (thread == 0)
+                file << "Main";
+            else
+                file << "Thread " << thread;
+            file << "\"}}";
+        }
+
+        file.setf(std::ios::fixed);
+        file.precision(3);
+        for (auto &event: captured) {
+            if (event.frame <= first_frame)
+                continue;
+            file << ",\n" << R"({"name": ")" << event.name
+                 << R"(", "cat": ")" << (event.gpu ? "gpu" : "cpu")
+                 << R"(", "ph": "X", "pid": 1, "tid": )" << event.thread
+                 << ", \"ts\": " << (double) (event.start_ns - origin) / 1000.0
+                 << ", \"dur\": " << (double) (event.end_ns - event.start_ns) / 1000.0
+                 << ", \"args\": {\"frame\": " << event.frame << "}}";
+        }
+        file << "\n]}\n";
+
+        return (bool) file;
+    }
+
+    // scopes
+
+    ProfileScope::ProfileScope(const char *name)
+            : name(name), start(Profiler::instance().now()), depth(Profiler::instance().depth()++) {
+    }
+
+    ProfileScope::~ProfileScope() {
+        auto &profiler = Profiler::instance();
+        profiler.depth()--;
+
+        ProfileEvent event;
+        event.name = name;
+        event.start_ns = start;
+        event.end_ns = profiler.now();
+        event.depth = depth;
+        profiler.record(event);
+    }
+
+    ProfileGpuScope::ProfileGpuScope(const char *name)
+            : cpu(name), scope(Profiler::instance().beginGpu(name, Profiler::instance().depth() - 1)) {
+    }
+
+    ProfileGpuScope::~ProfileGpuScope() {
+        Profiler::instance().endGpu(scope);
+    }
+}
+
+#endif
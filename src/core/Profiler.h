@@ -0,0 +1,188 @@
+#ifndef CARNIVAL_PROFILER_H
+#define CARNIVAL_PROFILER_H
+
+// Scoped CPU / GPU profiling. Everything compiles out to nothing unless CARNIVAL_ENABLE_PROFILER is set
+// (the CARNIVAL_PROFILER CMake option).
+//
+//   CARNIVAL_PROFILE_SCOPE("decode");      CPU time of the enclosing scope, any thread
+//   CARNIVAL_PROFILE_GPU_SCOPE("renderGL"); CPU time plus GPU time, GL thread only
+
+#ifndef CARNIVAL_ENABLE_PROFILER
+#define CARNIVAL_ENABLE_PROFILER 0
+#endif
+
+#if CARNIVAL_ENABLE_PROFILER
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "glad/glad.h"
+
+namespace carnival::core {
+
+    struct ProfileEvent {
+        const char *name = nullptr;   // must outlive the profiler, i.e. a string literal
+        uint64_t start_ns = 0;
+        uint64_t end_ns = 0;
+        uint64_t frame = 0;
+        uint16_t depth = 0;
+        uint16_t thread = 0;
+        bool gpu = false;
+    };
+
+    // Single producer / single consumer ring, the owning thread pushes, endFrame() drains.
+    class ProfileRing {
+    public:
+        static const size_t capacity = 4096;
+
+        bool push(const ProfileEvent &event);
+        template<typename F>
+        void drain(F &&consume);
+
+        uint16_t thread = 0;
+        std::atomic<uint64_t> dropped{0};
+
+    private:
+        std::array<ProfileEvent, capacity> events;
+        std::atomic<size_t> head{0};
+        std::atomic<size_t> tail{0};
+    };
+
+    struct PassTiming {
+        const char *name = nullptr;
+        uint16_t depth = 0;
+        double cpu_ms = 0.0;        // smoothed per-frame averages
+        double gpu_ms = 0.0;
+        uint32_t order = 0;         // first seen, keeps the list stable
+    };
+
+    class Profiler {
+    public:
+        static const int historySize = 240;
+        // frames of GPU queries in flight; results are read when the slot comes around again and
+        // dropped if they are still not available, so the CPU never waits on the GPU
+        static const int gpuFrames = 3;
+
+        static Profiler &instance();
+
+        // GL thread, around everything that belongs to a frame
+        void beginFrame();
+        void endFrame();
+
+        void record(const ProfileEvent &event);
+        uint64_t now() const;
+        uint16_t &depth();
+
+        int beginGpu(const char *name, uint16_t depth);
+        void endGpu(int scope);
+
+        // main thread only
+        const std::vector<PassTiming> &passes() const { return pass_timings; }
+        const float *cpuHistory() const { return cpu_history; }
+        const float *gpuHistory() const { return gpu_history; }
+        int historyOffset() const { return (int) ((frame + 1) % historySize); }
+        uint64_t frameIndex() const { return frame; }
+        uint64_t droppedEvents() const;
+        uint64_t droppedGpuFrames() const { return gpu_dropped; }
+        bool gpuTiming() const;
+
+        // last `frames` frames as Chrome trace_event JSON (chrome://tracing, Perfetto)
+        bool exportChromeTrace(const std::filesystem::path &path, int frames) const;
+
+        int capture_frames = 600;
+
+    private:
+        struct GpuScope {
+            const char *name;
+            uint16_t depth;
+            int begin_query;
+            int end_query;
+        };
+
+        struct GpuFrame {
+            uint64_t frame = 0;
+            int64_t clock_offset = 0; // GPU timestamp minus CPU time at the start of the frame
+            std::vector<GLuint> queries;
+            int used_queries = 0;
+            std::vector<GpuScope> scopes;
+        };
+
+        struct PassAccumulator {
+            const char *name = nullptr;
+            uint16_t depth = 0;
+            uint32_t order = 0;
+            double cpu_ms = 0.0;
+            double gpu_ms = 0.0;
+            double frame_cpu_ms = 0.0;
+            double frame_gpu_ms = 0.0;
+        };
+
+        Profiler() = default;
+
+        std::mutex rings_mutex;
+        std::vector<ProfileRing *> rings;
+
+        uint64_t frame = 0;
+        std::atomic<uint64_t> current_frame{0}; // for scopes on other threads
+        uint64_t frame_start = 0;
+        uint64_t gpu_dropped = 0;
+        uint32_t next_order = 0;
+        GpuFrame gpu_frames[gpuFrames];
+
+        std::deque<ProfileEvent> captured;
+        std::unordered_map<std::string_view, PassAccumulator> accumulators;
+        std::vector<PassTiming> pass_timings;
+        float cpu_history[historySize] = {};
+        float gpu_history[historySize] = {};
+
+        ProfileRing &threadRing();
+        int nextQuery(GpuFrame &gpu_frame);
+        void resolveGpu(GpuFrame &gpu_frame);
+        void accumulate(const ProfileEvent &event);
+    };
+
+    class ProfileScope {
+    public:
+        explicit ProfileScope(const char *name);
+        ~ProfileScope();
+
+    private:
+        const char *name;
+        uint64_t start;
+        uint16_t depth;
+    };
+
+    class ProfileGpuScope {
+    public:
+        explicit ProfileGpuScope(const char *name);
+        ~ProfileGpuScope();
+
+    private:
+        ProfileScope cpu;
+        int scope;
+    };
+}
+
+#define CARNIVAL_PROFILE_CONCAT_(a, b) a##b
+#define CARNIVAL_PROFILE_CONCAT(a, b) CARNIVAL_PROFILE_CONCAT_(a, b)
+#define CARNIVAL_PROFILE_SCOPE(name) carnival::core::ProfileScope CARNIVAL_PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define CARNIVAL_PROFILE_GPU_SCOPE(name) carnival::core::ProfileGpuScope CARNIVAL_PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define CARNIVAL_PROFILE_BEGIN_FRAME() carnival::core::Profiler::instance().beginFrame()
+#define CARNIVAL_PROFILE_END_FRAME() carnival::core::Profiler::instance().endFrame()
+
+#else
+
+#define CARNIVAL_PROFILE_SCOPE(name) ((void) 0)
+#define CARNIVAL_PROFILE_GPU_SCOPE(name) ((void) 0)
+#define CARNIVAL_PROFILE_BEGIN_FRAME() ((void) 0)
+#define CARNIVAL_PROFILE_END_FRAME() ((void) 0)
+
+#endif
+
+#endif //CARNIVAL_PROFILER_H
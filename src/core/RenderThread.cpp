@@ -0,0 +1,134 @@
+#include "RenderThread.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace carnival::core {
+
+    // weight of the newest frame in the smoothed numbers
+    static const double loopSmoothing = 0.1;
+
+    static void smooth(double &value, double sample) {
+        value = value > 0.0 ? value + (sample - value) * loopSmoothing : sample;
+    }
+
+    static double toMs(int64_t ns) {
+        return (double) ns / 1e6;
+    }
+
+    void FrameLoopMonitor::setThreaded(bool threaded) {
+        std::lock_guard lock(mutex);
+        counters.threaded = threaded;
+    }
+
+    void FrameLoopMonitor::record(const FrameTiming &timing) {
+        std::lock_guard lock(mutex);
+        counters.frames++;
+        smooth(counters.build_ms, toMs(timing.build_end - timing.build_start));
+        smooth(counters.queued_ms, toMs(std::max<int64_t>(timing.submit_start - timing.build_end, 0)));
+        smooth(counters.submit_ms, toMs(timing.submit_end - timing.submit_start));
+        smooth(counters.present_ms, toMs(timing.present - timing.submit_end));
+        if (last_present != 0) {
+            smooth(present_interval_ms, toMs(timing.present - last_present));
+            counters.frames_per_second = present_interval_ms > 0.0 ? 1000.0 / present_interval_ms : 0.0;
+        }
+        last_present = timing.present;
+
+        auto latency = toMs(timing.present - timing.build_start);
+        if (latency_ms.size() < latencySamples) {
+            latency_ms.push_back(latency);
+        } else {
+            latency_ms[next_sample] = latency;
+            next_sample = (next_sample + 1) % latencySamples;
+        }
+    }
+
+    void FrameLoopMonitor::waited(double ms) {
+        std::lock_guard lock(mutex);
+        smooth(counters.wait_ms, ms);
+    }
+
+    FrameLoopStats FrameLoopMonitor::stats() const {
+        FrameLoopStats stats;
+        {
+            std::lock_guard lock(mutex);
+            stats = counters;
+            sorted_latency_ms.assign(latency_ms.begin(), latency_ms.end());
+        }
+        stats.latency_p90 = percentile(sorted_latency_ms, 90.0);
+        stats.latency = summarizeInPlace(sorted_latency_ms);
+        return stats;
+    }
+
+    RenderThread::~RenderThread() {
+        stop();
+    }
+
+    void RenderThread::start(Callbacks thread_callbacks) {
+        callbacks = std::move(thread_callbacks);
+        stopping = false;
+        free_frames.clear();
+        for (size_t i = 0; i < framesInFlight; i++)
+            free_frames.push_back(std::make_unique<FrameCommands>());
+        thread = std::thread(&RenderThread::run, this);
+    }
+
+    void RenderThread::stop() {
+        if (!thread.joinable())
+            return;
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        thread.join();
+        free_frames.clear();
+    }
+
+    bool RenderThread::waitReady(int timeout_ms) {
+        std::unique_lock lock(mutex);
+        return condition.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                                  [this]() { return !free_frames.empty(); });
+    }
+
+    std::unique_ptr<FrameCommands> RenderThread::acquire() {
+        std::unique_lock lock(mutex);
+        condition.wait(lock, [this]() { return !free_frames.empty(); });
+        auto frame = std::move(free_frames.back());
+        free_frames.pop_back();
+        return frame;
+    }
+
+    void RenderThread::submit(std::unique_ptr<FrameCommands> frame) {
+        {
+            std::lock_guard lock(mutex);
+            queue.push_back(std::move(frame));
+        }
+        condition.notify_all();
+    }
+
+    void RenderThread::run() {
+        callbacks.attach();
+        while (true) {
+            std::unique_ptr<FrameCommands> frame;
+            {
+                std::unique_lock lock(mutex);
+                condition.wait(lock, [this]() { return stopping || !queue.empty(); });
+                // what was queued before stop() is still presented
+                if (queue.empty())
+                    break;
+                frame = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            callbacks.submit(*frame);
+            frame->actions.clear();
+            {
+                std::lock_guard lock(mutex);
+                free_frames.push_back(std::move(frame));
+            }
+            condition.notify_all();
+        }
+        callbacks.detach();
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef CARNIVAL_RENDERTHREAD_H
+#define CARNIVAL_RENDERTHREAD_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../render/ImGuiRenderer.h"
+#include "Stats.h"
+
+namespace carnival::core {
+
+    // When a frame went through each stage, in InputSystem::now() nanoseconds.
+    struct FrameTiming {
+        int64_t build_start = 0;    // input sampled, the UI is built next
+        int64_t build_end = 0;
+        int64_t submit_start = 0;   // the GL thread started on it
+        int64_t submit_end = 0;     // everything issued, before the swap
+        int64_t present = 0;        // the swap returned
+    };
+
+    struct FrameLoopStats {
+        bool threaded = false;
+        uint64_t frames = 0;
+        double frames_per_second = 0.0;
+        // smoothed
+        double build_ms = 0.0;      // input and UI on the main thread
+        double queued_ms = 0.0;     // built until the render thread started on it
+        double submit_ms = 0.0;
+        double present_ms = 0.0;    // in the swap
+        double wait_ms = 0.0;       // main thread blocked for a free frame
+        TimingSummary latency;      // build start to present, over the last latencySamples frames
+        double latency_p90 = 0.0;
+    };
+
+    // Collects the timings of presented frames from whichever thread presents them.
+    class FrameLoopMonitor {
+    public:
+        static constexpr size_t latencySamples = 600;
+
+        void setThreaded(bool threaded);
+        void record(const FrameTiming &timing);
+        // main thread, before it could start building a frame
+        void waited(double ms);
+        FrameLoopStats stats() const;
+
+    private:
+        mutable std::mutex mutex;
+        FrameLoopStats counters;
+        std::vector<double> latency_ms;
+        // stats() sorts a copy in here, so showing them every frame doesn't allocate; main thread only
+        mutable std::vector<double> sorted_latency_ms;
+        size_t next_sample = 0;
+        int64_t last_present = 0;
+        double present_interval_ms = 0.0;
+    };
+
+    // What the render thread needs to draw a frame, built on the main thread.
+    struct FrameCommands {
+        uint64_t input_sequence = 0;    // of the snapshot it was built with
+        FrameTiming timing;
+        render::ImGuiDrawCopy gui;
+        // GL work the UI asked for, run before the frame is drawn
+        std::vector<std::function<void()>> actions;
+    };
+
+    // The thread the GL context is current on in threaded mode.
+    // Frames are double buffered: the render thread submits and presents frame N while the main thread
+    // builds N + 1 into the other FrameCommands, and N + 2 can't be started before N was presented.
+    // Queued frames are submitted in order, at most one waits while another is submitted.
+    class RenderThread {
+    public:
+        static constexpr size_t framesInFlight = 2;
+
+        struct Callbacks {
+            std::function<void()> attach;                   // first thing on the thread, makes the context current
+            std::function<void(FrameCommands &)> submit;
+            std::function<void()> detach;                   // last thing on the thread
+        };
+
+        RenderThread() = default;
+        RenderThread(const RenderThread &) = delete;
+        RenderThread &operator=(const RenderThread &) = delete;
+        ~RenderThread();
+
+        void start(Callbacks callbacks);
+        // submits what is queued, detaches and joins
+        void stop();
+        bool running() const { return thread.joinable(); }
+
+        // main thread: waits up to timeout_ms for acquire() to return without waiting
+        bool waitReady(int timeout_ms);
+        // main thread: a frame to build into, waits until one was presented
+        std::unique_ptr<FrameCommands> acquire();
+        void submit(std::unique_ptr<FrameCommands> frame);
+
+    private:
+        std::thread thread;
+        Callbacks callbacks;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::deque<std::unique_ptr<FrameCommands>> queue;
+        std::vector<std::unique_ptr<FrameCommands>> free_frames;
+        bool stopping = false;
+
+        void run();
+    };
+}
+
+#endif //CARNIVAL_RENDERTHREAD_H
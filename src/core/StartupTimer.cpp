@@ -0,0 +1,96 @@
+#include "StartupTimer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "Log.h"
+
+namespace carnival::core {
+
+    // initialized before main() runs
+    static const auto processStart = std::chrono::steady_clock::now();
+    static const auto mainThread = std::this_thread::get_id();
+
+    StartupTimer &StartupTimer::instance() {
+        static StartupTimer timer;
+        return timer;
+    }
+
+    double StartupTimer::now() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - processStart).count();
+    }
+
+    void StartupTimer::record(const char *name, double start_ms, double end_ms) {
+        StartupEvent event;
+        event.name = name;
+        event.start_ms = start_ms;
+        event.duration_ms = end_ms - start_ms;
+        event.main_thread = std::this_thread::get_id() == mainThread;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        recorded.push_back(std::move(event));
+    }
+
+    void StartupTimer::milestone(const char *name) {
+        auto time = now();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (find(name) != nullptr)
+            return;
+
+        StartupEvent event;
+        event.name = name;
+        event.start_ms = time;
+        event.milestone = true;
+        event.main_thread = std::this_thread::get_id() == mainThread;
+        recorded.push_back(std::move(event));
+    }
+
+    bool StartupTimer::reached(const char *name) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return find(name) != nullptr;
+    }
+
+    double StartupTimer::milestoneMs(const char *name) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto *event = find(name);
+        return event != nullptr ? event->start_ms : 0.0;
+    }
+
+    const StartupEvent *StartupTimer::find(const char *name) const {
+        for (auto &event: recorded) {
+            if (event.milestone && event.name == name)
+                return &event;
+        }
+        return nullptr;
+    }
+
+    void StartupTimer::report() {
+        auto all = events();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (reported)
+                return;
+            reported = true;
+        }
+
+        for (auto &event: all) {
+            if (event.milestone)
+                CARNIVAL_LOG_INFO("Startup: {} after {:.1f} ms", event.name, event.start_ms);
+            else
+                CARNIVAL_LOG_INFO("Startup:   {} {:.1f} ms (at {:.1f} ms{})", event.name, event.duration_ms,
+                                  event.start_ms, event.main_thread ? "" : ", worker");
+        }
+    }
+
+    std::vector<StartupEvent> StartupTimer::events() const {
+        std::vector<StartupEvent> sorted;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sorted = recorded;
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [](const StartupEvent &a, const StartupEvent &b) {
+            return a.start_ms < b.start_ms;
+        });
+        return sorted;
+    }
+}
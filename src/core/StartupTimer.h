@@ -0,0 +1,60 @@
+#ifndef CARNIVAL_STARTUPTIMER_H
+#define CARNIVAL_STARTUPTIMER_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace carnival::core {
+
+    struct StartupEvent {
+        std::string name;
+        double start_ms = 0.0;      // since the process started
+        double duration_ms = 0.0;   // 0 for milestones
+        bool milestone = false;
+        bool main_thread = true;
+    };
+
+    // Where the time until the first frame goes: init phases timed with StartupPhase plus
+    // milestones like the first presented frame. Times count from static initialization, which is
+    // as close to process start as portable code gets.
+    class StartupTimer {
+    public:
+        static StartupTimer &instance();
+
+        double now() const;
+        void record(const char *name, double start_ms, double end_ms);
+        // only the first call per name counts
+        void milestone(const char *name);
+        bool reached(const char *name) const;
+        double milestoneMs(const char *name) const;
+
+        // logs the breakdown, once
+        void report();
+
+        std::vector<StartupEvent> events() const;
+
+    private:
+        mutable std::mutex mutex;
+        std::vector<StartupEvent> recorded;
+        bool reported = false;
+
+        const StartupEvent *find(const char *name) const;
+    };
+
+    // Times the enclosing scope as a startup phase.
+    class StartupPhase {
+    public:
+        explicit StartupPhase(const char *name) : name(name), start_ms(StartupTimer::instance().now()) {}
+        ~StartupPhase() { StartupTimer::instance().record(name, start_ms, StartupTimer::instance().now()); }
+
+        StartupPhase(const StartupPhase &) = delete;
+        StartupPhase &operator=(const StartupPhase &) = delete;
+
+    private:
+        const char *name;
+        double start_ms;
+    };
+}
+
+#endif //CARNIVAL_STARTUPTIMER_H
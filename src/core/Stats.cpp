@@ -0,0 +1,39 @@
+#include "Stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace carnival::core {
+
+    double percentile(std::vector<double> &samples, double p)
+    {
+        if (samples.empty())
+            return 0.0;
+
+        std::sort(samples.begin(), samples.end());
+        auto rank = (size_t) std::ceil(p / 100.0 * (double) samples.size());
+        rank = std::clamp<size_t>(rank, 1, samples.size());
+        return samples[rank - 1];
+    }
+
+    TimingSummary summarize(std::vector<double> samples)
+    {
+        return summarizeInPlace(samples);
+    }
+
+    TimingSummary summarizeInPlace(std::vector<double> &samples)
+    {
+        TimingSummary summary;
+        if (samples.empty())
+            return summary;
+
+        summary.count = (int) samples.size();
+        summary.median = percentile(samples, 50.0);
+        summary.p99 = percentile(samples, 99.0);
+        summary.min = samples.front();
+        summary.max = samples.back();
+        summary.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / (double) samples.size();
+        return summary;
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef CARNIVAL_STATS_H
+#define CARNIVAL_STATS_H
+
+#include <vector>
+
+namespace carnival::core {
+
+    struct TimingSummary {
+        int count = 0;
+        double min = 0.0;
+        double median = 0.0;
+        double mean = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+    };
+
+    // nearest-rank percentile, p in [0, 100]; sorts the samples in place
+    double percentile(std::vector<double> &samples, double p);
+    TimingSummary summarize(std::vector<double> samples);
+    // the same, sorting the caller's samples, whose storage can then be reused
+    TimingSummary summarizeInPlace(std::vector<double> &samples);
+}
+
+#endif //CARNIVAL_STATS_H
@@ -0,0 +1,100 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace carnival::core {
+
+    ThreadPool::ThreadPool(size_t thread_count) {
+        if (thread_count == 0) {
+            auto hardware = (size_t) std::thread::hardware_concurrency();
+            thread_count = std::max<size_t>(hardware > 1 ? hardware - 1 : 1, 1);
+        }
+
+        workers.reserve(thread_count);
+        for (size_t i = 0; i < thread_count; i++)
+            workers.emplace_back(&ThreadPool::work, this);
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+
+        for (auto &worker: workers)
+            worker.join();
+    }
+
+    void ThreadPool::submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        condition.notify_one();
+    }
+
+    void ThreadPool::parallelFor(size_t count, size_t chunk, const std::function<void(size_t, size_t)> &fn) {
+        chunk = std::max<size_t>(chunk, 1);
+        auto chunks = (count + chunk - 1) / chunk;
+        if (chunks <= 1 || workers.empty()) {
+            if (count > 0)
+                fn(0, count);
+            return;
+        }
+
+        // helpers may only get to run after everything is done, by then there is nothing left for them
+        // and fn isn't touched anymore
+        struct Shared {
+            std::atomic<size_t> next{0};
+            std::mutex mutex;
+            std::condition_variable condition;
+            size_t done = 0;
+        };
+        auto shared = std::make_shared<Shared>();
+        auto run = [shared, chunks, chunk, count, &fn]() {
+            size_t finished = 0;
+            for (auto i = shared->next++; i < chunks; i = shared->next++) {
+                fn(i * chunk, std::min(count, (i + 1) * chunk));
+                finished++;
+            }
+            if (finished == 0)
+                return;
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            shared->done += finished;
+            if (shared->done == chunks)
+                shared->condition.notify_all();
+        };
+
+        auto helpers = std::min(workers.size(), chunks - 1);
+        for (size_t i = 0; i < helpers; i++)
+            submit(run);
+        run();
+
+        std::unique_lock<std::mutex> lock(shared->mutex);
+        shared->condition.wait(lock, [&shared, chunks] { return shared->done == chunks; });
+    }
+
+    size_t ThreadPool::queued() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return jobs.size();
+    }
+
+    void ThreadPool::work() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this] { return stopping || !jobs.empty(); });
+                // queued jobs are still run on shutdown so nobody waits on a result forever
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+}
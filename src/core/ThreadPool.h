@@ -0,0 +1,42 @@
+#ifndef CARNIVAL_THREADPOOL_H
+#define CARNIVAL_THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace carnival::core {
+
+    // Fixed set of worker threads consuming a FIFO of jobs. Jobs must not touch GL.
+    class ThreadPool {
+    public:
+        // 0 picks hardware_concurrency - 1 (the main thread is busy enough), at least one
+        explicit ThreadPool(size_t thread_count = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        void submit(std::function<void()> job);
+        // Calls fn(begin, end) for chunks of [0, count) on the workers and the calling thread, returns once
+        // every chunk is done. The caller works through the chunks as well, so calling it from a job is fine.
+        void parallelFor(size_t count, size_t chunk, const std::function<void(size_t, size_t)> &fn);
+        // jobs that haven't been picked up yet
+        size_t queued() const;
+        size_t size() const { return workers.size(); }
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> jobs;
+        mutable std::mutex mutex;
+        std::condition_variable condition;
+        bool stopping = false;
+
+        void work();
+    };
+}
+
+#endif //CARNIVAL_THREADPOOL_H
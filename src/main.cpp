@@ -1,4 +1,9 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include "core/Application.h"
+#include "core/Log.h"
 
 using namespace carnival::core;
 
@@ -6,12 +11,88 @@ Application* app;
 
 int main(int argc, char* args[])
 {
-    app = new Application();
+    ApplicationConfig config;
+    int headless_frames = 0;
+
+    // the build puts carnival_pack's output next to the executable
+    if (char *base = SDL_GetBasePath()) {
+        auto pack = std::filesystem::path(base) / "carnival.pak";
+        SDL_free(base);
+        std::error_code error;
+        if (std::filesystem::exists(pack, error))
+            config.pack_path = pack;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        // --headless [frames]: render offscreen and exit, e.g. for CI smoke runs
+        if (std::strcmp(args[i], "--headless") == 0) {
+            config.headless = true;
+            headless_frames = 100;
+            if (i + 1 < argc && std::atoi(args[i + 1]) > 0)
+                headless_frames = std::atoi(args[++i]);
+        }
+        // --path-tracer: show the CPU path tracer instead of the GL renderer
+        if (std::strcmp(args[i], "--path-tracer") == 0)
+            config.path_tracer = true;
+        // --viewports N: open viewports, up to 4
+        if (std::strcmp(args[i], "--viewports") == 0 && i + 1 < argc)
+            config.viewports = std::clamp(std::atoi(args[++i]), 1, maxViewports);
+        // --post-effects: blur and vignette the viewport through the render graph
+        if (std::strcmp(args[i], "--post-effects") == 0)
+            config.post_effects = true;
+        // --msaa N: samples per pixel of the viewports, 1 turns multisampling off
+        if (std::strcmp(args[i], "--msaa") == 0 && i + 1 < argc)
+            config.msaa_samples = std::clamp(std::atoi(args[++i]), 1, 8);
+        // --measure-input-latency: follow input events to the present, the percentiles are logged on exit
+        if (std::strcmp(args[i], "--measure-input-latency") == 0)
+            config.measure_input_latency = true;
+        // --render-thread: draw and swap on a thread of its own while the main thread handles events and the UI
+        if (std::strcmp(args[i], "--render-thread") == 0)
+            config.render_thread = true;
+        // --dynamic-resolution MS: scale the viewports down to keep each under MS of GPU time
+        if (std::strcmp(args[i], "--dynamic-resolution") == 0 && i + 1 < argc) {
+            config.dynamic_resolution = true;
+            config.resolution_budget_ms = std::max(std::atof(args[++i]), 0.1);
+        }
+        // --objects N: shapes drawn through the render queue
+        if (std::strcmp(args[i], "--objects") == 0 && i + 1 < argc)
+            config.objects = (size_t) std::max(0, std::atoi(args[++i]));
+        // --pack file: read shaders and images from this asset pack, --no-pack: only from the loose files
+        if (std::strcmp(args[i], "--pack") == 0 && i + 1 < argc)
+            config.pack_path = args[++i];
+        if (std::strcmp(args[i], "--no-pack") == 0)
+            config.pack_path.clear();
+        // --check-allocations: log every frame that allocates from the heap once the loop has settled
+        if (std::strcmp(args[i], "--check-allocations") == 0)
+            config.check_allocations = true;
+        // --no-state-cache: issue every GL state change, --validate-gl-state: check the cache against glGet*
+        if (std::strcmp(args[i], "--no-state-cache") == 0)
+            config.gl_state_cache = false;
+        if (std::strcmp(args[i], "--validate-gl-state") == 0)
+            config.validate_gl_state = true;
+        // --log file: append the log to a file instead of stderr
+        if (std::strcmp(args[i], "--log") == 0 && i + 1 < argc)
+            Log::instance().open(args[++i]);
+        // --record path: record the viewport to a .y4m, a .raw or a directory of PNGs
+        if (std::strcmp(args[i], "--record") == 0 && i + 1 < argc)
+            config.record_path = args[++i];
+        // --export WxH path: render a still in tiles to a .png or .raw, headless runs quit once it's written
+        if (std::strcmp(args[i], "--export") == 0 && i + 2 < argc
+            && std::sscanf(args[i + 1], "%dx%d", &config.export_width, &config.export_height) == 2) {
+            config.export_path = args[i + 2];
+            i += 2;
+        }
+    }
+
+    app = new Application(config);
     app->setupTriangle();
     app->setupImage();
-    app->Run();
+    if (config.headless && !config.export_path.empty())
+        app->finishExport();
+    else if (config.headless)
+        app->RunHeadless(headless_frames);
+    else
+        app->Run();
     delete app;
     return 0;
 }
-
-
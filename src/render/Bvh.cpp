@@ -0,0 +1,475 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include "BvhTraversal.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CARNIVAL_BVH_SSE 1
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace carnival::render {
+
+    using bvh::BuildNode;
+    using bvh::Triangle;
+    using bvh::TraversalRay;
+    using bvh::WideNode;
+
+    namespace {
+        const float emptyBound = 1e30f;
+
+        struct Bounds {
+            float lo[3] = {emptyBound, emptyBound, emptyBound};
+            float hi[3] = {-emptyBound, -emptyBound, -emptyBound};
+
+            void grow(const Bounds &other) {
+                for (int axis = 0; axis < 3; axis++) {
+                    lo[axis] = std::min(lo[axis], other.lo[axis]);
+                    hi[axis] = std::max(hi[axis], other.hi[axis]);
+                }
+            }
+
+            void grow(const float *point) {
+                for (int axis = 0; axis < 3; axis++) {
+                    lo[axis] = std::min(lo[axis], point[axis]);
+                    hi[axis] = std::max(hi[axis], point[axis]);
+                }
+            }
+
+            float area() const {
+                float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+                if (dx < 0.0f || dy < 0.0f || dz < 0.0f)
+                    return 0.0f;
+                return 2.0f * (dx * dy + dy * dz + dz * dx);
+            }
+        };
+
+        struct Bin {
+            Bounds bounds;
+            uint32_t count = 0;
+        };
+
+        struct BuildContext {
+            std::vector<Bounds> triangle_bounds;
+            std::vector<float> centroids;       // xyz per triangle
+            std::vector<uint32_t> ids;
+            std::vector<BuildNode> nodes;
+            std::atomic<uint32_t> node_count{1};
+            std::atomic<int> depth{0};
+
+            core::ThreadPool *pool = nullptr;
+            std::mutex mutex;
+            std::condition_variable done;
+            int outstanding = 0;
+        };
+
+        void buildRange(BuildContext &context, uint32_t node, uint32_t begin, uint32_t end, int depth);
+
+        void spawn(BuildContext &context, uint32_t node, uint32_t begin, uint32_t end, int depth) {
+            {
+                std::lock_guard<std::mutex> lock(context.mutex);
+                context.outstanding++;
+            }
+            context.pool->submit([&context, node, begin, end, depth]() {
+                buildRange(context, node, begin, end, depth);
+
+                std::lock_guard<std::mutex> lock(context.mutex);
+                if (--context.outstanding == 0)
+                    context.done.notify_all();
+            });
+        }
+
+        void buildRange(BuildContext &context, uint32_t node, uint32_t begin, uint32_t end, int depth) {
+            // the second child is handed to the pool or to a recursive call, the first one continues here
+            for (;;) {
+                Bounds bounds, centroid_bounds;
+                for (uint32_t i = begin; i < end; i++) {
+                    auto id = context.ids[i];
+                    bounds.grow(context.triangle_bounds[id]);
+                    centroid_bounds.grow(&context.centroids[id * 3]);
+                }
+
+                auto &current = context.nodes[node];
+                std::copy(bounds.lo, bounds.lo + 3, current.lo);
+                std::copy(bounds.hi, bounds.hi + 3, current.hi);
+
+                int known_depth = context.depth.load(std::memory_order_relaxed);
+                while (depth > known_depth && !context.depth.compare_exchange_weak(known_depth, depth)) {}
+
+                uint32_t count = end - begin;
+                if (count <= (uint32_t) Bvh::maxLeafSize || depth >= Bvh::maxDepth) {
+                    current.first = begin;
+                    current.count = count;
+                    return;
+                }
+
+                // binned SAH over all three axes
+                int best_axis = -1, best_split = 0;
+                float best_cost = INFINITY;
+                for (int axis = 0; axis < 3; axis++) {
+                    float extent = centroid_bounds.hi[axis] - centroid_bounds.lo[axis];
+                    if (extent <= 0.0f)
+                        continue;
+
+                    float scale = (float) Bvh::binCount / extent;
+                    Bin bins[Bvh::binCount];
+                    for (uint32_t i = begin; i < end; i++) {
+                        auto id = context.ids[i];
+                        int bin = std::min((int) ((context.centroids[id * 3 + axis] - centroid_bounds.lo[axis]) * scale),
+                                           Bvh::binCount - 1);
+                        bins[bin].bounds.grow(context.triangle_bounds[id]);
+                        bins[bin].count++;
+                    }
+
+                    float right_cost[Bvh::binCount];
+                    Bounds right;
+                    uint32_t right_count = 0;
+                    for (int bin = Bvh::binCount - 1; bin > 0; bin--) {
+                        right.grow(bins[bin].bounds);
+                        right_count += bins[bin].count;
+                        right_cost[bin] = right.area() * (float) right_count;
+                    }
+
+                    Bounds left;
+                    uint32_t left_count = 0;
+                    for (int split = 0; split < Bvh::binCount - 1; split++) {
+                        left.grow(bins[split].bounds);
+                        left_count += bins[split].count;
+                        float cost = left.area() * (float) left_count + right_cost[split + 1];
+                        if (left_count > 0 && left_count < count && cost < best_cost) {
+                            best_cost = cost;
+                            best_axis = axis;
+                            best_split = split;
+                        }
+                    }
+                }
+
+                uint32_t middle;
+                if (best_axis >= 0) {
+                    float lo = centroid_bounds.lo[best_axis];
+                    float scale = (float) Bvh::binCount / (centroid_bounds.hi[best_axis] - lo);
+                    auto *split = std::partition(context.ids.data() + begin, context.ids.data() + end, [&](uint32_t id) {
+                        int bin = std::min((int) ((context.centroids[id * 3 + best_axis] - lo) * scale), Bvh::binCount - 1);
+                        return bin <= best_split;
+                    });
+                    middle = (uint32_t) (split - context.ids.data());
+                } else {
+                    // all centroids in one spot, any split is as good as the other
+                    middle = begin + count / 2;
+                }
+
+                auto left = context.node_count.fetch_add(2);
+                current.first = left;
+                current.count = 0;
+
+                if (context.pool != nullptr && end - middle >= Bvh::parallelThreshold)
+                    spawn(context, left + 1, middle, end, depth + 1);
+                else
+                    buildRange(context, left + 1, middle, end, depth + 1);
+
+                node = left;
+                end = middle;
+                depth++;
+            }
+        }
+
+        struct ScalarTest {
+            template<int N>
+            unsigned operator()(const WideNode<N> &node, const TraversalRay &ray, float t_max, float *near) const {
+                unsigned mask = 0;
+                for (int lane = 0; lane < N; lane++) {
+                    float entry = 0.0f, exit = t_max;
+                    for (int axis = 0; axis < 3; axis++) {
+                        entry = std::max(entry, (node.bounds[ray.near[axis]][lane] - ray.origin[axis]) * ray.inverse[axis]);
+                        exit = std::min(exit, (node.bounds[ray.far[axis]][lane] - ray.origin[axis]) * ray.inverse[axis]);
+                    }
+                    near[lane] = entry;
+                    mask |= (unsigned) (entry <= exit) << lane;
+                }
+                return mask;
+            }
+        };
+
+#if CARNIVAL_BVH_SSE
+        struct Sse4Test {
+            unsigned operator()(const WideNode<4> &node, const TraversalRay &ray, float t_max, float *near) const {
+                __m128 origin_x = _mm_set1_ps(ray.origin[0]), inverse_x = _mm_set1_ps(ray.inverse[0]);
+                __m128 origin_y = _mm_set1_ps(ray.origin[1]), inverse_y = _mm_set1_ps(ray.inverse[1]);
+                __m128 origin_z = _mm_set1_ps(ray.origin[2]), inverse_z = _mm_set1_ps(ray.inverse[2]);
+
+                __m128 near_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.near[0]]), origin_x), inverse_x);
+                __m128 near_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.near[1]]), origin_y), inverse_y);
+                __m128 near_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.near[2]]), origin_z), inverse_z);
+                __m128 far_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.far[0]]), origin_x), inverse_x);
+                __m128 far_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.far[1]]), origin_y), inverse_y);
+                __m128 far_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.far[2]]), origin_z), inverse_z);
+
+                __m128 entry = _mm_max_ps(_mm_max_ps(near_x, near_y), _mm_max_ps(near_z, _mm_setzero_ps()));
+                __m128 exit = _mm_min_ps(_mm_min_ps(far_x, far_y), _mm_min_ps(far_z, _mm_set1_ps(t_max)));
+                _mm_store_ps(near, entry);
+                return (unsigned) _mm_movemask_ps(_mm_cmple_ps(entry, exit));
+            }
+        };
+#endif
+
+        bool cpuHasAvx2() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+            int info[4];
+            __cpuid(info, 1);
+            // the OS has to save the AVX registers too
+            bool os_saves_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+            if (!os_saves_avx)
+                return false;
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+        }
+
+        template<int N>
+        WideNode<N> emptyWideNode() {
+            WideNode<N> node = {};
+            for (int lane = 0; lane < N; lane++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    node.bounds[axis * 2][lane] = emptyBound;
+                    node.bounds[axis * 2 + 1][lane] = -emptyBound;
+                }
+            }
+            return node;
+        }
+
+        float nodeArea(const BuildNode &node) {
+            Bounds bounds;
+            std::copy(node.lo, node.lo + 3, bounds.lo);
+            std::copy(node.hi, node.hi + 3, bounds.hi);
+            return bounds.area();
+        }
+    }
+
+    const char *traversalName(BvhTraversal traversal) {
+        switch (traversal) {
+            case BvhTraversal::Scalar:
+                return "scalar";
+            case BvhTraversal::Sse4:
+                return "sse4";
+            case BvhTraversal::Avx8:
+                return "avx2_8";
+        }
+        return "unknown";
+    }
+
+    bool traversalSupported(BvhTraversal traversal) {
+        switch (traversal) {
+            case BvhTraversal::Scalar:
+                return true;
+            case BvhTraversal::Sse4:
+#if CARNIVAL_BVH_SSE
+                return true;
+#else
+                return false;
+#endif
+            case BvhTraversal::Avx8: {
+                static const bool supported = bvh::avx2Compiled() && cpuHasAvx2();
+                return supported;
+            }
+        }
+        return false;
+    }
+
+    BvhTraversal bestTraversal() {
+        if (traversalSupported(BvhTraversal::Avx8))
+            return BvhTraversal::Avx8;
+        if (traversalSupported(BvhTraversal::Sse4))
+            return BvhTraversal::Sse4;
+        return BvhTraversal::Scalar;
+    }
+
+    void Bvh::clear() {
+        triangles.clear();
+        triangle_ids.clear();
+        nodes4.clear();
+        nodes8.clear();
+        counters = BvhStats();
+    }
+
+    void Bvh::build(const Mesh &mesh, core::ThreadPool *pool) {
+        clear();
+        auto count = (uint32_t) mesh.triangleCount();
+        counters.triangles = count;
+        if (count == 0)
+            return;
+
+        auto start = std::chrono::steady_clock::now();
+
+        BuildContext context;
+        context.pool = pool;
+        context.triangle_bounds.resize(count);
+        context.centroids.resize((size_t) count * 3);
+        context.ids.resize(count);
+        // a binary tree with at least one triangle per leaf never has more nodes than this
+        context.nodes.resize((size_t) count * 2 - 1);
+
+        for (uint32_t i = 0; i < count; i++) {
+            auto &bounds = context.triangle_bounds[i];
+            for (int corner = 0; corner < 3; corner++) {
+                auto vertex = mesh.indices[(size_t) i * 3 + corner];
+                float point[3] = {mesh.x[vertex], mesh.y[vertex], mesh.z[vertex]};
+                bounds.grow(point);
+            }
+            for (int axis = 0; axis < 3; axis++)
+                context.centroids[(size_t) i * 3 + axis] = 0.5f * (bounds.lo[axis] + bounds.hi[axis]);
+            context.ids[i] = i;
+        }
+
+        if (pool != nullptr) {
+            std::unique_lock<std::mutex> lock(context.mutex);
+            context.outstanding = 1;
+        }
+        buildRange(context, 0, 0, count, 1);
+        if (pool != nullptr) {
+            std::unique_lock<std::mutex> lock(context.mutex);
+            context.outstanding--;
+            context.done.wait(lock, [&context]() { return context.outstanding == 0; });
+        }
+
+        context.nodes.resize(context.node_count.load());
+        counters.build_nodes = context.nodes.size();
+        counters.depth = context.depth.load();
+
+        triangles.resize(count);
+        triangle_ids = std::move(context.ids);
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t *corners = &mesh.indices[(size_t) triangle_ids[i] * 3];
+            Vec3 v0 = mesh.vertex(corners[0]), e1 = mesh.vertex(corners[1]) - v0, e2 = mesh.vertex(corners[2]) - v0;
+            triangles[i] = {{v0.x, v0.y, v0.z}, {e1.x, e1.y, e1.z}, {e2.x, e2.y, e2.z}};
+        }
+
+        float root_area = std::max(nodeArea(context.nodes[0]), 1e-20f);
+        for (auto &node: context.nodes) {
+            float relative = nodeArea(node) / root_area;
+            counters.sah_cost += node.count == 0 ? relative : relative * (double) node.count;
+            counters.leaves += node.count != 0;
+        }
+
+        auto built = std::chrono::steady_clock::now();
+        counters.build_ms = std::chrono::duration<double, std::milli>(built - start).count();
+
+        collapse<4>(context.nodes, 0, nodes4);
+        collapse<8>(context.nodes, 0, nodes8);
+        counters.nodes4 = nodes4.size();
+        counters.nodes8 = nodes8.size();
+        counters.collapse_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - built).count();
+
+        setTraversal(bestTraversal());
+    }
+
+    template<int N>
+    uint32_t Bvh::collapse(const std::vector<BuildNode> &build_nodes, uint32_t index, std::vector<WideNode<N>> &out) {
+        auto wide = (uint32_t) out.size();
+        out.push_back(emptyWideNode<N>());
+
+        // open up the largest inner child until all slots are used
+        uint32_t children[N];
+        int child_count = 0;
+        if (build_nodes[index].count != 0) {
+            children[child_count++] = index;
+        } else {
+            children[child_count++] = build_nodes[index].first;
+            children[child_count++] = build_nodes[index].first + 1;
+        }
+
+        while (child_count < N) {
+            int largest = -1;
+            float largest_area = -1.0f;
+            for (int i = 0; i < child_count; i++) {
+                auto &child = build_nodes[children[i]];
+                if (child.count == 0 && nodeArea(child) > largest_area) {
+                    largest = i;
+                    largest_area = nodeArea(child);
+                }
+            }
+            if (largest < 0)
+                break;
+
+            auto left = build_nodes[children[largest]].first;
+            children[largest] = left;
+            children[child_count++] = left + 1;
+        }
+
+        for (int lane = 0; lane < child_count; lane++) {
+            auto &child = build_nodes[children[lane]];
+            uint32_t target = child.first, count = child.count;
+            if (count == 0)
+                target = collapse<N>(build_nodes, children[lane], out);
+
+            // out may have grown, index again
+            auto &node = out[wide];
+            for (int axis = 0; axis < 3; axis++) {
+                node.bounds[axis * 2][lane] = child.lo[axis];
+                node.bounds[axis * 2 + 1][lane] = child.hi[axis];
+            }
+            node.child[lane] = target;
+            node.count[lane] = count;
+        }
+
+        return wide;
+    }
+
+    void Bvh::setTraversal(BvhTraversal traversal) {
+        mode = traversalSupported(traversal) ? traversal : BvhTraversal::Scalar;
+    }
+
+    bool Bvh::intersect(const Vec3 &origin, const Vec3 &direction, float t_max, RayHit &hit) const {
+        hit.t = t_max;
+        hit.u = hit.v = 0.0f;
+        hit.triangle = noTriangle;
+        if (empty())
+            return false;
+
+        TraversalRay ray = {};
+        for (int axis = 0; axis < 3; axis++) {
+            float component = direction[axis];
+            // keeps 0 * inf out of the slab test
+            if (std::fabs(component) < 1e-12f)
+                component = std::copysign(1e-12f, component);
+            ray.origin[axis] = origin[axis];
+            ray.direction[axis] = direction[axis];
+            ray.inverse[axis] = 1.0f / component;
+            ray.near[axis] = axis * 2 + (component < 0.0f);
+            ray.far[axis] = axis * 2 + (component >= 0.0f);
+        }
+
+        bool found;
+        switch (mode) {
+#if CARNIVAL_BVH_SSE
+            case BvhTraversal::Sse4:
+                found = bvh::traverse<4>(nodes4.data(), triangles.data(), ray, hit, Sse4Test());
+                break;
+#endif
+            case BvhTraversal::Avx8:
+                found = bvh::intersectAvx2(nodes8.data(), triangles.data(), ray, hit);
+                break;
+            default:
+                found = bvh::traverse<4>(nodes4.data(), triangles.data(), ray, hit, ScalarTest());
+                break;
+        }
+
+        if (found)
+            hit.triangle = triangle_ids[hit.triangle];
+        return found;
+    }
+}
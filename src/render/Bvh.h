@@ -0,0 +1,120 @@
+#ifndef CARNIVAL_BVH_H
+#define CARNIVAL_BVH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Mesh.h"
+#include "../common/vec3.h"
+#include "../core/ThreadPool.h"
+
+namespace carnival::render {
+
+    enum class BvhTraversal {
+        Scalar, // 4 wide nodes, one child at a time
+        Sse4,   // 4 wide nodes, all children in one SSE slab test
+        Avx8    // 8 wide nodes, AVX2
+    };
+
+    const char *traversalName(BvhTraversal traversal);
+    // compiled in and supported by this CPU
+    bool traversalSupported(BvhTraversal traversal);
+    BvhTraversal bestTraversal();
+
+    const uint32_t noTriangle = 0xFFFFFFFFu;
+
+    struct RayHit {
+        float t;
+        float u;                // barycentrics of the hit
+        float v;
+        uint32_t triangle;      // index into the mesh, noTriangle on a miss
+    };
+
+    struct BvhStats {
+        size_t triangles = 0;
+        size_t build_nodes = 0;  // binary nodes before collapsing
+        size_t nodes4 = 0;
+        size_t nodes8 = 0;
+        size_t leaves = 0;
+        int depth = 0;           // of the binary tree
+        double sah_cost = 0.0;
+        double build_ms = 0.0;   // binary tree
+        double collapse_ms = 0.0;
+    };
+
+    namespace bvh {
+        // laid out for the Moeller-Trumbore test
+        struct Triangle {
+            float v0[3];
+            float e1[3];
+            float e2[3];
+        };
+
+        // Children are structure of arrays so one slab test covers all of them. bounds holds
+        // min x, max x, min y, max y, min z, max z. A child with count > 0 is a leaf with the
+        // triangles [child, child + count), count == 0 is an inner node, child == 0 an empty slot
+        // (the root is never anybody's child).
+        template<int N>
+        struct alignas(32) WideNode {
+            float bounds[6][N];
+            uint32_t child[N];
+            uint32_t count[N];
+        };
+
+        struct BuildNode {
+            float lo[3];
+            float hi[3];
+            uint32_t first;    // first triangle for leaves, left child for inner nodes (right is left + 1)
+            uint32_t count;    // 0 for inner nodes
+        };
+
+        // a ray prepared for the slab tests
+        struct TraversalRay {
+            float origin[3];
+            float direction[3];
+            float inverse[3];
+            int near[3];       // bounds row of the plane the ray enters through, per axis
+            int far[3];
+        };
+    }
+
+    // Bounding volume hierarchy over a triangle mesh.
+    // Built top down with binned SAH; large subtrees are built in parallel on the thread pool.
+    // The binary tree is then collapsed into 4 and 8 wide trees for SIMD traversal, the
+    // traversal itself is picked at runtime depending on what the CPU supports.
+    class Bvh {
+    public:
+        static const int binCount = 16;
+        static const int maxLeafSize = 4;
+        static const int maxDepth = 64;
+        // subtrees with fewer triangles are built by the task that created them
+        static const size_t parallelThreshold = 16384;
+
+        // pool == nullptr builds on the calling thread
+        void build(const Mesh &mesh, core::ThreadPool *pool = nullptr);
+        void clear();
+        bool empty() const { return nodes4.empty(); }
+
+        // unsupported choices fall back to Scalar
+        void setTraversal(BvhTraversal traversal);
+        BvhTraversal traversal() const { return mode; }
+
+        // closest hit in (0, t_max)
+        bool intersect(const Vec3 &origin, const Vec3 &direction, float t_max, RayHit &hit) const;
+
+        const BvhStats &stats() const { return counters; }
+
+    private:
+        std::vector<bvh::Triangle> triangles;   // in leaf order
+        std::vector<uint32_t> triangle_ids;     // leaf order to mesh order
+        std::vector<bvh::WideNode<4>> nodes4;
+        std::vector<bvh::WideNode<8>> nodes8;
+        BvhTraversal mode = BvhTraversal::Scalar;
+        BvhStats counters;
+
+        template<int N>
+        uint32_t collapse(const std::vector<bvh::BuildNode> &build_nodes, uint32_t index, std::vector<bvh::WideNode<N>> &out);
+    };
+}
+
+#endif //CARNIVAL_BVH_H
@@ -0,0 +1,51 @@
+// 8 wide traversal. This file is compiled with AVX2 enabled (see CMakeLists.txt) and only called after
+// the CPU was checked, keep everything else out of it.
+
+#include "BvhTraversal.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace carnival::render::bvh {
+
+#if defined(__AVX2__)
+
+    namespace {
+        struct Avx8Test {
+            unsigned operator()(const WideNode<8> &node, const TraversalRay &ray, float t_max, float *near) const {
+                __m256 near_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.near[0]]), _mm256_set1_ps(ray.origin[0])), _mm256_set1_ps(ray.inverse[0]));
+                __m256 near_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.near[1]]), _mm256_set1_ps(ray.origin[1])), _mm256_set1_ps(ray.inverse[1]));
+                __m256 near_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.near[2]]), _mm256_set1_ps(ray.origin[2])), _mm256_set1_ps(ray.inverse[2]));
+                __m256 far_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.far[0]]), _mm256_set1_ps(ray.origin[0])), _mm256_set1_ps(ray.inverse[0]));
+                __m256 far_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.far[1]]), _mm256_set1_ps(ray.origin[1])), _mm256_set1_ps(ray.inverse[1]));
+                __m256 far_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.far[2]]), _mm256_set1_ps(ray.origin[2])), _mm256_set1_ps(ray.inverse[2]));
+
+                __m256 entry = _mm256_max_ps(_mm256_max_ps(near_x, near_y), _mm256_max_ps(near_z, _mm256_setzero_ps()));
+                __m256 exit = _mm256_min_ps(_mm256_min_ps(far_x, far_y), _mm256_min_ps(far_z, _mm256_set1_ps(t_max)));
+                _mm256_store_ps(near, entry);
+                return (unsigned) _mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ));
+            }
+        };
+    }
+
+    bool avx2Compiled() {
+        return true;
+    }
+
+    bool intersectAvx2(const WideNode<8> *nodes, const Triangle *triangles, const TraversalRay &ray, RayHit &hit) {
+        return traverse<8>(nodes, triangles, ray, hit, Avx8Test());
+    }
+
+#else
+
+    bool avx2Compiled() {
+        return false;
+    }
+
+    bool intersectAvx2(const WideNode<8> *, const Triangle *, const TraversalRay &, RayHit &) {
+        return false;
+    }
+
+#endif
+}
@@ -0,0 +1,119 @@
+#ifndef CARNIVAL_BVHTRAVERSAL_H
+#define CARNIVAL_BVHTRAVERSAL_H
+
+// Traversal loop shared by Bvh.cpp and BvhAvx2.cpp. Included by both, so everything here has internal
+// linkage and only uses plain arithmetic: code compiled with AVX2 enabled must never end up in an inline
+// function the linker could pick for the baseline build.
+
+#include "Bvh.h"
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace carnival::render::bvh {
+
+    // BvhAvx2.cpp
+    bool avx2Compiled();
+    bool intersectAvx2(const WideNode<8> *nodes, const Triangle *triangles, const TraversalRay &ray, RayHit &hit);
+
+    namespace {
+        // deep enough for maxDepth levels of 8 wide nodes
+        const int stackSize = Bvh::maxDepth * 8;
+
+        struct StackEntry {
+            float t;
+            uint32_t child;
+            uint32_t count;
+        };
+
+        inline int lowestBit(unsigned mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return (int) index;
+#else
+            return __builtin_ctz(mask);
+#endif
+        }
+
+        // Moeller-Trumbore, updates the hit if closer
+        inline bool intersectTriangle(const Triangle &triangle, uint32_t index, const TraversalRay &ray, RayHit &hit) {
+            const float *d = ray.direction;
+            const float *e1 = triangle.e1;
+            const float *e2 = triangle.e2;
+
+            float p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+            float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+            if (det == 0.0f)
+                return false;
+            float inverse_det = 1.0f / det;
+
+            float s[3] = {ray.origin[0] - triangle.v0[0], ray.origin[1] - triangle.v0[1], ray.origin[2] - triangle.v0[2]};
+            float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inverse_det;
+            if (u < 0.0f || u > 1.0f)
+                return false;
+
+            float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+            float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inverse_det;
+            if (v < 0.0f || u + v > 1.0f)
+                return false;
+
+            float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inverse_det;
+            if (t <= 0.0f || t >= hit.t)
+                return false;
+
+            hit.t = t;
+            hit.u = u;
+            hit.v = v;
+            hit.triangle = index;
+            return true;
+        }
+
+        // ChildTest(node, ray, t_max, near) returns a bit per child the ray enters before t_max
+        // and writes the entry distances to near
+        template<int N, typename ChildTest>
+        inline bool traverse(const WideNode<N> *nodes, const Triangle *triangles, const TraversalRay &ray, RayHit &hit,
+                             ChildTest test) {
+            StackEntry stack[stackSize];
+            int top = 0;
+            stack[top++] = {0.0f, 0, 0};
+            bool found = false;
+
+            while (top > 0) {
+                StackEntry entry = stack[--top];
+                if (entry.t > hit.t)
+                    continue;
+
+                if (entry.count != 0) {
+                    for (uint32_t i = entry.child; i < entry.child + entry.count; i++)
+                        found = intersectTriangle(triangles[i], i, ray, hit) || found;
+                    continue;
+                }
+
+                const auto &node = nodes[entry.child];
+                alignas(32) float near[N];
+                unsigned mask = test(node, ray, hit.t, near);
+
+                // sorted so the nearest child is popped first
+                int first = top;
+                while (mask != 0) {
+                    int lane = lowestBit(mask);
+                    mask &= mask - 1;
+
+                    StackEntry child = {near[lane], node.child[lane], node.count[lane]};
+                    int i = top++;
+                    while (i > first && stack[i - 1].t < child.t) {
+                        stack[i] = stack[i - 1];
+                        i--;
+                    }
+                    stack[i] = child;
+                }
+            }
+
+            return found;
+        }
+    }
+}
+
+#endif //CARNIVAL_BVHTRAVERSAL_H
@@ -0,0 +1,76 @@
+#include "DemoScene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace carnival::render {
+
+    static const float pi = 3.14159265358979f;
+
+    // regular polygon around the origin with radius 1, as a triangle fan
+    static MeshHandle addPolygon(RenderQueue &queue, int corners) {
+        std::vector<float> positions = {0.0f, 0.0f, 0.0f};
+        std::vector<uint32_t> indices;
+        for (int corner = 0; corner < corners; corner++) {
+            float angle = 2.0f * pi * (float) corner / (float) corners + pi / 2.0f;
+            positions.insert(positions.end(), {std::cos(angle), std::sin(angle), 0.0f});
+            indices.insert(indices.end(), {0u, (uint32_t) corner + 1, (uint32_t) (corner + 1) % corners + 1});
+        }
+        return queue.addMesh(positions.data(), positions.size() / 3, indices.data(), indices.size());
+    }
+
+    void DemoScene::init(RenderQueue &queue) {
+        meshes = {addPolygon(queue, 3), addPolygon(queue, 4), addPolygon(queue, 6), addPolygon(queue, 24)};
+    }
+
+    void DemoScene::resize(size_t count) {
+        count = std::min(count, maxObjects);
+        if (count == objects.size() || meshes.empty())
+            return;
+
+        std::mt19937 random(4242);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        // shapes shrink as the count grows so the viewport stays readable
+        float base_size = 0.08f / std::sqrt(std::max((float) count / 100.0f, 1.0f));
+
+        objects.resize(count);
+        for (auto &object: objects) {
+            object.x = unit(random) * 2.0f - 1.0f;
+            object.y = unit(random) * 2.0f - 1.0f;
+            object.size = base_size * (0.5f + unit(random));
+            object.rotation = unit(random) * 2.0f * pi;
+            object.spin = (unit(random) - 0.5f) * 4.0f;
+            object.depth = unit(random);
+            object.color = (uint32_t) (64 + unit(random) * 191) | (uint32_t) (64 + unit(random) * 191) << 8
+                           | (uint32_t) (64 + unit(random) * 191) << 16 | 0xFF000000u;
+            object.mesh = meshes[std::min((size_t) (unit(random) * (float) meshes.size()), meshes.size() - 1)];
+        }
+    }
+
+    void DemoScene::update(float seconds) {
+        for (auto &object: objects)
+            object.rotation = std::fmod(object.rotation + object.spin * seconds, 2.0f * pi);
+    }
+
+    void DemoScene::submit(RenderQueue &queue, GLuint program, float aspect, const ViewRegion &region) const {
+        float scale_x = 2.0f / (region.x1 - region.x0);
+        float scale_y = 2.0f / (region.y1 - region.y0);
+        float center_x = (region.x0 + region.x1) * 0.5f;
+        float center_y = (region.y0 + region.y1) * 0.5f;
+
+        for (auto &object: objects) {
+            // the meshes fit into the unit circle, whatever the rotation
+            float extent_x = object.size / aspect;
+            float extent_y = object.size;
+            if (object.x + extent_x < region.x0 || object.x - extent_x > region.x1
+                || object.y + extent_y < region.y0 || object.y - extent_y > region.y1)
+                continue;
+
+            ObjectData data = {{(object.x - center_x) * scale_x, (object.y - center_y) * scale_y,
+                                extent_x * scale_x, extent_y * scale_y}, object.rotation, object.depth,
+                               object.color, 0};
+            queue.submit(program, 0, object.mesh, data);
+        }
+    }
+}
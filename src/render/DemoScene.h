@@ -0,0 +1,42 @@
+#ifndef CARNIVAL_DEMOSCENE_H
+#define CARNIVAL_DEMOSCENE_H
+
+#include <cstddef>
+#include <vector>
+#include "RenderQueue.h"
+#include "RenderTarget.h"
+
+namespace carnival::render {
+
+    // Lots of small spinning shapes for the raster viewport, enough to put load on the render queue.
+    class DemoScene {
+    public:
+        static constexpr size_t maxObjects = 100000;
+
+        // registers the shapes with the queue
+        void init(RenderQueue &queue);
+        // same count, same objects: they come from a fixed seed
+        void resize(size_t count);
+        size_t size() const { return objects.size(); }
+
+        void update(float seconds);
+        // aspect is the full image's, region the part of it that is drawn; shapes outside it are skipped
+        void submit(RenderQueue &queue, GLuint program, float aspect, const ViewRegion &region = ViewRegion()) const;
+
+    private:
+        struct Object {
+            float x, y;
+            float size;
+            float rotation;
+            float spin;      // radians per second
+            float depth;
+            uint32_t color;
+            MeshHandle mesh;
+        };
+
+        std::vector<MeshHandle> meshes;
+        std::vector<Object> objects;
+    };
+}
+
+#endif //CARNIVAL_DEMOSCENE_H
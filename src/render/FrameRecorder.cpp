@@ -0,0 +1,340 @@
+#include "FrameRecorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "GLState.h"
+#include "../core/Log.h"
+#include "../core/PngWriter.h"
+#include "../core/Profiler.h"
+
+namespace carnival::render {
+
+    // a readback is left alone for this many captures, by then the copy is normally done
+    static const uint64_t mapDelay = 2;
+
+    // Y4M
+
+    // full range BT.601, which is what C420jpeg means
+    static void convertToYuv420(const uint8_t *pixels, int width, int height, std::vector<uint8_t> &out) {
+        int chroma_width = (width + 1) / 2;
+        int chroma_height = (height + 1) / 2;
+        out.resize((size_t) width * height + 2 * (size_t) chroma_width * chroma_height);
+        uint8_t *y_plane = out.data();
+        uint8_t *u_plane = y_plane + (size_t) width * height;
+        uint8_t *v_plane = u_plane + (size_t) chroma_width * chroma_height;
+
+        auto pixel = [&](int x, int y) {
+            // GL rows start at the bottom
+            return pixels + ((size_t) (height - 1 - y) * width + x) * 4;
+        };
+
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                auto *p = pixel(x, y);
+                y_plane[(size_t) y * width + x] = (uint8_t) ((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+            }
+        }
+
+        for (int cy = 0; cy < chroma_height; cy++) {
+            for (int cx = 0; cx < chroma_width; cx++) {
+                // average of the 2x2 block, clamped at odd edges
+                int r = 0, g = 0, b = 0;
+                for (int dy = 0; dy < 2; dy++) {
+                    for (int dx = 0; dx < 2; dx++) {
+                        auto *p = pixel(std::min(cx * 2 + dx, width - 1), std::min(cy * 2 + dy, height - 1));
+                        r += p[0];
+                        g += p[1];
+                        b += p[2];
+                    }
+                }
+                int u = (-43 * r - 85 * g + 128 * b) / 1024 + 128;
+                int v = (128 * r - 107 * g - 21 * b) / 1024 + 128;
+                u_plane[(size_t) cy * chroma_width + cx] = (uint8_t) std::clamp(u, 0, 255);
+                v_plane[(size_t) cy * chroma_width + cx] = (uint8_t) std::clamp(v, 0, 255);
+            }
+        }
+    }
+
+    // FrameRecorder
+
+    FrameRecorder::~FrameRecorder() {
+        // without a context the GL side is gone anyway, but the file has to be closed
+        if (active) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            condition.notify_one();
+            writer.join();
+            if (stream != nullptr)
+                std::fclose(stream);
+        }
+    }
+
+    RecordingFormat FrameRecorder::formatFor(const std::filesystem::path &path) {
+        auto extension = path.extension().string();
+        if (extension == ".y4m")
+            return RecordingFormat::Y4M;
+        if (extension == ".raw" || extension == ".rgba")
+            return RecordingFormat::Raw;
+        return RecordingFormat::PngSequence;
+    }
+
+    bool FrameRecorder::start(const std::filesystem::path &path, RecordingFormat recording_format, int frame_rate) {
+        if (active)
+            return false;
+
+        std::error_code error;
+        if (recording_format == RecordingFormat::PngSequence) {
+            std::filesystem::create_directories(path, error);
+        } else if (path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path(), error);
+        }
+        if (error) {
+            CARNIVAL_LOG_ERROR("Can't create {}: {}", path, error.message());
+            return false;
+        }
+
+        if (recording_format != RecordingFormat::PngSequence) {
+            stream = std::fopen(path.string().c_str(), "wb");
+            if (stream == nullptr) {
+                CARNIVAL_LOG_ERROR("Can't open {} for writing", path);
+                return false;
+            }
+        }
+
+        format = recording_format;
+        output_path = path;
+        fps = std::max(frame_rate, 1);
+        stream_width = stream_height = 0;
+        frame_index = 0;
+        next_readback = 0;
+        counters = FrameRecorderStats();
+        stopping = false;
+
+        for (auto &readback: readbacks) {
+            readback = Readback();
+            glGenBuffers(1, &readback.buffer);
+        }
+
+        writer = std::thread(&FrameRecorder::run, this);
+        active = true;
+        CARNIVAL_LOG_INFO("Recording to {}", path);
+        return true;
+    }
+
+    void FrameRecorder::stop() {
+        if (!active)
+            return;
+
+        collect(true);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_one();
+        writer.join();
+
+        for (auto &readback: readbacks) {
+            if (readback.fence != nullptr)
+                glDeleteSync(readback.fence);
+            glstate.deleteBuffers(1, &readback.buffer);
+            readback = Readback();
+        }
+        if (stream != nullptr)
+            std::fclose(stream);
+        stream = nullptr;
+        free_frames.clear();
+        active = false;
+
+        auto summary = stats();
+        CARNIVAL_LOG_INFO("Recorded {} frames to {} ({:.1f} MB), dropped {} (readback {}, writer {}, size {})",
+                          summary.written, output_path, (double) summary.bytes_written / (1024.0 * 1024.0),
+                          summary.dropped_readback + summary.dropped_writer + summary.dropped_size,
+                          summary.dropped_readback, summary.dropped_writer, summary.dropped_size);
+        if (format == RecordingFormat::Raw && stream_width > 0) {
+            CARNIVAL_LOG_INFO("Play it with: ffplay -f rawvideo -pixel_format rgba -video_size {}x{} -framerate {} {}",
+                              stream_width, stream_height, fps, output_path);
+        }
+    }
+
+    void FrameRecorder::capture(GLuint framebuffer, int width, int height) {
+        if (!active || width <= 0 || height <= 0)
+            return;
+        CARNIVAL_PROFILE_SCOPE("capture frame");
+        auto start = std::chrono::steady_clock::now();
+
+        collect(false);
+
+        // the oldest readback is the one to reuse, if it's still in flight so are all the others
+        auto &readback = readbacks[next_readback];
+        if (readback.fence != nullptr) {
+            std::lock_guard<std::mutex> lock(mutex);
+            counters.dropped_readback++;
+            return;
+        }
+
+        if (format != RecordingFormat::PngSequence) {
+            if (stream_width == 0) {
+                stream_width = width;
+                stream_height = height;
+            }
+            if (width != stream_width || height != stream_height) {
+                std::lock_guard<std::mutex> lock(mutex);
+                counters.dropped_size++;
+                return;
+            }
+        }
+
+        auto size = (size_t) width * (size_t) height * 4;
+        glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        if (readback.capacity < size) {
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) size, nullptr, GL_STREAM_READ);
+            readback.capacity = size;
+        }
+
+        GLuint previous_read_framebuffer = glstate.readFramebuffer();
+        glstate.bindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        // into the buffer, returns right away
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glstate.bindFramebuffer(GL_READ_FRAMEBUFFER, previous_read_framebuffer);
+        glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        readback.width = width;
+        readback.height = height;
+        readback.sequence = issued++;
+        next_readback = (next_readback + 1) % readbackDepth;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.captured++;
+        counters.capture_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void FrameRecorder::collect(bool wait) {
+        // oldest first, fences signal in order
+        for (int i = 0; i < readbackDepth; i++) {
+            auto &readback = readbacks[(next_readback + i) % readbackDepth];
+            if (readback.fence == nullptr)
+                continue;
+
+            if (!wait) {
+                if (issued - readback.sequence < mapDelay)
+                    break;
+                if (glClientWaitSync(readback.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                    break;
+            } else {
+                while (glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000) == GL_TIMEOUT_EXPIRED) {}
+            }
+            enqueue(readback, wait);
+        }
+    }
+
+    void FrameRecorder::enqueue(Readback &readback, bool keep) {
+        glDeleteSync(readback.fence);
+        readback.fence = nullptr;
+
+        Frame frame;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // stop() keeps everything, it's about to wait for the writer anyway
+            if (queue.size() >= maxQueuedFrames && !keep) {
+                counters.dropped_writer++;
+                return;
+            }
+            if (!free_frames.empty()) {
+                frame = std::move(free_frames.back());
+                free_frames.pop_back();
+            }
+        }
+
+        auto size = (size_t) readback.width * (size_t) readback.height * 4;
+        glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        auto *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr) size, GL_MAP_READ_BIT);
+        if (mapped != nullptr) {
+            frame.pixels.resize(size);
+            std::memcpy(frame.pixels.data(), mapped, size);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (mapped == nullptr)
+            return;
+
+        frame.width = readback.width;
+        frame.height = readback.height;
+        frame.index = frame_index++;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(frame));
+            counters.queued = queue.size();
+        }
+        condition.notify_one();
+    }
+
+    void FrameRecorder::run() {
+        std::vector<uint8_t> scratch;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            condition.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty())
+                break;
+
+            Frame frame = std::move(queue.front());
+            queue.pop_front();
+            counters.queued = queue.size();
+            lock.unlock();
+
+            auto start = std::chrono::steady_clock::now();
+            write(frame, scratch);
+            auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            lock.lock();
+            counters.write_ms = ms;
+            free_frames.push_back(std::move(frame));
+        }
+    }
+
+    void FrameRecorder::write(const Frame &frame, std::vector<uint8_t> &scratch) {
+        CARNIVAL_PROFILE_SCOPE("write frame");
+        size_t bytes = 0;
+
+        if (format == RecordingFormat::Y4M) {
+            if (frame.index == 0) {
+                char header[128];
+                int length = std::snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+                                           frame.width, frame.height, fps);
+                bytes += std::fwrite(header, 1, (size_t) length, stream);
+            }
+            convertToYuv420(frame.pixels.data(), frame.width, frame.height, scratch);
+            bytes += std::fwrite("FRAME\n", 1, 6, stream);
+            bytes += std::fwrite(scratch.data(), 1, scratch.size(), stream);
+        } else if (format == RecordingFormat::Raw) {
+            // top row first, like every other raw video
+            size_t row_bytes = (size_t) frame.width * 4;
+            for (int y = frame.height - 1; y >= 0; y--)
+                bytes += std::fwrite(frame.pixels.data() + (size_t) y * row_bytes, 1, row_bytes, stream);
+        } else {
+            char name[32];
+            std::snprintf(name, sizeof(name), "frame_%06llu.png", (unsigned long long) frame.index);
+            core::PngWriter png;
+            if (!png.open(output_path / name, frame.width, frame.height))
+                return;
+            size_t row_bytes = (size_t) frame.width * 4;
+            for (int y = frame.height - 1; y >= 0; y--)
+                png.writeRow(frame.pixels.data() + (size_t) y * row_bytes);
+            png.close();
+            bytes = png.bytesWritten();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.written++;
+        counters.bytes_written += bytes;
+    }
+
+    FrameRecorderStats FrameRecorder::stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef CARNIVAL_FRAMERECORDER_H
+#define CARNIVAL_FRAMERECORDER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "glad/glad.h"
+
+namespace carnival::render {
+
+    enum class RecordingFormat {
+        Y4M,        // 4:2:0 YUV stream, plays in ffplay / mpv and encodes with anything
+        Raw,        // RGBA frames back to back, see the log for the matching ffmpeg arguments
+        PngSequence // frame_000000.png ... in a directory, see core::PngWriter
+    };
+
+    struct FrameRecorderStats {
+        uint64_t captured = 0;          // readbacks issued
+        uint64_t written = 0;
+        uint64_t dropped_readback = 0;  // every pixel pack buffer was still in flight
+        uint64_t dropped_writer = 0;    // the writer queue was full
+        uint64_t dropped_size = 0;      // Y4M and raw keep the size they started with
+        uint64_t bytes_written = 0;
+        size_t queued = 0;              // frames waiting for the writer
+        double capture_ms = 0.0;        // GL thread time of the last capture()
+        double write_ms = 0.0;          // writer time of the last frame
+    };
+
+    // Records what is drawn into a framebuffer without stalling the GL thread.
+    // capture() starts an asynchronous glReadPixels into one of readbackDepth pixel pack buffers and
+    // fences it; a buffer is mapped once its fence has signalled, which is normally a couple of frames
+    // later. The pixels go to a writer thread that converts and writes them. When either the readback
+    // ring or the writer queue is full the frame is dropped and counted, capture() never waits.
+    class FrameRecorder {
+    public:
+        static constexpr int readbackDepth = 4;
+        static constexpr size_t maxQueuedFrames = 8;
+
+        ~FrameRecorder();
+
+        // the format follows the extension: .y4m, .raw / .rgba, anything else is a PNG directory
+        static RecordingFormat formatFor(const std::filesystem::path &path);
+
+        // with a current context
+        bool start(const std::filesystem::path &path, RecordingFormat format, int fps = 60);
+        // collects what is still in flight, waits for the writer and closes the output
+        void stop();
+        bool recording() const { return active; }
+        const std::filesystem::path &path() const { return output_path; }
+
+        // GL thread, after the frame was drawn into framebuffer
+        void capture(GLuint framebuffer, int width, int height);
+
+        FrameRecorderStats stats() const;
+
+    private:
+        struct Frame {
+            std::vector<uint8_t> pixels;    // RGBA, bottom row first as GL returns it
+            int width = 0;
+            int height = 0;
+            uint64_t index = 0;
+        };
+
+        struct Readback {
+            GLuint buffer = 0;
+            GLsync fence = nullptr;
+            size_t capacity = 0;
+            int width = 0;
+            int height = 0;
+            uint64_t sequence = 0;
+        };
+
+        RecordingFormat format = RecordingFormat::Y4M;
+        std::filesystem::path output_path;
+        int fps = 60;
+        bool active = false;
+        int stream_width = 0;               // Y4M / raw, fixed by the first frame
+        int stream_height = 0;
+
+        Readback readbacks[readbackDepth];
+        int next_readback = 0;              // the oldest one in flight is the next to be reused
+        uint64_t issued = 0;
+
+        std::thread writer;
+        mutable std::mutex mutex;
+        std::condition_variable condition;
+        std::deque<Frame> queue;
+        std::vector<Frame> free_frames;     // pixel storage is reused
+        bool stopping = false;
+        FILE *stream = nullptr;
+        uint64_t frame_index = 0;
+        FrameRecorderStats counters;
+
+        // maps every readback whose fence signalled, oldest first; wait blocks until they all did
+        void collect(bool wait);
+        // hands the pixels to the writer, or drops them when its queue is full and keep isn't set
+        void enqueue(Readback &readback, bool keep);
+        void run();
+        void write(const Frame &frame, std::vector<uint8_t> &scratch);
+    };
+}
+
+#endif //CARNIVAL_FRAMERECORDER_H
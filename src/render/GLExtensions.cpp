@@ -0,0 +1,103 @@
+#include "GLExtensions.h"
+
+#include <unordered_set>
+#include "../common/hash.h"
+
+namespace carnival::render {
+
+    GLExtensions glext;
+
+    // hashes of the context's extension names, listed on the first query instead of once per query
+    static std::unordered_set<uint64_t> extension_hashes;
+    static bool extensions_listed = false;
+
+    bool hasGLVersion(int major, int minor)
+    {
+        return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+    }
+
+    bool hasGLExtension(const char *name)
+    {
+        if (!extensions_listed) {
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            extension_hashes.reserve((size_t) count);
+            for (GLint i = 0; i < count; i++)
+                extension_hashes.insert(hashString((const char *) glGetStringi(GL_EXTENSIONS, i)));
+            extensions_listed = true;
+        }
+        return extension_hashes.count(hashString(name)) != 0;
+    }
+
+    void loadGLExtensions(GLADloadproc load)
+    {
+        glext = GLExtensions();
+        // a new context may support something else
+        extension_hashes.clear();
+        extensions_listed = false;
+
+        // some loaders hand out pointers for anything, so the version / extension check comes first
+        if (hasGLVersion(3, 3) || hasGLExtension("GL_ARB_timer_query")) {
+            glext.QueryCounter = (PFNGLQUERYCOUNTERPROC) load("glQueryCounter");
+            glext.GetQueryObjecti64v = (PFNGLGETQUERYOBJECTI64VPROC) load("glGetQueryObjecti64v");
+            glext.GetQueryObjectui64v = (PFNGLGETQUERYOBJECTUI64VPROC) load("glGetQueryObjectui64v");
+        }
+
+        glext.timer_query = glext.QueryCounter && glext.GetQueryObjecti64v && glext.GetQueryObjectui64v;
+
+        if (hasGLVersion(4, 1) || hasGLExtension("GL_ARB_get_program_binary")) {
+            glext.GetProgramBinary = (PFNGLGETPROGRAMBINARYPROC) load("glGetProgramBinary");
+            glext.ProgramBinary = (PFNGLPROGRAMBINARYPROC) load("glProgramBinary");
+            glext.ProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC) load("glProgramParameteri");
+
+            GLint formats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            glext.program_binary = formats > 0 && glext.GetProgramBinary && glext.ProgramBinary && glext.ProgramParameteri;
+        }
+
+        if (hasGLExtension("GL_KHR_parallel_shader_compile")) {
+            glext.MaxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) load("glMaxShaderCompilerThreadsKHR");
+        } else if (hasGLExtension("GL_ARB_parallel_shader_compile")) {
+            glext.MaxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) load("glMaxShaderCompilerThreadsARB");
+        }
+        glext.parallel_shader_compile = glext.MaxShaderCompilerThreads != nullptr;
+
+        if (hasGLVersion(3, 3) || hasGLExtension("GL_ARB_instanced_arrays"))
+            glext.VertexAttribDivisor = (PFNGLVERTEXATTRIBDIVISORPROC) load("glVertexAttribDivisor");
+        glext.instanced_arrays = glext.VertexAttribDivisor != nullptr;
+
+        if (hasGLVersion(4, 2) || hasGLExtension("GL_ARB_base_instance")) {
+            glext.DrawElementsInstancedBaseVertexBaseInstance =
+                    (PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXBASEINSTANCEPROC) load("glDrawElementsInstancedBaseVertexBaseInstance");
+        }
+        glext.base_instance = glext.DrawElementsInstancedBaseVertexBaseInstance != nullptr;
+
+        if (hasGLVersion(4, 2) || hasGLExtension("GL_ARB_shader_image_load_store"))
+            glext.MemoryBarrier = (PFNGLMEMORYBARRIERPROC) load("glMemoryBarrier");
+        glext.memory_barrier = glext.MemoryBarrier != nullptr;
+
+        if (hasGLVersion(4, 3) || hasGLExtension("GL_ARB_invalidate_subdata"))
+            glext.InvalidateFramebuffer = (PFNGLINVALIDATEFRAMEBUFFERPROC) load("glInvalidateFramebuffer");
+        glext.invalidate_framebuffer = glext.InvalidateFramebuffer != nullptr;
+
+        glext.shader_storage = hasGLVersion(4, 3) || hasGLExtension("GL_ARB_shader_storage_buffer_object");
+
+        if (hasGLVersion(4, 3) || hasGLExtension("GL_ARB_multi_draw_indirect"))
+            glext.MultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC) load("glMultiDrawElementsIndirect");
+        glext.multi_draw_indirect = glext.MultiDrawElementsIndirect != nullptr;
+
+        if (hasGLVersion(4, 3) || hasGLExtension("GL_ARB_program_interface_query")) {
+            glext.GetProgramInterfaceiv = (PFNGLGETPROGRAMINTERFACEIVPROC) load("glGetProgramInterfaceiv");
+            glext.GetProgramResourceName = (PFNGLGETPROGRAMRESOURCENAMEPROC) load("glGetProgramResourceName");
+            glext.GetProgramResourceiv = (PFNGLGETPROGRAMRESOURCEIVPROC) load("glGetProgramResourceiv");
+        }
+        glext.program_interface_query = glext.GetProgramInterfaceiv && glext.GetProgramResourceName
+                                        && glext.GetProgramResourceiv;
+
+        if (hasGLVersion(4, 4) || hasGLExtension("GL_ARB_buffer_storage"))
+            glext.BufferStorage = (PFNGLBUFFERSTORAGEPROC) load("glBufferStorage");
+        glext.buffer_storage = glext.BufferStorage != nullptr;
+
+        glext.texture_compression_s3tc = hasGLExtension("GL_EXT_texture_compression_s3tc");
+    }
+}
@@ -0,0 +1,151 @@
+#ifndef CARNIVAL_GLEXTENSIONS_H
+#define CARNIVAL_GLEXTENSIONS_H
+
+#include "glad/glad.h"
+
+// glad is generated for GL 3.2, everything newer we use is loaded here at runtime
+// and has to be checked for before use.
+
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+#ifndef GL_TIMESTAMP
+#define GL_TIMESTAMP 0x8E28
+#endif
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER_BINDING
+#define GL_SHADER_STORAGE_BUFFER_BINDING 0x90D3
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+#define GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT 0x90DF
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER_BINDING
+#define GL_DRAW_INDIRECT_BUFFER_BINDING 0x8F43
+#endif
+#ifndef GL_TEXTURE_FETCH_BARRIER_BIT
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#define GL_FRAMEBUFFER_BARRIER_BIT 0x00000400
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#endif
+#ifndef GL_UNIFORM_BLOCK
+#define GL_UNIFORM 0x92E1
+#define GL_UNIFORM_BLOCK 0x92E2
+#define GL_ACTIVE_RESOURCES 0x92F5
+#define GL_MAX_NAME_LENGTH 0x92F6
+#define GL_TYPE 0x92FA
+#define GL_ARRAY_SIZE 0x92FB
+#define GL_OFFSET 0x92FC
+#define GL_ARRAY_STRIDE 0x92FE
+#define GL_MATRIX_STRIDE 0x92FF
+#define GL_BUFFER_BINDING 0x9302
+#define GL_BUFFER_DATA_SIZE 0x9303
+#define GL_NUM_ACTIVE_VARIABLES 0x9304
+#define GL_ACTIVE_VARIABLES 0x9305
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+namespace carnival::render {
+
+    typedef void (APIENTRYP PFNGLQUERYCOUNTERPROC)(GLuint id, GLenum target);
+    typedef void (APIENTRYP PFNGLGETQUERYOBJECTI64VPROC)(GLuint id, GLenum pname, GLint64 *params);
+    typedef void (APIENTRYP PFNGLGETQUERYOBJECTUI64VPROC)(GLuint id, GLenum pname, GLuint64 *params);
+    typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+    typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+    typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+    typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+    typedef void (APIENTRYP PFNGLVERTEXATTRIBDIVISORPROC)(GLuint index, GLuint divisor);
+    typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+    typedef void (APIENTRYP PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXBASEINSTANCEPROC)(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instancecount, GLint basevertex, GLuint baseinstance);
+    typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+    typedef void (APIENTRYP PFNGLINVALIDATEFRAMEBUFFERPROC)(GLenum target, GLsizei numAttachments, const GLenum *attachments);
+    typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+    typedef void (APIENTRYP PFNGLGETPROGRAMINTERFACEIVPROC)(GLuint program, GLenum programInterface, GLenum pname, GLint *params);
+    typedef void (APIENTRYP PFNGLGETPROGRAMRESOURCENAMEPROC)(GLuint program, GLenum programInterface, GLuint index, GLsizei bufSize, GLsizei *length, GLchar *name);
+    typedef void (APIENTRYP PFNGLGETPROGRAMRESOURCEIVPROC)(GLuint program, GLenum programInterface, GLuint index, GLsizei propCount, const GLenum *props, GLsizei count, GLsizei *length, GLint *params);
+
+    struct GLExtensions {
+        // GL 3.3 / ARB_timer_query
+        bool timer_query = false;
+        PFNGLQUERYCOUNTERPROC QueryCounter = nullptr;
+        PFNGLGETQUERYOBJECTI64VPROC GetQueryObjecti64v = nullptr;
+        PFNGLGETQUERYOBJECTUI64VPROC GetQueryObjectui64v = nullptr;
+
+        // GL 4.1 / ARB_get_program_binary, only set if the driver offers at least one binary format
+        bool program_binary = false;
+        PFNGLGETPROGRAMBINARYPROC GetProgramBinary = nullptr;
+        PFNGLPROGRAMBINARYPROC ProgramBinary = nullptr;
+        PFNGLPROGRAMPARAMETERIPROC ProgramParameteri = nullptr;
+
+        // KHR_parallel_shader_compile (or the ARB version), GL_COMPLETION_STATUS_KHR can be polled
+        bool parallel_shader_compile = false;
+        PFNGLMAXSHADERCOMPILERTHREADSKHRPROC MaxShaderCompilerThreads = nullptr;
+
+        // GL 3.3 / ARB_instanced_arrays
+        bool instanced_arrays = false;
+        PFNGLVERTEXATTRIBDIVISORPROC VertexAttribDivisor = nullptr;
+
+        // GL 4.2 / ARB_base_instance
+        bool base_instance = false;
+        PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXBASEINSTANCEPROC DrawElementsInstancedBaseVertexBaseInstance = nullptr;
+
+        // GL 4.2 / ARB_shader_image_load_store, only the barrier so far
+        bool memory_barrier = false;
+        PFNGLMEMORYBARRIERPROC MemoryBarrier = nullptr;
+
+        // GL 4.3 / ARB_invalidate_subdata, only the framebuffer part
+        bool invalidate_framebuffer = false;
+        PFNGLINVALIDATEFRAMEBUFFERPROC InvalidateFramebuffer = nullptr;
+
+        // GL 4.3 / ARB_shader_storage_buffer_object, nothing to load
+        bool shader_storage = false;
+
+        // GL 4.3 / ARB_multi_draw_indirect
+        bool multi_draw_indirect = false;
+        PFNGLMULTIDRAWELEMENTSINDIRECTPROC MultiDrawElementsIndirect = nullptr;
+
+        // GL 4.3 / ARB_program_interface_query, without it uniform blocks are reflected through glGetActiveUniformBlockiv
+        bool program_interface_query = false;
+        PFNGLGETPROGRAMINTERFACEIVPROC GetProgramInterfaceiv = nullptr;
+        PFNGLGETPROGRAMRESOURCENAMEPROC GetProgramResourceName = nullptr;
+        PFNGLGETPROGRAMRESOURCEIVPROC GetProgramResourceiv = nullptr;
+
+        // GL 4.4 / ARB_buffer_storage, for persistently mapped buffers
+        bool buffer_storage = false;
+        PFNGLBUFFERSTORAGEPROC BufferStorage = nullptr;
+
+        // EXT_texture_compression_s3tc, BC1 to BC3 through glCompressedTexImage2D
+        bool texture_compression_s3tc = false;
+    };
+
+    extern GLExtensions glext;
+
+    // must be called with a current context, after glad
+    void loadGLExtensions(GLADloadproc load);
+
+    bool hasGLVersion(int major, int minor);
+    // the extension list is hashed on the first call after loadGLExtensions()
+    bool hasGLExtension(const char *name);
+}
+
+#endif //CARNIVAL_GLEXTENSIONS_H
@@ -0,0 +1,424 @@
+#include "GLState.h"
+
+#include <algorithm>
+#include "../core/Log.h"
+
+namespace carnival::render {
+
+    GLStateCache glstate;
+
+    namespace {
+        // mismatches logged while validating, the rest are only counted
+        const uint64_t maxLoggedMismatches = 20;
+
+        const GLenum bufferTargets[] = {GL_ARRAY_BUFFER, GL_COPY_WRITE_BUFFER, GL_PIXEL_PACK_BUFFER,
+                                        GL_PIXEL_UNPACK_BUFFER, GL_DRAW_INDIRECT_BUFFER, GL_UNIFORM_BUFFER,
+                                        GL_SHADER_STORAGE_BUFFER};
+        // GL_COPY_WRITE_BUFFER is its own binding's name before GL 4.2
+        const GLenum bufferBindings[] = {GL_ARRAY_BUFFER_BINDING, GL_COPY_WRITE_BUFFER, GL_PIXEL_PACK_BUFFER_BINDING,
+                                         GL_PIXEL_UNPACK_BUFFER_BINDING, GL_DRAW_INDIRECT_BUFFER_BINDING,
+                                         GL_UNIFORM_BUFFER_BINDING, GL_SHADER_STORAGE_BUFFER_BINDING};
+        const GLenum capabilityNames[] = {GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST, GL_SCISSOR_TEST, GL_STENCIL_TEST,
+                                          GL_MULTISAMPLE};
+        const GLenum blendFunctionNames[] = {GL_BLEND_SRC_RGB, GL_BLEND_DST_RGB, GL_BLEND_SRC_ALPHA, GL_BLEND_DST_ALPHA};
+    }
+
+    const char *stateKindName(GLStateKind kind)
+    {
+        switch (kind) {
+            case GLStateKind::Program:
+                return "program";
+            case GLStateKind::VertexArray:
+                return "vertex array";
+            case GLStateKind::Buffer:
+                return "buffer";
+            case GLStateKind::Texture:
+                return "texture";
+            case GLStateKind::Framebuffer:
+                return "framebuffer";
+            case GLStateKind::Viewport:
+                return "viewport";
+            case GLStateKind::Capability:
+                return "enable / disable";
+            case GLStateKind::Blend:
+                return "blend";
+            case GLStateKind::Depth:
+                return "depth";
+            case GLStateKind::Scissor:
+                return "scissor";
+            case GLStateKind::Count:
+                break;
+        }
+        return "?";
+    }
+
+    int GLStateCache::bufferIndex(GLenum target)
+    {
+        for (size_t i = 0; i < bufferTargetCount; i++) {
+            if (bufferTargets[i] == target)
+                return (int) i;
+        }
+        return -1;
+    }
+
+    int GLStateCache::capabilityIndex(GLenum capability)
+    {
+        for (size_t i = 0; i < capabilityCount; i++) {
+            if (capabilityNames[i] == capability)
+                return (int) i;
+        }
+        return -1;
+    }
+
+    void GLStateCache::forget()
+    {
+        program = unknown;
+        vertex_array = unknown;
+        element_buffer = unknown;
+        buffers.fill(unknown);
+        active_unit = unknown;
+        textures.fill(unknown);
+        draw_framebuffer = unknown;
+        read_framebuffer = unknown;
+        viewport_known = false;
+        scissor_known = false;
+        capabilities.fill(-1);
+        blend_equation = unknown;
+        blend_functions.fill(unknown);
+        depth_function = unknown;
+        depth_mask = -1;
+    }
+
+    void GLStateCache::invalidate()
+    {
+        forget();
+        invalidations++;
+    }
+
+    bool GLStateCache::elide(GLStateKind kind, bool same)
+    {
+        if (enabled && same) {
+            elided[(size_t) kind]++;
+            return true;
+        }
+        issued[(size_t) kind]++;
+        return false;
+    }
+
+    bool GLStateCache::agrees(const char *what, GLenum pname, const GLint *expected, int count)
+    {
+        if (!validating)
+            return true;
+        GLint actual[4] = {};
+        glGetIntegerv(pname, actual);
+        auto differs = std::mismatch(expected, expected + count, actual);
+        if (differs.first == expected + count)
+            return true;
+
+        if (++counters.mismatches <= maxLoggedMismatches) {
+            CARNIVAL_LOG_WARNING("GL state: {} is {}, cached {} (value {} of {}); something changed it past the cache",
+                                 what, *differs.second, *differs.first, differs.first - expected + 1, count);
+            if (counters.mismatches == maxLoggedMismatches)
+                CARNIVAL_LOG_WARNING("Further GL state mismatches are only counted");
+        }
+        return false;
+    }
+
+    void GLStateCache::useProgram(GLuint id)
+    {
+        if (elide(GLStateKind::Program, program == id) && agrees("program", GL_CURRENT_PROGRAM, (GLint) id))
+            return;
+        glUseProgram(id);
+        program = id;
+    }
+
+    void GLStateCache::bindVertexArray(GLuint id)
+    {
+        if (elide(GLStateKind::VertexArray, vertex_array == id)
+            && agrees("vertex array", GL_VERTEX_ARRAY_BINDING, (GLint) id))
+            return;
+        glBindVertexArray(id);
+        // the element buffer binding is part of the vertex array
+        if (vertex_array != id)
+            element_buffer = unknown;
+        vertex_array = id;
+    }
+
+    void GLStateCache::bindBuffer(GLenum target, GLuint buffer)
+    {
+        if (target == GL_ELEMENT_ARRAY_BUFFER) {
+            if (elide(GLStateKind::Buffer, element_buffer == buffer)
+                && agrees("element buffer", GL_ELEMENT_ARRAY_BUFFER_BINDING, (GLint) buffer))
+                return;
+            glBindBuffer(target, buffer);
+            element_buffer = vertex_array != unknown ? buffer : unknown;
+            return;
+        }
+
+        auto index = bufferIndex(target);
+        if (index < 0) {
+            issued[(size_t) GLStateKind::Buffer]++;
+            glBindBuffer(target, buffer);
+            return;
+        }
+        if (elide(GLStateKind::Buffer, buffers[index] == buffer)
+            && agrees("buffer", bufferBindings[index], (GLint) buffer))
+            return;
+        glBindBuffer(target, buffer);
+        buffers[index] = buffer;
+    }
+
+    void GLStateCache::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        issued[(size_t) GLStateKind::Buffer]++;
+        glBindBufferRange(target, index, buffer, offset, size);
+        auto generic = bufferIndex(target);
+        if (generic >= 0)
+            buffers[generic] = buffer;
+    }
+
+    void GLStateCache::activeTexture(GLenum unit)
+    {
+        if (elide(GLStateKind::Texture, active_unit == unit)
+            && agrees("active texture", GL_ACTIVE_TEXTURE, (GLint) unit))
+            return;
+        glActiveTexture(unit);
+        active_unit = unit;
+    }
+
+    void GLStateCache::bindTexture(GLenum target, GLuint texture)
+    {
+        auto unit = active_unit - GL_TEXTURE0;
+        if (target != GL_TEXTURE_2D || active_unit == unknown || unit >= (GLuint) maxTextureUnits) {
+            issued[(size_t) GLStateKind::Texture]++;
+            glBindTexture(target, texture);
+            return;
+        }
+        if (elide(GLStateKind::Texture, textures[unit] == texture)
+            && agrees("2D texture", GL_TEXTURE_BINDING_2D, (GLint) texture))
+            return;
+        glBindTexture(target, texture);
+        textures[unit] = texture;
+    }
+
+    void GLStateCache::bindFramebuffer(GLenum target, GLuint framebuffer)
+    {
+        bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+        bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+        bool same = (!draw || draw_framebuffer == framebuffer) && (!read || read_framebuffer == framebuffer);
+        if (elide(GLStateKind::Framebuffer, same)
+            && (!draw || agrees("draw framebuffer", GL_DRAW_FRAMEBUFFER_BINDING, (GLint) framebuffer))
+            && (!read || agrees("read framebuffer", GL_READ_FRAMEBUFFER_BINDING, (GLint) framebuffer)))
+            return;
+        glBindFramebuffer(target, framebuffer);
+        if (draw)
+            draw_framebuffer = framebuffer;
+        if (read)
+            read_framebuffer = framebuffer;
+    }
+
+    void GLStateCache::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+    {
+        std::array<GLint, 4> box = {x, y, width, height};
+        if (elide(GLStateKind::Viewport, viewport_known && viewport_box == box)
+            && agrees("viewport", GL_VIEWPORT, box.data(), 4))
+            return;
+        glViewport(x, y, width, height);
+        viewport_box = box;
+        viewport_known = true;
+    }
+
+    void GLStateCache::scissor(GLint x, GLint y, GLsizei width, GLsizei height)
+    {
+        std::array<GLint, 4> box = {x, y, width, height};
+        if (elide(GLStateKind::Scissor, scissor_known && scissor_box == box)
+            && agrees("scissor box", GL_SCISSOR_BOX, box.data(), 4))
+            return;
+        glScissor(x, y, width, height);
+        scissor_box = box;
+        scissor_known = true;
+    }
+
+    void GLStateCache::setCapability(GLenum capability, bool on)
+    {
+        auto index = capabilityIndex(capability);
+        if (index < 0) {
+            issued[(size_t) GLStateKind::Capability]++;
+            on ? glEnable(capability) : glDisable(capability);
+            return;
+        }
+        // the capabilities can be queried by their own name
+        if (elide(GLStateKind::Capability, capabilities[index] == (int8_t) on)
+            && agrees("capability", capability, (GLint) on))
+            return;
+        on ? glEnable(capability) : glDisable(capability);
+        capabilities[index] = (int8_t) on;
+    }
+
+    void GLStateCache::blendEquation(GLenum mode)
+    {
+        if (elide(GLStateKind::Blend, blend_equation == mode)
+            && agrees("blend equation", GL_BLEND_EQUATION_RGB, (GLint) mode)
+            && agrees("blend equation", GL_BLEND_EQUATION_ALPHA, (GLint) mode))
+            return;
+        glBlendEquation(mode);
+        blend_equation = mode;
+    }
+
+    void GLStateCache::blendFuncSeparate(GLenum source_rgb, GLenum destination_rgb, GLenum source_alpha,
+                                         GLenum destination_alpha)
+    {
+        std::array<GLenum, 4> functions = {source_rgb, destination_rgb, source_alpha, destination_alpha};
+        if (elide(GLStateKind::Blend, blend_functions == functions)
+            && agrees("blend source", GL_BLEND_SRC_RGB, (GLint) source_rgb)
+            && agrees("blend destination", GL_BLEND_DST_RGB, (GLint) destination_rgb)
+            && agrees("blend source alpha", GL_BLEND_SRC_ALPHA, (GLint) source_alpha)
+            && agrees("blend destination alpha", GL_BLEND_DST_ALPHA, (GLint) destination_alpha))
+            return;
+        glBlendFuncSeparate(source_rgb, destination_rgb, source_alpha, destination_alpha);
+        blend_functions = functions;
+    }
+
+    void GLStateCache::depthFunc(GLenum function)
+    {
+        if (elide(GLStateKind::Depth, depth_function == function)
+            && agrees("depth function", GL_DEPTH_FUNC, (GLint) function))
+            return;
+        glDepthFunc(function);
+        depth_function = function;
+    }
+
+    void GLStateCache::depthMask(GLboolean mask)
+    {
+        if (elide(GLStateKind::Depth, depth_mask == (int8_t) mask)
+            && agrees("depth mask", GL_DEPTH_WRITEMASK, (GLint) mask))
+            return;
+        glDepthMask(mask);
+        depth_mask = (int8_t) mask;
+    }
+
+    GLuint GLStateCache::drawFramebuffer()
+    {
+        if (draw_framebuffer == unknown) {
+            GLint framebuffer = 0;
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+            draw_framebuffer = (GLuint) framebuffer;
+        }
+        return draw_framebuffer;
+    }
+
+    GLuint GLStateCache::readFramebuffer()
+    {
+        if (read_framebuffer == unknown) {
+            GLint framebuffer = 0;
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &framebuffer);
+            read_framebuffer = (GLuint) framebuffer;
+        }
+        return read_framebuffer;
+    }
+
+    // deleting a bound object binds 0 in its place
+
+    void GLStateCache::deleteTextures(GLsizei count, const GLuint *names)
+    {
+        for (GLsizei i = 0; i < count; i++)
+            std::replace(textures.begin(), textures.end(), names[i], 0u);
+        glDeleteTextures(count, names);
+    }
+
+    void GLStateCache::deleteBuffers(GLsizei count, const GLuint *names)
+    {
+        for (GLsizei i = 0; i < count; i++) {
+            std::replace(buffers.begin(), buffers.end(), names[i], 0u);
+            if (element_buffer == names[i])
+                element_buffer = 0;
+        }
+        glDeleteBuffers(count, names);
+    }
+
+    void GLStateCache::deleteFramebuffers(GLsizei count, const GLuint *names)
+    {
+        for (GLsizei i = 0; i < count; i++) {
+            if (draw_framebuffer == names[i])
+                draw_framebuffer = 0;
+            if (read_framebuffer == names[i])
+                read_framebuffer = 0;
+        }
+        glDeleteFramebuffers(count, names);
+    }
+
+    void GLStateCache::deleteVertexArrays(GLsizei count, const GLuint *names)
+    {
+        for (GLsizei i = 0; i < count; i++) {
+            if (vertex_array == names[i]) {
+                vertex_array = 0;
+                element_buffer = unknown;
+            }
+        }
+        glDeleteVertexArrays(count, names);
+    }
+
+    void GLStateCache::validateAll()
+    {
+        if (program != unknown)
+            agrees("program", GL_CURRENT_PROGRAM, (GLint) program);
+        if (vertex_array != unknown)
+            agrees("vertex array", GL_VERTEX_ARRAY_BINDING, (GLint) vertex_array);
+        if (element_buffer != unknown)
+            agrees("element buffer", GL_ELEMENT_ARRAY_BUFFER_BINDING, (GLint) element_buffer);
+        for (size_t i = 0; i < bufferTargetCount; i++) {
+            if (buffers[i] != unknown)
+                agrees("buffer", bufferBindings[i], (GLint) buffers[i]);
+        }
+        if (active_unit != unknown) {
+            agrees("active texture", GL_ACTIVE_TEXTURE, (GLint) active_unit);
+            // only the active unit can be asked without switching
+            auto unit = active_unit - GL_TEXTURE0;
+            if (unit < (GLuint) maxTextureUnits && textures[unit] != unknown)
+                agrees("2D texture", GL_TEXTURE_BINDING_2D, (GLint) textures[unit]);
+        }
+        if (draw_framebuffer != unknown)
+            agrees("draw framebuffer", GL_DRAW_FRAMEBUFFER_BINDING, (GLint) draw_framebuffer);
+        if (read_framebuffer != unknown)
+            agrees("read framebuffer", GL_READ_FRAMEBUFFER_BINDING, (GLint) read_framebuffer);
+        if (viewport_known)
+            agrees("viewport", GL_VIEWPORT, viewport_box.data(), 4);
+        if (scissor_known)
+            agrees("scissor box", GL_SCISSOR_BOX, scissor_box.data(), 4);
+        for (size_t i = 0; i < capabilityCount; i++) {
+            if (capabilities[i] >= 0)
+                agrees("capability", capabilityNames[i], capabilities[i]);
+        }
+        if (blend_equation != unknown)
+            agrees("blend equation", GL_BLEND_EQUATION_RGB, (GLint) blend_equation);
+        for (size_t i = 0; i < 4; i++) {
+            if (blend_functions[i] != unknown)
+                agrees("blend function", blendFunctionNames[i], (GLint) blend_functions[i]);
+        }
+        if (depth_function != unknown)
+            agrees("depth function", GL_DEPTH_FUNC, (GLint) depth_function);
+        if (depth_mask >= 0)
+            agrees("depth mask", GL_DEPTH_WRITEMASK, depth_mask);
+    }
+
+    void GLStateCache::endFrame()
+    {
+        if (validating)
+            validateAll();
+
+        counters.frames++;
+        counters.issued = issued;
+        counters.elided = elided;
+        counters.frame_issued = counters.frame_elided = 0;
+        for (size_t i = 0; i < GLStateStats::kindCount; i++) {
+            counters.frame_issued += issued[i];
+            counters.frame_elided += elided[i];
+        }
+        counters.total_issued += counters.frame_issued;
+        counters.total_elided += counters.frame_elided;
+        counters.frame_invalidations = invalidations;
+        issued.fill(0);
+        elided.fill(0);
+        invalidations = 0;
+    }
+}
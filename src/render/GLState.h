@@ -0,0 +1,146 @@
+#ifndef CARNIVAL_GLSTATE_H
+#define CARNIVAL_GLSTATE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "GLExtensions.h"
+
+namespace carnival::render {
+
+    // what the counters are kept per
+    enum class GLStateKind {
+        Program,
+        VertexArray,
+        Buffer,
+        Texture,
+        Framebuffer,
+        Viewport,
+        Capability,
+        Blend,
+        Depth,
+        Scissor,
+        Count
+    };
+
+    const char *stateKindName(GLStateKind kind);
+
+    struct GLStateStats {
+        static constexpr size_t kindCount = (size_t) GLStateKind::Count;
+
+        uint64_t frames = 0;
+        // of the last frame, see GLStateCache::endFrame()
+        std::array<uint64_t, kindCount> issued{};
+        std::array<uint64_t, kindCount> elided{};
+        uint64_t frame_issued = 0;
+        uint64_t frame_elided = 0;
+        uint64_t frame_invalidations = 0;
+        uint64_t total_issued = 0;
+        uint64_t total_elided = 0;
+        uint64_t mismatches = 0;        // validation found GL in a different state than cached
+    };
+
+    // Shadows the GL state Carnival's own rendering sets, so a call that wouldn't change anything is skipped
+    // before the driver validates it. That only holds while every change goes through here: after code that
+    // doesn't, the ImGui backend or another context becoming current, call invalidate(). Objects are deleted
+    // through the delete* functions, GL hands the name of a bound object out again once it's gone.
+    //
+    // Tracked: program, vertex array, the element buffer of the bound vertex array, the generic binding of the
+    // buffer targets below, the 2D texture of the first maxTextureUnits units, draw and read framebuffers,
+    // viewport, scissor box, blending, depth test and write mask, and the capabilities below. Anything else is
+    // passed on and counted as issued.
+    //
+    // With validation on every elided call first checks GL agrees through glGet*, which is slow, and logs
+    // where it doesn't.
+    class GLStateCache {
+    public:
+        static constexpr int maxTextureUnits = 16;
+
+        GLStateCache() { forget(); }
+
+        // false passes every call on, for comparing
+        bool enabled = true;
+        bool validating = false;
+
+        // with a current context, forgets everything
+        void invalidate();
+
+        void useProgram(GLuint program);
+        void bindVertexArray(GLuint vertex_array);
+        void bindBuffer(GLenum target, GLuint buffer);
+        // passed on, the generic binding of target changes as well
+        void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+        void activeTexture(GLenum unit);
+        void bindTexture(GLenum target, GLuint texture);
+        void bindFramebuffer(GLenum target, GLuint framebuffer);
+        void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+        void scissor(GLint x, GLint y, GLsizei width, GLsizei height);
+        void enable(GLenum capability) { setCapability(capability, true); }
+        void disable(GLenum capability) { setCapability(capability, false); }
+        void blendEquation(GLenum mode);
+        void blendFuncSeparate(GLenum source_rgb, GLenum destination_rgb, GLenum source_alpha, GLenum destination_alpha);
+        void depthFunc(GLenum function);
+        void depthMask(GLboolean mask);
+
+        // asks GL only if not known, for code that puts the binding back when it's done
+        GLuint drawFramebuffer();
+        GLuint readFramebuffer();
+
+        void deleteTextures(GLsizei count, const GLuint *textures);
+        void deleteBuffers(GLsizei count, const GLuint *buffers);
+        void deleteFramebuffers(GLsizei count, const GLuint *framebuffers);
+        void deleteVertexArrays(GLsizei count, const GLuint *vertex_arrays);
+
+        // moves this frame's counters into stats()
+        void endFrame();
+        const GLStateStats &stats() const { return counters; }
+
+    private:
+        static constexpr GLuint unknown = ~0u;
+        // GL_ARRAY_BUFFER, GL_COPY_WRITE_BUFFER, GL_PIXEL_PACK_BUFFER, GL_PIXEL_UNPACK_BUFFER,
+        // GL_DRAW_INDIRECT_BUFFER, GL_UNIFORM_BUFFER, GL_SHADER_STORAGE_BUFFER
+        static constexpr size_t bufferTargetCount = 7;
+        // GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST, GL_SCISSOR_TEST, GL_STENCIL_TEST, GL_MULTISAMPLE
+        static constexpr size_t capabilityCount = 6;
+
+        GLuint program = unknown;
+        GLuint vertex_array = unknown;
+        GLuint element_buffer = unknown;
+        std::array<GLuint, bufferTargetCount> buffers{};
+        GLenum active_unit = unknown;
+        std::array<GLuint, maxTextureUnits> textures{};
+        GLuint draw_framebuffer = unknown;
+        GLuint read_framebuffer = unknown;
+        std::array<GLint, 4> viewport_box{};
+        bool viewport_known = false;
+        std::array<GLint, 4> scissor_box{};
+        bool scissor_known = false;
+        std::array<int8_t, capabilityCount> capabilities{};    // -1 unknown
+        GLenum blend_equation = unknown;
+        std::array<GLenum, 4> blend_functions{};
+        GLenum depth_function = unknown;
+        int8_t depth_mask = -1;
+
+        std::array<uint64_t, GLStateStats::kindCount> issued{};
+        std::array<uint64_t, GLStateStats::kindCount> elided{};
+        uint64_t invalidations = 0;
+        GLStateStats counters;
+
+        void forget();
+        // true if the call can be left out
+        bool elide(GLStateKind kind, bool same);
+        // true unless validating and GL disagrees
+        bool agrees(const char *what, GLenum pname, const GLint *expected, int count = 1);
+        bool agrees(const char *what, GLenum pname, GLint expected) { return agrees(what, pname, &expected); }
+        void setCapability(GLenum capability, bool on);
+        // every known value against GL
+        void validateAll();
+        static int bufferIndex(GLenum target);
+        static int capabilityIndex(GLenum capability);
+    };
+
+    // of the context current on the thread that renders
+    extern GLStateCache glstate;
+}
+
+#endif //CARNIVAL_GLSTATE_H
@@ -0,0 +1,249 @@
+#include "ImGuiRenderer.h"
+
+#include <cstring>
+#include <type_traits>
+#include "GLState.h"
+#include "Shader.h"
+#include "../core/Profiler.h"
+
+namespace carnival::render {
+
+    static const GLuint projectionBinding = 0;
+
+    static const char *vertexSource = R"(#version 330 core
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec2 uv;
+layout(location = 2) in vec4 color;
+
+layout(std140) uniform Projection {
+    mat4 projection;
+};
+
+out vec2 frag_uv;
+out vec4 frag_color;
+
+void main(){
+    frag_uv = uv;
+    frag_color = color;
+    gl_Position = projection * vec4(position, 0.0, 1.0);
+}
+)";
+
+    static const char *fragmentSource = R"(#version 330 core
+in vec2 frag_uv;
+in vec4 frag_color;
+uniform sampler2D image;
+layout(location = 0) out vec4 color;
+
+void main(){
+    color = frag_color * texture(image, frag_uv);
+}
+)";
+
+    bool ImGuiRenderer::init() {
+        program = buildProgram(vertexSource, fragmentSource, "imgui", false);
+        if (program == 0)
+            return false;
+
+        glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Projection"), projectionBinding);
+        glstate.useProgram(program);
+        glUniform1i(glGetUniformLocation(program, "image"), 0);
+        glstate.useProgram(0);
+
+        glGenVertexArrays(1, &vao);
+        return true;
+    }
+
+    void ImGuiRenderer::shutdown() {
+        if (program == 0)
+            return;
+
+        glstate.deleteVertexArrays(1, &vao);
+        glDeleteProgram(program);
+        vao = program = 0;
+    }
+
+    void ImGuiRenderer::setupState(int framebuffer_width, int framebuffer_height, const StreamAllocation &projection) {
+        glstate.enable(GL_BLEND);
+        glstate.blendEquation(GL_FUNC_ADD);
+        glstate.blendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        glstate.disable(GL_CULL_FACE);
+        glstate.disable(GL_DEPTH_TEST);
+        glstate.disable(GL_STENCIL_TEST);
+        glstate.enable(GL_SCISSOR_TEST);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+        glstate.viewport(0, 0, framebuffer_width, framebuffer_height);
+        glstate.useProgram(program);
+        glstate.activeTexture(GL_TEXTURE0);
+        glstate.bindVertexArray(vao);
+        glstate.bindBufferRange(GL_UNIFORM_BUFFER, projectionBinding, projection.buffer, projection.offset,
+                                projection.size);
+    }
+
+    void ImGuiRenderer::render(ImDrawData *draw_data, StreamBuffer &stream) {
+        CARNIVAL_PROFILE_GPU_SCOPE("ImGui draw");
+        counters = ImGuiRendererStats();
+
+        auto framebuffer_width = (int) (draw_data->DisplaySize.x * draw_data->FramebufferScale.x);
+        auto framebuffer_height = (int) (draw_data->DisplaySize.y * draw_data->FramebufferScale.y);
+        if (framebuffer_width <= 0 || framebuffer_height <= 0 || draw_data->TotalVtxCount == 0)
+            return;
+
+        // aligned to the vertex size, so a base vertex can address it
+        auto vertices = stream.allocate(draw_data->TotalVtxCount * sizeof(ImDrawVert), sizeof(ImDrawVert));
+        if (!vertices.valid())
+            return;
+        auto *vertex_target = (ImDrawVert *) vertices.data;
+        for (int list = 0; list < draw_data->CmdListsCount; list++) {
+            auto &buffer = draw_data->CmdLists[list]->VtxBuffer;
+            std::memcpy(vertex_target, buffer.Data, buffer.Size * sizeof(ImDrawVert));
+            vertex_target += buffer.Size;
+        }
+
+        auto indices = stream.allocate(draw_data->TotalIdxCount * sizeof(ImDrawIdx), sizeof(ImDrawIdx));
+        if (!indices.valid())
+            return;
+        auto *index_target = (ImDrawIdx *) indices.data;
+        for (int list = 0; list < draw_data->CmdListsCount; list++) {
+            auto &buffer = draw_data->CmdLists[list]->IdxBuffer;
+            std::memcpy(index_target, buffer.Data, buffer.Size * sizeof(ImDrawIdx));
+            index_target += buffer.Size;
+        }
+
+        // same orthographic projection as imgui_impl_opengl3
+        float left = draw_data->DisplayPos.x;
+        float right = draw_data->DisplayPos.x + draw_data->DisplaySize.x;
+        float top = draw_data->DisplayPos.y;
+        float bottom = draw_data->DisplayPos.y + draw_data->DisplaySize.y;
+        const float matrix[16] = {
+                2.0f / (right - left), 0.0f, 0.0f, 0.0f,
+                0.0f, 2.0f / (top - bottom), 0.0f, 0.0f,
+                0.0f, 0.0f, -1.0f, 0.0f,
+                (right + left) / (left - right), (top + bottom) / (bottom - top), 0.0f, 1.0f,
+        };
+        auto projection = stream.allocateUniform(sizeof(matrix));
+        if (!projection.valid())
+            return;
+        std::memcpy(projection.data, matrix, sizeof(matrix));
+        stream.flush();
+
+        // names of replaced stream buffers get reused, so the layout is set every frame rather than cached
+        setupState(framebuffer_width, framebuffer_height, projection);
+        glstate.bindBuffer(GL_ARRAY_BUFFER, vertices.buffer);
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (void *) offsetof(ImDrawVert, pos));
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (void *) offsetof(ImDrawVert, uv));
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), (void *) offsetof(ImDrawVert, col));
+        glstate.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.buffer);
+
+        const GLenum index_type = sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        auto clip_offset = draw_data->DisplayPos;
+        auto clip_scale = draw_data->FramebufferScale;
+        auto base_vertex = (GLint) (vertices.offset / (GLintptr) sizeof(ImDrawVert));
+        auto index_offset = (size_t) indices.offset;
+
+        for (int list_index = 0; list_index < draw_data->CmdListsCount; list_index++) {
+            const ImDrawList *list = draw_data->CmdLists[list_index];
+            for (int command_index = 0; command_index < list->CmdBuffer.Size; command_index++) {
+                const ImDrawCmd &command = list->CmdBuffer[command_index];
+                if (command.UserCallback != nullptr) {
+                    if (command.UserCallback == ImDrawCallback_ResetRenderState)
+                        setupState(framebuffer_width, framebuffer_height, projection);
+                    else
+                        command.UserCallback(list, &command);
+                    // whatever the callback changed went past the cache
+                    glstate.invalidate();
+                    continue;
+                }
+
+                float clip_min_x = (command.ClipRect.x - clip_offset.x) * clip_scale.x;
+                float clip_min_y = (command.ClipRect.y - clip_offset.y) * clip_scale.y;
+                float clip_max_x = (command.ClipRect.z - clip_offset.x) * clip_scale.x;
+                float clip_max_y = (command.ClipRect.w - clip_offset.y) * clip_scale.y;
+                if (clip_max_x <= clip_min_x || clip_max_y <= clip_min_y)
+                    continue;
+
+                glstate.scissor((GLint) clip_min_x, (GLint) ((float) framebuffer_height - clip_max_y),
+                                (GLsizei) (clip_max_x - clip_min_x), (GLsizei) (clip_max_y - clip_min_y));
+                glstate.bindTexture(GL_TEXTURE_2D, (GLuint) (intptr_t) command.GetTexID());
+                glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei) command.ElemCount, index_type,
+                                         (void *) (index_offset + command.IdxOffset * sizeof(ImDrawIdx)),
+                                         base_vertex + (GLint) command.VtxOffset);
+                counters.draw_calls++;
+            }
+
+            base_vertex += list->VtxBuffer.Size;
+            index_offset += list->IdxBuffer.Size * sizeof(ImDrawIdx);
+        }
+
+        counters.vertices = (size_t) draw_data->TotalVtxCount;
+        counters.indices = (size_t) draw_data->TotalIdxCount;
+
+        glstate.disable(GL_SCISSOR_TEST);
+        glstate.disable(GL_BLEND);
+    }
+
+    // resize() keeps the capacity, assigning an ImVector frees it first
+    template<typename T>
+    static void copyVector(ImVector<T> &target, const ImVector<T> &source) {
+        target.resize(source.Size);
+        if (source.Size > 0)
+            std::memcpy(target.Data, source.Data, (size_t) source.Size * sizeof(T));
+    }
+
+    // a plain array in older ImGui versions, an ImVector since 1.89.8
+    template<typename Lists>
+    static void setLists(Lists &target, std::vector<ImDrawList *> &lists, int count) {
+        if constexpr (std::is_pointer_v<Lists>) {
+            target = lists.data();
+        } else {
+            target.resize(0);
+            for (int i = 0; i < count; i++)
+                target.push_back(lists[i]);
+        }
+    }
+
+    ImGuiDrawCopy::~ImGuiDrawCopy() {
+        for (auto *list: lists)
+            IM_DELETE(list);
+    }
+
+    void ImGuiDrawCopy::copy(const ImDrawData *source) {
+        valid = source != nullptr && source->Valid;
+        if (!valid)
+            return;
+
+        while ((int) lists.size() < source->CmdListsCount)
+            lists.push_back(IM_NEW(ImDrawList)(nullptr));
+        for (int i = 0; i < source->CmdListsCount; i++) {
+            const auto *from = source->CmdLists[i];
+            auto *to = lists[i];
+            copyVector(to->CmdBuffer, from->CmdBuffer);
+            copyVector(to->IdxBuffer, from->IdxBuffer);
+            copyVector(to->VtxBuffer, from->VtxBuffer);
+            to->Flags = from->Flags;
+        }
+
+        draw_data.Valid = true;
+        draw_data.CmdListsCount = source->CmdListsCount;
+        draw_data.TotalIdxCount = source->TotalIdxCount;
+        draw_data.TotalVtxCount = source->TotalVtxCount;
+        draw_data.DisplayPos = source->DisplayPos;
+        draw_data.DisplaySize = source->DisplaySize;
+        draw_data.FramebufferScale = source->FramebufferScale;
+        // the platform windows aren't drawn from a copy
+        draw_data.OwnerViewport = nullptr;
+        setLists(draw_data.CmdLists, lists, source->CmdListsCount);
+    }
+
+    void remapTextures(ImDrawData *draw_data, const std::function<ImTextureID(ImTextureID)> &resolve) {
+        for (int list = 0; list < draw_data->CmdListsCount; list++) {
+            auto &commands = draw_data->CmdLists[list]->CmdBuffer;
+            for (int i = 0; i < commands.Size; i++)
+                commands[i].TextureId = resolve(commands[i].TextureId);
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef CARNIVAL_IMGUIRENDERER_H
+#define CARNIVAL_IMGUIRENDERER_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include "glad/glad.h"
+#include "imgui.h"
+#include "StreamBuffer.h"
+
+namespace carnival::render {
+
+    struct ImGuiRendererStats {
+        size_t draw_calls = 0;
+        size_t vertices = 0;
+        size_t indices = 0;
+    };
+
+    // Draws ImGui's draw data for the main viewport from a StreamBuffer instead of the orphaned
+    // glBufferData uploads of imgui_impl_opengl3. Vertices, indices and the projection block are
+    // written straight into the ring; every draw list is addressed with a base vertex, so the whole
+    // frame draws with a single vertex layout.
+    // The backend is still initialized: it owns the font texture and draws the platform windows.
+    class ImGuiRenderer {
+    public:
+        // with a current context, after ImGui_ImplOpenGL3_Init
+        bool init();
+        void shutdown();
+        bool ready() const { return program != 0; }
+
+        // into the default framebuffer, between stream.beginFrame() and stream.endFrame()
+        void render(ImDrawData *draw_data, StreamBuffer &stream);
+
+        const ImGuiRendererStats &stats() const { return counters; }
+
+    private:
+        GLuint program = 0;
+        GLuint vao = 0;
+        ImGuiRendererStats counters;
+
+        void setupState(int framebuffer_width, int framebuffer_height, const StreamAllocation &projection);
+    };
+
+    // A frame of draw data that outlives ImGui::NewFrame(), for drawing it on another thread.
+    // The lists are kept from frame to frame, once they have grown copying allocates nothing.
+    class ImGuiDrawCopy {
+    public:
+        ImGuiDrawCopy() = default;
+        ImGuiDrawCopy(const ImGuiDrawCopy &) = delete;
+        ImGuiDrawCopy &operator=(const ImGuiDrawCopy &) = delete;
+        ~ImGuiDrawCopy();
+
+        // after ImGui::Render(), on the thread that built the frame
+        void copy(const ImDrawData *source);
+        // nullptr until something valid was copied
+        ImDrawData *data() { return valid ? &draw_data : nullptr; }
+
+    private:
+        ImDrawData draw_data;
+        std::vector<ImDrawList *> lists;
+        bool valid = false;
+    };
+
+    // Replaces every command's texture with what resolve returns for it, for textures the UI only
+    // knows by a handle until the frame is drawn.
+    void remapTextures(ImDrawData *draw_data, const std::function<ImTextureID(ImTextureID)> &resolve);
+}
+
+#endif //CARNIVAL_IMGUIRENDERER_H
@@ -0,0 +1,307 @@
+#include "Ktx2.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace carnival::render {
+
+    namespace {
+        const unsigned char ktxIdentifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+        // VkFormat values
+        const uint32_t vkFormatRGBA8 = 37;
+        const uint32_t vkFormatBC1 = 131;
+        const uint32_t vkFormatBC3 = 137;
+
+        // identifier, header and index
+        const size_t headerBytes = 80;
+        const size_t levelIndexBytes = 24;
+
+        // Khronos data format descriptor values
+        const uint8_t modelRGBSDA = 1;
+        const uint8_t modelBC1A = 128;
+        const uint8_t modelBC3 = 130;
+        const uint8_t primariesBT709 = 1;
+        const uint8_t transferLinear = 1;
+        const uint8_t channelAlpha = 15;
+
+        uint32_t vkFormat(TextureFormat format) {
+            switch (format) {
+                case TextureFormat::BC1:
+                    return vkFormatBC1;
+                case TextureFormat::BC3:
+                    return vkFormatBC3;
+                default:
+                    return vkFormatRGBA8;
+            }
+        }
+
+        // of a level's offset in the file: the texel block size, at least 4
+        size_t levelAlignment(TextureFormat format) {
+            switch (format) {
+                case TextureFormat::BC1:
+                    return 8;
+                case TextureFormat::BC3:
+                    return 16;
+                default:
+                    return 4;
+            }
+        }
+
+        size_t alignUp(size_t value, size_t alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        void put32(std::vector<unsigned char> &out, size_t offset, uint32_t value) {
+            for (size_t i = 0; i < 4; i++)
+                out[offset + i] = (unsigned char) (value >> (i * 8));
+        }
+
+        void put64(std::vector<unsigned char> &out, size_t offset, uint64_t value) {
+            for (size_t i = 0; i < 8; i++)
+                out[offset + i] = (unsigned char) (value >> (i * 8));
+        }
+
+        uint32_t get32(const unsigned char *in, size_t offset) {
+            uint32_t value = 0;
+            for (size_t i = 0; i < 4; i++)
+                value |= (uint32_t) in[offset + i] << (i * 8);
+            return value;
+        }
+
+        uint64_t get64(const unsigned char *in, size_t offset) {
+            uint64_t value = 0;
+            for (size_t i = 0; i < 8; i++)
+                value |= (uint64_t) in[offset + i] << (i * 8);
+            return value;
+        }
+
+        struct Sample {
+            uint16_t bit_offset;
+            uint8_t bit_length;
+            uint8_t channel;
+            uint32_t upper;
+        };
+
+        // the basic descriptor block, with the total size in front
+        std::vector<unsigned char> dataFormatDescriptor(TextureFormat format) {
+            std::vector<Sample> samples;
+            uint8_t model = modelRGBSDA;
+            bool blocks = isCompressed(format);
+            if (format == TextureFormat::BC1) {
+                model = modelBC1A;
+                samples = {{0, 64, 0, 0xFFFFFFFFu}};
+            } else if (format == TextureFormat::BC3) {
+                model = modelBC3;
+                samples = {{0, 64, channelAlpha, 0xFFFFFFFFu}, {64, 64, 0, 0xFFFFFFFFu}};
+            } else {
+                samples = {{0, 8, 0, 255}, {8, 8, 1, 255}, {16, 8, 2, 255}, {24, 8, channelAlpha, 255}};
+            }
+
+            size_t block_size = 24 + 16 * samples.size();
+            std::vector<unsigned char> descriptor(4 + block_size, 0);
+            put32(descriptor, 0, (uint32_t) descriptor.size());
+            // vendor 0, type 0, then version 2 and the block size
+            put32(descriptor, 4, 0);
+            put32(descriptor, 8, 2u | (uint32_t) block_size << 16);
+            descriptor[12] = model;
+            descriptor[13] = primariesBT709;
+            descriptor[14] = transferLinear;
+            descriptor[15] = 0;
+            // block dimensions minus one
+            descriptor[16] = blocks ? 3 : 0;
+            descriptor[17] = blocks ? 3 : 0;
+            descriptor[20] = (unsigned char) (blocks ? levelSize(format, 4, 4) : 4);
+
+            for (size_t i = 0; i < samples.size(); i++) {
+                auto &sample = samples[i];
+                auto offset = 28 + 16 * i;
+                put32(descriptor, offset, (uint32_t) sample.bit_offset | (uint32_t) (sample.bit_length - 1) << 16
+                                          | (uint32_t) sample.channel << 24);
+                put32(descriptor, offset + 4, 0);
+                put32(descriptor, offset + 8, 0);
+                put32(descriptor, offset + 12, sample.upper);
+            }
+            return descriptor;
+        }
+
+        // a single key and value pair with its padding
+        std::vector<unsigned char> keyValue(const std::string &key, const std::string &value) {
+            auto length = key.size() + 1 + value.size() + 1;
+            std::vector<unsigned char> data(alignUp(4 + length, 4), 0);
+            put32(data, 0, (uint32_t) length);
+            std::memcpy(data.data() + 4, key.data(), key.size());
+            std::memcpy(data.data() + 4 + key.size() + 1, value.data(), value.size());
+            return data;
+        }
+    }
+
+    bool encodeKtx2(const TextureImage &image, const std::string &writer, std::vector<unsigned char> &out) {
+        if (!image.valid())
+            return false;
+
+        auto descriptor = dataFormatDescriptor(image.format);
+        auto key_values = keyValue("KTXwriter", writer);
+        auto level_count = image.levels.size();
+        auto descriptor_offset = headerBytes + levelIndexBytes * level_count;
+        auto key_values_offset = descriptor_offset + descriptor.size();
+
+        // the smallest level comes first in the file
+        auto alignment = levelAlignment(image.format);
+        std::vector<size_t> level_offsets(level_count);
+        size_t end = key_values_offset + key_values.size();
+        for (size_t i = level_count; i-- > 0;) {
+            level_offsets[i] = alignUp(end, alignment);
+            end = level_offsets[i] + image.levels[i].size;
+        }
+
+        out.assign(end, 0);
+        std::memcpy(out.data(), ktxIdentifier, sizeof(ktxIdentifier));
+        put32(out, 12, vkFormat(image.format));
+        put32(out, 16, 1);
+        put32(out, 20, (uint32_t) image.width());
+        put32(out, 24, (uint32_t) image.height());
+        put32(out, 28, 0);
+        put32(out, 32, 0);
+        put32(out, 36, 1);
+        put32(out, 40, (uint32_t) level_count);
+        put32(out, 44, 0);
+        put32(out, 48, (uint32_t) descriptor_offset);
+        put32(out, 52, (uint32_t) descriptor.size());
+        put32(out, 56, (uint32_t) key_values_offset);
+        put32(out, 60, (uint32_t) key_values.size());
+        put64(out, 64, 0);
+        put64(out, 72, 0);
+        for (size_t i = 0; i < level_count; i++) {
+            auto offset = headerBytes + levelIndexBytes * i;
+            put64(out, offset, level_offsets[i]);
+            put64(out, offset + 8, image.levels[i].size);
+            put64(out, offset + 16, image.levels[i].size);
+        }
+        std::memcpy(out.data() + descriptor_offset, descriptor.data(), descriptor.size());
+        std::memcpy(out.data() + key_values_offset, key_values.data(), key_values.size());
+        for (size_t i = 0; i < level_count; i++)
+            std::memcpy(out.data() + level_offsets[i], image.level(i), image.levels[i].size);
+        return true;
+    }
+
+    bool writeKtx2(const std::filesystem::path &path, const TextureImage &image, const std::string &writer) {
+        std::vector<unsigned char> data;
+        if (!encodeKtx2(image, writer, data))
+            return false;
+
+        auto temporary = path;
+        temporary += ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+            file.write((const char *) data.data(), (std::streamsize) data.size());
+            if (!file)
+                return false;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+        if (error) {
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+        return true;
+    }
+
+    // levels are copied into image, or point into data with view
+    static bool parseKtx2(const unsigned char *data, size_t file_size, TextureImage &image, std::string *writer,
+                          bool view) {
+        if (file_size < headerBytes || std::memcmp(data, ktxIdentifier, sizeof(ktxIdentifier)) != 0)
+            return false;
+
+        TextureFormat format;
+        switch (get32(data, 12)) {
+            case vkFormatRGBA8:
+                format = TextureFormat::RGBA8;
+                break;
+            case vkFormatBC1:
+                format = TextureFormat::BC1;
+                break;
+            case vkFormatBC3:
+                format = TextureFormat::BC3;
+                break;
+            default:
+                return false;
+        }
+
+        auto width = get32(data, 20), height = get32(data, 24);
+        auto level_count = get32(data, 40);
+        bool supported = width > 0 && height > 0 && width <= 65536 && height <= 65536
+                         && get32(data, 28) == 0 && get32(data, 32) <= 1 && get32(data, 36) == 1
+                         && level_count > 0 && level_count <= 17 && get32(data, 44) == 0
+                         && headerBytes + levelIndexBytes * level_count <= file_size;
+        if (!supported)
+            return false;
+
+        if (writer != nullptr) {
+            writer->clear();
+            size_t offset = get32(data, 56), end = offset + get32(data, 60);
+            if (end > file_size)
+                return false;
+            while (offset + 4 <= end) {
+                size_t length = get32(data, offset);
+                if (length == 0 || offset + 4 + length > end)
+                    break;
+                auto *pair = (const char *) data + offset + 4;
+                auto *key_end = std::find(pair, pair + length, '\0');
+                if (std::string(pair, key_end) == "KTXwriter" && key_end != pair + length)
+                    *writer = std::string(key_end + 1, std::find(key_end + 1, pair + length, '\0'));
+                offset = alignUp(offset + 4 + length, 4);
+            }
+        }
+
+        if (view) {
+            image = {};
+            image.format = format;
+            image.view = data;
+            int level_width = (int) width, level_height = (int) height;
+            for (size_t i = 0; i < level_count; i++) {
+                TextureLevel level;
+                level.width = level_width;
+                level.height = level_height;
+                level.offset = (size_t) get64(data, headerBytes + levelIndexBytes * i);
+                level.size = levelSize(format, level_width, level_height);
+                image.levels.push_back(level);
+                level_width = std::max(level_width / 2, 1);
+                level_height = std::max(level_height / 2, 1);
+            }
+        } else {
+            allocateLevels(image, format, (int) width, (int) height, (int) level_count);
+        }
+
+        for (size_t i = 0; i < level_count; i++) {
+            auto index = headerBytes + levelIndexBytes * i;
+            auto offset = get64(data, index), length = get64(data, index + 8);
+            if (length != image.levels[i].size || offset > file_size || length > file_size - offset) {
+                image = {};
+                return false;
+            }
+            if (!view)
+                std::memcpy(image.data.data() + image.levels[i].offset, data + offset, length);
+        }
+        return true;
+    }
+
+    bool readKtx2(const std::filesystem::path &path, TextureImage &image, std::string *writer) {
+        std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+            return false;
+        auto file_size = (size_t) file.tellg();
+        std::vector<unsigned char> data(file_size);
+        file.seekg(0);
+        if (!file.read((char *) data.data(), (std::streamsize) file_size))
+            return false;
+        return parseKtx2(data.data(), data.size(), image, writer, false);
+    }
+
+    bool viewKtx2(const unsigned char *data, size_t size, TextureImage &image, std::string *writer) {
+        return parseKtx2(data, size, image, writer, true);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef CARNIVAL_KTX2_H
+#define CARNIVAL_KTX2_H
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "TextureCompressor.h"
+
+namespace carnival::render {
+
+    // KTX 2.0 files of a single 2D image with its mip chain, without supercompression.
+    // Only the formats TextureImage holds are understood: R8G8B8A8_UNORM, BC1_RGB_UNORM and BC3_UNORM.
+
+    // the whole file in memory, what writeKtx2 writes
+    bool encodeKtx2(const TextureImage &image, const std::string &writer, std::vector<unsigned char> &out);
+    // writes to a temporary next to path and renames, a crash never leaves a torn file behind
+    bool writeKtx2(const std::filesystem::path &path, const TextureImage &image, const std::string &writer);
+    // false for anything unreadable or outside the subset above; writer receives the KTXwriter value
+    bool readKtx2(const std::filesystem::path &path, TextureImage &image, std::string *writer = nullptr);
+    // a file already in memory that outlives image, e.g. in an asset pack: the levels point into it
+    bool viewKtx2(const unsigned char *data, size_t size, TextureImage &image, std::string *writer = nullptr);
+}
+
+#endif //CARNIVAL_KTX2_H
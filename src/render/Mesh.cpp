@@ -0,0 +1,371 @@
+#include "Mesh.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include "../core/Log.h"
+
+namespace carnival::render {
+
+    void Mesh::clear() {
+        x.clear();
+        y.clear();
+        z.clear();
+        indices.clear();
+    }
+
+    void Mesh::reserve(size_t vertices, size_t triangles) {
+        x.reserve(vertices);
+        y.reserve(vertices);
+        z.reserve(vertices);
+        indices.reserve(triangles * 3);
+    }
+
+    void Mesh::addVertex(float vx, float vy, float vz) {
+        x.push_back(vx);
+        y.push_back(vy);
+        z.push_back(vz);
+    }
+
+    // whole file in one go, zero terminated so strtof / strtol can't run off the end
+    static bool readFile(const std::filesystem::path &path, std::string &out) {
+        std::ifstream stream(path, std::ios::in | std::ios::binary);
+        if (!stream.is_open())
+            return false;
+
+        stream.seekg(0, std::ios::end);
+        auto size = (size_t) stream.tellg();
+        stream.seekg(0, std::ios::beg);
+        out.resize(size);
+        stream.read(out.data(), (std::streamsize) size);
+        return (bool) stream;
+    }
+
+    static bool isBlank(char c) {
+        return c == ' ' || c == '\t';
+    }
+
+    static bool isLineEnd(char c) {
+        return c == '\n' || c == '\r' || c == '\0';
+    }
+
+    // adds the polygon as a triangle fan
+    static void addPolygon(Mesh &mesh, const std::vector<uint32_t> &polygon) {
+        for (size_t i = 2; i < polygon.size(); i++) {
+            mesh.indices.push_back(polygon[0]);
+            mesh.indices.push_back(polygon[i - 1]);
+            mesh.indices.push_back(polygon[i]);
+        }
+    }
+
+    bool loadMesh(const std::filesystem::path &path, Mesh &mesh) {
+        auto extension = path.extension().string();
+        for (auto &c: extension)
+            c = (char) std::tolower((unsigned char) c);
+
+        if (extension == ".obj")
+            return loadObj(path, mesh);
+        if (extension == ".ply")
+            return loadPly(path, mesh);
+
+        CARNIVAL_LOG_ERROR("Unknown mesh format {}", path);
+        return false;
+    }
+
+    // OBJ
+
+    bool loadObj(const std::filesystem::path &path, Mesh &mesh) {
+        std::string data;
+        if (!readFile(path, data)) {
+            CARNIVAL_LOG_ERROR("Can't open {}", path);
+            return false;
+        }
+
+        mesh.clear();
+        // rough guess, a typical OBJ line is around 30 bytes and there are twice as many faces as vertices
+        mesh.reserve(data.size() / 90, data.size() / 45);
+
+        std::vector<uint32_t> polygon;
+        const char *p = data.c_str();
+        size_t line = 1;
+
+        auto fail = [&](const char *reason) {
+            CARNIVAL_LOG_ERROR("{}:{}: {}", path, line, reason);
+            mesh.clear();
+            return false;
+        };
+
+        while (*p != '\0') {
+            while (isBlank(*p))
+                p++;
+
+            if (p[0] == 'v' && isBlank(p[1])) {
+                p += 2;
+                float values[3];
+                for (auto &value: values) {
+                    while (isBlank(*p))
+                        p++;
+                    char *next = nullptr;
+                    value = std::strtof(p, &next);
+                    if (next == p || isLineEnd(*p))
+                        return fail("expected three coordinates");
+                    p = next;
+                }
+                mesh.addVertex(values[0], values[1], values[2]);
+            } else if (p[0] == 'f' && isBlank(p[1])) {
+                p += 2;
+                polygon.clear();
+                for (;;) {
+                    while (isBlank(*p))
+                        p++;
+                    if (isLineEnd(*p) || *p == '#')
+                        break;
+
+                    char *next = nullptr;
+                    long index = std::strtol(p, &next, 10);
+                    if (next == p)
+                        return fail("bad face index");
+                    p = next;
+                    // skip texture coordinate and normal indices
+                    while (!isBlank(*p) && !isLineEnd(*p))
+                        p++;
+
+                    // 1 based, negative counts back from the last vertex
+                    long resolved = index > 0 ? index - 1 : (long) mesh.vertexCount() + index;
+                    if (index == 0 || resolved < 0 || resolved >= (long) mesh.vertexCount())
+                        return fail("face index out of range");
+                    polygon.push_back((uint32_t) resolved);
+                }
+                if (polygon.size() < 3)
+                    return fail("face with less than three vertices");
+                addPolygon(mesh, polygon);
+            }
+
+            while (!isLineEnd(*p))
+                p++;
+            while (*p == '\r' || *p == '\n') {
+                line += *p == '\n';
+                p++;
+            }
+        }
+
+        return true;
+    }
+
+    // PLY
+
+    namespace {
+        enum class PlyType {
+            Int8, Uint8, Int16, Uint16, Int32, Uint32, Float32, Float64, Invalid
+        };
+
+        struct PlyProperty {
+            std::string name;
+            PlyType type = PlyType::Invalid;
+            PlyType count_type = PlyType::Invalid; // only for lists
+            bool list = false;
+        };
+
+        struct PlyElement {
+            std::string name;
+            size_t count = 0;
+            std::vector<PlyProperty> properties;
+        };
+
+        PlyType plyType(const std::string &name) {
+            if (name == "char" || name == "int8") return PlyType::Int8;
+            if (name == "uchar" || name == "uint8") return PlyType::Uint8;
+            if (name == "short" || name == "int16") return PlyType::Int16;
+            if (name == "ushort" || name == "uint16") return PlyType::Uint16;
+            if (name == "int" || name == "int32") return PlyType::Int32;
+            if (name == "uint" || name == "uint32") return PlyType::Uint32;
+            if (name == "float" || name == "float32") return PlyType::Float32;
+            if (name == "double" || name == "float64") return PlyType::Float64;
+            return PlyType::Invalid;
+        }
+
+        size_t plyTypeSize(PlyType type) {
+            switch (type) {
+                case PlyType::Int8:
+                case PlyType::Uint8:
+                    return 1;
+                case PlyType::Int16:
+                case PlyType::Uint16:
+                    return 2;
+                case PlyType::Int32:
+                case PlyType::Uint32:
+                case PlyType::Float32:
+                    return 4;
+                case PlyType::Float64:
+                    return 8;
+                default:
+                    return 0;
+            }
+        }
+
+        // reads values from the body of the file, ascii or binary
+        struct PlyReader {
+            const char *p;
+            const char *end;
+            bool ascii;
+            bool swap; // file endianness differs from ours
+            bool failed = false;
+
+            double read(PlyType type) {
+                if (ascii) {
+                    char *next = nullptr;
+                    double value = std::strtod(p, &next);
+                    if (next == p)
+                        failed = true;
+                    p = next;
+                    return value;
+                }
+
+                auto size = plyTypeSize(type);
+                if ((size_t) (end - p) < size) {
+                    failed = true;
+                    return 0.0;
+                }
+
+                unsigned char bytes[8];
+                std::memcpy(bytes, p, size);
+                p += size;
+                if (swap) {
+                    for (size_t i = 0; i < size / 2; i++)
+                        std::swap(bytes[i], bytes[size - 1 - i]);
+                }
+
+                switch (type) {
+                    case PlyType::Int8: { int8_t v; std::memcpy(&v, bytes, 1); return v; }
+                    case PlyType::Uint8: { uint8_t v; std::memcpy(&v, bytes, 1); return v; }
+                    case PlyType::Int16: { int16_t v; std::memcpy(&v, bytes, 2); return v; }
+                    case PlyType::Uint16: { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+                    case PlyType::Int32: { int32_t v; std::memcpy(&v, bytes, 4); return v; }
+                    case PlyType::Uint32: { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+                    case PlyType::Float32: { float v; std::memcpy(&v, bytes, 4); return v; }
+                    case PlyType::Float64: { double v; std::memcpy(&v, bytes, 8); return v; }
+                    default: failed = true; return 0.0;
+                }
+            }
+        };
+
+        bool littleEndianHost() {
+            const uint16_t probe = 1;
+            unsigned char first;
+            std::memcpy(&first, &probe, 1);
+            return first == 1;
+        }
+    }
+
+    bool loadPly(const std::filesystem::path &path, Mesh &mesh) {
+        std::string data;
+        if (!readFile(path, data)) {
+            CARNIVAL_LOG_ERROR("Can't open {}", path);
+            return false;
+        }
+
+        auto fail = [&](const char *reason) {
+            CARNIVAL_LOG_ERROR("{}: {}", path, reason);
+            mesh.clear();
+            return false;
+        };
+
+        auto header_end = data.find("end_header");
+        if (data.compare(0, 3, "ply") != 0 || header_end == std::string::npos)
+            return fail("not a PLY file");
+
+        std::istringstream header(data.substr(0, header_end));
+        std::string line, format;
+        std::vector<PlyElement> elements;
+        while (std::getline(header, line)) {
+            std::istringstream words(line);
+            std::string keyword;
+            words >> keyword;
+
+            if (keyword == "format") {
+                words >> format;
+            } else if (keyword == "element") {
+                PlyElement element;
+                words >> element.name >> element.count;
+                elements.push_back(element);
+            } else if (keyword == "property" && !elements.empty()) {
+                PlyProperty property;
+                std::string type;
+                words >> type;
+                if (type == "list") {
+                    std::string count_type;
+                    words >> count_type >> type;
+                    property.list = true;
+                    property.count_type = plyType(count_type);
+                }
+                property.type = plyType(type);
+                words >> property.name;
+                if (property.type == PlyType::Invalid || (property.list && property.count_type == PlyType::Invalid))
+                    return fail("unknown property type");
+                elements.back().properties.push_back(property);
+            }
+        }
+
+        // the body starts after the end_header line
+        auto body = data.find('\n', header_end);
+        if (body == std::string::npos)
+            return fail("truncated header");
+
+        PlyReader reader = {data.c_str() + body + 1, data.c_str() + data.size(), format == "ascii", false};
+        if (format == "binary_little_endian")
+            reader.swap = !littleEndianHost();
+        else if (format == "binary_big_endian")
+            reader.swap = littleEndianHost();
+        else if (format != "ascii")
+            return fail("unknown format");
+
+        mesh.clear();
+        std::vector<uint32_t> polygon;
+
+        for (auto &element: elements) {
+            bool vertices = element.name == "vertex";
+            bool faces = element.name == "face";
+            if (vertices)
+                mesh.reserve(element.count, 0);
+            if (faces)
+                mesh.indices.reserve(element.count * 3);
+
+            for (size_t item = 0; item < element.count; item++) {
+                float position[3] = {};
+                for (auto &property: element.properties) {
+                    if (!property.list) {
+                        auto value = reader.read(property.type);
+                        if (vertices && property.name.size() == 1 && property.name[0] >= 'x' && property.name[0] <= 'z')
+                            position[property.name[0] - 'x'] = (float) value;
+                        continue;
+                    }
+
+                    auto count = (size_t) reader.read(property.count_type);
+                    bool indices = faces && (property.name == "vertex_indices" || property.name == "vertex_index");
+                    polygon.clear();
+                    for (size_t i = 0; i < count && !reader.failed; i++) {
+                        auto value = reader.read(property.type);
+                        if (indices) {
+                            if (value < 0.0 || value >= (double) mesh.vertexCount())
+                                return fail("face index out of range");
+                            polygon.push_back((uint32_t) value);
+                        }
+                    }
+                    if (indices)
+                        addPolygon(mesh, polygon);
+                }
+
+                if (reader.failed)
+                    return fail("truncated or malformed body");
+                if (vertices)
+                    mesh.addVertex(position[0], position[1], position[2]);
+            }
+        }
+
+        return true;
+    }
+}
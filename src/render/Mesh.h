@@ -0,0 +1,38 @@
+#ifndef CARNIVAL_MESH_H
+#define CARNIVAL_MESH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include "../common/vec3.h"
+
+namespace carnival::render {
+
+    // Triangle soup with shared vertices. Positions are kept as separate x / y / z arrays so
+    // bounds, centroids and transforms run over contiguous floats.
+    struct Mesh {
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        std::vector<uint32_t> indices; // three per triangle
+
+        size_t vertexCount() const { return x.size(); }
+        size_t triangleCount() const { return indices.size() / 3; }
+        Vec3 vertex(uint32_t index) const { return {x[index], y[index], z[index]}; }
+
+        void clear();
+        void reserve(size_t vertices, size_t triangles);
+        void addVertex(float vx, float vy, float vz);
+    };
+
+    // picks the format by extension; polygons are triangulated as fans.
+    // Prints the reason and returns false on failure.
+    bool loadMesh(const std::filesystem::path &path, Mesh &mesh);
+    // Wavefront OBJ, positions and faces only
+    bool loadObj(const std::filesystem::path &path, Mesh &mesh);
+    // Stanford PLY, ascii and binary of either endianness
+    bool loadPly(const std::filesystem::path &path, Mesh &mesh);
+}
+
+#endif //CARNIVAL_MESH_H
@@ -0,0 +1,507 @@
+#include "PathTracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include "GLState.h"
+#include "../core/Profiler.h"
+
+namespace carnival::render {
+
+    namespace {
+        const float pi = 3.14159265358979f;
+        const float rayEpsilon = 1e-4f;
+
+        struct Sphere {
+            Vec3 center;
+            float radius;
+            Vec3 albedo;
+            Vec3 emission;
+        };
+
+        struct Hit {
+            float t = 1e30f;
+            Vec3 position;
+            Vec3 normal;
+            Vec3 albedo;
+            Vec3 emission;
+        };
+
+        // a checkered floor plus a few spheres, one of them a lamp
+        const Sphere sceneSpheres[] = {
+                {{0.0f, 0.5f, 0.0f},    0.5f,  {0.80f, 0.30f, 0.20f}, {}},
+                {{-1.1f, 0.4f, 0.3f},   0.4f,  {0.20f, 0.45f, 0.80f}, {}},
+                {{1.0f, 0.3f, -0.4f},   0.3f,  {0.90f, 0.90f, 0.90f}, {}},
+                {{0.45f, 0.15f, 0.85f}, 0.15f, {0.0f, 0.0f, 0.0f},    {8.0f, 6.0f, 3.5f}},
+        };
+
+        // PCG hash, cheap and good enough to decorrelate pixels and samples
+        uint32_t pcgHash(uint32_t value) {
+            uint32_t state = value * 747796405u + 2891336453u;
+            uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+            return (word >> 22u) ^ word;
+        }
+
+        struct Rng {
+            uint32_t state;
+
+            float next() {
+                state = pcgHash(state);
+                return (float) (state >> 8) * (1.0f / 16777216.0f);
+            }
+        };
+
+        bool intersectScene(const Vec3 &origin, const Vec3 &direction, Hit &hit) {
+            bool found = false;
+
+            for (auto &sphere: sceneSpheres) {
+                Vec3 offset = origin - sphere.center;
+                float b = dot(offset, direction);
+                float c = dot(offset, offset) - sphere.radius * sphere.radius;
+                float discriminant = b * b - c;
+                if (discriminant < 0.0f)
+                    continue;
+
+                float root = std::sqrt(discriminant);
+                float t = -b - root;
+                if (t < rayEpsilon)
+                    t = -b + root;
+                if (t < rayEpsilon || t >= hit.t)
+                    continue;
+
+                hit.t = t;
+                hit.position = origin + direction * t;
+                hit.normal = (hit.position - sphere.center) / sphere.radius;
+                hit.albedo = sphere.albedo;
+                hit.emission = sphere.emission;
+                found = true;
+            }
+
+            // floor at y = 0
+            if (direction.y < 0.0f) {
+                float t = -origin.y / direction.y;
+                if (t > rayEpsilon && t < hit.t) {
+                    hit.t = t;
+                    hit.position = origin + direction * t;
+                    hit.normal = {0.0f, 1.0f, 0.0f};
+                    bool odd = ((int) std::floor(hit.position.x) + (int) std::floor(hit.position.z)) & 1;
+                    hit.albedo = odd ? Vec3(0.35f, 0.35f, 0.35f) : Vec3(0.75f, 0.75f, 0.75f);
+                    hit.emission = {};
+                    found = true;
+                }
+            }
+
+            return found;
+        }
+
+        Vec3 sky(const Vec3 &direction) {
+            float t = 0.5f * (direction.y + 1.0f);
+            return Vec3(1.0f, 1.0f, 1.0f) * (1.0f - t) + Vec3(0.5f, 0.7f, 1.0f) * t;
+        }
+
+        // cosine weighted, so the lambert term and the pdf cancel out
+        Vec3 sampleHemisphere(const Vec3 &normal, Rng &rng) {
+            // orthonormal basis without branches (Duff et al. 2017)
+            float sign = std::copysign(1.0f, normal.z);
+            float a = -1.0f / (sign + normal.z);
+            float b = normal.x * normal.y * a;
+            Vec3 tangent(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+            Vec3 bitangent(b, sign + normal.y * normal.y * a, -normal.y);
+
+            float phi = 2.0f * pi * rng.next();
+            float r2 = rng.next();
+            float r = std::sqrt(r2);
+            return tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + normal * std::sqrt(1.0f - r2);
+        }
+
+        Vec3 radiance(Vec3 origin, Vec3 direction, int max_bounces, Rng &rng) {
+            Vec3 result, throughput(1.0f, 1.0f, 1.0f);
+
+            for (int bounce = 0; bounce <= max_bounces; bounce++) {
+                Hit hit;
+                if (!intersectScene(origin, direction, hit)) {
+                    result += throughput * sky(direction);
+                    break;
+                }
+
+                result += throughput * hit.emission;
+                throughput *= hit.albedo;
+
+                // russian roulette once the path had a chance to pick up some light
+                if (bounce >= 2) {
+                    float survive = std::clamp(maxComponent(throughput), 0.05f, 0.95f);
+                    if (rng.next() > survive)
+                        break;
+                    throughput *= 1.0f / survive;
+                }
+
+                origin = hit.position + hit.normal * rayEpsilon;
+                direction = sampleHemisphere(hit.normal, rng);
+            }
+
+            return result;
+        }
+
+        uint32_t toneMap(const Vec3 &color) {
+            auto channel = [](float value) {
+                value = value / (1.0f + value);
+                return (uint32_t) (std::pow(value, 1.0f / 2.2f) * 255.0f + 0.5f);
+            };
+            return channel(color.x) | (channel(color.y) << 8) | (channel(color.z) << 16) | 0xFF000000u;
+        }
+    }
+
+    Vec3 PathTracerCamera::eye() const {
+        return target + Vec3(std::cos(pitch) * std::sin(yaw), std::sin(pitch), std::cos(pitch) * std::cos(yaw)) * distance;
+    }
+
+    bool PathTracerCamera::operator==(const PathTracerCamera &other) const {
+        return target == other.target && yaw == other.yaw && pitch == other.pitch
+               && distance == other.distance && fov_degrees == other.fov_degrees;
+    }
+
+    PathTracer::PathTracer(size_t thread_count)
+            : thread_count(thread_count != 0 ? thread_count : std::max(std::thread::hardware_concurrency(), 1u)),
+              queues(this->thread_count) {
+        counters.threads = this->thread_count;
+        counters.max_samples = max_samples;
+    }
+
+    PathTracer::~PathTracer() {
+        stop();
+    }
+
+    void PathTracer::start() {
+        if (running())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(control_mutex);
+            stopping = false;
+        }
+        // the first rate window starts now, not at the clock's epoch
+        rate_start = std::chrono::steady_clock::now();
+        rate_samples = samples_traced.load();
+        for (size_t i = 0; i < thread_count; i++)
+            workers.emplace_back([this, i]() { work(i); });
+
+        restart();
+    }
+
+    void PathTracer::stop() {
+        if (!running())
+            return;
+
+        {
+            auto lock = cancel();
+            stopping = true;
+        }
+        work_condition.notify_all();
+        for (auto &worker: workers)
+            worker.join();
+        workers.clear();
+
+        std::lock_guard<std::mutex> lock(upload_mutex);
+        uploads.clear();
+    }
+
+    void PathTracer::setTarget(GLuint target_texture, int target_width, int target_height) {
+        if (target_texture == texture && target_width == width && target_height == height)
+            return;
+
+        auto lock = cancel();
+        texture = target_texture;
+        width = std::max(target_width, 0);
+        height = std::max(target_height, 0);
+        begin(lock);
+    }
+
+    void PathTracer::setCamera(const PathTracerCamera &camera) {
+        if (camera == view)
+            return;
+
+        auto lock = cancel();
+        view = camera;
+        begin(lock);
+    }
+
+    void PathTracer::setMaxBounces(int bounces) {
+        if (bounces == max_bounces)
+            return;
+
+        auto lock = cancel();
+        max_bounces = bounces;
+        begin(lock);
+    }
+
+    void PathTracer::setMaxSamples(int samples) {
+        std::lock_guard<std::mutex> lock(control_mutex);
+        max_samples = std::max(samples, 1);
+        counters.max_samples = max_samples;
+
+        // a converged image picks up where it stopped
+        if (running() && pending_tiles.load() == 0 && samples_done.load() < max_samples) {
+            queuePass();
+            work_condition.notify_all();
+        }
+    }
+
+    void PathTracer::restart() {
+        auto lock = cancel();
+        begin(lock);
+    }
+
+    std::unique_lock<std::mutex> PathTracer::cancel() {
+        std::unique_lock<std::mutex> lock(control_mutex);
+        generation++;
+
+        for (auto &queue: queues) {
+            std::lock_guard<std::mutex> queue_lock(queue.mutex);
+            queued_tiles -= (int) queue.jobs.size();
+            queue.jobs.clear();
+        }
+
+        // workers check the generation between rows, this doesn't take long
+        idle_condition.wait(lock, [this]() { return busy_workers == 0; });
+        return lock;
+    }
+
+    void PathTracer::begin([[maybe_unused]] std::unique_lock<std::mutex> &lock) {
+        tiles_x = (width + tileSize - 1) / tileSize;
+        tiles_y = (height + tileSize - 1) / tileSize;
+        // no need to clear it, the first pass writes instead of adding
+        accumulation.resize((size_t) width * (size_t) height * 3);
+        samples_done = 0;
+        pending_tiles = 0;
+        first_pass_ms = 0.0;
+        restart_time = std::chrono::steady_clock::now();
+        counters.restarts++;
+
+        {
+            std::lock_guard<std::mutex> upload_lock(upload_mutex);
+            for (auto &upload: uploads)
+                spare_pixels.push_back(std::move(upload.pixels));
+            uploads.clear();
+        }
+        uploaded.assign((size_t) tiles_x * (size_t) tiles_y, 0);
+
+        if (running() && !stopping && texture != 0) {
+            queuePass();
+            work_condition.notify_all();
+        }
+    }
+
+    void PathTracer::queuePass() {
+        int count = tiles_x * tiles_y;
+        if (count == 0)
+            return;
+
+        pending_tiles = count;
+        pass_start = std::chrono::steady_clock::now();
+        // counted before they are visible, a thief may take one before we are done
+        queued_tiles += count;
+
+        // interleaved, so every worker starts with tiles spread over the whole image
+        auto current = generation.load();
+        for (size_t i = 0; i < queues.size(); i++) {
+            std::lock_guard<std::mutex> queue_lock(queues[i].mutex);
+            for (int tile = (int) i; tile < count; tile += (int) queues.size())
+                queues[i].jobs.push_back({tile, current});
+        }
+    }
+
+    void PathTracer::work(size_t index) {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(control_mutex);
+                work_condition.wait(lock, [this]() { return stopping || queued_tiles.load() > 0; });
+                if (stopping)
+                    return;
+                busy_workers++;
+            }
+
+            TileJob job = {};
+            while (takeTile(index, job)) {
+                if (job.generation == generation.load() && renderTile(job))
+                    finishTile(job);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(control_mutex);
+                busy_workers--;
+            }
+            idle_condition.notify_all();
+        }
+    }
+
+    bool PathTracer::takeTile(size_t index, TileJob &job) {
+        {
+            auto &queue = queues[index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.jobs.empty()) {
+                job = queue.jobs.front();
+                queue.jobs.pop_front();
+                queued_tiles--;
+                return true;
+            }
+        }
+
+        for (size_t offset = 1; offset < queues.size(); offset++) {
+            auto &victim = queues[(index + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                job = victim.jobs.back();
+                victim.jobs.pop_back();
+                queued_tiles--;
+                tiles_stolen++;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool PathTracer::renderTile(const TileJob &job) {
+        CARNIVAL_PROFILE_SCOPE("trace tile");
+        int x0 = (job.tile % tiles_x) * tileSize;
+        int y0 = (job.tile / tiles_x) * tileSize;
+        int x1 = std::min(x0 + tileSize, width);
+        int y1 = std::min(y0 + tileSize, height);
+        int base_samples = samples_done.load();
+        float weight = 1.0f / (float) (base_samples + 1);
+
+        Vec3 eye = view.eye();
+        Vec3 forward = normalize(view.target - eye);
+        Vec3 right = normalize(cross(forward, Vec3(0.0f, 1.0f, 0.0f)));
+        Vec3 up = cross(right, forward);
+        float half_height = std::tan(view.fov_degrees * pi / 360.0f);
+        float half_width = half_height * (float) width / (float) height;
+
+        std::vector<uint32_t> pixels;
+        {
+            std::lock_guard<std::mutex> lock(upload_mutex);
+            if (!spare_pixels.empty()) {
+                pixels = std::move(spare_pixels.back());
+                spare_pixels.pop_back();
+            }
+        }
+        pixels.resize((size_t) (x1 - x0) * (size_t) (y1 - y0));
+        auto *output = pixels.data();
+
+        for (int y = y0; y < y1; y++) {
+            if (job.generation != generation.load(std::memory_order_relaxed))
+                return false;
+
+            for (int x = x0; x < x1; x++) {
+                auto pixel = (size_t) y * (size_t) width + (size_t) x;
+                Rng rng = {pcgHash((uint32_t) pixel ^ pcgHash((uint32_t) base_samples ^ pcgHash((uint32_t) job.generation)))};
+
+                // row 0 is the top of the image, the way ImGui shows the texture
+                float u = (((float) x + rng.next()) / (float) width * 2.0f - 1.0f) * half_width;
+                float v = (1.0f - ((float) y + rng.next()) / (float) height * 2.0f) * half_height;
+                Vec3 direction = normalize(forward + right * u + up * v);
+                Vec3 color = radiance(eye, direction, max_bounces, rng);
+
+                float *sum = &accumulation[pixel * 3];
+                if (base_samples == 0) {
+                    sum[0] = color.x;
+                    sum[1] = color.y;
+                    sum[2] = color.z;
+                } else {
+                    sum[0] += color.x;
+                    sum[1] += color.y;
+                    sum[2] += color.z;
+                }
+                *output++ = toneMap(Vec3(sum[0], sum[1], sum[2]) * weight);
+            }
+        }
+
+        samples_traced += (uint64_t) pixels.size();
+
+        std::lock_guard<std::mutex> lock(upload_mutex);
+        uploads.push_back({job.tile, job.generation, std::move(pixels)});
+        return true;
+    }
+
+    void PathTracer::finishTile(const TileJob &job) {
+        if (pending_tiles.fetch_sub(1) != 1)
+            return;
+
+        // last tile of the pass
+        std::lock_guard<std::mutex> lock(control_mutex);
+        if (job.generation != generation.load())
+            return;
+
+        auto now = std::chrono::steady_clock::now();
+        pass_ms = std::chrono::duration<double, std::milli>(now - pass_start).count();
+        if (samples_done.load() == 0)
+            first_pass_ms = std::chrono::duration<double, std::milli>(now - restart_time).count();
+
+        if (++samples_done < max_samples) {
+            queuePass();
+            work_condition.notify_all();
+        }
+    }
+
+    void PathTracer::update() {
+        if (!running())
+            return;
+
+        CARNIVAL_PROFILE_GPU_SCOPE("path tracer uploads");
+        std::vector<TileUpload> ready;
+        {
+            std::lock_guard<std::mutex> lock(upload_mutex);
+            ready.swap(uploads);
+        }
+
+        // only the newest version of a tile is worth uploading
+        auto current = generation.load();
+        std::fill(uploaded.begin(), uploaded.end(), 0);
+        counters.tiles_uploaded_frame = 0;
+
+        glstate.bindTexture(GL_TEXTURE_2D, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        for (auto it = ready.rbegin(); it != ready.rend(); ++it) {
+            if (it->generation != current || uploaded[it->tile])
+                continue;
+            uploaded[it->tile] = 1;
+
+            int x0 = (it->tile % tiles_x) * tileSize;
+            int y0 = (it->tile / tiles_x) * tileSize;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, std::min(tileSize, width - x0), std::min(tileSize, height - y0),
+                            GL_RGBA, GL_UNSIGNED_BYTE, it->pixels.data());
+            counters.tiles_uploaded_frame++;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(upload_mutex);
+            for (auto &upload: ready)
+                spare_pixels.push_back(std::move(upload.pixels));
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - rate_start).count();
+        if (elapsed >= 0.5) {
+            auto traced = samples_traced.load();
+            counters.samples_per_second = (double) (traced - rate_samples) / elapsed;
+            counters.samples_per_second_core = counters.samples_per_second / (double) thread_count;
+            rate_samples = traced;
+            rate_start = now;
+        }
+
+        std::lock_guard<std::mutex> lock(control_mutex);
+        counters.samples = samples_done.load();
+        counters.pass_ms = pass_ms;
+        counters.first_pass_ms = first_pass_ms;
+        counters.tiles_stolen = tiles_stolen.load();
+    }
+
+    bool PathTracer::busy() const {
+        if (!running() || texture == 0 || tiles_x * tiles_y == 0)
+            return false;
+        if (samples_done.load() < max_samples)
+            return true;
+
+        std::lock_guard<std::mutex> lock(upload_mutex);
+        return !uploads.empty();
+    }
+}
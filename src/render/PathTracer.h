@@ -0,0 +1,153 @@
+#ifndef CARNIVAL_PATHTRACER_H
+#define CARNIVAL_PATHTRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "glad/glad.h"
+#include "../common/vec3.h"
+
+namespace carnival::render {
+
+    struct PathTracerCamera {
+        Vec3 target{0.0f, 0.4f, 0.0f};
+        float yaw = 0.6f;           // radians around the y axis
+        float pitch = 0.3f;
+        float distance = 4.0f;
+        float fov_degrees = 50.0f;
+
+        Vec3 eye() const;
+        bool operator==(const PathTracerCamera &other) const;
+        bool operator!=(const PathTracerCamera &other) const { return !(*this == other); }
+    };
+
+    struct PathTracerStats {
+        size_t threads = 0;
+        int samples = 0;                    // completed samples per pixel
+        int max_samples = 0;
+        double samples_per_second = 0.0;    // pixel samples, all threads
+        double samples_per_second_core = 0.0;
+        double pass_ms = 0.0;               // last full pass over the image
+        double first_pass_ms = 0.0;         // restart until the whole image had one sample
+        uint64_t tiles_stolen = 0;
+        uint64_t restarts = 0;
+        size_t tiles_uploaded_frame = 0;
+    };
+
+    // Progressive CPU path tracer rendering into the viewport texture.
+    // The image is cut into tiles, every pass adds one sample per pixel to a float accumulation buffer.
+    // Each worker has its own tile queue and steals from the others once it runs dry.
+    // Finished tiles are tone mapped on the worker and uploaded by update() with glTexSubImage2D,
+    // so the GL thread only copies pixels. Any change of camera, size or settings cancels the
+    // running pass and starts over.
+    class PathTracer {
+    public:
+        static constexpr int tileSize = 32;
+
+        // 0 uses every core
+        explicit PathTracer(size_t thread_count = 0);
+        ~PathTracer();
+
+        PathTracer(const PathTracer &) = delete;
+        PathTracer &operator=(const PathTracer &) = delete;
+
+        // spawns / joins the workers
+        void start();
+        void stop();
+        bool running() const { return !workers.empty(); }
+
+        // main thread, each of these restarts the image if anything changed
+        void setTarget(GLuint texture, int width, int height);
+        void setCamera(const PathTracerCamera &camera);
+        void setMaxBounces(int bounces);
+        void setMaxSamples(int samples);
+        void restart();
+
+        // GL thread, once per frame: uploads finished tiles into the target texture
+        void update();
+        // still converging or tiles waiting for upload
+        bool busy() const;
+
+        const PathTracerCamera &camera() const { return view; }
+        int maxBounces() const { return max_bounces; }
+        const PathTracerStats &stats() const { return counters; }
+
+    private:
+        struct TileJob {
+            int tile;
+            uint64_t generation;
+        };
+
+        // one per worker, the owner takes from the front, thieves from the back
+        struct TileQueue {
+            std::mutex mutex;
+            std::deque<TileJob> jobs;
+        };
+
+        struct TileUpload {
+            int tile = 0;
+            uint64_t generation = 0;
+            std::vector<uint32_t> pixels; // RGBA8
+        };
+
+        size_t thread_count;
+        std::vector<std::thread> workers;
+        std::vector<TileQueue> queues;
+
+        // guards everything below that workers read when they pick up work
+        std::mutex control_mutex;
+        std::condition_variable work_condition;
+        std::condition_variable idle_condition;
+        bool stopping = false;
+        int busy_workers = 0;
+        std::atomic<uint64_t> generation{0};
+        std::atomic<int> queued_tiles{0};
+        std::atomic<int> pending_tiles{0};
+        std::atomic<int> samples_done{0};
+        int max_samples = 1024;
+        int max_bounces = 4;
+        double pass_ms = 0.0;
+        double first_pass_ms = 0.0;
+
+        PathTracerCamera view;
+        GLuint texture = 0;
+        int width = 0;
+        int height = 0;
+        int tiles_x = 0;
+        int tiles_y = 0;
+        std::vector<float> accumulation; // RGB sums
+
+        mutable std::mutex upload_mutex;
+        std::vector<TileUpload> uploads;
+        std::vector<std::vector<uint32_t>> spare_pixels;
+        std::vector<char> uploaded; // per tile, dedupes within one update()
+
+        std::atomic<uint64_t> samples_traced{0};
+        std::atomic<uint64_t> tiles_stolen{0};
+        std::chrono::steady_clock::time_point restart_time;
+        std::chrono::steady_clock::time_point pass_start;
+        std::chrono::steady_clock::time_point rate_start;
+        uint64_t rate_samples = 0;
+        PathTracerStats counters;
+
+        // cancels the current image and waits until no worker touches the buffers anymore
+        std::unique_lock<std::mutex> cancel();
+        // starts over with whatever changed while cancelled, lock is the one cancel() returned
+        void begin([[maybe_unused]] std::unique_lock<std::mutex> &lock);
+
+        void work(size_t index);
+        bool takeTile(size_t index, TileJob &job);
+        // false if the image was restarted in the meantime
+        bool renderTile(const TileJob &job);
+        void finishTile(const TileJob &job);
+        // with control_mutex held
+        void queuePass();
+    };
+}
+
+#endif //CARNIVAL_PATHTRACER_H
@@ -0,0 +1,144 @@
+#include "ProgramCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include "GLExtensions.h"
+#include "../common/hash.h"
+#include "../core/Log.h"
+
+namespace carnival::render {
+
+    namespace {
+        const char cacheMagic[4] = {'C', 'P', 'B', '1'};
+
+        struct CacheHeader {
+            char magic[4];
+            uint32_t format;
+            uint32_t length;
+            uint32_t reserved;
+            uint64_t key;
+        };
+    }
+
+    ProgramCache::ProgramCache(std::filesystem::path directory) : directory(std::move(directory)) {
+    }
+
+    void ProgramCache::init() {
+        available = glext.program_binary;
+        if (!available) {
+            CARNIVAL_LOG_INFO("Program binaries not supported, shaders are always compiled from source");
+            return;
+        }
+
+        driver_hash = hashString((const char *) glGetString(GL_RENDERER));
+        driver_hash = hashString((const char *) glGetString(GL_VERSION), driver_hash);
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        if (error) {
+            CARNIVAL_LOG_ERROR("Can't create program cache {}: {}", directory, error.message());
+            available = false;
+        }
+    }
+
+    uint64_t ProgramCache::key(const std::string &vertex_source, const std::string &fragment_source) const {
+        uint64_t hash = hashString(vertex_source, driver_hash);
+        // separator so moving text from one stage to the other changes the key
+        hash = hashString("\x1f", hash);
+        return hashString(fragment_source, hash);
+    }
+
+    GLuint ProgramCache::load(uint64_t key) {
+        if (!available)
+            return 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::ifstream file(entryPath(key), std::ios::in | std::ios::binary);
+        if (!file.is_open()) {
+            counters.misses++;
+            return 0;
+        }
+
+        CacheHeader header = {};
+        std::vector<char> binary;
+        bool valid = (bool) file.read((char *) &header, sizeof(header))
+                     && std::equal(header.magic, header.magic + 4, cacheMagic)
+                     && header.key == key;
+        if (valid) {
+            binary.resize(header.length);
+            valid = (bool) file.read(binary.data(), (std::streamsize) binary.size());
+        }
+        if (!valid) {
+            counters.rejected++;
+            return 0;
+        }
+
+        GLuint program = glCreateProgram();
+        glext.ProgramBinary(program, header.format, binary.data(), (GLsizei) binary.size());
+
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (linked != GL_TRUE) {
+            glDeleteProgram(program);
+            counters.rejected++;
+            return 0;
+        }
+
+        counters.hits++;
+        counters.last_load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return program;
+    }
+
+    void ProgramCache::store(uint64_t key, GLuint program) {
+        if (!available || program == 0)
+            return;
+
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        GLsizei written = 0;
+        glext.GetProgramBinary(program, length, &written, &format, binary.data());
+        if (written <= 0)
+            return;
+
+        CacheHeader header = {};
+        std::copy(cacheMagic, cacheMagic + 4, header.magic);
+        header.format = format;
+        header.length = (uint32_t) written;
+        header.key = key;
+
+        // write next to the entry and rename, so a crash never leaves a torn file behind
+        auto path = entryPath(key);
+        auto temporary = path;
+        temporary += ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+            file.write((const char *) &header, sizeof(header));
+            file.write(binary.data(), written);
+            if (!file)
+                return;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+        if (error) {
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+        counters.stores++;
+    }
+
+    std::filesystem::path ProgramCache::entryPath(uint64_t key) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long) key);
+        return directory / name;
+    }
+}
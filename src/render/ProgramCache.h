@@ -0,0 +1,48 @@
+#ifndef CARNIVAL_PROGRAMCACHE_H
+#define CARNIVAL_PROGRAMCACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include "glad/glad.h"
+
+namespace carnival::render {
+
+    struct ProgramCacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t rejected = 0;   // entries the driver refused, e.g. after a driver update
+        uint64_t stores = 0;
+        double last_load_ms = 0.0;
+    };
+
+    // Keeps linked program binaries on disk (glGetProgramBinary), so warm starts skip compiling.
+    // Entries are keyed by the shader sources plus GL_RENDERER and GL_VERSION; if the driver still
+    // rejects a binary the caller compiles from source and stores the new one.
+    class ProgramCache {
+    public:
+        explicit ProgramCache(std::filesystem::path directory);
+
+        // with a current context
+        void init();
+        bool enabled() const { return available; }
+
+        uint64_t key(const std::string &vertex_source, const std::string &fragment_source) const;
+
+        // a linked program, or 0 if there is no usable entry
+        GLuint load(uint64_t key);
+        void store(uint64_t key, GLuint program);
+
+        const ProgramCacheStats &stats() const { return counters; }
+
+    private:
+        std::filesystem::path directory;
+        uint64_t driver_hash = 0;
+        bool available = false;
+        ProgramCacheStats counters;
+
+        std::filesystem::path entryPath(uint64_t key) const;
+    };
+}
+
+#endif //CARNIVAL_PROGRAMCACHE_H
@@ -0,0 +1,792 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "../common/hash.h"
+#include "../core/Log.h"
+#include "../core/Profiler.h"
+
+namespace carnival::render {
+
+    namespace {
+        double millisecondsSince(std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        int roundUp(int size, int granularity) {
+            return (size + granularity - 1) / granularity * granularity;
+        }
+
+        // glTexImage2D needs a matching client format even without data
+        void uploadFormat(GLenum internal_format, GLenum &format, GLenum &type) {
+            switch (internal_format) {
+                case GL_RGBA16F:
+                case GL_RGBA32F:
+                    format = GL_RGBA;
+                    type = GL_FLOAT;
+                    break;
+                case GL_R8:
+                    format = GL_RED;
+                    type = GL_UNSIGNED_BYTE;
+                    break;
+                case GL_R16F:
+                case GL_R32F:
+                    format = GL_RED;
+                    type = GL_FLOAT;
+                    break;
+                case GL_DEPTH_COMPONENT16:
+                case GL_DEPTH_COMPONENT24:
+                    format = GL_DEPTH_COMPONENT;
+                    type = GL_UNSIGNED_INT;
+                    break;
+                case GL_DEPTH_COMPONENT32F:
+                    format = GL_DEPTH_COMPONENT;
+                    type = GL_FLOAT;
+                    break;
+                case GL_DEPTH24_STENCIL8:
+                    format = GL_DEPTH_STENCIL;
+                    type = GL_UNSIGNED_INT_24_8;
+                    break;
+                case GL_DEPTH32F_STENCIL8:
+                    format = GL_DEPTH_STENCIL;
+                    type = GL_FLOAT_32_UNSIGNED_INT_24_8_REV;
+                    break;
+                default:
+                    format = GL_RGBA;
+                    type = GL_UNSIGNED_BYTE;
+                    break;
+            }
+        }
+
+        bool hasStencil(GLenum format) {
+            return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+        }
+    }
+
+    bool GraphTextureDesc::depth() const {
+        switch (format) {
+            case GL_DEPTH_COMPONENT16:
+            case GL_DEPTH_COMPONENT24:
+            case GL_DEPTH_COMPONENT32F:
+            case GL_DEPTH24_STENCIL8:
+            case GL_DEPTH32F_STENCIL8:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    size_t GraphTextureDesc::bytes() const {
+        size_t texel;
+        switch (format) {
+            case GL_R8: texel = 1; break;
+            case GL_DEPTH_COMPONENT16:
+            case GL_R16F: texel = 2; break;
+            case GL_RGBA16F:
+            case GL_DEPTH32F_STENCIL8: texel = 8; break;
+            case GL_RGBA32F: texel = 16; break;
+            // RGBA8, 24 bit depth padded to 4 bytes, 32 bit floats
+            default: texel = 4; break;
+        }
+        return (size_t) width * (size_t) height * texel * (size_t) std::max(samples, 1);
+    }
+
+    GLuint RenderPassContext::texture(GraphResource resource) const {
+        return graph != nullptr ? graph->texture(resource) : 0;
+    }
+
+    RenderGraph::PassBuilder &RenderGraph::PassBuilder::read(GraphResource resource, GraphAccess access) {
+        if (resource < graph.resources.size())
+            graph.passes[pass].reads.push_back({resource, access});
+        return *this;
+    }
+
+    RenderGraph::PassBuilder &RenderGraph::PassBuilder::write(GraphResource resource, GraphAccess access) {
+        if (resource < graph.resources.size())
+            graph.passes[pass].writes.push_back({resource, access});
+        return *this;
+    }
+
+    RenderGraph::PassBuilder &RenderGraph::PassBuilder::resolve(GraphResource source, GraphResource target) {
+        read(source, GraphAccess::Resolve);
+        return write(target, GraphAccess::RenderTarget);
+    }
+
+    RenderGraph::PassBuilder &RenderGraph::PassBuilder::keep() {
+        graph.passes[pass].keep = true;
+        return *this;
+    }
+
+    void RenderGraph::reset() {
+        resources.clear();
+        // the next frame's passes take over their vectors' storage, the same pass the same storage
+        for (size_t i = passes.size(); i-- > 0;) {
+            passes[i].execute = nullptr;
+            spare_passes.push_back(std::move(passes[i]));
+        }
+        passes.clear();
+    }
+
+    GraphResource RenderGraph::createTexture(const char *name, const GraphTextureDesc &desc) {
+        Resource resource;
+        resource.name = name;
+        resource.desc = desc;
+        resources.push_back(resource);
+        return (GraphResource) resources.size() - 1;
+    }
+
+    GraphResource RenderGraph::importTexture(const char *name, GLuint texture, const GraphTextureDesc &desc) {
+        Resource resource;
+        resource.name = name;
+        resource.desc = desc;
+        resource.texture = texture;
+        resource.imported = true;
+        resources.push_back(resource);
+        return (GraphResource) resources.size() - 1;
+    }
+
+    GraphResource RenderGraph::importBackbuffer(const char *name, int width, int height) {
+        Resource resource;
+        resource.name = name;
+        resource.desc = {width, height, GL_RGBA8};
+        resource.imported = true;
+        resource.backbuffer = true;
+        resources.push_back(resource);
+        return (GraphResource) resources.size() - 1;
+    }
+
+    RenderGraph::PassBuilder RenderGraph::addPass(const char *name, Execute execute) {
+        Pass pass;
+        if (!spare_passes.empty()) {
+            auto &spare = spare_passes.back();
+            auto take = [](auto &vector, auto &from) {
+                vector.swap(from);
+                vector.clear();
+            };
+            take(pass.reads, spare.reads);
+            take(pass.writes, spare.writes);
+            take(pass.attachments, spare.attachments);
+            take(pass.invalidate, spare.invalidate);
+            take(pass.resolve_attachments, spare.resolve_attachments);
+            take(pass.resolve_invalidate, spare.resolve_invalidate);
+            spare_passes.pop_back();
+        }
+        pass.name = name;
+        pass.execute = std::move(execute);
+        passes.push_back(std::move(pass));
+        return PassBuilder(*this, passes.size() - 1);
+    }
+
+    void RenderGraph::compile() {
+        CARNIVAL_PROFILE_SCOPE("RenderGraph::compile");
+        auto start = std::chrono::steady_clock::now();
+        frame++;
+
+        // removing pooled textures moves the others, a plan pointing at them has to be made again
+        if (trim())
+            compiled = false;
+
+        auto hash = structureHash();
+        bool cached = compiled && hash == compiled_hash &&
+                      plan_resources.size() == resources.size() && plan_passes.size() == passes.size();
+        if (cached) {
+            for (size_t i = 0; i < resources.size(); i++)
+                resources[i] = plan_resources[i];
+            for (size_t i = 0; i < passes.size(); i++) {
+                auto execute = std::move(passes[i].execute);
+                passes[i] = plan_passes[i];
+                passes[i].execute = std::move(execute);
+            }
+            markUsed();
+        } else {
+            cull();
+            assignPhysical();
+            placeBarriers();
+            createFramebuffers();
+            markUsed();
+
+            plan_resources = resources;
+            plan_passes.clear();
+            for (auto &pass: passes) {
+                plan_passes.push_back(pass);
+                plan_passes.back().execute = nullptr;
+            }
+            compiled_hash = hash;
+            compiled = true;
+            counters.compiles++;
+        }
+
+        updateStats(millisecondsSince(start), cached);
+    }
+
+    uint64_t RenderGraph::structureHash() const {
+        auto hash = fnvOffsetBasis;
+        for (auto &resource: resources) {
+            hash = hashBytes(&resource.name, sizeof(resource.name), hash);
+            hash = hashBytes(&resource.desc.width, sizeof(resource.desc.width), hash);
+            hash = hashBytes(&resource.desc.height, sizeof(resource.desc.height), hash);
+            hash = hashBytes(&resource.desc.format, sizeof(resource.desc.format), hash);
+            hash = hashBytes(&resource.desc.samples, sizeof(resource.desc.samples), hash);
+            hash = hashBytes(&resource.desc.capacity_width, sizeof(resource.desc.capacity_width), hash);
+            hash = hashBytes(&resource.desc.capacity_height, sizeof(resource.desc.capacity_height), hash);
+            hash = hashBytes(&resource.texture, sizeof(resource.texture), hash);
+            uint8_t flags = (resource.imported ? 1 : 0) | (resource.backbuffer ? 2 : 0);
+            hash = hashBytes(&flags, sizeof(flags), hash);
+        }
+        for (auto &pass: passes) {
+            hash = hashBytes(&pass.name, sizeof(pass.name), hash);
+            for (auto *accesses: {&pass.reads, &pass.writes}) {
+                auto count = accesses->size();
+                hash = hashBytes(&count, sizeof(count), hash);
+                for (auto &access: *accesses) {
+                    hash = hashBytes(&access.resource, sizeof(access.resource), hash);
+                    hash = hashBytes(&access.access, sizeof(access.access), hash);
+                }
+            }
+            hash = hashBytes(&pass.keep, sizeof(pass.keep), hash);
+        }
+        return hash;
+    }
+
+    void RenderGraph::cull() {
+        // walk backwards: a pass is needed if something needed reads what it writes
+        std::vector<char> live(resources.size(), 0);
+        for (size_t i = 0; i < resources.size(); i++)
+            live[i] = resources[i].imported;
+
+        for (size_t i = passes.size(); i-- > 0;) {
+            auto &pass = passes[i];
+            pass.culled = !pass.keep && std::none_of(pass.writes.begin(), pass.writes.end(), [&](const Access &write) {
+                return live[write.resource];
+            });
+            if (pass.culled)
+                continue;
+
+            // whatever was in a transient before this pass overwrote it doesn't matter
+            for (auto &write: pass.writes) {
+                bool reads_it = std::any_of(pass.reads.begin(), pass.reads.end(), [&](const Access &read) {
+                    return read.resource == write.resource;
+                });
+                if (!resources[write.resource].imported && !reads_it)
+                    live[write.resource] = 0;
+            }
+            for (auto &read: pass.reads)
+                live[read.resource] = 1;
+        }
+    }
+
+    void RenderGraph::assignPhysical() {
+        for (auto &resource: resources) {
+            resource.physical = -1;
+            resource.first_pass = -1;
+            resource.last_pass = -1;
+        }
+        for (size_t i = 0; i < passes.size(); i++) {
+            if (passes[i].culled)
+                continue;
+            for (auto *accesses: {&passes[i].reads, &passes[i].writes}) {
+                for (auto &access: *accesses) {
+                    auto &resource = resources[access.resource];
+                    if (resource.first_pass < 0)
+                        resource.first_pass = (int) i;
+                    resource.last_pass = (int) i;
+                }
+            }
+        }
+
+        for (auto &texture: pool)
+            texture.busy_until = -1;
+
+        // greedy in pass order: take a pooled texture of the same kind that is free by the time the resource
+        // is first used. Lifetimes are intervals, so this never needs more textures than are live at once
+        for (size_t i = 0; i < passes.size(); i++) {
+            if (passes[i].culled)
+                continue;
+            for (auto *accesses: {&passes[i].reads, &passes[i].writes}) {
+                for (auto &access: *accesses) {
+                    auto &resource = resources[access.resource];
+                    if (resource.imported || resource.physical >= 0 || resource.first_pass != (int) i)
+                        continue;
+
+                    GraphTextureDesc storage = resource.desc;
+                    storage.width = roundUp(std::max({storage.width, storage.capacity_width, 1}), granularity);
+                    storage.height = roundUp(std::max({storage.height, storage.capacity_height, 1}), granularity);
+                    storage.capacity_width = storage.capacity_height = 0;
+                    if (storage.samples > 1) {
+                        if (max_samples == 0)
+                            glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+                        storage.samples = std::min(storage.samples, (int) std::max(max_samples, 1));
+                    }
+                    storage.samples = std::max(storage.samples, 1);
+
+                    int physical = -1;
+                    for (size_t p = 0; p < pool.size(); p++) {
+                        if (pool[p].desc == storage && pool[p].busy_until < (int) i) {
+                            physical = (int) p;
+                            break;
+                        }
+                    }
+                    if (physical < 0 && storage.samples > 1) {
+                        PhysicalTexture texture;
+                        texture.desc = storage;
+                        glGenRenderbuffers(1, &texture.renderbuffer);
+                        glBindRenderbuffer(GL_RENDERBUFFER, texture.renderbuffer);
+                        glRenderbufferStorageMultisample(GL_RENDERBUFFER, storage.samples, storage.format, storage.width,
+                                                         storage.height);
+                        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+                        pool.push_back(texture);
+                        physical = (int) pool.size() - 1;
+                    } else if (physical < 0) {
+                        PhysicalTexture texture;
+                        texture.desc = storage;
+                        GLenum format, type;
+                        uploadFormat(storage.format, format, type);
+                        glGenTextures(1, &texture.texture);
+                        glstate.bindTexture(GL_TEXTURE_2D, texture.texture);
+                        glTexImage2D(GL_TEXTURE_2D, 0, (GLint) storage.format, storage.width, storage.height, 0,
+                                     format, type, nullptr);
+                        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                        glstate.bindTexture(GL_TEXTURE_2D, 0);
+                        pool.push_back(texture);
+                        physical = (int) pool.size() - 1;
+                    }
+                    pool[physical].busy_until = resource.last_pass;
+                    resource.physical = physical;
+                }
+            }
+        }
+    }
+
+    void RenderGraph::placeBarriers() {
+        // tracked per texture rather than per resource, aliasing hands an image store on to the next owner
+        auto key = [&](GraphResource resource) {
+            auto physical = resources[resource].physical;
+            return physical >= 0 ? resources.size() + (size_t) physical : (size_t) resource;
+        };
+        std::vector<char> stored(resources.size() + pool.size(), 0);
+
+        for (auto &pass: passes) {
+            pass.barrier = 0;
+            if (pass.culled)
+                continue;
+
+            for (auto &read: pass.reads) {
+                if (!stored[key(read.resource)])
+                    continue;
+                if (read.access == GraphAccess::Storage)
+                    pass.barrier |= GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+                else if (read.access == GraphAccess::Resolve)
+                    pass.barrier |= GL_FRAMEBUFFER_BARRIER_BIT;
+                else
+                    pass.barrier |= GL_TEXTURE_FETCH_BARRIER_BIT;
+            }
+            for (auto &write: pass.writes) {
+                if (stored[key(write.resource)])
+                    pass.barrier |= write.access == GraphAccess::Storage ? GL_SHADER_IMAGE_ACCESS_BARRIER_BIT
+                                                                         : GL_FRAMEBUFFER_BARRIER_BIT;
+                if (write.access == GraphAccess::RenderTarget) {
+                    for (auto &read: pass.reads) {
+                        if (read.resource == write.resource && read.access == GraphAccess::Sampled)
+                            CARNIVAL_LOG_WARNING("Render pass {} samples {} while rendering into it", pass.name,
+                                                 resources[write.resource].name);
+                    }
+                }
+            }
+            // cleared once something waited for them
+            for (auto &read: pass.reads)
+                stored[key(read.resource)] = 0;
+            for (auto &write: pass.writes)
+                stored[key(write.resource)] = write.access == GraphAccess::Storage;
+        }
+    }
+
+    void RenderGraph::createFramebuffers() {
+        auto depthAttachment = [](const GraphTextureDesc &desc) {
+            return hasStencil(desc.format) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+        };
+
+        for (size_t i = 0; i < passes.size(); i++) {
+            auto &pass = passes[i];
+            pass.binds_framebuffer = false;
+            pass.framebuffer = 0;
+            pass.attachments.clear();
+            pass.invalidate.clear();
+            pass.resolve_framebuffer = 0;
+            pass.resolve_mask = 0;
+            pass.resolve_attachments.clear();
+            pass.resolve_invalidate.clear();
+            if (pass.culled)
+                continue;
+
+            bool backbuffer = false;
+            int colors = 0;
+            for (auto &write: pass.writes) {
+                if (write.access != GraphAccess::RenderTarget)
+                    continue;
+                auto &resource = resources[write.resource];
+                if (!pass.binds_framebuffer) {
+                    pass.width = resource.desc.width;
+                    pass.height = resource.desc.height;
+                    pass.binds_framebuffer = true;
+                }
+                if (resource.backbuffer)
+                    backbuffer = true;
+                else if (resource.desc.depth())
+                    pass.attachments.emplace_back(write.resource, depthAttachment(resource.desc));
+                else if (colors < 4)
+                    pass.attachments.emplace_back(write.resource, GL_COLOR_ATTACHMENT0 + colors++);
+            }
+
+            if (backbuffer) {
+                if (!pass.attachments.empty())
+                    CARNIVAL_LOG_WARNING("Render pass {} mixes the backbuffer with textures, only the backbuffer is bound",
+                                         pass.name);
+                pass.attachments.clear();
+            } else if (pass.binds_framebuffer) {
+                pass.framebuffer = framebufferFor(pass.name, pass.attachments);
+            }
+
+            for (auto &read: pass.reads) {
+                if (read.access != GraphAccess::Resolve)
+                    continue;
+                auto &desc = resources[read.resource].desc;
+                GLbitfield mask = desc.depth() ? GL_DEPTH_BUFFER_BIT | (hasStencil(desc.format) ? GL_STENCIL_BUFFER_BIT : 0)
+                                               : GL_COLOR_BUFFER_BIT;
+                if (pass.resolve_mask & mask) {
+                    CARNIVAL_LOG_WARNING("Render pass {} resolves more than one {} source", pass.name,
+                                         desc.depth() ? "depth" : "colour");
+                    continue;
+                }
+                pass.resolve_mask |= mask;
+                pass.resolve_attachments.emplace_back(read.resource, desc.depth() ? depthAttachment(desc)
+                                                                                  : GL_COLOR_ATTACHMENT0);
+            }
+            if (pass.resolve_mask != 0)
+                pass.resolve_framebuffer = framebufferFor(pass.name, pass.resolve_attachments);
+
+            // nothing reads these after the pass, the driver doesn't have to keep (or write back) their contents
+            auto lastUse = [&](GraphResource resource) {
+                return !resources[resource].imported && resources[resource].last_pass == (int) i;
+            };
+            for (auto &attachment: pass.attachments) {
+                if (lastUse(attachment.first))
+                    pass.invalidate.push_back(attachment.second);
+            }
+            for (auto &attachment: pass.resolve_attachments) {
+                if (lastUse(attachment.first))
+                    pass.resolve_invalidate.push_back(attachment.second);
+            }
+        }
+    }
+
+    uint64_t RenderGraph::attachmentKey(GraphResource resource) const {
+        auto &entry = resources[resource];
+        if (entry.imported || entry.physical < 0)
+            return entry.texture;
+        auto &physical = pool[entry.physical];
+        return physical.renderbuffer != 0 ? (1ull << 32) | physical.renderbuffer : physical.texture;
+    }
+
+    void RenderGraph::attach(GLenum target, GLenum attachment, GraphResource resource) const {
+        auto &entry = resources[resource];
+        if (!entry.imported && entry.physical >= 0 && pool[entry.physical].renderbuffer != 0)
+            glFramebufferRenderbuffer(target, attachment, GL_RENDERBUFFER, pool[entry.physical].renderbuffer);
+        else
+            glFramebufferTexture2D(target, attachment, GL_TEXTURE_2D, texture(resource), 0);
+    }
+
+    GLuint RenderGraph::framebufferFor(const char *name, const std::vector<std::pair<GraphResource, GLenum>> &attachments) {
+        Framebuffer key;
+        int colors = 0;
+        for (auto &attachment: attachments) {
+            if (attachment.second >= GL_COLOR_ATTACHMENT0 && attachment.second < GL_COLOR_ATTACHMENT0 + 4)
+                key.colors[colors++] = attachmentKey(attachment.first);
+            else
+                key.depth = attachmentKey(attachment.first);
+        }
+
+        for (auto &framebuffer: framebuffers) {
+            if (std::equal(std::begin(key.colors), std::end(key.colors), std::begin(framebuffer.colors)) &&
+                key.depth == framebuffer.depth)
+                return framebuffer.framebuffer;
+        }
+
+        GLuint previous = glstate.drawFramebuffer();
+        glGenFramebuffers(1, &key.framebuffer);
+        glstate.bindFramebuffer(GL_FRAMEBUFFER, key.framebuffer);
+        for (auto &attachment: attachments)
+            attach(GL_FRAMEBUFFER, attachment.second, attachment.first);
+
+        GLenum draw_buffers[4] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
+        if (colors > 0) {
+            glDrawBuffers(colors, draw_buffers);
+        } else {
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            CARNIVAL_LOG_ERROR("Framebuffer of render pass {} is incomplete", name);
+        glstate.bindFramebuffer(GL_FRAMEBUFFER, previous);
+
+        framebuffers.push_back(key);
+        return key.framebuffer;
+    }
+
+    bool RenderGraph::trim() {
+        auto textures = pool.size();
+        for (size_t p = pool.size(); p-- > 0;) {
+            if (pool[p].last_used_frame + maxUnusedFrames >= frame)
+                continue;
+            auto &texture = pool[p];
+            auto key = texture.renderbuffer != 0 ? (1ull << 32) | texture.renderbuffer : (uint64_t) texture.texture;
+            // framebuffers holding it go with it
+            framebuffers.erase(std::remove_if(framebuffers.begin(), framebuffers.end(), [&](Framebuffer &framebuffer) {
+                bool attached = framebuffer.depth == key ||
+                                std::find(std::begin(framebuffer.colors), std::end(framebuffer.colors), key) !=
+                                std::end(framebuffer.colors);
+                if (attached)
+                    glstate.deleteFramebuffers(1, &framebuffer.framebuffer);
+                return attached;
+            }), framebuffers.end());
+            if (texture.renderbuffer != 0)
+                glDeleteRenderbuffers(1, &texture.renderbuffer);
+            else
+                glstate.deleteTextures(1, &texture.texture);
+            pool.erase(pool.begin() + (long) p);
+        }
+
+        framebuffers.erase(std::remove_if(framebuffers.begin(), framebuffers.end(), [&](Framebuffer &framebuffer) {
+            bool unused = framebuffer.last_used_frame + maxUnusedFrames < frame;
+            if (unused)
+                glstate.deleteFramebuffers(1, &framebuffer.framebuffer);
+            return unused;
+        }), framebuffers.end());
+        return pool.size() != textures;
+    }
+
+    void RenderGraph::markUsed() {
+        for (auto &resource: resources) {
+            if (resource.physical >= 0)
+                pool[resource.physical].last_used_frame = frame;
+        }
+        for (auto &pass: passes) {
+            for (auto &framebuffer: framebuffers) {
+                if (framebuffer.framebuffer == pass.framebuffer || framebuffer.framebuffer == pass.resolve_framebuffer)
+                    framebuffer.last_used_frame = frame;
+            }
+        }
+    }
+
+    void RenderGraph::execute() {
+        CARNIVAL_PROFILE_SCOPE("RenderGraph::execute");
+        auto &timings = gpu_timings[frame % gpuFrames];
+        resolveGpuTimings(timings);
+
+        // known unless something outside the cache bound it
+        GLuint previous = glstate.drawFramebuffer();
+
+        for (size_t i = 0; i < passes.size(); i++) {
+            auto &pass = passes[i];
+            if (pass.culled)
+                continue;
+
+            CARNIVAL_PROFILE_GPU_SCOPE(pass.name);
+            auto start = std::chrono::steady_clock::now();
+
+            if (pass.barrier != 0 && glext.memory_barrier)
+                glext.MemoryBarrier(pass.barrier);
+
+            GpuTiming timing = {pass.name, {0, 0}};
+            if (glext.timer_query) {
+                timing.queries[0] = query();
+                timing.queries[1] = query();
+                glext.QueryCounter(timing.queries[0], GL_TIMESTAMP);
+            }
+
+            RenderPassContext context;
+            context.graph = this;
+            if (pass.binds_framebuffer) {
+                glstate.bindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+                // the owner of an imported texture may have replaced it under the same name since the
+                // framebuffer was made, attaching it again is cheaper than finding out
+                for (auto &attachment: pass.attachments) {
+                    if (resources[attachment.first].imported)
+                        attach(GL_FRAMEBUFFER, attachment.second, attachment.first);
+                }
+                glstate.viewport(0, 0, pass.width, pass.height);
+                context.framebuffer = pass.framebuffer;
+                context.width = pass.width;
+                context.height = pass.height;
+            }
+
+            if (pass.resolve_mask != 0) {
+                glstate.bindFramebuffer(GL_READ_FRAMEBUFFER, pass.resolve_framebuffer);
+                for (auto &attachment: pass.resolve_attachments) {
+                    if (resources[attachment.first].imported)
+                        attach(GL_READ_FRAMEBUFFER, attachment.second, attachment.first);
+                }
+                // depth can only be resolved with nearest, for colour it's the same at 1:1
+                glBlitFramebuffer(0, 0, pass.width, pass.height, 0, 0, pass.width, pass.height, pass.resolve_mask,
+                                  GL_NEAREST);
+                if (!pass.resolve_invalidate.empty() && glext.invalidate_framebuffer)
+                    glext.InvalidateFramebuffer(GL_READ_FRAMEBUFFER, (GLsizei) pass.resolve_invalidate.size(),
+                                                pass.resolve_invalidate.data());
+                glstate.bindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+            }
+
+            if (pass.execute)
+                pass.execute(context);
+
+            if (!pass.invalidate.empty() && glext.invalidate_framebuffer) {
+                glstate.bindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+                glext.InvalidateFramebuffer(GL_FRAMEBUFFER, (GLsizei) pass.invalidate.size(), pass.invalidate.data());
+            }
+
+            if (glext.timer_query) {
+                glext.QueryCounter(timing.queries[1], GL_TIMESTAMP);
+                timings.push_back(timing);
+            }
+            if (i < counters.passes.size())
+                counters.passes[i].cpu_ms = millisecondsSince(start);
+        }
+
+        glstate.bindFramebuffer(GL_FRAMEBUFFER, previous);
+    }
+
+    void RenderGraph::shutdown() {
+        for (auto &texture: pool) {
+            glstate.deleteTextures(1, &texture.texture);
+            glDeleteRenderbuffers(1, &texture.renderbuffer);
+        }
+        for (auto &framebuffer: framebuffers)
+            glstate.deleteFramebuffers(1, &framebuffer.framebuffer);
+        for (auto &timings: gpu_timings) {
+            for (auto &timing: timings)
+                free_queries.insert(free_queries.end(), std::begin(timing.queries), std::end(timing.queries));
+            timings.clear();
+        }
+        if (!free_queries.empty())
+            glDeleteQueries((GLsizei) free_queries.size(), free_queries.data());
+
+        pool.clear();
+        framebuffers.clear();
+        free_queries.clear();
+        plan_resources.clear();
+        plan_passes.clear();
+        compiled = false;
+        reset();
+    }
+
+    GLuint RenderGraph::texture(GraphResource resource) const {
+        if (resource >= resources.size())
+            return 0;
+        auto &entry = resources[resource];
+        if (entry.imported)
+            return entry.texture;
+        return entry.physical >= 0 ? pool[entry.physical].texture : 0;
+    }
+
+    void RenderGraph::storageSize(GraphResource resource, int &width, int &height) const {
+        width = height = 0;
+        if (resource >= resources.size())
+            return;
+        auto &entry = resources[resource];
+        auto &desc = !entry.imported && entry.physical >= 0 ? pool[entry.physical].desc : entry.desc;
+        width = desc.width;
+        height = desc.height;
+    }
+
+    void RenderGraph::updateStats(double compile_ms, bool cached) {
+        auto compiles = counters.compiles;
+        // the per pass stats keep their storage from frame to frame
+        auto pass_stats = std::move(counters.passes);
+        counters = RenderGraphStats();
+        counters.passes = std::move(pass_stats);
+        counters.compiles = compiles;
+        counters.compile_ms = compile_ms;
+        counters.cached = cached;
+        counters.framebuffers = framebuffers.size();
+
+        counters.passes.assign(passes.size(), RenderGraphPassStats());
+        for (size_t i = 0; i < passes.size(); i++) {
+            auto &stats = counters.passes[i];
+            stats.name = passes[i].name;
+            stats.culled = passes[i].culled;
+            for (auto &entry: gpu_ms) {
+                if (entry.first == stats.name)
+                    stats.gpu_ms = entry.second;
+            }
+            if (passes[i].culled)
+                counters.culled_passes++;
+            if (passes[i].barrier != 0)
+                counters.barriers++;
+            if (passes[i].resolve_mask != 0)
+                counters.resolves++;
+            counters.invalidated += passes[i].invalidate.size() + passes[i].resolve_invalidate.size();
+        }
+
+        auto &counted = counted_textures;
+        counted.assign(pool.size(), 0);
+        for (auto &resource: resources) {
+            if (resource.physical < 0)
+                continue;
+            auto bytes = pool[resource.physical].desc.bytes();
+            counters.transient_resources++;
+            counters.virtual_bytes += bytes;
+            if (!counted[resource.physical]) {
+                counted[resource.physical] = 1;
+                counters.physical_textures++;
+                counters.physical_bytes += bytes;
+            }
+            // lifetimes on one texture never overlap, so the sum per pass is what is really in use
+            for (int pass = resource.first_pass; pass <= resource.last_pass; pass++)
+                counters.passes[pass].live_bytes += bytes;
+        }
+        for (auto &stats: counters.passes)
+            counters.peak_bytes = std::max(counters.peak_bytes, stats.live_bytes);
+        for (auto &texture: pool)
+            counters.pooled_bytes += texture.desc.bytes();
+    }
+
+    void RenderGraph::resolveGpuTimings(std::vector<GpuTiming> &timings) {
+        if (timings.empty())
+            return;
+
+        // timestamps complete in order, if the last one is there so are all others; if not, the frame is
+        // dropped rather than waited for
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(timings.back().queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        for (auto &timing: timings) {
+            if (available) {
+                GLuint64 begin = 0, end = 0;
+                glext.GetQueryObjectui64v(timing.queries[0], GL_QUERY_RESULT, &begin);
+                glext.GetQueryObjectui64v(timing.queries[1], GL_QUERY_RESULT, &end);
+                auto ms = end > begin ? (double) (end - begin) / 1e6 : 0.0;
+                auto entry = std::find_if(gpu_ms.begin(), gpu_ms.end(), [&](const std::pair<const char *, double> &e) {
+                    return e.first == timing.name;
+                });
+                if (entry != gpu_ms.end())
+                    entry->second = ms;
+                else
+                    gpu_ms.emplace_back(timing.name, ms);
+            }
+            free_queries.insert(free_queries.end(), std::begin(timing.queries), std::end(timing.queries));
+        }
+        timings.clear();
+    }
+
+    GLuint RenderGraph::query() {
+        if (free_queries.empty()) {
+            GLuint query = 0;
+            glGenQueries(1, &query);
+            return query;
+        }
+        auto query = free_queries.back();
+        free_queries.pop_back();
+        return query;
+    }
+}
@@ -0,0 +1,240 @@
+#ifndef CARNIVAL_RENDERGRAPH_H
+#define CARNIVAL_RENDERGRAPH_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "glad/glad.h"
+
+namespace carnival::render {
+
+    using GraphResource = uint32_t;
+    const GraphResource invalidGraphResource = ~0u;
+
+    struct GraphTextureDesc {
+        int width = 0;
+        int height = 0;
+        GLenum format = GL_RGBA8;   // depth formats are attached as depth
+        // above 1 a multisampled renderbuffer: rendered into and resolved, never sampled
+        int samples = 1;
+        // storage is at least this large, so a texture drawn at a changing size keeps its storage
+        int capacity_width = 0;
+        int capacity_height = 0;
+
+        bool operator==(const GraphTextureDesc &other) const {
+            return width == other.width && height == other.height && format == other.format
+                   && samples == other.samples && capacity_width == other.capacity_width
+                   && capacity_height == other.capacity_height;
+        }
+        bool depth() const;
+        size_t bytes() const;
+    };
+
+    enum class GraphAccess {
+        Sampled,        // read through a sampler
+        RenderTarget,   // written as a framebuffer attachment
+        Storage,        // image load / store, needs a barrier before anything else sees it
+        Resolve         // blitted from, see PassBuilder::resolve
+    };
+
+    struct RenderGraphPassStats {
+        const char *name = nullptr;
+        bool culled = false;
+        double cpu_ms = 0.0;
+        double gpu_ms = 0.0;        // a few frames old, 0 without timer queries
+        size_t live_bytes = 0;      // transient memory allocated while the pass runs
+    };
+
+    struct RenderGraphStats {
+        std::vector<RenderGraphPassStats> passes;
+        size_t culled_passes = 0;
+        size_t transient_resources = 0;
+        size_t physical_textures = 0;   // the transient resources were aliased onto these
+        size_t virtual_bytes = 0;       // what the transient resources would take on their own
+        size_t physical_bytes = 0;      // what they take aliased
+        size_t peak_bytes = 0;          // largest live_bytes of a pass
+        size_t pooled_bytes = 0;        // everything the pool holds, used this frame or not
+        size_t barriers = 0;
+        size_t resolves = 0;            // blits, colour and depth of a pass resolve in one
+        size_t invalidated = 0;         // attachments discarded once nothing reads them any more
+        size_t framebuffers = 0;
+        double compile_ms = 0.0;
+        bool cached = false;            // the last compiled graph was reused
+        uint64_t compiles = 0;
+    };
+
+    class RenderGraph;
+
+    // What a pass sees while it executes: its framebuffer is bound and the viewport set.
+    // Transient textures may be larger than their desc, read them with texelFetch / gl_FragCoord.
+    class RenderPassContext {
+    public:
+        GLuint framebuffer = 0;
+        int width = 0;      // of the attachments' desc
+        int height = 0;
+
+        GLuint texture(GraphResource resource) const;
+
+    private:
+        friend class RenderGraph;
+        const RenderGraph *graph = nullptr;
+    };
+
+    // Describes a frame as passes that read and write virtual resources, rebuilt every frame.
+    // compile() culls the passes nothing depends on, places barriers where an image store is read and
+    // puts transient textures whose lifetimes don't overlap onto the same pooled texture, so a chain of
+    // post-processing passes ping-pongs between two textures however long it gets. The result is
+    // reused while the graph stays the same from one frame to the next.
+    // Transient storage is rounded up to granularity, so a viewport being dragged larger doesn't
+    // allocate a new set of textures every frame.
+    // Writing an imported resource is what a graph is for: those passes are never culled.
+    class RenderGraph {
+    public:
+        using Execute = std::function<void(const RenderPassContext &context)>;
+
+        class PassBuilder {
+        public:
+            PassBuilder &read(GraphResource resource, GraphAccess access = GraphAccess::Sampled);
+            PassBuilder &write(GraphResource resource, GraphAccess access = GraphAccess::RenderTarget);
+            // blits source into target before the pass executes, one colour and one depth source per pass
+            PassBuilder &resolve(GraphResource source, GraphResource target);
+            // never culled, for passes with effects the graph doesn't see
+            PassBuilder &keep();
+
+        private:
+            friend class RenderGraph;
+            PassBuilder(RenderGraph &graph, size_t pass) : graph(graph), pass(pass) {}
+            RenderGraph &graph;
+            size_t pass;
+        };
+
+        // pooled textures unused this many frames are deleted
+        static constexpr uint64_t maxUnusedFrames = 60;
+        static constexpr int granularity = 64;
+
+        // starts describing a new frame
+        void reset();
+        // names must outlive the graph, i.e. be literals
+        GraphResource createTexture(const char *name, const GraphTextureDesc &desc);
+        // owned elsewhere, desc.width x desc.height is the part that is drawn
+        GraphResource importTexture(const char *name, GLuint texture, const GraphTextureDesc &desc);
+        // the default framebuffer
+        GraphResource importBackbuffer(const char *name, int width, int height);
+        PassBuilder addPass(const char *name, Execute execute);
+        // index of the next pass, also its index in stats().passes
+        size_t passCount() const { return passes.size(); }
+
+        void compile();
+        void execute();
+        // with a current context
+        void shutdown();
+
+        // after compile(), 0 for culled resources
+        GLuint texture(GraphResource resource) const;
+        // of the storage behind resource, for cropping it with desc.width / width
+        void storageSize(GraphResource resource, int &width, int &height) const;
+        const RenderGraphStats &stats() const { return counters; }
+
+    private:
+        struct Resource {
+            const char *name = nullptr;
+            GraphTextureDesc desc;
+            GLuint texture = 0;         // imported
+            bool imported = false;
+            bool backbuffer = false;
+            int physical = -1;
+            int first_pass = -1;
+            int last_pass = -1;
+        };
+
+        struct Access {
+            GraphResource resource;
+            GraphAccess access;
+        };
+
+        struct Pass {
+            const char *name = nullptr;
+            Execute execute;
+            std::vector<Access> reads;
+            std::vector<Access> writes;
+            bool keep = false;
+            bool culled = false;
+            GLbitfield barrier = 0;
+            bool binds_framebuffer = false;
+            GLuint framebuffer = 0;
+            int width = 0;
+            int height = 0;
+            std::vector<std::pair<GraphResource, GLenum>> attachments;
+            std::vector<GLenum> invalidate;             // attachments whose last use this is
+            GLuint resolve_framebuffer = 0;
+            GLbitfield resolve_mask = 0;
+            std::vector<std::pair<GraphResource, GLenum>> resolve_attachments;
+            std::vector<GLenum> resolve_invalidate;
+        };
+
+        struct PhysicalTexture {
+            GraphTextureDesc desc;      // rounded up
+            GLuint texture = 0;
+            GLuint renderbuffer = 0;    // multisampled
+            uint64_t last_used_frame = 0;
+            int busy_until = -1;        // last pass of the resource it holds, while compiling
+        };
+
+        // attachments are keyed by attachmentKey(), textures and renderbuffers have separate names
+        struct Framebuffer {
+            uint64_t colors[4] = {};
+            uint64_t depth = 0;
+            GLuint framebuffer = 0;
+            uint64_t last_used_frame = 0;
+        };
+
+        // GPU times arrive a few frames later, by then the passes may have changed
+        struct GpuTiming {
+            const char *name;
+            GLuint queries[2];
+        };
+
+        static constexpr int gpuFrames = 3;
+
+        std::vector<Resource> resources;
+        std::vector<Pass> passes;
+        // passes of earlier frames, kept for the storage of their vectors
+        std::vector<Pass> spare_passes;
+        std::vector<PhysicalTexture> pool;
+        std::vector<Framebuffer> framebuffers;
+        uint64_t frame = 0;
+        uint64_t compiled_hash = 0;
+        bool compiled = false;
+        GLint max_samples = 0;
+
+        // what compile() decided, copied onto an unchanged graph
+        std::vector<Resource> plan_resources;
+        std::vector<Pass> plan_passes;         // without execute
+
+        std::vector<GpuTiming> gpu_timings[gpuFrames];
+        std::vector<GLuint> free_queries;
+        std::vector<std::pair<const char *, double>> gpu_ms;
+        RenderGraphStats counters;
+        std::vector<char> counted_textures;    // updateStats() scratch
+
+        uint64_t structureHash() const;
+        void cull();
+        void assignPhysical();
+        void placeBarriers();
+        void createFramebuffers();
+        GLuint framebufferFor(const char *name, const std::vector<std::pair<GraphResource, GLenum>> &attachments);
+        uint64_t attachmentKey(GraphResource resource) const;
+        void attach(GLenum target, GLenum attachment, GraphResource resource) const;
+        // true if pooled textures were deleted
+        bool trim();
+        void markUsed();
+        void updateStats(double compile_ms, bool cached);
+        void resolveGpuTimings(std::vector<GpuTiming> &timings);
+        GLuint query();
+    };
+}
+
+#endif //CARNIVAL_RENDERGRAPH_H
@@ -0,0 +1,282 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "../core/Log.h"
+#include "../core/Profiler.h"
+
+namespace carnival::render {
+
+    static const size_t initialCapacity = 4096;
+    static const int depthBits = 24;
+    static const int meshShift = 24;
+    static const int stateShift = 36;   // program, VAO and texture
+
+    static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // the queue only ever sees a handful of programs and textures per frame
+    static uint32_t slotOf(std::vector<GLuint> &slots, GLuint name) {
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i] == name)
+                return (uint32_t) i;
+        }
+        slots.push_back(name);
+        return (uint32_t) slots.size() - 1;
+    }
+
+    uint64_t makeSortKey(uint32_t program_slot, uint32_t vao_slot, uint32_t texture_slot, MeshHandle mesh, float depth) {
+        auto quantized = (uint64_t) (std::clamp(depth, 0.0f, 1.0f) * (float) ((1u << depthBits) - 1));
+        return ((uint64_t) (program_slot & 0xFF) << 56) | ((uint64_t) (vao_slot & 0xFF) << 48)
+               | ((uint64_t) (texture_slot & 0xFFF) << stateShift) | ((uint64_t) (mesh & 0xFFF) << meshShift)
+               | quantized;
+    }
+
+    bool RenderQueue::init(StreamBuffer &stream_buffer) {
+        if (!glext.shader_storage || !glext.base_instance || !glext.instanced_arrays) {
+            CARNIVAL_LOG_INFO("Render queue needs GL 4.3 (shader storage buffers, base instance), not available");
+            return false;
+        }
+
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vertex_buffer);
+        glGenBuffers(1, &index_buffer);
+
+        glstate.bindVertexArray(vao);
+        glstate.bindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+        glEnableVertexAttribArray(0);
+        glstate.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+        glstate.bindVertexArray(0);
+
+        stream = &stream_buffer;
+        reserve(initialCapacity);
+        return true;
+    }
+
+    void RenderQueue::shutdown() {
+        if (vao == 0)
+            return;
+
+        glstate.deleteBuffers(1, &object_index_buffer);
+        glstate.deleteBuffers(1, &vertex_buffer);
+        glstate.deleteBuffers(1, &index_buffer);
+        glstate.deleteVertexArrays(1, &vao);
+        object_index_buffer = vertex_buffer = index_buffer = vao = 0;
+        capacity = 0;
+    }
+
+    MeshHandle RenderQueue::addMesh(const float *positions, size_t vertex_count, const uint32_t *mesh_indices,
+                                    size_t index_count) {
+        meshes.push_back({(GLuint) indices.size(), (GLuint) index_count, (GLint) (vertices.size() / 3)});
+        vertices.insert(vertices.end(), positions, positions + vertex_count * 3);
+        indices.insert(indices.end(), mesh_indices, mesh_indices + index_count);
+        geometry_dirty = true;
+        return (MeshHandle) meshes.size() - 1;
+    }
+
+    void RenderQueue::submit(GLuint program, GLuint texture, MeshHandle mesh, const ObjectData &object) {
+        keys.push_back(makeSortKey(slotOf(program_slots, program), 0, slotOf(texture_slots, texture), mesh,
+                                   object.depth));
+        objects.push_back(object);
+        draws.push_back({program, texture, mesh});
+    }
+
+    void RenderQueue::uploadGeometry() {
+        glstate.bindVertexArray(vao);
+        glstate.bindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) (vertices.size() * sizeof(float)), vertices.data(), GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr) (indices.size() * sizeof(uint32_t)), indices.data(),
+                     GL_STATIC_DRAW);
+        glstate.bindVertexArray(0);
+        geometry_dirty = false;
+    }
+
+    void RenderQueue::reserve(size_t count) {
+        if (count <= capacity)
+            return;
+
+        capacity = std::max(capacity * 2, initialCapacity);
+        while (capacity < count)
+            capacity *= 2;
+
+        // base instance plus instance index
+        std::vector<uint32_t> object_indices(capacity);
+        std::iota(object_indices.begin(), object_indices.end(), 0u);
+        if (object_index_buffer == 0)
+            glGenBuffers(1, &object_index_buffer);
+        glstate.bindVertexArray(vao);
+        glstate.bindBuffer(GL_ARRAY_BUFFER, object_index_buffer);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) (object_indices.size() * sizeof(uint32_t)), object_indices.data(),
+                     GL_STATIC_DRAW);
+        glVertexAttribIPointer(objectIndexAttribute, 1, GL_UNSIGNED_INT, 0, nullptr);
+        glext.VertexAttribDivisor(objectIndexAttribute, 1);
+        glEnableVertexAttribArray(objectIndexAttribute);
+        glstate.bindVertexArray(0);
+    }
+
+    // LSD radix sort of the keys, carrying the submission index along. Digits that are the same
+    // for every key (usually the program and VAO bytes) are skipped.
+    void RenderQueue::sort() {
+        auto count = keys.size();
+        order.resize(count);
+        std::iota(order.begin(), order.end(), 0u);
+        sort_keys.resize(count);
+        sort_order.resize(count);
+
+        size_t histograms[8][256] = {};
+        for (auto key: keys) {
+            for (int digit = 0; digit < 8; digit++)
+                histograms[digit][(key >> (digit * 8)) & 0xFF]++;
+        }
+
+        for (int digit = 0; digit < 8; digit++) {
+            auto &histogram = histograms[digit];
+            int shift = digit * 8;
+            if (histogram[(keys[0] >> shift) & 0xFF] == count)
+                continue;
+
+            size_t offset = 0;
+            for (auto &bucket: histogram) {
+                auto size = bucket;
+                bucket = offset;
+                offset += size;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                auto position = histogram[(keys[i] >> shift) & 0xFF]++;
+                sort_keys[position] = keys[i];
+                sort_order[position] = order[i];
+            }
+            keys.swap(sort_keys);
+            order.swap(sort_order);
+        }
+    }
+
+    void RenderQueue::flush() {
+        CARNIVAL_PROFILE_GPU_SCOPE("render queue");
+        auto count = keys.size();
+        counters.objects = count;
+        counters.batches = counters.commands = counters.draw_calls = counters.state_changes = 0;
+        counters.sort_ms = counters.upload_ms = counters.submit_ms = 0.0;
+        counters.multi_draw = use_multi_draw && glext.multi_draw_indirect;
+
+        if (!supported() || count == 0) {
+            clearFrame();
+            return;
+        }
+
+        if (geometry_dirty)
+            uploadGeometry();
+
+        auto start = std::chrono::steady_clock::now();
+        sort();
+        counters.sort_ms = millisecondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        reserve(count);
+        auto object_data = stream->allocateStorage(count * sizeof(ObjectData));
+        if (!object_data.valid()) {
+            clearFrame();
+            return;
+        }
+        auto *object_target = (ObjectData *) object_data.data;
+
+        // objects in sorted order, so every run of the same mesh is one instanced command
+        commands.clear();
+        batches.clear();
+        const DrawState *previous = nullptr;
+        for (size_t i = 0; i < count; i++) {
+            object_target[i] = objects[order[i]];
+
+            // compared on the state itself, slots that wrapped in the key may share bits
+            auto &draw = draws[order[i]];
+            bool new_batch = previous == nullptr || draw.program != previous->program
+                             || draw.texture != previous->texture;
+            bool new_command = new_batch || draw.mesh != previous->mesh;
+            previous = &draw;
+
+            if (new_batch)
+                batches.push_back({draw.program, draw.texture, commands.size(), 0});
+            if (new_command) {
+                auto &mesh = meshes[draw.mesh];
+                commands.push_back({mesh.index_count, 1, mesh.first_index, mesh.base_vertex, (GLuint) i});
+                batches.back().command_count++;
+            } else {
+                commands.back().instance_count++;
+            }
+        }
+
+        StreamAllocation command_data;
+        if (counters.multi_draw) {
+            command_data = stream->allocate(commands.size() * sizeof(DrawElementsIndirectCommand));
+            if (command_data.valid())
+                std::copy(commands.begin(), commands.end(), (DrawElementsIndirectCommand *) command_data.data);
+            else
+                counters.multi_draw = false;
+        }
+        stream->flush();
+        counters.upload_ms = millisecondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        glstate.bindVertexArray(vao);
+        glstate.bindBufferRange(GL_SHADER_STORAGE_BUFFER, objectBinding, object_data.buffer, object_data.offset,
+                                object_data.size);
+        if (counters.multi_draw)
+            glstate.bindBuffer(GL_DRAW_INDIRECT_BUFFER, command_data.buffer);
+        glstate.enable(GL_DEPTH_TEST);
+        glstate.depthFunc(GL_LESS);
+        glstate.activeTexture(GL_TEXTURE0);
+        counters.state_changes++;
+
+        GLuint bound_program = 0, bound_texture = 0;
+        for (auto &batch: batches) {
+            if (batch.program != bound_program) {
+                glstate.useProgram(batch.program);
+                bound_program = batch.program;
+                counters.state_changes++;
+            }
+            if (batch.texture != bound_texture) {
+                glstate.bindTexture(GL_TEXTURE_2D, batch.texture);
+                bound_texture = batch.texture;
+                counters.state_changes++;
+            }
+
+            if (counters.multi_draw) {
+                auto offset = command_data.offset + batch.first_command * sizeof(DrawElementsIndirectCommand);
+                glext.MultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void *) offset,
+                                                (GLsizei) batch.command_count, 0);
+                counters.draw_calls++;
+            } else {
+                for (size_t i = batch.first_command; i < batch.first_command + batch.command_count; i++) {
+                    auto &command = commands[i];
+                    glext.DrawElementsInstancedBaseVertexBaseInstance(
+                            GL_TRIANGLES, (GLsizei) command.count, GL_UNSIGNED_INT,
+                            (const void *) (command.first_index * sizeof(uint32_t)), (GLsizei) command.instance_count,
+                            command.base_vertex, command.base_instance);
+                    counters.draw_calls++;
+                }
+            }
+        }
+
+        // the vertex array stays bound, the next frame's flush finds it there
+        glstate.disable(GL_DEPTH_TEST);
+        counters.submit_ms = millisecondsSince(start);
+
+        counters.batches = batches.size();
+        counters.commands = commands.size();
+        clearFrame();
+    }
+
+    void RenderQueue::clearFrame() {
+        keys.clear();
+        objects.clear();
+        draws.clear();
+        program_slots.clear();
+        texture_slots.clear();
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef CARNIVAL_RENDERQUEUE_H
+#define CARNIVAL_RENDERQUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glad/glad.h"
+#include "StreamBuffer.h"
+
+namespace carnival::render {
+
+    using MeshHandle = uint32_t;
+
+    // std430 layout of the Objects buffer in the object shaders, keep both in sync
+    struct ObjectData {
+        float transform[4];     // x, y, scale x, scale y in clip space
+        float rotation;         // radians
+        float depth;            // 0 near .. 1 far
+        uint32_t color;         // RGBA8, R in the lowest byte (unpackUnorm4x8)
+        uint32_t flags;
+    };
+
+    // Bits from high to low: program 8, VAO 8, texture 12, mesh 12, depth 24.
+    // Mesh sorts before depth so equal meshes of a batch end up next to each other and become
+    // one instanced command; opaque objects are still drawn front to back per mesh.
+    // Slots past their field wrap around, which only costs batching: flush() draws with the state an
+    // object was submitted with, not with what the key says.
+    uint64_t makeSortKey(uint32_t program_slot, uint32_t vao_slot, uint32_t texture_slot, MeshHandle mesh, float depth);
+
+    struct RenderQueueStats {
+        // last flush
+        size_t objects = 0;
+        size_t batches = 0;          // runs of equal program, VAO and texture
+        size_t commands = 0;         // indirect commands, one per run of the same mesh
+        size_t draw_calls = 0;
+        size_t state_changes = 0;    // program, VAO and texture binds
+        double sort_ms = 0.0;
+        double upload_ms = 0.0;
+        double submit_ms = 0.0;
+        bool multi_draw = false;     // batches go through glMultiDrawElementsIndirect
+    };
+
+    // Collects the draws of a frame, sorts them by state and submits them in as few calls as possible.
+    // Per object data and the indirect draw commands are allocated from the frame's stream buffer,
+    // the objects bound as a shader storage buffer. Every batch is one glMultiDrawElementsIndirect.
+    // The object shaders find their data through an instanced vertex attribute (location objectIndexAttribute),
+    // which counts up from the command's base instance.
+    class RenderQueue {
+    public:
+        static const GLuint objectBinding = 0;
+        static const GLuint objectIndexAttribute = 1;
+
+        // with a current context, false if the context can't run the queue (needs SSBOs and base instance).
+        // flush() allocates from stream, between its beginFrame() and endFrame()
+        bool init(StreamBuffer &stream);
+        void shutdown();
+        bool supported() const { return vao != 0; }
+
+        // positions are xyz, the mesh is drawn as triangles
+        MeshHandle addMesh(const float *positions, size_t vertex_count, const uint32_t *indices, size_t index_count);
+
+        void submit(GLuint program, GLuint texture, MeshHandle mesh, const ObjectData &object);
+        // sorts, uploads and draws everything submitted since the last flush into the bound framebuffer
+        void flush();
+
+        // off draws every command on its own, to compare
+        bool use_multi_draw = true;
+
+        const RenderQueueStats &stats() const { return counters; }
+
+    private:
+        struct Mesh {
+            GLuint first_index;
+            GLuint index_count;
+            GLint base_vertex;
+        };
+
+        struct DrawElementsIndirectCommand {
+            GLuint count;
+            GLuint instance_count;
+            GLuint first_index;
+            GLint base_vertex;
+            GLuint base_instance;
+        };
+
+        // what an object was submitted with
+        struct DrawState {
+            GLuint program;
+            GLuint texture;
+            MeshHandle mesh;
+        };
+
+        struct Batch {
+            GLuint program;
+            GLuint texture;
+            size_t first_command;
+            size_t command_count;
+        };
+
+        std::vector<Mesh> meshes;
+        std::vector<float> vertices;
+        std::vector<uint32_t> indices;
+        bool geometry_dirty = false;
+
+        GLuint vao = 0;
+        GLuint vertex_buffer = 0;
+        GLuint index_buffer = 0;
+        GLuint object_index_buffer = 0;  // 0, 1, 2, ... for the instanced attribute
+        size_t capacity = 0;
+        StreamBuffer *stream = nullptr;
+
+        // the frame being recorded
+        std::vector<uint64_t> keys;
+        std::vector<uint32_t> order;
+        std::vector<ObjectData> objects;
+        std::vector<DrawState> draws;       // by submission, like objects
+        std::vector<GLuint> program_slots;
+        std::vector<GLuint> texture_slots;
+
+        // scratch
+        std::vector<uint64_t> sort_keys;
+        std::vector<uint32_t> sort_order;
+        std::vector<DrawElementsIndirectCommand> commands;
+        std::vector<Batch> batches;
+
+        RenderQueueStats counters;
+
+        void uploadGeometry();
+        void reserve(size_t count);
+        void sort();
+        void clearFrame();
+    };
+}
+
+#endif //CARNIVAL_RENDERQUEUE_H
@@ -0,0 +1,266 @@
+#include "RenderTarget.h"
+
+#include <algorithm>
+#include "GLState.h"
+#include "../core/Log.h"
+
+namespace carnival::render {
+
+    static int roundUp(int value, int multiple)
+    {
+        return ((value + multiple - 1) / multiple) * multiple;
+    }
+
+    RenderTarget createRenderTarget(int width, int height)
+    {
+        RenderTarget target;
+        target.width = width;
+        target.height = height;
+
+        glGenFramebuffers(1, &target.framebuffer);
+        glstate.bindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+
+        glGenTextures(1, &target.texture);
+        glstate.bindTexture(GL_TEXTURE_2D, target.texture);
+
+        // Give an empty image to OpenGL ( the last "0" )
+        // RGBA8 like the multisampled attachments resolved into it, blits between formats aren't portable
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+        // Poor filtering. Needed !
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+        // The depth buffer
+        glGenRenderbuffers(1, &target.depthbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, target.depthbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depthbuffer);
+
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0);
+
+        GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
+        glDrawBuffers(1, DrawBuffers);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            CARNIVAL_LOG_ERROR("Framebuffer {}x{} is incomplete", width, height);
+        }
+
+        return target;
+    }
+
+    void destroyRenderTarget(RenderTarget &target)
+    {
+        if (target.framebuffer == 0)
+            return;
+
+        glstate.deleteTextures(1, &target.texture);
+        glDeleteRenderbuffers(1, &target.depthbuffer);
+        glstate.deleteFramebuffers(1, &target.framebuffer);
+        target = RenderTarget();
+    }
+
+    // RenderTargetPool
+
+    RenderTargetPool::~RenderTargetPool()
+    {
+        clear();
+    }
+
+    bool RenderTargetPool::acquire(int width, int height, RenderTarget &out, float max_waste)
+    {
+        auto best = targets.end();
+        for (auto it = targets.begin(); it != targets.end(); ++it) {
+            if (it->width < width || it->height < height)
+                continue;
+            if ((float) it->width * (float) it->height > max_waste * (float) width * (float) height)
+                continue;
+            if (best == targets.end() || it->bytes() < best->bytes())
+                best = it;
+        }
+
+        if (best == targets.end())
+            return false;
+
+        out = *best;
+        targets.erase(best);
+        return true;
+    }
+
+    void RenderTargetPool::release(RenderTarget target, uint64_t frame)
+    {
+        if (target.framebuffer == 0)
+            return;
+
+        target.last_used_frame = frame;
+        targets.push_back(target);
+
+        // evict the least recently used ones
+        while (targets.size() > max_targets) {
+            auto oldest = std::min_element(targets.begin(), targets.end(),
+                                           [](const RenderTarget &a, const RenderTarget &b) {
+                                               return a.last_used_frame < b.last_used_frame;
+                                           });
+            destroyRenderTarget(*oldest);
+            targets.erase(oldest);
+        }
+    }
+
+    void RenderTargetPool::trim(uint64_t frame, uint64_t max_age)
+    {
+        for (auto it = targets.begin(); it != targets.end();) {
+            if (frame - it->last_used_frame > max_age) {
+                destroyRenderTarget(*it);
+                it = targets.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void RenderTargetPool::clear()
+    {
+        for (auto &target: targets)
+            destroyRenderTarget(target);
+        targets.clear();
+    }
+
+    size_t RenderTargetPool::bytes() const
+    {
+        size_t total = 0;
+        for (auto &target: targets)
+            total += target.bytes();
+        return total;
+    }
+
+    // ViewportTarget
+
+    ViewportTarget::~ViewportTarget()
+    {
+        release();
+    }
+
+    void ViewportTarget::request(int width, int height)
+    {
+        width = std::max(width, 1);
+        height = std::max(height, 1);
+
+        if (width != requested_width || height != requested_height) {
+            requested_width = width;
+            requested_height = height;
+            stable_frames = 0;
+        }
+    }
+
+    bool ViewportTarget::pending() const
+    {
+        if (current.framebuffer == 0)
+            return true;
+        if (view.width != requested_width || view.height != requested_height)
+            return true;
+        // an oversized allocation still waiting to be given back
+        int width = roundUp(std::min(requested_width, (int) max_size), granularity);
+        int height = roundUp(std::min(requested_height, (int) max_size), granularity);
+        return (size_t) current.width * current.height > (size_t) 4 * width * height;
+    }
+
+    bool ViewportTarget::update()
+    {
+        frame++;
+        stable_frames++;
+        pool.trim(frame, 600);
+
+        if (max_size == 0) {
+            GLint max_texture = 0, max_renderbuffer = 0;
+            glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture);
+            glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_renderbuffer);
+            max_size = std::min(max_texture, max_renderbuffer);
+        }
+
+        int width = std::min(requested_width, (int) max_size);
+        int height = std::min(requested_height, (int) max_size);
+
+        if (current.framebuffer == 0) {
+            reallocate(roundUp(width, granularity), roundUp(height, granularity));
+            refreshView(width, height);
+            return true;
+        }
+
+        bool fits = width <= current.width && height <= current.height;
+        if (fits) {
+            // shrinking or small growth: just draw into a smaller part of what we have,
+            // but give memory back once a much smaller size has settled. compare against the
+            // rounded size we would reallocate to, or small viewports never stop shrinking
+            int shrunk_width = roundUp(width, granularity), shrunk_height = roundUp(height, granularity);
+            bool oversized = (size_t) current.width * current.height > (size_t) 4 * shrunk_width * shrunk_height;
+            if (oversized && stable_frames >= shrink_settle_frames) {
+                reallocate(shrunk_width, shrunk_height);
+                refreshView(width, height);
+                stable_frames = 0;
+                return true;
+            }
+            refreshView(width, height);
+            return false;
+        }
+
+        if (stable_frames < settle_frames) {
+            // still being dragged, keep rendering into what we have
+            counters.resizes_coalesced++;
+            refreshView(std::min(width, current.width), std::min(height, current.height));
+            return false;
+        }
+
+        int new_width = current.width, new_height = current.height;
+        if (width > current.width)
+            new_width = std::max(width, (int) ((float) current.width * growth_factor));
+        if (height > current.height)
+            new_height = std::max(height, (int) ((float) current.height * growth_factor));
+
+        new_width = std::min(roundUp(new_width, granularity), (int) max_size);
+        new_height = std::min(roundUp(new_height, granularity), (int) max_size);
+
+        reallocate(new_width, new_height);
+        refreshView(width, height);
+        return true;
+    }
+
+    void ViewportTarget::release()
+    {
+        destroyRenderTarget(current);
+        pool.clear();
+        view = ImageData();
+        counters.bytes_resident = 0;
+        counters.bytes_pooled = 0;
+        counters.pooled_targets = 0;
+    }
+
+    void ViewportTarget::reallocate(int width, int height)
+    {
+        RenderTarget next;
+        if (pool.acquire(width, height, next)) {
+            counters.pool_hits++;
+        } else {
+            next = createRenderTarget(width, height);
+            counters.reallocations++;
+            counters.bytes_allocated += next.bytes();
+        }
+
+        pool.release(current, frame);
+        current = next;
+
+        counters.bytes_pooled = pool.bytes();
+        counters.pooled_targets = pool.size();
+        counters.bytes_resident = current.bytes() + counters.bytes_pooled;
+    }
+
+    void ViewportTarget::refreshView(int width, int height)
+    {
+        view.texture = current.texture;
+        view.framebuffer = current.framebuffer;
+        view.depthbuffer = current.depthbuffer;
+        view.width = width;
+        view.height = height;
+        view.capacity_width = current.width;
+        view.capacity_height = current.height;
+    }
+}
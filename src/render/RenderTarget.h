@@ -0,0 +1,123 @@
+#ifndef CARNIVAL_RENDERTARGET_H
+#define CARNIVAL_RENDERTARGET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glad/glad.h"
+
+namespace carnival::render {
+
+    // One complete colour + depth framebuffer at a fixed storage size.
+    struct RenderTarget {
+        GLuint framebuffer = 0;
+        GLuint texture = 0;
+        GLuint depthbuffer = 0;
+        int width = 0;
+        int height = 0;
+        uint64_t last_used_frame = 0;
+
+        // RGBA8 colour and a 24 bit depth buffer padded to 4 bytes per texel by every driver we know of
+        size_t bytes() const { return (size_t) width * (size_t) height * 8; }
+    };
+
+    // What the renderer and the GUI see of the viewport target: the region that is
+    // actually drawn into (width x height) inside a possibly larger allocation.
+    struct ImageData {
+        GLuint texture = 0;
+        GLuint framebuffer = 0;
+        GLuint depthbuffer = 0;
+        int width = 0;
+        int height = 0;
+        int capacity_width = 0;
+        int capacity_height = 0;
+
+        // texture coordinates of the used region's upper corner, for UV-cropped ImGui::Image calls
+        float uvMaxX() const { return capacity_width > 0 ? (float) width / (float) capacity_width : 1.0f; }
+        float uvMaxY() const { return capacity_height > 0 ? (float) height / (float) capacity_height : 1.0f; }
+    };
+
+    // The part of the full image's clip space that is drawn into a target, for rendering an image in tiles.
+    // A renderer maps it onto -1..1, the default region is the whole image.
+    struct ViewRegion {
+        float x0 = -1.0f, y0 = -1.0f;
+        float x1 = 1.0f, y1 = 1.0f;
+    };
+
+    struct RenderTargetStats {
+        uint64_t reallocations = 0;      // targets created with fresh GL storage
+        uint64_t pool_hits = 0;          // resizes served by a retired target
+        uint64_t bytes_allocated = 0;    // total bytes of GL storage ever created
+        uint64_t resizes_coalesced = 0;  // frames where a resize was deferred until the size settled
+        size_t bytes_resident = 0;       // active target + pool
+        size_t bytes_pooled = 0;
+        size_t pooled_targets = 0;
+    };
+
+    // Keeps retired targets around so that going back to a previous size
+    // (e.g. toggling a side panel) doesn't touch GL storage at all.
+    class RenderTargetPool {
+    public:
+        ~RenderTargetPool();
+
+        // smallest pooled target that can hold width x height without wasting more than max_waste x the area
+        bool acquire(int width, int height, RenderTarget &out, float max_waste = 2.0f);
+        void release(RenderTarget target, uint64_t frame);
+        // drops targets that weren't reused for max_age frames
+        void trim(uint64_t frame, uint64_t max_age);
+        void clear();
+
+        size_t bytes() const;
+        size_t size() const { return targets.size(); }
+
+        size_t max_targets = 3;
+
+    private:
+        std::vector<RenderTarget> targets;
+    };
+
+    // Manages the viewport framebuffer.
+    // Resizes are coalesced until the requested size has been stable for a few frames, storage grows
+    // geometrically and anything that fits into the current allocation is drawn as a sub-rectangle.
+    class ViewportTarget {
+    public:
+        ~ViewportTarget();
+
+        // called every frame with the size of the region the image is shown in
+        void request(int width, int height);
+        // applies the request, returns true if the GL storage changed
+        bool update();
+        // true while a requested size has not been applied yet
+        bool pending() const;
+        void release();
+
+        const ImageData &image() const { return view; }
+        const RenderTargetStats &stats() const { return counters; }
+
+        int settle_frames = 8;          // frames a growing size must be stable before we reallocate
+        int shrink_settle_frames = 120; // frames before an oversized allocation is given back
+        float growth_factor = 1.5f;
+        int granularity = 64;
+
+    private:
+        RenderTarget current;
+        RenderTargetPool pool;
+        ImageData view;
+        RenderTargetStats counters;
+
+        int requested_width = 0;
+        int requested_height = 0;
+        int stable_frames = 0;
+        uint64_t frame = 0;
+        GLint max_size = 0;
+
+        void reallocate(int width, int height);
+        void refreshView(int width, int height);
+    };
+
+    // leaves the new framebuffer bound
+    RenderTarget createRenderTarget(int width, int height);
+    void destroyRenderTarget(RenderTarget &target);
+}
+
+#endif //CARNIVAL_RENDERTARGET_H
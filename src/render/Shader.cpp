@@ -0,0 +1,278 @@
+#include "Shader.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string_view>
+#include <vector>
+#include "GLExtensions.h"
+#include "../core/Log.h"
+
+namespace carnival::render {
+
+    bool readTextFile(const std::filesystem::path &path, std::string &out)
+    {
+        std::ifstream stream(path, std::ios::in | std::ios::binary);
+        if (!stream.is_open())
+            return false;
+
+        std::stringstream sstr;
+        sstr << stream.rdbuf();
+        out = sstr.str();
+        return true;
+    }
+
+    std::string injectDefines(const std::string &source, const ShaderDefines &defines)
+    {
+        if (defines.empty())
+            return source;
+
+        // without a #version line the defines simply come first
+        size_t insert = 0;
+        auto version = source.find("#version");
+        if (version != std::string::npos) {
+            auto end = source.find('\n', version);
+            insert = end == std::string::npos ? source.size() : end + 1;
+        }
+
+        std::string out;
+        out.reserve(source.size() + defines.size() * 32 + 16);
+        out.append(source, 0, insert);
+        if (insert > 0 && out.back() != '\n')
+            out += '\n';
+        auto next_line = std::count(out.begin(), out.end(), '\n') + 1;
+        for (auto &define: defines)
+            out.append("#define ").append(define).append("\n");
+        out.append("#line ").append(std::to_string(next_line)).append("\n");
+        out.append(source, insert, std::string::npos);
+        return out;
+    }
+
+    GLuint createShader(GLenum type, const std::string &source)
+    {
+        GLuint shader = glCreateShader(type);
+        const char *source_pointer = source.c_str();
+        glShaderSource(shader, 1, &source_pointer, nullptr);
+        glCompileShader(shader);
+        return shader;
+    }
+
+    GLuint createProgram(GLuint vertex_shader, GLuint fragment_shader, bool retrievable)
+    {
+        GLuint program = glCreateProgram();
+        if (retrievable && glext.program_binary)
+            glext.ProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+        glAttachShader(program, vertex_shader);
+        glAttachShader(program, fragment_shader);
+        glLinkProgram(program);
+        return program;
+    }
+
+    bool isCompletionDone(GLuint shader_or_program, bool is_program)
+    {
+        if (!glext.parallel_shader_compile)
+            return true;
+
+        GLint done = GL_TRUE;
+        if (is_program)
+            glGetProgramiv(shader_or_program, GL_COMPLETION_STATUS_KHR, &done);
+        else
+            glGetShaderiv(shader_or_program, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+
+    // a line per record, a whole compiler log would be cut at the record size
+    static void logInfoLog(bool success, const std::string &name, std::string_view message)
+    {
+        while (!message.empty()) {
+            auto end = message.find('\n');
+            auto line = message.substr(0, end);
+            if (!line.empty()) {
+                if (success)
+                    CARNIVAL_LOG_INFO("{}: {}", name, line);
+                else
+                    CARNIVAL_LOG_ERROR("{}: {}", name, line);
+            }
+            if (end == std::string_view::npos)
+                break;
+            message.remove_prefix(end + 1);
+        }
+    }
+
+    bool checkShader(GLuint shader, const std::string &name)
+    {
+        GLint result = GL_FALSE;
+        int info_log_length = 0;
+
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &info_log_length);
+        if (info_log_length > 1) {
+            std::vector<char> message(info_log_length + 1);
+            glGetShaderInfoLog(shader, info_log_length, nullptr, message.data());
+            logInfoLog(result == GL_TRUE, name, message.data());
+        }
+        return result == GL_TRUE;
+    }
+
+    bool checkProgram(GLuint program, const std::string &name)
+    {
+        GLint result = GL_FALSE;
+        int info_log_length = 0;
+
+        glGetProgramiv(program, GL_LINK_STATUS, &result);
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &info_log_length);
+        if (info_log_length > 1) {
+            std::vector<char> message(info_log_length + 1);
+            glGetProgramInfoLog(program, info_log_length, nullptr, message.data());
+            logInfoLog(result == GL_TRUE, name, message.data());
+        }
+        return result == GL_TRUE;
+    }
+
+    GLuint buildProgram(const std::string &vertex_source, const std::string &fragment_source,
+                        const std::string &name, bool retrievable)
+    {
+        GLuint vertex_shader = createShader(GL_VERTEX_SHADER, vertex_source);
+        GLuint fragment_shader = createShader(GL_FRAGMENT_SHADER, fragment_source);
+
+        GLuint program = 0;
+        bool compiled = checkShader(vertex_shader, name + " (vertex)");
+        compiled = checkShader(fragment_shader, name + " (fragment)") && compiled;
+        if (compiled) {
+            program = createProgram(vertex_shader, fragment_shader, retrievable);
+            if (!checkProgram(program, name)) {
+                glDeleteProgram(program);
+                program = 0;
+            } else {
+                glDetachShader(program, vertex_shader);
+                glDetachShader(program, fragment_shader);
+            }
+        }
+
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+        return program;
+    }
+
+    bool UniformBlockMember::operator==(const UniformBlockMember &other) const
+    {
+        return name == other.name && offset == other.offset && type == other.type && array_size == other.array_size
+               && array_stride == other.array_stride && matrix_stride == other.matrix_stride;
+    }
+
+    GLint UniformBlockLayout::offset(std::string_view member) const
+    {
+        for (auto &candidate: members) {
+            if (candidate.name == member)
+                return candidate.offset;
+        }
+        return -1;
+    }
+
+    bool UniformBlockLayout::sameLayout(const UniformBlockLayout &other) const
+    {
+        return size == other.size && members == other.members;
+    }
+
+    static std::vector<UniformBlockLayout> reflectResources(GLuint program)
+    {
+        GLint block_count = 0, block_name_length = 0, member_name_length = 0;
+        glext.GetProgramInterfaceiv(program, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &block_count);
+        glext.GetProgramInterfaceiv(program, GL_UNIFORM_BLOCK, GL_MAX_NAME_LENGTH, &block_name_length);
+        glext.GetProgramInterfaceiv(program, GL_UNIFORM, GL_MAX_NAME_LENGTH, &member_name_length);
+
+        std::vector<UniformBlockLayout> blocks((size_t) block_count);
+        std::vector<char> name((size_t) std::max({block_name_length, member_name_length, 1}));
+        std::vector<GLint> indices;
+        for (GLint i = 0; i < block_count; i++) {
+            auto &block = blocks[(size_t) i];
+            GLsizei length = 0;
+            glext.GetProgramResourceName(program, GL_UNIFORM_BLOCK, (GLuint) i, (GLsizei) name.size(), &length,
+                                         name.data());
+            block.name.assign(name.data(), (size_t) length);
+
+            const GLenum block_properties[] = {GL_BUFFER_DATA_SIZE, GL_BUFFER_BINDING, GL_NUM_ACTIVE_VARIABLES};
+            GLint values[3] = {};
+            glext.GetProgramResourceiv(program, GL_UNIFORM_BLOCK, (GLuint) i, 3, block_properties, 3, nullptr,
+                                       values);
+            block.size = values[0];
+            block.binding = (GLuint) values[1];
+
+            indices.assign((size_t) values[2], 0);
+            const GLenum active_variables = GL_ACTIVE_VARIABLES;
+            glext.GetProgramResourceiv(program, GL_UNIFORM_BLOCK, (GLuint) i, 1, &active_variables,
+                                       (GLsizei) indices.size(), nullptr, indices.data());
+            for (auto index: indices) {
+                const GLenum member_properties[] = {GL_OFFSET, GL_TYPE, GL_ARRAY_SIZE, GL_ARRAY_STRIDE,
+                                                    GL_MATRIX_STRIDE};
+                GLint member_values[5] = {};
+                glext.GetProgramResourceiv(program, GL_UNIFORM, (GLuint) index, 5, member_properties, 5, nullptr,
+                                           member_values);
+                glext.GetProgramResourceName(program, GL_UNIFORM, (GLuint) index, (GLsizei) name.size(), &length,
+                                             name.data());
+                block.members.push_back({std::string(name.data(), (size_t) length), member_values[0],
+                                         (GLenum) member_values[1], member_values[2], member_values[3],
+                                         member_values[4]});
+            }
+        }
+        return blocks;
+    }
+
+    // GL 3.1, the same through the uniform block queries
+    static std::vector<UniformBlockLayout> reflectActiveBlocks(GLuint program)
+    {
+        GLint block_count = 0, block_name_length = 0, member_name_length = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &block_count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &block_name_length);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &member_name_length);
+
+        std::vector<UniformBlockLayout> blocks((size_t) block_count);
+        std::vector<char> name((size_t) std::max({block_name_length, member_name_length, 1}));
+        std::vector<GLint> signed_indices;
+        std::vector<GLuint> indices;
+        for (GLint i = 0; i < block_count; i++) {
+            auto &block = blocks[(size_t) i];
+            GLsizei length = 0;
+            glGetActiveUniformBlockName(program, (GLuint) i, (GLsizei) name.size(), &length, name.data());
+            block.name.assign(name.data(), (size_t) length);
+
+            GLint binding = 0, member_count = 0;
+            glGetActiveUniformBlockiv(program, (GLuint) i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.size);
+            glGetActiveUniformBlockiv(program, (GLuint) i, GL_UNIFORM_BLOCK_BINDING, &binding);
+            glGetActiveUniformBlockiv(program, (GLuint) i, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &member_count);
+            block.binding = (GLuint) binding;
+            if (member_count == 0)
+                continue;
+
+            signed_indices.assign((size_t) member_count, 0);
+            glGetActiveUniformBlockiv(program, (GLuint) i, GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES,
+                                      signed_indices.data());
+            indices.assign(signed_indices.begin(), signed_indices.end());
+
+            auto query = [&](GLenum property) {
+                std::vector<GLint> values((size_t) member_count);
+                glGetActiveUniformsiv(program, member_count, indices.data(), property, values.data());
+                return values;
+            };
+            auto offsets = query(GL_UNIFORM_OFFSET), types = query(GL_UNIFORM_TYPE), sizes = query(GL_UNIFORM_SIZE);
+            auto array_strides = query(GL_UNIFORM_ARRAY_STRIDE), matrix_strides = query(GL_UNIFORM_MATRIX_STRIDE);
+            for (size_t j = 0; j < indices.size(); j++) {
+                glGetActiveUniformName(program, indices[j], (GLsizei) name.size(), &length, name.data());
+                block.members.push_back({std::string(name.data(), (size_t) length), offsets[j], (GLenum) types[j],
+                                         sizes[j], array_strides[j], matrix_strides[j]});
+            }
+        }
+        return blocks;
+    }
+
+    std::vector<UniformBlockLayout> reflectUniformBlocks(GLuint program)
+    {
+        auto blocks = glext.program_interface_query ? reflectResources(program) : reflectActiveBlocks(program);
+        for (auto &block: blocks) {
+            std::sort(block.members.begin(), block.members.end(),
+                      [](const UniformBlockMember &a, const UniformBlockMember &b) { return a.offset < b.offset; });
+        }
+        return blocks;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef CARNIVAL_SHADER_H
+#define CARNIVAL_SHADER_H
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "glad/glad.h"
+
+namespace carnival::render {
+
+    bool readTextFile(const std::filesystem::path &path, std::string &out);
+
+    // "NAME" or "NAME VALUE", one #define each
+    using ShaderDefines = std::vector<std::string>;
+
+    // source with the defines right after its #version line, followed by a #line so the compiler's line
+    // numbers still match the file
+    std::string injectDefines(const std::string &source, const ShaderDefines &defines);
+
+    struct UniformBlockMember {
+        std::string name;
+        GLint offset = 0;           // bytes into the block
+        GLenum type = 0;
+        GLint array_size = 1;
+        GLint array_stride = 0;
+        GLint matrix_stride = 0;
+
+        bool operator==(const UniformBlockMember &other) const;
+        bool operator!=(const UniformBlockMember &other) const { return !(*this == other); }
+    };
+
+    struct UniformBlockLayout {
+        std::string name;
+        GLint size = 0;             // bytes a buffer bound to it needs
+        GLuint binding = 0;
+        std::vector<UniformBlockMember> members;    // by offset
+
+        // -1 if the block has no such member
+        GLint offset(std::string_view member) const;
+        // same size and members, the binding doesn't count
+        bool sameLayout(const UniformBlockLayout &other) const;
+    };
+
+    // the active uniform blocks of a linked program by block index, through glGetProgramResource* where
+    // available, glGetActiveUniformBlockiv otherwise
+    std::vector<UniformBlockLayout> reflectUniformBlocks(GLuint program);
+
+    // These only submit the work. With KHR_parallel_shader_compile the driver compiles in the background
+    // until the object is queried, so poll isCompletionDone() before the check* functions if you don't want to wait.
+    GLuint createShader(GLenum type, const std::string &source);
+    GLuint createProgram(GLuint vertex_shader, GLuint fragment_shader, bool retrievable);
+
+    bool isCompletionDone(GLuint shader_or_program, bool is_program);
+
+    // wait for the result, print the info log; false if compiling / linking failed
+    bool checkShader(GLuint shader, const std::string &name);
+    bool checkProgram(GLuint program, const std::string &name);
+
+    // compile and link from source, blocking
+    GLuint buildProgram(const std::string &vertex_source, const std::string &fragment_source,
+                        const std::string &name, bool retrievable);
+}
+
+#endif //CARNIVAL_SHADER_H
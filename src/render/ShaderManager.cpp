@@ -0,0 +1,412 @@
+#include "ShaderManager.h"
+
+#include <algorithm>
+#include <thread>
+#include "GLExtensions.h"
+#include "Shader.h"
+#include "../core/Log.h"
+#include "../core/Profiler.h"
+
+namespace carnival::render {
+
+    static std::string watchKey(const std::filesystem::path &path) {
+        return std::filesystem::absolute(path).lexically_normal().string();
+    }
+
+    ShaderManager::ShaderManager(core::ThreadPool &pool, std::filesystem::path cache_directory)
+            : pool(pool), cache(std::move(cache_directory)),
+              watcher([this](const std::filesystem::path &path) { onFileChanged(path); }) {
+    }
+
+    ShaderManager::~ShaderManager() {
+        watcher.stop();
+        // the pool outlives us, a read that is still running only has to finish
+        while (reads_in_flight.load(std::memory_order_acquire) > 0)
+            std::this_thread::yield();
+    }
+
+    void ShaderManager::init() {
+        cache.init();
+
+        // let the driver use as many compiler threads as it likes
+        if (glext.parallel_shader_compile)
+            glext.MaxShaderCompilerThreads(0xFFFFFFFF);
+
+        watcher.start();
+    }
+
+    void ShaderManager::shutdown() {
+        watcher.stop();
+
+        for (auto &program: programs) {
+            cancelBuild(program);
+            glDeleteProgram(program.program);
+            program.program = 0;
+        }
+        uniform_blocks.clear();
+    }
+
+    ProgramHandle ShaderManager::add(const std::filesystem::path &vertex_path,
+                                     const std::filesystem::path &fragment_path, const ShaderDefines &defines) {
+        auto handle = registerProgram(vertex_path, fragment_path, defines);
+        queueRead({handle}, vertex_path, fragment_path);
+        return handle;
+    }
+
+    std::vector<ProgramHandle> ShaderManager::addVariants(const std::filesystem::path &vertex_path,
+                                                          const std::filesystem::path &fragment_path,
+                                                          const std::vector<std::string> &features) {
+        std::vector<ProgramHandle> handles;
+        for (size_t mask = 0; mask < ((size_t) 1 << features.size()); mask++) {
+            ShaderDefines defines;
+            for (size_t i = 0; i < features.size(); i++) {
+                if (mask & ((size_t) 1 << i))
+                    defines.push_back(features[i]);
+            }
+            handles.push_back(registerProgram(vertex_path, fragment_path, defines));
+        }
+        queueRead(handles, vertex_path, fragment_path);
+        return handles;
+    }
+
+    ProgramHandle ShaderManager::registerProgram(const std::filesystem::path &vertex_path,
+                                                 const std::filesystem::path &fragment_path,
+                                                 const ShaderDefines &defines) {
+        ProgramHandle handle;
+        {
+            // the watcher thread reads the paths
+            std::lock_guard<std::mutex> lock(watch_mutex);
+            handle = (ProgramHandle) programs.size();
+            programs.emplace_back();
+            programs.back().vertex_path = vertex_path;
+            programs.back().fragment_path = fragment_path;
+            watched_files[watchKey(vertex_path)].push_back(handle);
+            watched_files[watchKey(fragment_path)].push_back(handle);
+        }
+        auto &program = programs.back();
+        program.defines = defines;
+        program.name = vertex_path.filename().string() + " + " + fragment_path.filename().string();
+        for (size_t i = 0; i < defines.size(); i++)
+            program.name += (i == 0 ? " [" : ", ") + defines[i] + (i + 1 == defines.size() ? "]" : "");
+        program.added = std::chrono::steady_clock::now();
+        program.initial_build = true;
+        counters.programs.emplace_back();
+        counters.programs.back().name = program.name;
+
+        watcher.watch(vertex_path);
+        watcher.watch(fragment_path);
+        loads_pending.fetch_add(1, std::memory_order_relaxed);
+        return handle;
+    }
+
+    void ShaderManager::queueRead(std::vector<ProgramHandle> handles, const std::filesystem::path &vertex_path,
+                                  const std::filesystem::path &fragment_path) {
+        // same path as a changed file from here on, update() picks the sources up
+        reads_in_flight.fetch_add(1, std::memory_order_relaxed);
+        pool.submit([this, handles = std::move(handles), vertex_path, fragment_path]() {
+            CARNIVAL_PROFILE_SCOPE("read shaders");
+            ChangedSources sources;
+            sources.changed = std::chrono::steady_clock::now();
+
+            if (!readSource(vertex_path, sources.vertex_source)) {
+                CARNIVAL_LOG_ERROR("Can't open {}, waiting for it to appear", vertex_path);
+                sources.missing = true;
+            } else if (!readSource(fragment_path, sources.fragment_source)) {
+                CARNIVAL_LOG_ERROR("Can't open {}, waiting for it to appear", fragment_path);
+                sources.missing = true;
+            }
+            {
+                std::lock_guard<std::mutex> lock(watch_mutex);
+                for (auto handle: handles) {
+                    sources.handle = handle;
+                    changed_sources.push_back(sources);
+                }
+            }
+            if (on_change)
+                on_change();
+            reads_in_flight.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    void ShaderManager::finishLoading() {
+        while (loading()) {
+            update();
+            if (loading())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    GLuint ShaderManager::program(ProgramHandle handle) const {
+        return handle < programs.size() ? programs[handle].program : 0;
+    }
+
+    GLuint ShaderManager::acquire(ProgramHandle handle) {
+        if (handle >= programs.size())
+            return 0;
+        auto &program = programs[handle];
+        if (!program.initial_build)
+            return program.program;
+
+        CARNIVAL_PROFILE_SCOPE("wait for shader");
+        auto start = std::chrono::steady_clock::now();
+        while (program.initial_build) {
+            if (program.stage != BuildStage::Idle) {
+                pollBuild(program, true);
+                continue;
+            }
+            // the sources are still on their way from the pool
+            startChangedBuilds();
+            if (program.initial_build && program.stage == BuildStage::Idle)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        counters.blocking_acquires++;
+        counters.blocked_ms += ms;
+        CARNIVAL_LOG_INFO("Waited {:.1f} ms for {}", ms, program.name);
+        return program.program;
+    }
+
+    const UniformBlockLayout *ShaderManager::uniformBlock(std::string_view name) const {
+        auto it = std::find_if(uniform_blocks.begin(), uniform_blocks.end(),
+                               [&](const UniformBlockLayout &block) { return block.name == name; });
+        return it != uniform_blocks.end() ? &*it : nullptr;
+    }
+
+    void ShaderManager::update() {
+        CARNIVAL_PROFILE_SCOPE("shader reloads");
+        startChangedBuilds();
+
+        counters.in_flight = 0;
+        for (auto &program: programs) {
+            if (program.stage != BuildStage::Idle) {
+                pollBuild(program);
+                counters.in_flight += program.stage != BuildStage::Idle;
+            }
+        }
+    }
+
+    void ShaderManager::startChangedBuilds() {
+        std::vector<ChangedSources> changed;
+        {
+            std::lock_guard<std::mutex> lock(watch_mutex);
+            changed.swap(changed_sources);
+        }
+
+        for (auto &sources: changed) {
+            auto &program = programs[sources.handle];
+            if (sources.missing)
+                finishInitialLoad(program);
+            else
+                startBuild(program, sources);
+        }
+    }
+
+    bool ShaderManager::readSource(const std::filesystem::path &path, std::string &out) {
+        if (asset_pack != nullptr) {
+            auto source = asset_pack->findFile(path);
+            if (source) {
+                out.assign(source.text());
+                return true;
+            }
+        }
+        return readTextFile(path, out);
+    }
+
+    void ShaderManager::onFileChanged(const std::filesystem::path &path) {
+        // runs on the watcher thread: only file IO here, GL work happens in update()
+        std::vector<ProgramHandle> handles;
+        std::vector<std::pair<std::filesystem::path, std::filesystem::path>> paths;
+        {
+            std::lock_guard<std::mutex> lock(watch_mutex);
+            auto it = watched_files.find(watchKey(path));
+            if (it == watched_files.end())
+                return;
+            handles = it->second;
+            for (auto handle: handles)
+                paths.emplace_back(programs[handle].vertex_path, programs[handle].fragment_path);
+        }
+
+        for (size_t i = 0; i < handles.size(); i++) {
+            ChangedSources sources;
+            sources.handle = handles[i];
+            sources.changed = std::chrono::steady_clock::now();
+            if (!readTextFile(paths[i].first, sources.vertex_source)
+                || !readTextFile(paths[i].second, sources.fragment_source))
+                continue;
+
+            CARNIVAL_LOG_INFO("{} changed, rebuilding", path.filename());
+
+            {
+                std::lock_guard<std::mutex> lock(watch_mutex);
+                changed_sources.push_back(std::move(sources));
+            }
+            if (on_change)
+                on_change();
+        }
+    }
+
+    void ShaderManager::startBuild(Program &program, const ChangedSources &sources) {
+        // a newer change supersedes whatever is still compiling
+        cancelBuild(program);
+
+        program.changed = sources.changed;
+        program.submitted = std::chrono::steady_clock::now();
+        if (program.initial_build && !batch_open) {
+            batch_start = program.submitted;
+            batch_open = true;
+        }
+
+        // the defines are part of the source, so every variant has its own cache entry
+        auto defines = common_defines;
+        defines.insert(defines.end(), program.defines.begin(), program.defines.end());
+        auto vertex_source = injectDefines(sources.vertex_source, defines);
+        auto fragment_source = injectDefines(sources.fragment_source, defines);
+        program.pending_key = cache.key(vertex_source, fragment_source);
+
+        // reverting to an earlier version is free
+        GLuint cached = cache.load(program.pending_key);
+        if (cached != 0) {
+            finishBuild(program, cached, true);
+            return;
+        }
+
+        if (!program.loaded)
+            CARNIVAL_LOG_INFO("Compiling {}", program.name);
+
+        program.pending_vertex = createShader(GL_VERTEX_SHADER, vertex_source);
+        program.pending_fragment = createShader(GL_FRAGMENT_SHADER, fragment_source);
+        program.stage = BuildStage::Compiling;
+    }
+
+    void ShaderManager::pollBuild(Program &program, bool wait) {
+        if (program.stage == BuildStage::Compiling) {
+            if (!wait && (!isCompletionDone(program.pending_vertex, false)
+                          || !isCompletionDone(program.pending_fragment, false)))
+                return;
+
+            bool compiled = checkShader(program.pending_vertex, program.name + " (vertex)");
+            compiled = checkShader(program.pending_fragment, program.name + " (fragment)") && compiled;
+            if (!compiled) {
+                failBuild(program);
+                return;
+            }
+
+            program.pending_program = createProgram(program.pending_vertex, program.pending_fragment, cache.enabled());
+            program.stage = BuildStage::Linking;
+            return;
+        }
+
+        if (!wait && !isCompletionDone(program.pending_program, true))
+            return;
+
+        if (!checkProgram(program.pending_program, program.name)) {
+            failBuild(program);
+            return;
+        }
+
+        glDetachShader(program.pending_program, program.pending_vertex);
+        glDetachShader(program.pending_program, program.pending_fragment);
+        cache.store(program.pending_key, program.pending_program);
+
+        GLuint built = program.pending_program;
+        program.pending_program = 0;
+        cancelBuild(program);
+        finishBuild(program, built, false);
+    }
+
+    void ShaderManager::finishBuild(Program &program, GLuint built, bool cached) {
+        glDeleteProgram(program.program);
+        program.program = built;
+        bindUniformBlocks(program);
+
+        auto now = std::chrono::steady_clock::now();
+        auto &program_stats = counters.programs[(size_t) (&program - programs.data())];
+        program_stats.cached = cached;
+        program_stats.compile_ms =
+                cached ? 0.0 : std::chrono::duration<double, std::milli>(now - program.submitted).count();
+        program_stats.ready = true;
+
+        if (!program.loaded) {
+            program.loaded = true;
+            double ms = std::chrono::duration<double, std::milli>(now - program.added).count();
+            counters.startup_ms = std::max(counters.startup_ms, ms);
+            if (cached)
+                CARNIVAL_LOG_INFO("Loaded {} from the cache ({:.1f} ms after add)", program.name, ms);
+            else
+                CARNIVAL_LOG_INFO("Loaded {} ({:.1f} ms after add, compiled in {:.1f} ms)", program.name, ms,
+                                  program_stats.compile_ms);
+            finishInitialLoad(program);
+            return;
+        }
+
+        counters.reloads++;
+        counters.last_build_ms = std::chrono::duration<double, std::milli>(now - program.changed).count();
+        CARNIVAL_LOG_INFO("Reloaded {} ({:.1f} ms)", program.name, counters.last_build_ms);
+    }
+
+    void ShaderManager::failBuild(Program &program) {
+        if (program.loaded) {
+            CARNIVAL_LOG_ERROR("Keeping the previous version of {}", program.name);
+            counters.failed_reloads++;
+        } else {
+            CARNIVAL_LOG_ERROR("{} failed to build, waiting for a fix", program.name);
+        }
+        finishInitialLoad(program);
+        cancelBuild(program);
+    }
+
+    void ShaderManager::finishInitialLoad(Program &program) {
+        if (!program.initial_build)
+            return;
+        program.initial_build = false;
+        if (batch_open) {
+            counters.startup_compile_ms =
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batch_start).count();
+        }
+        if (loads_pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+
+        batch_open = false;
+        auto ready = std::count_if(counters.programs.begin(), counters.programs.end(),
+                                   [](const ShaderProgramStats &stats) { return stats.ready; });
+        CARNIVAL_LOG_INFO("{} of {} programs ready {:.1f} ms after the first build was submitted", ready,
+                          programs.size(), counters.startup_compile_ms);
+    }
+
+    void ShaderManager::bindUniformBlocks(Program &program) {
+        auto blocks = reflectUniformBlocks(program.program);
+        for (size_t index = 0; index < blocks.size(); index++) {
+            auto &block = blocks[index];
+            auto shared = std::find_if(uniform_blocks.begin(), uniform_blocks.end(),
+                                       [&](const UniformBlockLayout &layout) { return layout.name == block.name; });
+            if (shared == uniform_blocks.end()) {
+                block.binding = firstUniformBlockBinding + (GLuint) uniform_blocks.size();
+                CARNIVAL_LOG_INFO("Uniform block {}: {} bytes, {} members, binding {}", block.name, block.size,
+                                  block.members.size(), block.binding);
+                uniform_blocks.push_back(block);
+            } else {
+                block.binding = shared->binding;
+                // most likely an edit that hasn't reached every file yet, the newest declaration wins
+                if (!shared->sameLayout(block)) {
+                    counters.layout_mismatches++;
+                    CARNIVAL_LOG_WARNING("{} lays out uniform block {} differently ({} bytes, was {}), "
+                                         "using its layout", program.name, block.name, block.size, shared->size);
+                    *shared = block;
+                }
+            }
+            glUniformBlockBinding(program.program, (GLuint) index, block.binding);
+        }
+    }
+
+    void ShaderManager::cancelBuild(Program &program) {
+        // deleting 0 is a no-op
+        glDeleteShader(program.pending_vertex);
+        glDeleteShader(program.pending_fragment);
+        glDeleteProgram(program.pending_program);
+        program.pending_vertex = 0;
+        program.pending_fragment = 0;
+        program.pending_program = 0;
+        program.stage = BuildStage::Idle;
+    }
+}
@@ -0,0 +1,181 @@
+#ifndef CARNIVAL_SHADERMANAGER_H
+#define CARNIVAL_SHADERMANAGER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "glad/glad.h"
+#include "ProgramCache.h"
+#include "Shader.h"
+#include "../core/AssetPack.h"
+#include "../core/FileWatcher.h"
+#include "../core/ThreadPool.h"
+
+namespace carnival::render {
+
+    using ProgramHandle = uint32_t;
+
+    struct ShaderProgramStats {
+        std::string name;               // files and defines
+        double compile_ms = 0.0;        // submitted until linked, of the last build; 0 if it came from the cache
+        bool cached = false;
+        bool ready = false;
+    };
+
+    struct ShaderManagerStats {
+        uint64_t reloads = 0;
+        uint64_t failed_reloads = 0;
+        size_t in_flight = 0;           // programs currently being rebuilt in the background
+        double last_build_ms = 0.0;     // file change until the new program was swapped in
+        double startup_ms = 0.0;        // add() until the program was first ready, the slowest one
+        // the first build of a batch of add()s was submitted until the last one finished, of the latest batch
+        double startup_compile_ms = 0.0;
+        uint64_t blocking_acquires = 0;     // acquire() had to wait for the compiler
+        double blocked_ms = 0.0;
+        uint64_t layout_mismatches = 0;     // a program declared a uniform block differently than the one before
+        std::vector<ShaderProgramStats> programs;  // by handle
+    };
+
+    // Owns the vertex/fragment programs, backed by the on-disk ProgramCache.
+    // Sources are read on the thread pool, at startup and whenever a watched file changes. Compile and
+    // link are only submitted, completion is polled once per frame (GL_KHR_parallel_shader_compile where
+    // available) and the new program replaces the old one only after it linked successfully.
+    //
+    // A program can be added several times with different #defines, each variant is a program of its own
+    // with its own cache entry. All of them compile side by side; acquire() waits for the one it's asked
+    // for, program() never does.
+    //
+    // The uniform blocks of every built program are reflected into one layout per block name. A block gets
+    // the same binding in every program that declares it, so one buffer bound there serves all of them.
+    class ShaderManager {
+    public:
+        // binding of the first uniform block, 0 is ImGuiRenderer's
+        static constexpr GLuint firstUniformBlockBinding = 1;
+
+        ShaderManager(core::ThreadPool &pool, std::filesystem::path cache_directory);
+        ~ShaderManager();
+
+        // with a current context
+        void init();
+        void shutdown();
+
+        // the first read of a program's sources looks in the pack before the loose files, reloads always read
+        // the files; set before add()
+        void setAssetPack(core::AssetPack *pack) { asset_pack = pack; }
+
+        // defines every program gets ahead of its own, e.g. declarations shared by several files;
+        // set before add()
+        void setCommonDefines(ShaderDefines defines) { common_defines = std::move(defines); }
+
+        // starts loading the program and watching its files, doesn't need a context yet. The defines go into
+        // both stages. program() is 0 until update() has built it, and stays 0 while the sources are missing
+        // or broken.
+        ProgramHandle add(const std::filesystem::path &vertex_path, const std::filesystem::path &fragment_path,
+                          const ShaderDefines &defines = {});
+        // a variant per combination of the features, read once: the one at index i has feature j defined
+        // where bit j of i is set
+        std::vector<ProgramHandle> addVariants(const std::filesystem::path &vertex_path,
+                                               const std::filesystem::path &fragment_path,
+                                               const std::vector<std::string> &features);
+        GLuint program(ProgramHandle handle) const;
+        // program(), but one whose first build is still going is finished right away, waiting for the
+        // sources and the compiler; with a current context
+        GLuint acquire(ProgramHandle handle);
+
+        // nullptr until a program declaring the block was built
+        const UniformBlockLayout *uniformBlock(std::string_view name) const;
+        const std::vector<UniformBlockLayout> &uniformBlocks() const { return uniform_blocks; }
+
+        // programs from add() that are neither built nor failed yet
+        bool loading() const { return loads_pending.load(std::memory_order_acquire) > 0; }
+        // updates until nothing is loading anymore, for tools that want everything up front
+        void finishLoading();
+
+        // call once per frame on the GL thread
+        void update();
+
+        const ShaderManagerStats &stats() const { return counters; }
+        const ProgramCacheStats &cacheStats() const { return cache.stats(); }
+
+        // called on the watcher thread when changed sources are waiting for update(), set before init()
+        std::function<void()> on_change;
+
+    private:
+        enum class BuildStage {
+            Idle,
+            Compiling,
+            Linking
+        };
+
+        struct Program {
+            std::filesystem::path vertex_path;
+            std::filesystem::path fragment_path;
+            ShaderDefines defines;
+            std::string name;
+            GLuint program = 0;
+            bool loaded = false;            // a build succeeded once, later ones are reloads
+            bool initial_build = false;     // the load add() started is still going
+            std::chrono::steady_clock::time_point added;
+            std::chrono::steady_clock::time_point submitted;
+
+            BuildStage stage = BuildStage::Idle;
+            GLuint pending_vertex = 0;
+            GLuint pending_fragment = 0;
+            GLuint pending_program = 0;
+            uint64_t pending_key = 0;
+            std::chrono::steady_clock::time_point changed;
+        };
+
+        // sources read by the watcher thread
+        struct ChangedSources {
+            ProgramHandle handle;
+            std::string vertex_source;
+            std::string fragment_source;
+            std::chrono::steady_clock::time_point changed;
+            bool missing = false;           // the first read failed, nothing to build
+        };
+
+        core::ThreadPool &pool;
+        core::AssetPack *asset_pack = nullptr;
+        ShaderDefines common_defines;
+        ProgramCache cache;
+        std::vector<Program> programs;
+        ShaderManagerStats counters;
+        std::vector<UniformBlockLayout> uniform_blocks;    // by binding - firstUniformBlockBinding
+        std::chrono::steady_clock::time_point batch_start;
+        bool batch_open = false;            // initial builds were submitted and aren't all done
+
+        core::FileWatcher watcher;
+        std::mutex watch_mutex;
+        std::unordered_map<std::string, std::vector<ProgramHandle>> watched_files;
+        std::vector<ChangedSources> changed_sources;
+        std::atomic<int> loads_pending{0};
+        std::atomic<int> reads_in_flight{0};   // read jobs still holding this
+
+        ProgramHandle registerProgram(const std::filesystem::path &vertex_path,
+                                      const std::filesystem::path &fragment_path, const ShaderDefines &defines);
+        // reads the files once for all of the handles
+        void queueRead(std::vector<ProgramHandle> handles, const std::filesystem::path &vertex_path,
+                       const std::filesystem::path &fragment_path);
+        bool readSource(const std::filesystem::path &path, std::string &out);
+        void onFileChanged(const std::filesystem::path &path);
+        void startChangedBuilds();
+        void startBuild(Program &program, const ChangedSources &sources);
+        // waiting blocks on the compiler instead of polling it
+        void pollBuild(Program &program, bool wait = false);
+        void cancelBuild(Program &program);
+        void finishBuild(Program &program, GLuint built, bool cached);
+        void failBuild(Program &program);
+        void finishInitialLoad(Program &program);
+        void bindUniformBlocks(Program &program);
+    };
+}
+
+#endif //CARNIVAL_SHADERMANAGER_H
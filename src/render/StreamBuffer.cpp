@@ -0,0 +1,179 @@
+#include "StreamBuffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "../core/Log.h"
+
+namespace carnival::render {
+
+    static size_t alignUp(size_t value, size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    void StreamBuffer::init(size_t region_bytes) {
+        GLint alignment = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        uniform_alignment = (size_t) std::max(alignment, 16);
+        if (glext.shader_storage) {
+            alignment = 0;
+            glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            storage_alignment = (size_t) std::max(alignment, 16);
+        }
+
+        counters.persistent = glext.buffer_storage;
+        create(region_bytes);
+    }
+
+    void StreamBuffer::shutdown() {
+        if (buffer == 0)
+            return;
+
+        for (auto &fence: fences) {
+            if (fence != nullptr)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+        // deleting a buffer unmaps it
+        glstate.deleteBuffers(1, &buffer);
+        if (!retired.empty())
+            glstate.deleteBuffers((GLsizei) retired.size(), retired.data());
+        retired.clear();
+        buffer = 0;
+        mapped = nullptr;
+    }
+
+    void StreamBuffer::create(size_t region_bytes) {
+        if (buffer != 0) {
+            unmap();
+            retired.push_back(buffer);
+            counters.reallocations++;
+        }
+        for (auto &fence: fences) {
+            if (fence != nullptr)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+
+        // every region starts aligned for anything we hand out
+        region_size = alignUp(region_bytes, std::max(uniform_alignment, storage_alignment));
+        counters.region_bytes = region_size;
+        region = 0;
+        head = 0;
+        mapped = nullptr;
+
+        auto total = (GLsizeiptr) (region_size * regionCount);
+        glGenBuffers(1, &buffer);
+        glstate.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+
+        if (counters.persistent) {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glext.BufferStorage(GL_COPY_WRITE_BUFFER, total, nullptr, flags);
+            mapped = (uint8_t *) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total, flags);
+            if (mapped != nullptr)
+                return;
+
+            // immutable storage can't be respecified, start over with a plain buffer
+            CARNIVAL_LOG_ERROR("Couldn't map the stream buffer persistently");
+            counters.persistent = false;
+            glstate.deleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glstate.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        }
+
+        glBufferData(GL_COPY_WRITE_BUFFER, total, nullptr, GL_STREAM_DRAW);
+    }
+
+    void StreamBuffer::map() {
+        // nothing after head was written this frame and the fence says the GPU is done with the region
+        glstate.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        mapped = (uint8_t *) glMapBufferRange(GL_COPY_WRITE_BUFFER, (GLintptr) (region * region_size + head),
+                                              (GLsizeiptr) (region_size - head),
+                                              GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        mapped_from = head;
+    }
+
+    void StreamBuffer::unmap() {
+        if (counters.persistent || mapped == nullptr)
+            return;
+
+        glstate.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        mapped = nullptr;
+    }
+
+    void StreamBuffer::beginFrame() {
+        frame_open = true;
+        head = 0;
+        counters.frame_bytes = 0;
+
+        auto &fence = fences[region];
+        if (fence == nullptr)
+            return;
+
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            auto start = std::chrono::steady_clock::now();
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000) == GL_TIMEOUT_EXPIRED) {}
+            counters.last_wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            counters.wait_ms += counters.last_wait_ms;
+            counters.stalls++;
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    StreamAllocation StreamBuffer::allocate(size_t size, size_t alignment) {
+        if (!frame_open || buffer == 0 || size == 0)
+            return {};
+
+        // aligned in the buffer, not only in the region
+        auto base = region * region_size;
+        auto start = alignUp(base + head, alignment) - base;
+        if (start + size > region_size) {
+            auto new_size = region_size * 2;
+            while (new_size < size + alignment)
+                new_size *= 2;
+            create(new_size);
+            base = 0;
+            start = alignUp(head, alignment);
+        }
+
+        if (!counters.persistent && mapped == nullptr) {
+            map();
+            if (mapped == nullptr)
+                return {};
+        }
+
+        StreamAllocation allocation;
+        allocation.buffer = buffer;
+        allocation.offset = (GLintptr) (base + start);
+        allocation.size = (GLsizeiptr) size;
+        allocation.data = counters.persistent ? mapped + base + start : mapped + (start - mapped_from);
+
+        counters.frame_bytes += start + size - head;
+        head = start + size;
+        return allocation;
+    }
+
+    void StreamBuffer::flush() {
+        // coherent persistent mappings are visible to every command issued after the write
+        unmap();
+    }
+
+    void StreamBuffer::endFrame() {
+        if (!frame_open)
+            return;
+
+        flush();
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        region = (region + 1) % regionCount;
+        frame_open = false;
+        counters.peak_frame_bytes = std::max(counters.peak_frame_bytes, counters.frame_bytes);
+
+        // the driver keeps them alive until the GPU is done with this frame
+        if (!retired.empty())
+            glstate.deleteBuffers((GLsizei) retired.size(), retired.data());
+        retired.clear();
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef CARNIVAL_STREAMBUFFER_H
+#define CARNIVAL_STREAMBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glad/glad.h"
+
+namespace carnival::render {
+
+    // Space handed out by StreamBuffer, valid until the end of the frame.
+    struct StreamAllocation {
+        void *data = nullptr;       // write only
+        GLuint buffer = 0;
+        GLintptr offset = 0;        // bytes into buffer
+        GLsizeiptr size = 0;
+
+        bool valid() const { return data != nullptr; }
+    };
+
+    struct StreamBufferStats {
+        uint64_t stalls = 0;            // frames that had to wait for the GPU to release their region
+        double wait_ms = 0.0;           // total time spent in those waits
+        double last_wait_ms = 0.0;
+        size_t frame_bytes = 0;         // allocated in the last frame
+        size_t peak_frame_bytes = 0;
+        size_t region_bytes = 0;        // per frame before the buffer grows
+        uint64_t reallocations = 0;
+        bool persistent = false;        // mapped once with GL_ARB_buffer_storage, otherwise mapped per frame
+    };
+
+    // Ring buffer for data that lives for one frame: vertices, indices, uniforms, storage and
+    // indirect commands. Split into regionCount regions, one per frame in flight, each guarded by a fence.
+    // With GL_ARB_buffer_storage the whole ring is mapped persistent and coherent, writes go straight
+    // to memory the GPU reads. Without it the current region is mapped unsynchronized, which is safe
+    // because of the fences, and unmapped by flush().
+    // A frame that needs more than a region moves to a larger buffer right away; earlier allocations
+    // can still be drawn from until endFrame(), but without persistent mapping their pointers are gone,
+    // so fill each allocation before making the next one.
+    class StreamBuffer {
+    public:
+        static const int regionCount = 3;
+
+        // with a current context
+        void init(size_t region_bytes);
+        void shutdown();
+
+        // waits until the GPU is done with the region this frame will write
+        void beginFrame();
+        // alignment doesn't have to be a power of two, vertex data is aligned to the vertex size
+        // so it can be addressed with a base vertex
+        StreamAllocation allocate(size_t size, size_t alignment = 16);
+        StreamAllocation allocateUniform(size_t size) { return allocate(size, uniform_alignment); }
+        StreamAllocation allocateStorage(size_t size) { return allocate(size, storage_alignment); }
+        // makes everything allocated so far visible to the GPU, call before drawing from it
+        void flush();
+        // fences the region
+        void endFrame();
+
+        const StreamBufferStats &stats() const { return counters; }
+
+    private:
+        GLuint buffer = 0;
+        uint8_t *mapped = nullptr;          // the whole ring when persistent, the current region otherwise
+        size_t region_size = 0;
+        int region = 0;
+        size_t head = 0;                    // into the current region
+        size_t mapped_from = 0;             // start of the mapping inside the region, not persistent only
+        bool frame_open = false;
+        GLsync fences[regionCount] = {};
+        std::vector<GLuint> retired;        // replaced buffers the frame may still draw from
+        size_t uniform_alignment = 256;
+        size_t storage_alignment = 256;
+        StreamBufferStats counters;
+
+        void create(size_t region_bytes);
+        void map();
+        void unmap();
+    };
+}
+
+#endif //CARNIVAL_STREAMBUFFER_H
@@ -0,0 +1,331 @@
+#include "TextureCompressor.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include "../core/Profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CARNIVAL_MIP_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace carnival::render {
+
+    // pixel rows per pool job, blocks go by four of them
+    static const size_t rowsPerJob = 16;
+
+    bool isCompressed(TextureFormat format) {
+        return format != TextureFormat::RGBA8;
+    }
+
+    const char *formatName(TextureFormat format) {
+        switch (format) {
+            case TextureFormat::BC1:
+                return "BC1";
+            case TextureFormat::BC3:
+                return "BC3";
+            default:
+                return "RGBA8";
+        }
+    }
+
+    size_t levelSize(TextureFormat format, int width, int height) {
+        if (!isCompressed(format))
+            return (size_t) width * (size_t) height * 4;
+        auto blocks = (size_t) ((width + 3) / 4) * (size_t) ((height + 3) / 4);
+        return blocks * (format == TextureFormat::BC1 ? 8 : 16);
+    }
+
+    void allocateLevels(TextureImage &image, TextureFormat format, int width, int height, int level_count) {
+        if (level_count <= 0) {
+            level_count = 1;
+            for (int size = std::max(width, height); size > 1; size /= 2)
+                level_count++;
+        }
+
+        image.format = format;
+        image.levels.clear();
+        image.view = nullptr;
+        size_t offset = 0;
+        for (int i = 0; i < level_count; i++) {
+            TextureLevel level;
+            level.width = width;
+            level.height = height;
+            level.offset = offset;
+            level.size = levelSize(format, width, height);
+            image.levels.push_back(level);
+            offset += level.size;
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+        }
+        image.data.resize(offset);
+    }
+
+    static void forRows(core::ThreadPool *pool, size_t rows, size_t rows_per_job,
+                        const std::function<void(size_t, size_t)> &fn) {
+        if (pool != nullptr)
+            pool->parallelFor(rows, rows_per_job, fn);
+        else
+            fn(0, rows);
+    }
+
+    // a row of the next level from two rows of this one, odd columns and rows at the edge are dropped
+    static void downsampleRow(const unsigned char *row0, const unsigned char *row1, unsigned char *target,
+                              int source_width, int width) {
+        int x = 0;
+#if CARNIVAL_MIP_SSE
+        if (source_width >= 2) {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i rounding = _mm_set1_epi16(2);
+            // four pixels of both rows make two
+            for (; x + 2 <= width; x += 2) {
+                auto a = _mm_loadu_si128((const __m128i *) (row0 + (size_t) x * 8));
+                auto b = _mm_loadu_si128((const __m128i *) (row1 + (size_t) x * 8));
+                auto low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+                auto high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+                auto sum = _mm_add_epi16(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high));
+                sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+                _mm_storel_epi64((__m128i *) (target + (size_t) x * 4), _mm_packus_epi16(sum, sum));
+            }
+        }
+#endif
+        for (; x < width; x++) {
+            auto x0 = (size_t) std::min(x * 2, source_width - 1) * 4;
+            auto x1 = (size_t) std::min(x * 2 + 1, source_width - 1) * 4;
+            for (size_t c = 0; c < 4; c++)
+                target[(size_t) x * 4 + c] = (unsigned char) ((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+        }
+    }
+
+    TextureImage buildMipChain(const unsigned char *rgba, int width, int height, core::ThreadPool *pool) {
+        CARNIVAL_PROFILE_SCOPE("build mips");
+        TextureImage image;
+        allocateLevels(image, TextureFormat::RGBA8, width, height);
+        std::memcpy(image.data.data(), rgba, image.levels[0].size);
+
+        for (size_t i = 1; i < image.levels.size(); i++) {
+            auto &source = image.levels[i - 1];
+            auto &level = image.levels[i];
+            const unsigned char *from = image.data.data() + source.offset;
+            unsigned char *to = image.data.data() + level.offset;
+            forRows(pool, (size_t) level.height, rowsPerJob, [&](size_t begin, size_t end) {
+                for (auto y = (int) begin; y < (int) end; y++) {
+                    auto y0 = (size_t) std::min(y * 2, source.height - 1);
+                    auto y1 = (size_t) std::min(y * 2 + 1, source.height - 1);
+                    auto row_bytes = (size_t) source.width * 4;
+                    downsampleRow(from + y0 * row_bytes, from + y1 * row_bytes, to + (size_t) y * level.width * 4,
+                                  source.width, level.width);
+                }
+            });
+        }
+        return image;
+    }
+
+    namespace {
+        struct Block {
+            unsigned char pixels[16][4];
+        };
+
+        // edge blocks repeat the last row and column
+        void loadBlock(const unsigned char *rgba, int width, int height, int block_x, int block_y, Block &block) {
+            for (int y = 0; y < 4; y++) {
+                auto row = (size_t) std::min(block_y * 4 + y, height - 1);
+                for (int x = 0; x < 4; x++) {
+                    auto column = (size_t) std::min(block_x * 4 + x, width - 1);
+                    std::memcpy(block.pixels[y * 4 + x], rgba + (row * (size_t) width + column) * 4, 4);
+                }
+            }
+        }
+
+        uint16_t to565(const float color[3]) {
+            auto quantize = [](float value, float levels) {
+                return (int) std::lround(std::clamp(value, 0.0f, 255.0f) * levels / 255.0f);
+            };
+            return (uint16_t) (quantize(color[0], 31.0f) << 11 | quantize(color[1], 63.0f) << 5 | quantize(color[2], 31.0f));
+        }
+
+        void from565(uint16_t color, int rgb[3]) {
+            int r = color >> 11 & 31, g = color >> 5 & 63, b = color & 31;
+            rgb[0] = r << 3 | r >> 2;
+            rgb[1] = g << 2 | g >> 4;
+            rgb[2] = b << 3 | b >> 2;
+        }
+
+        void encodeColor(const Block &block, unsigned char *target) {
+            float mean[3] = {};
+            int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+            for (auto &pixel: block.pixels) {
+                for (int c = 0; c < 3; c++) {
+                    mean[c] += (float) pixel[c];
+                    lo[c] = std::min(lo[c], (int) pixel[c]);
+                    hi[c] = std::max(hi[c], (int) pixel[c]);
+                }
+            }
+            for (auto &value: mean)
+                value /= 16.0f;
+
+            // rr rg rb gg gb bb
+            float covariance[6] = {};
+            for (auto &pixel: block.pixels) {
+                float d[3] = {(float) pixel[0] - mean[0], (float) pixel[1] - mean[1], (float) pixel[2] - mean[2]};
+                covariance[0] += d[0] * d[0];
+                covariance[1] += d[0] * d[1];
+                covariance[2] += d[0] * d[2];
+                covariance[3] += d[1] * d[1];
+                covariance[4] += d[1] * d[2];
+                covariance[5] += d[2] * d[2];
+            }
+
+            // the principal axis by power iteration, starting along the bounding box diagonal
+            float axis[3] = {(float) (hi[0] - lo[0]), (float) (hi[1] - lo[1]), (float) (hi[2] - lo[2])};
+            for (int i = 0; i < 8; i++) {
+                float next[3] = {
+                        covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+                        covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+                        covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2],
+                };
+                auto largest = std::max({std::abs(next[0]), std::abs(next[1]), std::abs(next[2])});
+                if (largest < 1e-6f)
+                    break;
+                for (int c = 0; c < 3; c++)
+                    axis[c] = next[c] / largest;
+            }
+            auto length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+            if (length > 1e-6f) {
+                for (auto &value: axis)
+                    value /= length;
+            }
+
+            // the extremes along it, pulled in a little since the ends of the palette are rarely hit exactly
+            float low = 0.0f, high = 0.0f;
+            if (length > 1e-6f) {
+                low = FLT_MAX;
+                high = -FLT_MAX;
+                for (auto &pixel: block.pixels) {
+                    auto t = ((float) pixel[0] - mean[0]) * axis[0] + ((float) pixel[1] - mean[1]) * axis[1]
+                             + ((float) pixel[2] - mean[2]) * axis[2];
+                    low = std::min(low, t);
+                    high = std::max(high, t);
+                }
+                auto inset = (high - low) / 16.0f;
+                low += inset;
+                high -= inset;
+            }
+            float end0[3], end1[3];
+            for (int c = 0; c < 3; c++) {
+                end0[c] = mean[c] + axis[c] * high;
+                end1[c] = mean[c] + axis[c] * low;
+            }
+
+            // color0 > color1 selects the four colour palette
+            auto color0 = to565(end0), color1 = to565(end1);
+            if (color0 < color1)
+                std::swap(color0, color1);
+
+            uint32_t indices = 0;
+            if (color0 != color1) {
+                int palette[4][3];
+                from565(color0, palette[0]);
+                from565(color1, palette[1]);
+                for (int c = 0; c < 3; c++) {
+                    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+                }
+                for (int i = 0; i < 16; i++) {
+                    int best = 0, best_distance = INT_MAX;
+                    for (int p = 0; p < 4; p++) {
+                        int distance = 0;
+                        for (int c = 0; c < 3; c++) {
+                            int d = (int) block.pixels[i][c] - palette[p][c];
+                            distance += d * d;
+                        }
+                        if (distance < best_distance) {
+                            best_distance = distance;
+                            best = p;
+                        }
+                    }
+                    indices |= (uint32_t) best << (i * 2);
+                }
+            }
+
+            target[0] = (unsigned char) (color0 & 0xFF);
+            target[1] = (unsigned char) (color0 >> 8);
+            target[2] = (unsigned char) (color1 & 0xFF);
+            target[3] = (unsigned char) (color1 >> 8);
+            for (int i = 0; i < 4; i++)
+                target[4 + i] = (unsigned char) (indices >> (i * 8));
+        }
+
+        void encodeAlpha(const Block &block, unsigned char *target) {
+            int high = 0, low = 255;
+            for (auto &pixel: block.pixels) {
+                high = std::max(high, (int) pixel[3]);
+                low = std::min(low, (int) pixel[3]);
+            }
+
+            // alpha0 > alpha1 selects the eight value palette
+            uint64_t indices = 0;
+            if (high != low) {
+                int palette[8] = {high, low};
+                for (int i = 1; i < 7; i++)
+                    palette[i + 1] = ((7 - i) * high + i * low) / 7;
+                for (int i = 0; i < 16; i++) {
+                    int best = 0, best_distance = INT_MAX;
+                    for (int p = 0; p < 8; p++) {
+                        auto distance = std::abs((int) block.pixels[i][3] - palette[p]);
+                        if (distance < best_distance) {
+                            best_distance = distance;
+                            best = p;
+                        }
+                    }
+                    indices |= (uint64_t) best << (i * 3);
+                }
+            }
+
+            target[0] = (unsigned char) high;
+            target[1] = (unsigned char) low;
+            for (int i = 0; i < 6; i++)
+                target[2 + i] = (unsigned char) (indices >> (i * 8));
+        }
+    }
+
+    TextureImage compressBC(const TextureImage &rgba, core::ThreadPool *pool) {
+        CARNIVAL_PROFILE_SCOPE("compress BC");
+        // averages of opaque pixels are opaque, the first level decides
+        bool opaque = true;
+        const unsigned char *first = rgba.level(0);
+        for (size_t i = 3; i < rgba.levels[0].size && opaque; i += 4)
+            opaque = first[i] == 255;
+
+        TextureImage image;
+        allocateLevels(image, opaque ? TextureFormat::BC1 : TextureFormat::BC3, rgba.width(), rgba.height(),
+                       (int) rgba.levels.size());
+        size_t block_bytes = opaque ? 8 : 16;
+
+        for (size_t i = 0; i < image.levels.size(); i++) {
+            auto &source = rgba.levels[i];
+            const unsigned char *from = rgba.level(i);
+            unsigned char *to = image.data.data() + image.levels[i].offset;
+            int blocks_x = (source.width + 3) / 4, blocks_y = (source.height + 3) / 4;
+            forRows(pool, (size_t) blocks_y, rowsPerJob / 4, [&](size_t begin, size_t end) {
+                Block block;
+                for (auto y = (int) begin; y < (int) end; y++) {
+                    for (int x = 0; x < blocks_x; x++) {
+                        loadBlock(from, source.width, source.height, x, y, block);
+                        auto *target = to + ((size_t) y * blocks_x + x) * block_bytes;
+                        if (!opaque) {
+                            encodeAlpha(block, target);
+                            target += 8;
+                        }
+                        encodeColor(block, target);
+                    }
+                }
+            });
+        }
+        return image;
+    }
+}
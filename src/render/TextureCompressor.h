@@ -0,0 +1,64 @@
+#ifndef CARNIVAL_TEXTURECOMPRESSOR_H
+#define CARNIVAL_TEXTURECOMPRESSOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "../core/ThreadPool.h"
+
+namespace carnival::render {
+
+    enum class TextureFormat : uint8_t {
+        RGBA8,
+        BC1,    // opaque, 8 bytes per 4x4 block
+        BC3     // with alpha, 16 bytes per 4x4 block
+    };
+
+    struct TextureLevel {
+        int width = 0;
+        int height = 0;
+        size_t offset = 0;
+        size_t size = 0;
+    };
+
+    // A texture with its whole mip chain in one allocation, level 0 first.
+    // With view set the levels live in memory someone else owns and data stays empty.
+    struct TextureImage {
+        TextureFormat format = TextureFormat::RGBA8;
+        std::vector<TextureLevel> levels;
+        std::vector<unsigned char> data;
+        const unsigned char *view = nullptr;
+
+        bool valid() const { return !levels.empty(); }
+        int width() const { return levels.empty() ? 0 : levels[0].width; }
+        int height() const { return levels.empty() ? 0 : levels[0].height; }
+        const unsigned char *level(size_t index) const {
+            return (view != nullptr ? view : data.data()) + levels[index].offset;
+        }
+        // of all levels
+        size_t bytes() const {
+            size_t total = 0;
+            for (auto &level: levels)
+                total += level.size;
+            return total;
+        }
+    };
+
+    // KTXwriter of the cache files TextureLoader and carnival_pack write, bumped whenever the encoder's
+    // output changes so older files are encoded again
+    const char textureCacheWriter[] = "carnival texture cache 1";
+
+    bool isCompressed(TextureFormat format);
+    const char *formatName(TextureFormat format);
+    size_t levelSize(TextureFormat format, int width, int height);
+    // sets up the levels down to 1x1 and sizes data for them
+    void allocateLevels(TextureImage &image, TextureFormat format, int width, int height, int level_count = 0);
+
+    // Every level a 2x2 box filter of the one above, rows filtered in parallel on the pool.
+    TextureImage buildMipChain(const unsigned char *rgba, int width, int height, core::ThreadPool *pool = nullptr);
+    // Each level of an RGBA8 chain to BC1, or BC3 as soon as a single pixel isn't opaque.
+    // Endpoints lie on the principal axis of the block's colours, rows of blocks are encoded in parallel.
+    TextureImage compressBC(const TextureImage &rgba, core::ThreadPool *pool = nullptr);
+}
+
+#endif //CARNIVAL_TEXTURECOMPRESSOR_H
@@ -0,0 +1,430 @@
+#include "TextureLoader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "Ktx2.h"
+#include "../core/Log.h"
+#include "../core/Profiler.h"
+
+namespace carnival::render {
+
+    static double msSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static std::filesystem::path cachePath(const std::string &path) {
+        return path + ".ktx2";
+    }
+
+    // written after the image was last changed
+    static bool cacheCurrent(const std::string &path, const std::filesystem::path &cache) {
+        std::error_code error;
+        auto source_time = std::filesystem::last_write_time(path, error);
+        if (error)
+            return false;
+        auto cache_time = std::filesystem::last_write_time(cache, error);
+        return !error && cache_time >= source_time;
+    }
+
+    TextureLoader::TextureLoader(core::ThreadPool &pool)
+            : pool(pool), completed(std::make_shared<CompletionQueue>()) {
+    }
+
+    TextureLoader::~TextureLoader() = default;
+
+    void TextureLoader::init() {
+        // dark checker board until the real image arrives
+        const unsigned char checker[] = {
+                60, 60, 60, 255, 90, 90, 90, 255,
+                90, 90, 90, 255, 60, 60, 60, 255,
+        };
+        glGenTextures(1, &placeholder);
+        glstate.bindTexture(GL_TEXTURE_2D, placeholder);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, checker);
+
+        pixel_buffers.resize(4);
+        for (auto &pixel_buffer: pixel_buffers) {
+            glGenBuffers(1, &pixel_buffer.buffer);
+            glstate.bindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer.buffer);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) pixel_buffer_size, nullptr, GL_STREAM_DRAW);
+        }
+        glstate.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        completed->block_compression = block_compression && glext.texture_compression_s3tc;
+        if (block_compression && !glext.texture_compression_s3tc)
+            CARNIVAL_LOG_INFO("S3TC not supported, textures stay RGBA8");
+    }
+
+    void TextureLoader::shutdown() {
+        for (auto &[handle, entry]: entries)
+            destroy(entry);
+        entries.clear();
+        by_path.clear();
+        upload_queue.clear();
+
+        {
+            std::lock_guard<std::mutex> lock(completed->mutex);
+            completed->images.clear();
+        }
+
+        for (auto &pixel_buffer: pixel_buffers) {
+            if (pixel_buffer.fence != nullptr)
+                glDeleteSync(pixel_buffer.fence);
+            glstate.deleteBuffers(1, &pixel_buffer.buffer);
+        }
+        pixel_buffers.clear();
+
+        glstate.deleteTextures(1, &placeholder);
+        placeholder = 0;
+    }
+
+    TextureHandle TextureLoader::acquire(const std::string &path) {
+        auto cached = by_path.find(path);
+        if (cached != by_path.end()) {
+            entries[cached->second].references++;
+            counters.cache_hits++;
+            return cached->second;
+        }
+
+        TextureHandle handle = next_handle++;
+        Entry &entry = entries[handle];
+        entry.path = path;
+        entry.references = 1;
+        entry.requested = std::chrono::steady_clock::now();
+        by_path[path] = handle;
+
+        submitDecode(handle, path);
+        return handle;
+    }
+
+    void TextureLoader::release(TextureHandle handle) {
+        auto it = entries.find(handle);
+        if (it == entries.end() || --it->second.references > 0)
+            return;
+
+        // a decode still in flight is dropped when it arrives
+        destroy(it->second);
+        by_path.erase(it->second.path);
+        upload_queue.erase(std::remove(upload_queue.begin(), upload_queue.end(), handle), upload_queue.end());
+        entries.erase(it);
+    }
+
+    void TextureLoader::update() {
+        CARNIVAL_PROFILE_GPU_SCOPE("texture uploads");
+        collectDecoded();
+
+        counters.bytes_uploaded_frame = 0;
+        size_t budget = upload_budget;
+
+        while (!upload_queue.empty()) {
+            auto &entry = entries[upload_queue.front()];
+            if (!uploadLevels(entry, budget))
+                break;
+            finish(entry);
+            upload_queue.erase(upload_queue.begin());
+        }
+        glstate.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        counters.bytes_uploaded_total += counters.bytes_uploaded_frame;
+        counters.upload_queue = upload_queue.size();
+        counters.decode_queue = (size_t) std::count_if(entries.begin(), entries.end(), [](auto &it) {
+            return it.second.state == TextureState::Decoding;
+        });
+    }
+
+    GLuint TextureLoader::texture(TextureHandle handle) const {
+        auto it = entries.find(handle);
+        if (it == entries.end() || it->second.state != TextureState::Ready)
+            return placeholder;
+        return it->second.texture;
+    }
+
+    TextureState TextureLoader::state(TextureHandle handle) const {
+        auto it = entries.find(handle);
+        return it == entries.end() ? TextureState::Failed : it->second.state;
+    }
+
+    bool TextureLoader::size(TextureHandle handle, int &width, int &height) const {
+        auto it = entries.find(handle);
+        if (it == entries.end() || it->second.state == TextureState::Decoding || it->second.state == TextureState::Failed)
+            return false;
+        width = it->second.width;
+        height = it->second.height;
+        return true;
+    }
+
+    void TextureLoader::submitDecode(TextureHandle handle, const std::string &path) {
+        pool.submit([queue = completed, notify = on_decoded, &pool = pool, pack = asset_pack, handle, path]() {
+            CARNIVAL_PROFILE_SCOPE("decode image");
+            auto start = std::chrono::steady_clock::now();
+
+            DecodedImage decoded;
+            decoded.handle = handle;
+            bool compress = queue->block_compression;
+            auto cache = cachePath(path);
+
+            std::string writer;
+            // pre-encoded by carnival_pack and used in place, or encoded by an earlier run
+            auto packed = pack != nullptr ? pack->findFile(cache) : core::AssetSpan();
+            if (packed && viewKtx2(packed.data, packed.size, decoded.image, &writer) && writer == textureCacheWriter
+                && isCompressed(decoded.image.format) == compress) {
+                decoded.from_cache = true;
+                decoded.from_pack = true;
+            } else if (cacheCurrent(path, cache) && readKtx2(cache, decoded.image, &writer)
+                       && writer == textureCacheWriter && isCompressed(decoded.image.format) == compress) {
+                decoded.from_cache = true;
+            } else {
+                auto source = pack != nullptr ? pack->findFile(path) : core::AssetSpan();
+                decoded.from_pack = (bool) source;
+
+                int width = 0, height = 0;
+                unsigned char *pixels = source ? stbi_load_from_memory(source.data, (int) source.size, &width, &height, nullptr, 4)
+                                               : stbi_load(path.c_str(), &width, &height, nullptr, 4);
+                if (pixels == nullptr) {
+                    decoded.image = {};
+                    decoded.failure = stbi_failure_reason();
+                } else {
+                    auto mip_start = std::chrono::steady_clock::now();
+                    decoded.image = buildMipChain(pixels, width, height, &pool);
+                    stbi_image_free(pixels);
+                    decoded.mip_ms = msSince(mip_start);
+
+                    if (compress) {
+                        auto compress_start = std::chrono::steady_clock::now();
+                        decoded.image = compressBC(decoded.image, &pool);
+                        decoded.compress_ms = msSince(compress_start);
+                    }
+                    // a packed image may have no directory to cache next to, it's encoded each time
+                    if (!source)
+                        decoded.cache_written = writeKtx2(cache, decoded.image, textureCacheWriter);
+                }
+            }
+            decoded.decode_ms = msSince(start);
+
+            {
+                std::lock_guard<std::mutex> lock(queue->mutex);
+                queue->images.push_back(std::move(decoded));
+            }
+            if (notify)
+                notify();
+        });
+    }
+
+    void TextureLoader::collectDecoded() {
+        std::vector<DecodedImage> images;
+        {
+            std::lock_guard<std::mutex> lock(completed->mutex);
+            images.swap(completed->images);
+        }
+
+        for (auto &decoded: images) {
+            auto it = entries.find(decoded.handle);
+            if (it == entries.end())
+                continue;
+
+            auto &entry = it->second;
+            counters.last_decode_ms = decoded.decode_ms;
+
+            if (!decoded.image.valid()) {
+                CARNIVAL_LOG_ERROR("Failed to load image {}: {}", entry.path,
+                                   decoded.failure != nullptr ? decoded.failure : "unknown error");
+                entry.state = TextureState::Failed;
+                continue;
+            }
+
+            if (isCompressed(decoded.image.format) && !glext.texture_compression_s3tc) {
+                // compressed before init() knew the driver can't take it
+                submitDecode(decoded.handle, entry.path);
+                continue;
+            }
+
+            if (decoded.from_cache) {
+                counters.ktx_hits++;
+                counters.pack_hits += decoded.from_pack;
+                counters.average_ktx_ms += (decoded.decode_ms - counters.average_ktx_ms) / (double) counters.ktx_hits;
+            } else {
+                counters.encodes++;
+                counters.average_encode_ms += (decoded.decode_ms - counters.average_encode_ms) / (double) counters.encodes;
+                counters.last_mip_ms = decoded.mip_ms;
+                counters.last_compress_ms = decoded.compress_ms;
+                if (decoded.cache_written)
+                    counters.ktx_writes++;
+                else if (!decoded.from_pack)
+                    CARNIVAL_LOG_WARNING("Can't write texture cache {}", cachePath(entry.path));
+            }
+
+            entry.image = std::move(decoded.image);
+            entry.width = entry.image.width();
+            entry.height = entry.image.height();
+            entry.bytes = entry.image.bytes();
+            entry.bytes_rgba8 = 0;
+            for (auto &level: entry.image.levels)
+                entry.bytes_rgba8 += levelSize(TextureFormat::RGBA8, level.width, level.height);
+            entry.state = TextureState::Uploading;
+            upload_queue.push_back(decoded.handle);
+        }
+    }
+
+    bool TextureLoader::uploadLevels(Entry &entry, size_t &budget) {
+        auto &image = entry.image;
+        bool compressed = isCompressed(image.format);
+
+        if (entry.texture == 0) {
+            glGenTextures(1, &entry.texture);
+            glstate.bindTexture(GL_TEXTURE_2D, entry.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) image.levels.size() - 1);
+            if (!compressed) {
+                // storage for every level up front, the rows are streamed in below
+                glstate.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                for (size_t i = 0; i < image.levels.size(); i++) {
+                    glTexImage2D(GL_TEXTURE_2D, (GLint) i, GL_RGBA8, image.levels[i].width, image.levels[i].height, 0,
+                                 GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+                }
+            }
+        }
+
+        while (entry.level < image.levels.size()) {
+            auto &level = image.levels[entry.level];
+            const unsigned char *source = image.level(entry.level);
+            size_t bytes;
+
+            glstate.bindTexture(GL_TEXTURE_2D, entry.texture);
+
+            if (compressed) {
+                // levels go up whole, at least one per frame so huge ones can't starve
+                if (budget < level.size && counters.bytes_uploaded_frame > 0)
+                    return false;
+
+                const void *pixels = source;
+                if (level.size <= pixel_buffer_size) {
+                    if (!stagePixels(source, level.size, pixels))
+                        return false;
+                } else {
+                    glstate.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                }
+                auto internal_format = image.format == TextureFormat::BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                                                                          : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+                glCompressedTexImage2D(GL_TEXTURE_2D, (GLint) entry.level, internal_format, level.width, level.height,
+                                       0, (GLsizei) level.size, pixels);
+                fenceStaged(pixels);
+
+                bytes = level.size;
+                entry.level++;
+            } else {
+                size_t row_bytes = (size_t) level.width * 4;
+                auto rows_per_buffer = (int) (pixel_buffer_size / row_bytes);
+
+                // always let at least one row through so huge rows can't starve
+                if (budget < row_bytes && counters.bytes_uploaded_frame > 0)
+                    return false;
+
+                auto budget_rows = std::max((int) (budget / row_bytes), 1);
+                auto rows = std::min(level.height - entry.rows_uploaded, budget_rows);
+                source += (size_t) entry.rows_uploaded * row_bytes;
+
+                const void *pixels = source;
+                if (rows_per_buffer == 0) {
+                    // a single row doesn't fit into a pixel buffer, upload it straight from memory
+                    rows = 1;
+                    glstate.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                } else {
+                    rows = std::min(rows, rows_per_buffer);
+                    if (!stagePixels(source, (size_t) rows * row_bytes, pixels))
+                        return false;
+                }
+                glTexSubImage2D(GL_TEXTURE_2D, (GLint) entry.level, 0, entry.rows_uploaded, level.width, rows,
+                                GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+                fenceStaged(pixels);
+
+                bytes = (size_t) rows * row_bytes;
+                entry.rows_uploaded += rows;
+                if (entry.rows_uploaded == level.height) {
+                    entry.level++;
+                    entry.rows_uploaded = 0;
+                }
+            }
+
+            budget -= std::min(budget, bytes);
+            counters.bytes_uploaded_frame += bytes;
+        }
+
+        return true;
+    }
+
+    bool TextureLoader::stagePixels(const unsigned char *source, size_t bytes, const void *&pixels) {
+        auto &pixel_buffer = pixel_buffers[next_pixel_buffer];
+        if (pixel_buffer.fence != nullptr) {
+            // never wait for the GPU, try again next frame instead
+            if (glClientWaitSync(pixel_buffer.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+                counters.upload_stalls++;
+                return false;
+            }
+            glDeleteSync(pixel_buffer.fence);
+            pixel_buffer.fence = nullptr;
+        }
+
+        // the fence above guarantees the GPU is done reading this buffer
+        glstate.bindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer.buffer);
+        void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr) bytes,
+                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (mapped == nullptr) {
+            CARNIVAL_LOG_WARNING("Failed to map pixel unpack buffer, uploading from memory");
+            glstate.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            pixels = source;
+            return true;
+        }
+        std::memcpy(mapped, source, bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        pixels = nullptr;
+        return true;
+    }
+
+    void TextureLoader::fenceStaged(const void *pixels) {
+        // a pointer means the upload came straight from memory
+        if (pixels != nullptr)
+            return;
+        pixel_buffers[next_pixel_buffer].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        next_pixel_buffer = (next_pixel_buffer + 1) % pixel_buffers.size();
+    }
+
+    void TextureLoader::finish(Entry &entry) {
+        auto format = entry.image.format;
+        auto levels = entry.image.levels.size();
+        entry.image = {};
+        entry.state = TextureState::Ready;
+
+        counters.loads++;
+        counters.last_latency_ms = msSince(entry.requested);
+        counters.average_latency_ms += (counters.last_latency_ms - counters.average_latency_ms) / (double) counters.loads;
+        counters.bytes_resident += entry.bytes;
+        counters.bytes_resident_rgba8 += entry.bytes_rgba8;
+
+        CARNIVAL_LOG_INFO("Loaded {}: {}x{}, {} levels {}, {:.2f} MB ({:.2f} MB as RGBA8), {:.1f} ms", entry.path,
+                          entry.width, entry.height, levels, formatName(format), (double) entry.bytes / (1024.0 * 1024.0),
+                          (double) entry.bytes_rgba8 / (1024.0 * 1024.0), counters.last_latency_ms);
+    }
+
+    void TextureLoader::destroy(Entry &entry) {
+        entry.image = {};
+        if (entry.state == TextureState::Ready) {
+            counters.bytes_resident -= entry.bytes;
+            counters.bytes_resident_rgba8 -= entry.bytes_rgba8;
+        }
+        if (entry.texture != 0) {
+            glstate.deleteTextures(1, &entry.texture);
+            entry.texture = 0;
+        }
+    }
+}
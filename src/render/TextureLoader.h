@@ -0,0 +1,166 @@
+#ifndef CARNIVAL_TEXTURELOADER_H
+#define CARNIVAL_TEXTURELOADER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "glad/glad.h"
+#include "TextureCompressor.h"
+#include "../core/AssetPack.h"
+#include "../core/ThreadPool.h"
+
+namespace carnival::render {
+
+    using TextureHandle = uint32_t;
+    const TextureHandle invalidTexture = 0;
+
+    enum class TextureState {
+        Decoding,
+        Uploading,
+        Ready,
+        Failed
+    };
+
+    struct TextureLoaderStats {
+        size_t decode_queue = 0;            // images waiting for or being decoded
+        size_t upload_queue = 0;            // decoded images waiting for their pixels to reach the GPU
+        size_t bytes_uploaded_frame = 0;
+        uint64_t bytes_uploaded_total = 0;
+        uint64_t loads = 0;                 // images decoded and uploaded
+        uint64_t cache_hits = 0;            // acquire() calls served by an existing entry
+        uint64_t upload_stalls = 0;         // frames that stopped uploading because the PBO ring was still busy
+        double last_latency_ms = 0.0;       // acquire() until the texture is ready
+        double average_latency_ms = 0.0;
+        double last_decode_ms = 0.0;        // the whole job, from the source or the cache file
+        // what the KTX2 cache saves: encodes go through stb, mips, compression and the cache write
+        uint64_t ktx_hits = 0;              // next to the image or in the asset pack
+        uint64_t pack_hits = 0;
+        uint64_t ktx_writes = 0;
+        uint64_t encodes = 0;
+        double average_ktx_ms = 0.0;
+        double average_encode_ms = 0.0;
+        double last_mip_ms = 0.0;
+        double last_compress_ms = 0.0;
+        // of the ready textures with all their levels, and what they would take as RGBA8
+        size_t bytes_resident = 0;
+        size_t bytes_resident_rgba8 = 0;
+    };
+
+    // Loads image files without blocking the render thread.
+    // Decoding runs on the thread pool: the mip chain is filtered and, if the driver takes S3TC, compressed
+    // to BC1 / BC3, then kept in a .ktx2 next to the image so the next run only reads that file.
+    // An asset pack built by carnival_pack carries that file already, its levels are uploaded from the mapping.
+    // The levels are streamed into the texture through a ring of pixel unpack buffers, limited to
+    // upload_budget bytes per frame. Until then texture() returns a placeholder.
+    // Textures are cached by path and reference counted, loading the same file twice is free.
+    class TextureLoader {
+    public:
+        explicit TextureLoader(core::ThreadPool &pool);
+        ~TextureLoader();
+
+        // GL side setup and teardown, with a current context
+        void init();
+        void shutdown();
+
+        // images and their pre-encoded .ktx2 are looked up in the pack before the loose files, set before
+        // the first acquire(); the pack has to outlive the pool's jobs
+        void setAssetPack(core::AssetPack *pack) { asset_pack = pack; }
+
+        TextureHandle acquire(const std::string &path);
+        void release(TextureHandle handle);
+
+        // call once per frame on the GL thread
+        void update();
+
+        GLuint texture(TextureHandle handle) const;
+        TextureState state(TextureHandle handle) const;
+        bool size(TextureHandle handle, int &width, int &height) const;
+
+        const TextureLoaderStats &stats() const { return counters; }
+        // decoded pixels are still waiting to be uploaded, update() has work to do
+        bool busy() const { return !upload_queue.empty(); }
+
+        size_t upload_budget = 8 * 1024 * 1024;
+        // BC1 / BC3 where supported, read by init()
+        bool block_compression = true;
+        // called on the decoding thread after an image finished, e.g. to wake up an idle main loop
+        std::function<void()> on_decoded;
+
+    private:
+        struct DecodedImage {
+            TextureHandle handle = invalidTexture;
+            TextureImage image;
+            bool from_cache = false;        // a .ktx2 written before
+            bool from_pack = false;         // that, or the image itself, came out of the asset pack
+            bool cache_written = false;
+            double decode_ms = 0.0;
+            double mip_ms = 0.0;
+            double compress_ms = 0.0;
+            const char *failure = nullptr; // stb keeps the reason per thread
+        };
+
+        // shared with the decode jobs, which may outlive the loader during shutdown
+        struct CompletionQueue {
+            std::mutex mutex;
+            std::vector<DecodedImage> images;
+            // until init() knows better jobs compress, a result the driver can't take is decoded again
+            std::atomic<bool> block_compression{true};
+        };
+
+        struct Entry {
+            std::string path;
+            int references = 0;
+            TextureState state = TextureState::Decoding;
+            GLuint texture = 0;
+            int width = 0;
+            int height = 0;
+            TextureImage image;         // released once uploaded
+            size_t level = 0;           // being uploaded
+            int rows_uploaded = 0;      // of an RGBA8 level
+            size_t bytes = 0;
+            size_t bytes_rgba8 = 0;
+            std::chrono::steady_clock::time_point requested;
+        };
+
+        struct PixelBuffer {
+            GLuint buffer = 0;
+            GLsync fence = nullptr;
+        };
+
+        core::ThreadPool &pool;
+        core::AssetPack *asset_pack = nullptr;
+        std::shared_ptr<CompletionQueue> completed;
+
+        std::unordered_map<std::string, TextureHandle> by_path;
+        std::unordered_map<TextureHandle, Entry> entries;
+        std::vector<TextureHandle> upload_queue;
+        TextureHandle next_handle = 1;
+
+        GLuint placeholder = 0;
+        std::vector<PixelBuffer> pixel_buffers;
+        size_t pixel_buffer_size = 4 * 1024 * 1024;
+        size_t next_pixel_buffer = 0;
+
+        TextureLoaderStats counters;
+
+        void submitDecode(TextureHandle handle, const std::string &path);
+        void collectDecoded();
+        // streams as many levels or rows as budget and ring allow, returns false when out of either
+        bool uploadLevels(Entry &entry, size_t &budget);
+        // copies into the next buffer of the ring and binds it, pixels becomes the offset into it;
+        // false while the GPU may still read that buffer
+        bool stagePixels(const unsigned char *source, size_t bytes, const void *&pixels);
+        // after the upload that read the staged pixels
+        void fenceStaged(const void *pixels);
+        void finish(Entry &entry);
+        void destroy(Entry &entry);
+    };
+}
+
+#endif //CARNIVAL_TEXTURELOADER_H
@@ -0,0 +1,347 @@
+#include "TiledExporter.h"
+
+#include <algorithm>
+#include "GLState.h"
+#include "../core/Log.h"
+#include "../core/Profiler.h"
+
+namespace carnival::render {
+
+    TiledExporter::~TiledExporter() {
+        // without a context the GL side is gone anyway, but the writer has to stop
+        if (running) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            condition.notify_all();
+            writer.join();
+            if (raw != nullptr)
+                std::fclose(raw);
+        }
+    }
+
+    ExportFormat TiledExporter::formatFor(const std::filesystem::path &path) {
+        auto extension = path.extension().string();
+        if (extension == ".raw" || extension == ".rgba")
+            return ExportFormat::Raw;
+        return ExportFormat::Png;
+    }
+
+    bool TiledExporter::start(const std::filesystem::path &path, int image_width, int image_height, int requested_tile) {
+        if (running)
+            return false;
+        if (image_width <= 0 || image_height <= 0 || image_width > maxSize || image_height > maxSize) {
+            CARNIVAL_LOG_ERROR("Can't export {}x{}, sizes go up to {}", image_width, image_height, maxSize);
+            return false;
+        }
+
+        // the tile has to fit into a texture, a renderbuffer and the viewport
+        GLint max_texture = 0, max_renderbuffer = 0, max_viewport[2] = {};
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture);
+        glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_renderbuffer);
+        glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport);
+        int limit = std::min({max_texture, max_renderbuffer, max_viewport[0], max_viewport[1]});
+        requested_tile = std::clamp(requested_tile, 16, std::max(limit, 16));
+        requested_tile = std::min(requested_tile, std::max(image_width, image_height));
+
+        std::error_code error;
+        if (path.has_parent_path())
+            std::filesystem::create_directories(path.parent_path(), error);
+
+        format = formatFor(path);
+        if (format == ExportFormat::Png) {
+            if (!png.open(path, image_width, image_height))
+                return false;
+        } else {
+            raw = std::fopen(path.string().c_str(), "wb");
+            if (raw == nullptr) {
+                CARNIVAL_LOG_ERROR("Can't open {} for writing", path);
+                return false;
+            }
+        }
+
+        output_path = path;
+        width = image_width;
+        height = image_height;
+        tile_size = requested_tile;
+        tiles_x = (width + tile_size - 1) / tile_size;
+        strip_count = (height + tile_size - 1) / tile_size;
+        strips_drawn = strips_mapped = strips_done = 0;
+        next_tile = 0;
+
+        GLuint previous_framebuffer = glstate.drawFramebuffer();
+        tile = createRenderTarget(tile_size, tile_size);
+        glstate.bindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+
+        auto strip_bytes = (size_t) width * (size_t) std::min(tile_size, height) * 4;
+        for (auto &strip: strips) {
+            strip = Strip();
+            glGenBuffers(1, &strip.buffer);
+            glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, strip.buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) strip_bytes, nullptr, GL_STREAM_READ);
+        }
+        glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        counters = ExportStats();
+        counters.width = width;
+        counters.height = height;
+        counters.tile_size = tile_size;
+        counters.tiles = tiles_x * strip_count;
+        writer_strip = -1;
+        stopping = false;
+        start_time = std::chrono::steady_clock::now();
+        writer = std::thread(&TiledExporter::run, this);
+        running = true;
+
+        CARNIVAL_LOG_INFO("Exporting {}x{} to {} in {} tiles of {}x{}, {:.1f} MB per strip", width, height, path,
+                          counters.tiles, tile_size, tile_size, (double) strip_bytes / (1024.0 * 1024.0));
+        return true;
+    }
+
+    bool TiledExporter::update(const DrawTile &draw, int max_tiles, bool wait) {
+        if (!running)
+            return false;
+        CARNIVAL_PROFILE_SCOPE("export");
+
+        // strips the writer is done with go back to drawing
+        for (int i = 0; i < 2; i++) {
+            auto &strip = strips[i];
+            if (strip.state != StripState::Writing)
+                continue;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (wait)
+                    condition.wait(lock, [this, i]() { return writer_strip != i; });
+                if (writer_strip == i)
+                    continue;
+            }
+            glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, strip.buffer);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            strip.mapped = nullptr;
+            strip.state = StripState::Free;
+            strips_done++;
+        }
+
+        // the oldest strip goes to the writer once the GPU is done with it, strips are written in order
+        if (strips_mapped < strips_drawn) {
+            int index = strips_mapped % 2;
+            auto &strip = strips[index];
+            bool writer_idle;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                writer_idle = writer_strip == -1;
+            }
+
+            bool signalled = false;
+            if (writer_idle && wait) {
+                while (glClientWaitSync(strip.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000) == GL_TIMEOUT_EXPIRED) {}
+                signalled = true;
+            } else if (writer_idle) {
+                signalled = glClientWaitSync(strip.fence, 0, 0) != GL_TIMEOUT_EXPIRED;
+            }
+
+            if (signalled) {
+                glDeleteSync(strip.fence);
+                strip.fence = nullptr;
+
+                auto size = (size_t) width * (size_t) strip.height * 4;
+                glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, strip.buffer);
+                strip.mapped = (const uint8_t *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr) size,
+                                                                  GL_MAP_READ_BIT);
+                glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                if (strip.mapped == nullptr) {
+                    CARNIVAL_LOG_ERROR("Couldn't map the export strip at row {}", strip.row);
+                    cancel();
+                    return false;
+                }
+
+                strip.state = StripState::Writing;
+                strips_mapped++;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    writer_strip = index;
+                }
+                condition.notify_all();
+            }
+        }
+
+        if (strips_drawn < strip_count && max_tiles > 0) {
+            // whatever draws next sets its own viewport, only the framebuffer is put back
+            GLuint previous_framebuffer = glstate.drawFramebuffer();
+
+            for (int drawn = 0; drawn < max_tiles && strips_drawn < strip_count; drawn++) {
+                auto &strip = strips[strips_drawn % 2];
+                if (strip.state == StripState::Free) {
+                    strip.state = StripState::Drawing;
+                    strip.row = strips_drawn * tile_size;
+                    strip.height = std::min(tile_size, height - strip.row);
+                    next_tile = 0;
+                }
+                // both strips are still on their way to the file
+                if (strip.state != StripState::Drawing)
+                    break;
+
+                drawTile(draw);
+                if (++next_tile == tiles_x) {
+                    strip.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                    strip.state = StripState::Fenced;
+                    strips_drawn++;
+                }
+            }
+
+            glstate.bindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+        }
+
+        if (strips_done < strip_count)
+            return true;
+
+        shutdown();
+        bool written = format == ExportFormat::Png ? png.close() : std::fclose(raw) == 0;
+        raw = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            counters.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+            if (format == ExportFormat::Png)
+                counters.bytes_written = png.bytesWritten();
+            counters.failed = counters.failed || !written;
+        }
+        running = false;
+
+        auto summary = stats();
+        if (summary.failed) {
+            CARNIVAL_LOG_ERROR("Writing {} failed", output_path);
+        } else {
+            CARNIVAL_LOG_INFO("Exported {} in {:.2f} s: {:.1f} MB, {:.1f} Mpixels/s, {:.1f} MB/s", output_path,
+                              summary.elapsed_ms / 1000.0, (double) summary.bytes_written / (1024.0 * 1024.0),
+                              summary.megapixels_per_second, summary.megabytes_per_second);
+        }
+        return false;
+    }
+
+    void TiledExporter::cancel() {
+        if (!running)
+            return;
+
+        shutdown();
+        if (format == ExportFormat::Png)
+            png.close();
+        else
+            std::fclose(raw);
+        raw = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            counters.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        }
+        running = false;
+
+        std::error_code error;
+        std::filesystem::remove(output_path, error);
+        CARNIVAL_LOG_INFO("Export to {} cancelled", output_path);
+    }
+
+    void TiledExporter::drawTile(const DrawTile &draw) {
+        auto &strip = strips[strips_drawn % 2];
+        int x = next_tile * tile_size;
+        int tile_width = std::min(tile_size, width - x);
+
+        // the tile's part of the image in clip space, rows count from the top
+        ViewRegion region;
+        region.x0 = -1.0f + 2.0f * (float) x / (float) width;
+        region.x1 = -1.0f + 2.0f * (float) (x + tile_width) / (float) width;
+        region.y0 = 1.0f - 2.0f * (float) (strip.row + strip.height) / (float) height;
+        region.y1 = 1.0f - 2.0f * (float) strip.row / (float) height;
+
+        glstate.bindFramebuffer(GL_FRAMEBUFFER, tile.framebuffer);
+        glstate.viewport(0, 0, tile_width, strip.height);
+        draw(region, width, height);
+
+        // straight into the tile's columns of the strip, the strip's rows are the image's rows
+        glstate.bindFramebuffer(GL_READ_FRAMEBUFFER, tile.framebuffer);
+        glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, strip.buffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glPixelStorei(GL_PACK_ROW_LENGTH, width);
+        glReadPixels(0, 0, tile_width, strip.height, GL_RGBA, GL_UNSIGNED_BYTE, (void *) ((size_t) x * 4));
+        glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+        glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.tiles_rendered++;
+    }
+
+    void TiledExporter::run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            condition.wait(lock, [this]() { return stopping || writer_strip != -1; });
+            if (writer_strip == -1)
+                break;
+
+            auto &strip = strips[writer_strip];
+            lock.unlock();
+            writeStrip(strip);
+            lock.lock();
+
+            writer_strip = -1;
+            condition.notify_all();
+        }
+    }
+
+    void TiledExporter::writeStrip(const Strip &strip) {
+        CARNIVAL_PROFILE_SCOPE("write strip");
+        auto row_bytes = (size_t) width * 4;
+        uint64_t raw_bytes = 0;
+        bool failed = false;
+
+        // GL's rows go bottom up, the file's top down
+        for (int row = strip.height - 1; row >= 0; row--) {
+            auto *pixels = strip.mapped + (size_t) row * row_bytes;
+            if (format == ExportFormat::Png) {
+                png.writeRow(pixels);
+            } else {
+                auto written = std::fwrite(pixels, 1, row_bytes, raw);
+                raw_bytes += written;
+                failed = failed || written != row_bytes;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.rows_written += strip.height;
+        counters.bytes_written = format == ExportFormat::Png ? png.bytesWritten() : counters.bytes_written + raw_bytes;
+        counters.failed = counters.failed || failed;
+    }
+
+    void TiledExporter::shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        writer.join();
+
+        for (auto &strip: strips) {
+            if (strip.fence != nullptr)
+                glDeleteSync(strip.fence);
+            if (strip.mapped != nullptr) {
+                glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, strip.buffer);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glstate.deleteBuffers(1, &strip.buffer);
+            strip = Strip();
+        }
+        glstate.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        destroyRenderTarget(tile);
+    }
+
+    ExportStats TiledExporter::stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto result = counters;
+        if (running)
+            result.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        if (result.elapsed_ms > 0.0) {
+            result.megapixels_per_second = (double) result.rows_written * width / 1e6 / (result.elapsed_ms / 1000.0);
+            result.megabytes_per_second = (double) result.bytes_written / (1024.0 * 1024.0) / (result.elapsed_ms / 1000.0);
+        }
+        return result;
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef CARNIVAL_TILEDEXPORTER_H
+#define CARNIVAL_TILEDEXPORTER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "glad/glad.h"
+#include "../core/PngWriter.h"
+#include "RenderTarget.h"
+
+namespace carnival::render {
+
+    enum class ExportFormat {
+        Png,    // see core::PngWriter
+        Raw     // RGBA, top row first, no header
+    };
+
+    struct ExportStats {
+        int width = 0;
+        int height = 0;
+        int tile_size = 0;
+        int tiles = 0;
+        int tiles_rendered = 0;
+        int rows_written = 0;
+        uint64_t bytes_written = 0;
+        double elapsed_ms = 0.0;
+        double megapixels_per_second = 0.0;     // of rows written
+        double megabytes_per_second = 0.0;
+        bool failed = false;
+
+        float progress() const { return height > 0 ? (float) rows_written / (float) height : 0.0f; }
+    };
+
+    // Renders images larger than any framebuffer could be, e.g. 32k stills.
+    // The image is cut into square tiles that are drawn one after another into a single tile_size target.
+    // Every tile is read back with glReadPixels into a pixel pack buffer that holds a strip of tiles across
+    // the full width, so the strip's rows end up complete and in place. Once a strip's fence has signalled
+    // it is mapped and a writer thread streams its rows into the file, while the next strip is drawn into
+    // the other buffer. Memory stays at two strips, 2 * width * tile_size * 4 bytes, whatever the height.
+    class TiledExporter {
+    public:
+        static constexpr int maxSize = 65536;
+
+        // draws region of the full image_width x image_height image into the bound framebuffer,
+        // the viewport is already set to the tile
+        using DrawTile = std::function<void(const ViewRegion &region, int image_width, int image_height)>;
+
+        ~TiledExporter();
+
+        // .raw / .rgba, anything else is a PNG
+        static ExportFormat formatFor(const std::filesystem::path &path);
+
+        // with a current context, tile_size is clamped to what the context can render
+        bool start(const std::filesystem::path &path, int width, int height, int tile_size = 512);
+        // draws up to max_tiles tiles and moves finished strips along, returns false once the export is done.
+        // Without wait it never blocks; with wait it blocks on the GPU and the writer where that's the only way on
+        bool update(const DrawTile &draw, int max_tiles, bool wait = false);
+        // stops, deletes what was written so far
+        void cancel();
+
+        bool active() const { return running; }
+        const std::filesystem::path &path() const { return output_path; }
+        int tilesPerStrip() const { return tiles_x; }
+
+        ExportStats stats() const;
+
+    private:
+        enum class StripState {
+            Free,
+            Drawing,    // tiles are being read back into it
+            Fenced,     // every tile issued, waiting for the GPU
+            Writing     // mapped, the writer streams its rows; unmapped once writer_strip moved on
+        };
+
+        struct Strip {
+            GLuint buffer = 0;
+            GLsync fence = nullptr;
+            StripState state = StripState::Free;
+            int row = 0;                        // first image row, from the top
+            int height = 0;
+            const uint8_t *mapped = nullptr;    // rows bottom up, as GL reads them
+        };
+
+        ExportFormat format = ExportFormat::Png;
+        std::filesystem::path output_path;
+        bool running = false;
+        int width = 0;
+        int height = 0;
+        int tile_size = 0;
+        int tiles_x = 0;
+        int strip_count = 0;
+        RenderTarget tile;
+
+        Strip strips[2];
+        int strips_drawn = 0;       // completely issued
+        int strips_mapped = 0;      // handed to the writer
+        int strips_done = 0;        // written and unmapped
+        int next_tile = 0;          // in the strip being drawn
+
+        std::chrono::steady_clock::time_point start_time;
+        std::thread writer;
+        mutable std::mutex mutex;
+        std::condition_variable condition;
+        int writer_strip = -1;      // index into strips, -1 while idle
+        bool stopping = false;
+        core::PngWriter png;
+        FILE *raw = nullptr;
+        ExportStats counters;
+
+        void drawTile(const DrawTile &draw);
+        void run();
+        void writeStrip(const Strip &strip);
+        // joins the writer and frees the GL side
+        void shutdown();
+    };
+}
+
+#endif //CARNIVAL_TILEDEXPORTER_H
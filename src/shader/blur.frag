@@ -0,0 +1,18 @@
+#version 330 core
+// separable gaussian, texelFetch because the source may be larger than what was drawn into it
+uniform sampler2D source;
+FULLSCREEN_PASS_BLOCK;
+layout(location = 0) out vec4 color;
+
+const float weights[5] = float[](0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216);
+
+void main(){
+    ivec2 last = ivec2(size) - 1;
+    ivec2 center = ivec2(gl_FragCoord.xy);
+    color = texelFetch(source, center, 0) * weights[0];
+    for (int i = 1; i < 5; i++) {
+        ivec2 offset = ivec2(direction * float(i));
+        color += texelFetch(source, clamp(center + offset, ivec2(0), last), 0) * weights[i];
+        color += texelFetch(source, clamp(center - offset, ivec2(0), last), 0) * weights[i];
+    }
+}
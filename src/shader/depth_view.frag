@@ -0,0 +1,8 @@
+#version 330 core
+uniform sampler2D source;
+layout(location = 0) out vec4 color;
+
+void main(){
+    float depth = texelFetch(source, ivec2(gl_FragCoord.xy), 0).r;
+    color = vec4(vec3(1.0 - depth), 1.0);
+}
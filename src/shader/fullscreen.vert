@@ -0,0 +1,6 @@
+#version 330 core
+// one triangle covering the screen, drawn without any vertex data
+void main(){
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
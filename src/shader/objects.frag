@@ -0,0 +1,6 @@
+#version 430 core
+in vec4 object_color;
+layout(location = 0) out vec4 color;
+void main(){
+    color = object_color;
+}
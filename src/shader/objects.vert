@@ -0,0 +1,27 @@
+#version 430 core
+layout(location = 0) in vec3 position;
+// counts up from the draw's base instance, see RenderQueue
+layout(location = 1) in uint object_index;
+
+struct ObjectData {
+    vec4 transform;
+    float rotation;
+    float depth;
+    uint color;
+    uint flags;
+};
+
+layout(std430, binding = 0) readonly buffer Objects {
+    ObjectData objects[];
+};
+
+out vec4 object_color;
+
+void main(){
+    ObjectData object = objects[object_index];
+    float c = cos(object.rotation);
+    float s = sin(object.rotation);
+    vec2 rotated = vec2(c * position.x - s * position.y, s * position.x + c * position.y);
+    gl_Position = vec4(object.transform.xy + rotated * object.transform.zw, object.depth * 2.0 - 1.0, 1.0);
+    object_color = unpackUnorm4x8(object.color);
+}
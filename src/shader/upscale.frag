@@ -0,0 +1,29 @@
+#version 330 core
+// bilinear upscale of the drawn part of source to size; the SHARPEN variant adds an unsharp mask that is
+// clamped to the neighbourhood so edges don't ring
+uniform sampler2D source;
+FULLSCREEN_PASS_BLOCK;
+layout(location = 0) out vec4 color;
+
+vec4 sampleAt(vec2 texel, vec2 storage){
+    // stay half a texel inside what was drawn, the rest of the storage holds anything
+    return texture(source, clamp(texel, vec2(0.5), source_size - 0.5) / storage);
+}
+
+void main(){
+    vec2 storage = vec2(textureSize(source, 0));
+    vec2 texel = gl_FragCoord.xy * source_size / size;
+    vec4 center = sampleAt(texel, storage);
+#ifndef SHARPEN
+    color = center;
+#else
+    vec4 left = sampleAt(texel - vec2(1.0, 0.0), storage);
+    vec4 right = sampleAt(texel + vec2(1.0, 0.0), storage);
+    vec4 down = sampleAt(texel - vec2(0.0, 1.0), storage);
+    vec4 up = sampleAt(texel + vec2(0.0, 1.0), storage);
+    vec4 low = min(center, min(min(left, right), min(down, up)));
+    vec4 high = max(center, max(max(left, right), max(down, up)));
+    vec4 sharpened = center + (center * 4.0 - left - right - down - up) * sharpness;
+    color = clamp(sharpened, low, high);
+#endif
+}
@@ -0,0 +1,10 @@
+#version 330 core
+uniform sampler2D source;
+FULLSCREEN_PASS_BLOCK;
+layout(location = 0) out vec4 color;
+
+void main(){
+    vec4 texel = texelFetch(source, ivec2(gl_FragCoord.xy), 0);
+    float falloff = smoothstep(0.8, 0.2, length(gl_FragCoord.xy / size - 0.5));
+    color = vec4(texel.rgb * mix(0.35, 1.0, falloff), texel.a);
+}
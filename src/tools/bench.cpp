@@ -0,0 +1,242 @@
+// carnival_bench: renders the viewport offscreen and reports frame timings as JSON.
+//
+//   carnival_bench [--frames N] [--warmup N] [--width W] [--height H] [--objects N] [--separate-draws]
+//                  [--viewports N] [--post-effects] [--msaa N] [--dynamic-resolution MS] [--record path] [--export WxH path] [--output file.json]
+//                  [--no-state-cache] [--validate-gl-state]
+//
+// With --export the still is rendered after the timed frames and reported under "export".
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "../common/json.h"
+#include "../core/Application.h"
+#include "../core/StartupTimer.h"
+#include "../core/Stats.h"
+#include "../render/GLState.h"
+
+using namespace carnival::core;
+
+Application* app;
+
+static void writeSummary(std::ostream &out, const char *name, const TimingSummary &summary, bool last)
+{
+    out << "    \"" << name << "\": {"
+        << "\"count\": " << summary.count
+        << ", \"min\": " << summary.min
+        << ", \"median\": " << summary.median
+        << ", \"mean\": " << summary.mean
+        << ", \"p99\": " << summary.p99
+        << ", \"max\": " << summary.max
+        << "}" << (last ? "\n" : ",\n");
+}
+
+int main(int argc, char* args[])
+{
+    ApplicationConfig config;
+    config.headless = true;
+    int frames = 500;
+    int warmup = 50;
+    const char *output = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(args[i], "--frames") == 0 && has_value) {
+            frames = std::max(1, std::atoi(args[++i]));
+        } else if (std::strcmp(args[i], "--warmup") == 0 && has_value) {
+            warmup = std::max(0, std::atoi(args[++i]));
+        } else if (std::strcmp(args[i], "--width") == 0 && has_value) {
+            config.width = std::max(1, std::atoi(args[++i]));
+        } else if (std::strcmp(args[i], "--height") == 0 && has_value) {
+            config.height = std::max(1, std::atoi(args[++i]));
+        } else if (std::strcmp(args[i], "--objects") == 0 && has_value) {
+            config.objects = (size_t) std::max(0, std::atoi(args[++i]));
+        } else if (std::strcmp(args[i], "--separate-draws") == 0) {
+            config.multi_draw = false;
+        } else if (std::strcmp(args[i], "--viewports") == 0 && has_value) {
+            config.viewports = std::clamp(std::atoi(args[++i]), 1, maxViewports);
+        } else if (std::strcmp(args[i], "--post-effects") == 0) {
+            config.post_effects = true;
+        } else if (std::strcmp(args[i], "--msaa") == 0 && has_value) {
+            config.msaa_samples = std::clamp(std::atoi(args[++i]), 1, 8);
+        } else if (std::strcmp(args[i], "--dynamic-resolution") == 0 && has_value) {
+            config.dynamic_resolution = true;
+            config.resolution_budget_ms = std::max(std::atof(args[++i]), 0.1);
+        } else if (std::strcmp(args[i], "--record") == 0 && has_value) {
+            config.record_path = args[++i];
+        } else if (std::strcmp(args[i], "--export") == 0 && i + 2 < argc
+                   && std::sscanf(args[i + 1], "%dx%d", &config.export_width, &config.export_height) == 2) {
+            config.export_path = args[i + 2];
+            i += 2;
+        } else if (std::strcmp(args[i], "--no-state-cache") == 0) {
+            config.gl_state_cache = false;
+        } else if (std::strcmp(args[i], "--validate-gl-state") == 0) {
+            config.validate_gl_state = true;
+        } else if (std::strcmp(args[i], "--output") == 0 && has_value) {
+            output = args[++i];
+        } else {
+            std::cerr << "usage: carnival_bench [--frames N] [--warmup N] [--width W] [--height H] [--objects N]"
+                         " [--separate-draws] [--viewports N] [--post-effects] [--msaa N] [--dynamic-resolution MS] [--record path] [--export WxH path] [--output file.json]"
+                         " [--no-state-cache] [--validate-gl-state]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    FrameTimings timings;
+    std::string renderer, version;
+    carnival::render::RenderQueueStats queue;
+    carnival::render::StreamBufferStats stream;
+    carnival::render::RenderGraphStats graph;
+    AllocationStats heap;
+    carnival::render::GLStateStats gl_state;
+    std::vector<ViewportStats> viewports;
+    DynamicResolutionStats resolution;
+    carnival::render::FrameRecorderStats recording;
+    carnival::render::ExportStats exported;
+    auto &startup = carnival::core::StartupTimer::instance();
+
+    // keep stdout clean for the JSON, the application logs go to stderr
+    auto *stdout_buffer = std::cout.rdbuf(std::cerr.rdbuf());
+    try {
+        app = new Application(config);
+        app->setupTriangle();
+        app->setupImage();
+
+        renderer = (const char *) glGetString(GL_RENDERER);
+        version = (const char *) glGetString(GL_VERSION);
+        timings = app->RunHeadless(frames, warmup);
+        queue = app->renderQueueStats();
+        stream = app->streamBufferStats();
+        graph = app->renderGraphStats();
+        heap = AllocationTracker::instance().stats();
+        gl_state = carnival::render::glstate.stats();
+        for (int i = 0; i < config.viewports; i++)
+            viewports.push_back(app->viewportStats(i));
+        resolution = app->resolutionStats(0);
+        app->stopRecording();
+        recording = app->frameRecorderStats();
+        if (!config.export_path.empty()) {
+            app->finishExport();
+            exported = app->exportStats();
+        }
+
+        delete app;
+    } catch (int code) {
+        std::cout.rdbuf(stdout_buffer);
+        return code;
+    }
+    std::cout.rdbuf(stdout_buffer);
+
+    std::ostringstream json;
+    json << "{\n"
+         << "  \"renderer\": " << jsonString(renderer) << ",\n"
+         << "  \"version\": " << jsonString(version) << ",\n"
+         << "  \"width\": " << config.width << ",\n"
+         << "  \"height\": " << config.height << ",\n"
+         << "  \"frames\": " << frames << ",\n"
+         << "  \"warmup_frames\": " << warmup << ",\n"
+         << "  \"wall_ms\": " << timings.wall_ms << ",\n"
+         << "  \"objects\": " << queue.objects << ",\n"
+         << "  \"msaa_samples\": " << config.msaa_samples << ",\n"
+         << "  \"render_queue\": {"
+         << "\"draw_calls\": " << queue.draw_calls
+         << ", \"commands\": " << queue.commands
+         << ", \"batches\": " << queue.batches
+         << ", \"state_changes\": " << queue.state_changes
+         << ", \"multi_draw\": " << (queue.multi_draw ? "true" : "false") << "},\n"
+         << "  \"stream_buffer\": {"
+         << "\"stalls\": " << stream.stalls
+         << ", \"wait_ms\": " << stream.wait_ms
+         << ", \"peak_frame_bytes\": " << stream.peak_frame_bytes
+         << ", \"region_bytes\": " << stream.region_bytes
+         << ", \"reallocations\": " << stream.reallocations
+         << ", \"persistent\": " << (stream.persistent ? "true" : "false") << "},\n"
+         << "  \"render_graph\": {"
+         << "\"passes\": " << graph.passes.size()
+         << ", \"culled_passes\": " << graph.culled_passes
+         << ", \"transient_resources\": " << graph.transient_resources
+         << ", \"physical_textures\": " << graph.physical_textures
+         << ", \"virtual_bytes\": " << graph.virtual_bytes
+         << ", \"physical_bytes\": " << graph.physical_bytes
+         << ", \"resolves\": " << graph.resolves
+         << ", \"invalidated\": " << graph.invalidated
+         << ", \"compiles\": " << graph.compiles
+         << ", \"compile_ms\": " << graph.compile_ms << "},\n"
+         << "  \"heap\": {"
+         << "\"settled_frames\": " << heap.settled_frames
+         << ", \"frames_without_allocations\": " << heap.steady_frames
+         << ", \"peak_frame_allocations\": " << heap.peak_frame_allocations
+         << ", \"peak_frame_bytes\": " << heap.peak_frame_bytes << "},\n"
+         << "  \"gl_state\": {"
+         << "\"cache\": " << (config.gl_state_cache ? "true" : "false")
+         << ", \"issued_per_frame\": " << (double) gl_state.total_issued / (double) std::max<uint64_t>(gl_state.frames, 1)
+         << ", \"elided_per_frame\": " << (double) gl_state.total_elided / (double) std::max<uint64_t>(gl_state.frames, 1)
+         << ", \"mismatches\": " << gl_state.mismatches
+         << ", \"last_frame\": {";
+    for (size_t i = 0; i < carnival::render::GLStateStats::kindCount; i++) {
+        json << (i > 0 ? ", " : "") << "\"" << carnival::render::stateKindName((carnival::render::GLStateKind) i)
+             << "\": {\"issued\": " << gl_state.issued[i] << ", \"elided\": " << gl_state.elided[i] << "}";
+    }
+    json << "}},\n"
+         << "  \"viewports\": [";
+    for (size_t i = 0; i < viewports.size(); i++) {
+        json << (i > 0 ? ", " : "") << "{"
+             << "\"rendered\": " << viewports[i].rendered
+             << ", \"skipped_hidden\": " << viewports[i].skipped_hidden
+             << ", \"skipped_unchanged\": " << viewports[i].skipped_unchanged
+             << ", \"cpu_ms\": " << viewports[i].cpu_ms
+             << ", \"gpu_ms\": " << viewports[i].gpu_ms
+             << ", \"scale\": " << viewports[i].scale << "}";
+    }
+    json << "],\n";
+    if (config.dynamic_resolution) {
+        json << "  \"dynamic_resolution\": {"
+             << "\"budget_ms\": " << config.resolution_budget_ms
+             << ", \"scale\": " << resolution.scale
+             << ", \"gpu_ms\": " << resolution.gpu_ms
+             << ", \"frames_over\": " << resolution.frames_over
+             << ", \"scale_changes\": " << resolution.scale_changes << "},\n";
+    }
+    json << "  \"startup\": {"
+         << "\"first_frame_ms\": " << startup.milestoneMs("first frame")
+         << ", \"assets_ready_ms\": " << startup.milestoneMs("assets ready") << "},\n";
+    if (!config.record_path.empty()) {
+        json << "  \"recording\": {"
+             << "\"captured\": " << recording.captured
+             << ", \"written\": " << recording.written
+             << ", \"dropped_readback\": " << recording.dropped_readback
+             << ", \"dropped_writer\": " << recording.dropped_writer
+             << ", \"bytes_written\": " << recording.bytes_written << "},\n";
+    }
+    if (!config.export_path.empty()) {
+        json << "  \"export\": {"
+             << "\"width\": " << exported.width
+             << ", \"height\": " << exported.height
+             << ", \"tiles\": " << exported.tiles
+             << ", \"tile_size\": " << exported.tile_size
+             << ", \"ms\": " << exported.elapsed_ms
+             << ", \"megapixels_per_second\": " << exported.megapixels_per_second
+             << ", \"megabytes_per_second\": " << exported.megabytes_per_second
+             << ", \"bytes_written\": " << exported.bytes_written
+             << ", \"failed\": " << (exported.failed ? "true" : "false") << "},\n";
+    }
+    json << "  \"fps\": " << (timings.wall_ms > 0.0 ? 1000.0 * frames / timings.wall_ms : 0.0) << ",\n"
+         << "  \"frame_time_ms\": {\n";
+    writeSummary(json, "cpu", summarize(timings.cpu_ms), timings.gpu_ms.empty());
+    if (!timings.gpu_ms.empty())
+        writeSummary(json, "gpu", summarize(timings.gpu_ms), true);
+    json << "  }\n"
+         << "}\n";
+
+    if (output != nullptr) {
+        std::ofstream file(output);
+        file << json.str();
+    } else {
+        std::cout << json.str();
+    }
+    return 0;
+}
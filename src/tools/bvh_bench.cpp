@@ -0,0 +1,269 @@
+// carnival_bvh_bench: builds a BVH over a mesh and measures ray throughput of every traversal, prints JSON.
+// Without --mesh a displaced sphere with about --triangles triangles is generated.
+//
+//   carnival_bvh_bench [--mesh file.obj|file.ply] [--triangles N] [--rays N] [--threads N] [--output file.json]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include "../common/json.h"
+#include "../render/Bvh.h"
+#include "../render/Mesh.h"
+
+using namespace carnival;
+
+struct Ray {
+    Vec3 origin;
+    Vec3 direction;
+};
+
+struct TraceResult {
+    double ms = 0.0;
+    size_t hits = 0;
+    size_t mismatches = 0; // hits on a different triangle than the scalar traversal
+};
+
+// UV sphere with some bumps, so the BVH has to deal with something less regular than a grid
+static void generateMesh(size_t triangles, render::Mesh &mesh)
+{
+    auto rings = std::max<size_t>((size_t) std::sqrt((double) triangles / 4.0), 4);
+    auto segments = rings * 2;
+    mesh.clear();
+    mesh.reserve((rings + 1) * (segments + 1), rings * segments * 2);
+
+    const float pi = 3.14159265358979f;
+    for (size_t ring = 0; ring <= rings; ring++) {
+        float theta = pi * (float) ring / (float) rings;
+        for (size_t segment = 0; segment <= segments; segment++) {
+            float phi = 2.0f * pi * (float) segment / (float) segments;
+            float radius = 1.0f + 0.05f * std::sin(theta * 23.0f) * std::sin(phi * 17.0f);
+            mesh.addVertex(radius * std::sin(theta) * std::cos(phi), radius * std::cos(theta),
+                           radius * std::sin(theta) * std::sin(phi));
+        }
+    }
+
+    for (size_t ring = 0; ring < rings; ring++) {
+        for (size_t segment = 0; segment < segments; segment++) {
+            auto a = (uint32_t) (ring * (segments + 1) + segment);
+            auto b = a + (uint32_t) (segments + 1);
+            mesh.indices.insert(mesh.indices.end(), {a, b, a + 1, a + 1, b, b + 1});
+        }
+    }
+}
+
+static void meshBounds(const render::Mesh &mesh, Vec3 &lo, Vec3 &hi)
+{
+    lo = {mesh.x[0], mesh.y[0], mesh.z[0]};
+    hi = lo;
+    for (size_t i = 0; i < mesh.vertexCount(); i++) {
+        lo = min(lo, mesh.vertex((uint32_t) i));
+        hi = max(hi, mesh.vertex((uint32_t) i));
+    }
+}
+
+// camera rays in scanline order, neighbours hit the same nodes
+static std::vector<Ray> coherentRays(const Vec3 &lo, const Vec3 &hi, size_t count)
+{
+    auto side = std::max<size_t>((size_t) std::sqrt((double) count), 1);
+    Vec3 center = (lo + hi) * 0.5f;
+    float radius = length(hi - lo) * 0.5f;
+    Vec3 eye = center + normalize(Vec3(0.3f, 0.4f, 1.0f)) * (2.0f * radius);
+    Vec3 forward = normalize(center - eye);
+    Vec3 right = normalize(cross(forward, Vec3(0.0f, 1.0f, 0.0f)));
+    Vec3 up = cross(right, forward);
+
+    std::vector<Ray> rays;
+    rays.reserve(side * side);
+    for (size_t y = 0; y < side; y++) {
+        for (size_t x = 0; x < side; x++) {
+            float u = ((float) x + 0.5f) / (float) side * 2.0f - 1.0f;
+            float v = ((float) y + 0.5f) / (float) side * 2.0f - 1.0f;
+            rays.push_back({eye, normalize(forward + right * (u * 0.45f) + up * (v * 0.45f))});
+        }
+    }
+    return rays;
+}
+
+// random origins inside the bounds and random directions, like diffuse bounces
+static std::vector<Ray> incoherentRays(const Vec3 &lo, const Vec3 &hi, size_t count)
+{
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    std::vector<Ray> rays;
+    rays.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        Vec3 origin(lo.x + (hi.x - lo.x) * unit(random), lo.y + (hi.y - lo.y) * unit(random),
+                    lo.z + (hi.z - lo.z) * unit(random));
+        float z = unit(random) * 2.0f - 1.0f;
+        float phi = unit(random) * 6.2831853f;
+        float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+        rays.push_back({origin, Vec3(r * std::cos(phi), r * std::sin(phi), z)});
+    }
+    return rays;
+}
+
+static TraceResult trace(const render::Bvh &bvh, const std::vector<Ray> &rays, size_t threads,
+                         std::vector<uint32_t> *hits, const std::vector<uint32_t> *reference)
+{
+    TraceResult result;
+    std::vector<size_t> thread_hits(threads, 0), thread_mismatches(threads, 0);
+
+    auto start = std::chrono::steady_clock::now();
+    auto work = [&](size_t thread) {
+        size_t begin = rays.size() * thread / threads, end = rays.size() * (thread + 1) / threads;
+        for (size_t i = begin; i < end; i++) {
+            render::RayHit hit;
+            bvh.intersect(rays[i].origin, rays[i].direction, 1e30f, hit);
+            thread_hits[thread] += hit.triangle != render::noTriangle;
+            if (hits != nullptr)
+                (*hits)[i] = hit.triangle;
+            if (reference != nullptr && (*reference)[i] != hit.triangle)
+                thread_mismatches[thread]++;
+        }
+    };
+
+    if (threads == 1) {
+        work(0);
+    } else {
+        std::vector<std::thread> workers;
+        for (size_t thread = 0; thread < threads; thread++)
+            workers.emplace_back(work, thread);
+        for (auto &worker: workers)
+            worker.join();
+    }
+    result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t thread = 0; thread < threads; thread++) {
+        result.hits += thread_hits[thread];
+        result.mismatches += thread_mismatches[thread];
+    }
+    return result;
+}
+
+static void writeResult(std::ostream &out, const char *name, const TraceResult &result, size_t rays, bool last)
+{
+    out << "      \"" << name << "\": {"
+        << "\"ms\": " << result.ms
+        << ", \"mrays_per_second\": " << (result.ms > 0.0 ? (double) rays / result.ms / 1000.0 : 0.0)
+        << ", \"hit_rate\": " << (double) result.hits / (double) std::max<size_t>(rays, 1)
+        << ", \"mismatches\": " << result.mismatches
+        << "}" << (last ? "\n" : ",\n");
+}
+
+int main(int argc, char* args[])
+{
+    const char *mesh_path = nullptr;
+    const char *output = nullptr;
+    size_t triangles = 2'000'000;
+    size_t ray_count = 1'000'000;
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(args[i], "--mesh") == 0 && has_value) {
+            mesh_path = args[++i];
+        } else if (std::strcmp(args[i], "--triangles") == 0 && has_value) {
+            triangles = (size_t) std::max(1, std::atoi(args[++i]));
+        } else if (std::strcmp(args[i], "--rays") == 0 && has_value) {
+            ray_count = (size_t) std::max(1, std::atoi(args[++i]));
+        } else if (std::strcmp(args[i], "--threads") == 0 && has_value) {
+            threads = (size_t) std::max(1, std::atoi(args[++i]));
+        } else if (std::strcmp(args[i], "--output") == 0 && has_value) {
+            output = args[++i];
+        } else {
+            std::cerr << "usage: carnival_bvh_bench [--mesh file.obj|file.ply] [--triangles N] [--rays N] [--threads N]"
+                         " [--output file.json]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    render::Mesh mesh;
+    auto load_start = std::chrono::steady_clock::now();
+    if (mesh_path != nullptr) {
+        if (!render::loadMesh(mesh_path, mesh))
+            return EXIT_FAILURE;
+    } else {
+        generateMesh(triangles, mesh);
+    }
+    double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count();
+    if (mesh.triangleCount() == 0) {
+        std::cerr << "[ERROR] The mesh has no triangles" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    render::Bvh bvh;
+    bvh.build(mesh);
+    double serial_build_ms = bvh.stats().build_ms;
+    {
+        carnival::core::ThreadPool pool(threads);
+        bvh.build(mesh, &pool);
+    }
+    auto &stats = bvh.stats();
+
+    Vec3 lo, hi;
+    meshBounds(mesh, lo, hi);
+    std::vector<Ray> ray_sets[2] = {coherentRays(lo, hi, ray_count), incoherentRays(lo, hi, ray_count)};
+    const char *set_names[2] = {"coherent", "incoherent"};
+
+    const render::BvhTraversal traversals[] = {render::BvhTraversal::Scalar, render::BvhTraversal::Sse4,
+                                                render::BvhTraversal::Avx8};
+
+    std::ostringstream json;
+    json << "{\n"
+         << "  \"mesh\": " << jsonString(mesh_path != nullptr ? mesh_path : "generated") << ",\n"
+         << "  \"vertices\": " << mesh.vertexCount() << ",\n"
+         << "  \"triangles\": " << mesh.triangleCount() << ",\n"
+         << "  \"load_ms\": " << load_ms << ",\n"
+         << "  \"build\": {"
+         << "\"threads\": " << threads
+         << ", \"ms\": " << stats.build_ms
+         << ", \"serial_ms\": " << serial_build_ms
+         << ", \"collapse_ms\": " << stats.collapse_ms
+         << ", \"nodes\": " << stats.build_nodes
+         << ", \"nodes4\": " << stats.nodes4
+         << ", \"nodes8\": " << stats.nodes8
+         << ", \"leaves\": " << stats.leaves
+         << ", \"depth\": " << stats.depth
+         << ", \"sah_cost\": " << stats.sah_cost << "},\n"
+         << "  \"best_traversal\": \"" << render::traversalName(render::bestTraversal()) << "\",\n"
+         << "  \"rays\": {\n";
+
+    for (int set = 0; set < 2; set++) {
+        auto &rays = ray_sets[set];
+        std::vector<uint32_t> reference(rays.size());
+        json << "    \"" << set_names[set] << "\": {\n"
+             << "      \"count\": " << rays.size() << ",\n";
+
+        // one thread per traversal, then the best one on all threads
+        for (auto traversal: traversals) {
+            if (!render::traversalSupported(traversal))
+                continue;
+            bvh.setTraversal(traversal);
+            bool scalar = traversal == render::BvhTraversal::Scalar;
+            auto result = trace(bvh, rays, 1, scalar ? &reference : nullptr, scalar ? nullptr : &reference);
+            writeResult(json, render::traversalName(traversal), result, rays.size(), false);
+        }
+
+        bvh.setTraversal(render::bestTraversal());
+        writeResult(json, "best_all_threads", trace(bvh, rays, threads, nullptr, &reference), rays.size(), true);
+        json << "    }" << (set == 0 ? ",\n" : "\n");
+    }
+    json << "  }\n"
+         << "}\n";
+
+    if (output != nullptr) {
+        std::ofstream file(output);
+        file << json.str();
+    } else {
+        std::cout << json.str();
+    }
+    return 0;
+}
@@ -0,0 +1,150 @@
+// carnival_pack: packs the shaders and images below a source directory into one asset pack, prints JSON.
+// Shaders are LZ4 compressed, images are stored as they are next to their pre-encoded mip chain, <name>.ktx2,
+// the same file TextureLoader would cache; both stay uncompressed so the loader can upload straight from the mapping.
+//
+//   carnival_pack [--source dir] [--output file.pak] [--no-compress] [--no-textures] [--rgba8] [--threads N]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "stb_image.h"
+#include "../common/json.h"
+#include "../core/AssetPack.h"
+#include "../core/ThreadPool.h"
+#include "../render/Ktx2.h"
+#include "../render/TextureCompressor.h"
+
+using namespace carnival;
+
+static bool hasExtension(const std::filesystem::path &path, std::initializer_list<const char *> extensions)
+{
+    auto extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+    return std::any_of(extensions.begin(), extensions.end(), [&](const char *e) { return extension == e; });
+}
+
+static bool readFile(const std::filesystem::path &path, std::vector<unsigned char> &out)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return false;
+    out.resize((size_t) file.tellg());
+    file.seekg(0);
+    return (bool) file.read((char *) out.data(), (std::streamsize) out.size());
+}
+
+int main(int argc, char *argv[])
+{
+    std::filesystem::path source = "src";
+    std::filesystem::path output = "carnival.pak";
+    bool compress = true;
+    bool textures = true;
+    bool block_compression = true;
+    size_t threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--source") == 0 && i + 1 < argc) {
+            source = argv[++i];
+        } else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (std::strcmp(argv[i], "--no-compress") == 0) {
+            compress = false;
+        } else if (std::strcmp(argv[i], "--no-textures") == 0) {
+            textures = false;
+        } else if (std::strcmp(argv[i], "--rgba8") == 0) {
+            block_compression = false;
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = (size_t) std::max(std::atoi(argv[++i]), 1);
+        } else {
+            std::cerr << "usage: carnival_pack [--source dir] [--output file.pak] [--no-compress] [--no-textures]"
+                         " [--rgba8] [--threads N]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::error_code error;
+    if (!std::filesystem::is_directory(source, error)) {
+        std::cerr << "[ERROR] " << source << " is not a directory" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // sorted, so the same tree always gives the same pack
+    std::vector<std::filesystem::path> files;
+    for (auto it = std::filesystem::recursive_directory_iterator(source, error);
+         it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+        if (error)
+            break;
+        // third party code brings its own example images along
+        if (it->is_directory() && it->path().filename() == "external") {
+            it.disable_recursion_pending();
+            continue;
+        }
+        if (it->is_regular_file() && hasExtension(it->path(), {".vert", ".frag", ".glsl", ".jpg", ".jpeg", ".png"}))
+            files.push_back(it->path());
+    }
+    std::sort(files.begin(), files.end());
+
+    auto start = std::chrono::steady_clock::now();
+    core::ThreadPool pool(threads);
+    core::AssetPackWriter writer;
+    size_t shaders = 0, images = 0;
+    double encode_ms = 0.0;
+
+    for (auto &file: files) {
+        auto name = file.lexically_relative(source).generic_string();
+        std::vector<unsigned char> data;
+        if (!readFile(file, data)) {
+            std::cerr << "[ERROR] Can't read " << file << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        bool image = hasExtension(file, {".jpg", ".jpeg", ".png"});
+        if (image && textures) {
+            auto encode_start = std::chrono::steady_clock::now();
+            int width = 0, height = 0;
+            unsigned char *pixels = stbi_load_from_memory(data.data(), (int) data.size(), &width, &height, nullptr, 4);
+            if (pixels == nullptr) {
+                std::cerr << "[ERROR] Can't decode " << file << ": " << stbi_failure_reason() << std::endl;
+                return EXIT_FAILURE;
+            }
+            auto encoded = render::buildMipChain(pixels, width, height, &pool);
+            stbi_image_free(pixels);
+            if (block_compression)
+                encoded = render::compressBC(encoded, &pool);
+
+            std::vector<unsigned char> ktx;
+            render::encodeKtx2(encoded, render::textureCacheWriter, ktx);
+            writer.add(name + ".ktx2", std::move(ktx), false);
+            encode_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encode_start).count();
+        }
+
+        writer.add(name, std::move(data), compress && !image);
+        shaders += !image;
+        images += image;
+    }
+
+    if (!writer.write(output))
+        return EXIT_FAILURE;
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::ostringstream json;
+    json << "{\n"
+         << "  \"source\": " << jsonString(source.string()) << ",\n"
+         << "  \"output\": " << jsonString(output.string()) << ",\n"
+         << "  \"entries\": " << writer.entries() << ",\n"
+         << "  \"shaders\": " << shaders << ",\n"
+         << "  \"images\": " << images << ",\n"
+         << "  \"bytes\": " << writer.bytes() << ",\n"
+         << "  \"stored_bytes\": " << writer.storedBytes() << ",\n"
+         << "  \"encode_ms\": " << encode_ms << ",\n"
+         << "  \"ms\": " << ms << "\n"
+         << "}\n";
+    std::cout << json.str();
+    return 0;
+}
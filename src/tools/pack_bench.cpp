@@ -0,0 +1,184 @@
+// carnival_pack_bench: times reading every asset from the loose files against opening the asset pack, prints JSON.
+// Each run reads all assets of the pack that also exist as loose files and touches every byte. Cold runs drop the
+// files from the page cache first (Linux only, elsewhere they equal warm runs).
+//
+//   carnival_pack_bench [--pack file.pak] [--source dir] [--runs N] [--output file.json]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../common/json.h"
+#include "../core/AssetPack.h"
+#include "../core/Stats.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace carnival;
+
+// asks the kernel to forget the file's pages, clean ones are simply dropped
+static bool evict(const std::filesystem::path &path)
+{
+#if defined(__linux__)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool evicted = ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    ::close(fd);
+    return evicted;
+#else
+    (void) path;
+    return false;
+#endif
+}
+
+static uint64_t checksum(const unsigned char *data, size_t size)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; i++)
+        sum = sum * 31 + data[i];
+    return sum;
+}
+
+static uint64_t readLoose(const std::vector<std::filesystem::path> &files)
+{
+    uint64_t sum = 0;
+    std::vector<unsigned char> data;
+    for (auto &file: files) {
+        std::ifstream stream(file, std::ios::in | std::ios::binary | std::ios::ate);
+        data.resize((size_t) stream.tellg());
+        stream.seekg(0);
+        stream.read((char *) data.data(), (std::streamsize) data.size());
+        sum += checksum(data.data(), data.size());
+    }
+    return sum;
+}
+
+static uint64_t readPack(const std::filesystem::path &path, const std::vector<std::string> &names)
+{
+    core::AssetPack pack;
+    if (!pack.open(path))
+        return 0;
+    uint64_t sum = 0;
+    for (auto &name: names) {
+        auto asset = pack.find(name);
+        sum += checksum(asset.data, asset.size);
+    }
+    return sum;
+}
+
+static void writeSummary(std::ostream &out, const char *name, const core::TimingSummary &summary, bool last)
+{
+    out << "    \"" << name << "\": {"
+        << "\"count\": " << summary.count
+        << ", \"min\": " << summary.min
+        << ", \"median\": " << summary.median
+        << ", \"mean\": " << summary.mean
+        << ", \"max\": " << summary.max
+        << "}" << (last ? "\n" : ",\n");
+}
+
+int main(int argc, char *argv[])
+{
+    std::filesystem::path pack_path = "carnival.pak";
+    std::filesystem::path source = "src";
+    int runs = 20;
+    const char *output = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--pack") == 0 && i + 1 < argc) {
+            pack_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--source") == 0 && i + 1 < argc) {
+            source = argv[++i];
+        } else if (std::strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            std::cerr << "usage: carnival_pack_bench [--pack file.pak] [--source dir] [--runs N] [--output file.json]"
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<std::string> names;
+    std::vector<std::filesystem::path> files;
+    {
+        core::AssetPack pack;
+        if (!pack.open(pack_path)) {
+            std::cerr << "[ERROR] Can't open " << pack_path << std::endl;
+            return EXIT_FAILURE;
+        }
+        // pre-encoded textures only exist loose once the loader cached them, leave out what has no counterpart
+        std::error_code error;
+        for (size_t i = 0; i < pack.size(); i++) {
+            auto file = source / std::string(pack.name(i));
+            if (std::filesystem::is_regular_file(file, error)) {
+                names.emplace_back(pack.name(i));
+                files.push_back(file);
+            }
+        }
+    }
+    if (names.empty()) {
+        std::cerr << "[ERROR] No asset of " << pack_path << " found below " << source << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto time = [](auto &&read, uint64_t &sum) {
+        auto start = std::chrono::steady_clock::now();
+        sum = read();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::vector<double> loose_cold, loose_warm, pack_cold, pack_warm;
+    uint64_t loose_sum = 0, pack_sum = 0;
+    size_t mismatches = 0;
+    bool evicted = true;
+    for (int run = 0; run < runs; run++) {
+        for (auto &file: files)
+            evicted = evict(file) && evicted;
+        loose_cold.push_back(time([&]() { return readLoose(files); }, loose_sum));
+        loose_warm.push_back(time([&]() { return readLoose(files); }, loose_sum));
+
+        evicted = evict(pack_path) && evicted;
+        pack_cold.push_back(time([&]() { return readPack(pack_path, names); }, pack_sum));
+        pack_warm.push_back(time([&]() { return readPack(pack_path, names); }, pack_sum));
+        mismatches += loose_sum != pack_sum;
+    }
+
+    auto loose_cold_summary = core::summarize(loose_cold), loose_warm_summary = core::summarize(loose_warm);
+    auto pack_cold_summary = core::summarize(pack_cold), pack_warm_summary = core::summarize(pack_warm);
+
+    std::ostringstream json;
+    json << "{\n"
+         << "  \"pack\": " << jsonString(pack_path.string()) << ",\n"
+         << "  \"source\": " << jsonString(source.string()) << ",\n"
+         << "  \"assets\": " << names.size() << ",\n"
+         << "  \"runs\": " << runs << ",\n"
+         << "  \"evicted\": " << (evicted ? "true" : "false") << ",\n"
+         << "  \"mismatches\": " << mismatches << ",\n"
+         << "  \"ms\": {\n";
+    writeSummary(json, "loose_cold", loose_cold_summary, false);
+    writeSummary(json, "loose_warm", loose_warm_summary, false);
+    writeSummary(json, "pack_cold", pack_cold_summary, false);
+    writeSummary(json, "pack_warm", pack_warm_summary, true);
+    json << "  },\n"
+         << "  \"cold_speedup\": " << loose_cold_summary.median / std::max(pack_cold_summary.median, 1e-9) << ",\n"
+         << "  \"warm_speedup\": " << loose_warm_summary.median / std::max(pack_warm_summary.median, 1e-9) << "\n"
+         << "}\n";
+
+    std::cout << json.str();
+    if (output != nullptr) {
+        std::ofstream file(output);
+        file << json.str();
+    }
+    return mismatches == 0 ? 0 : EXIT_FAILURE;
+}